@@ -16,6 +16,8 @@
 #define RECEIVER 1352 // define the receiver board either 2500 or 1352
 #define PIN_TX1 6
 #define PIN_TX2 27
+#define PAYLOAD_SIZE 4 // payload size [byte]: even number from 2 (file index only) up to 60
+#define WHITENING false // PN9 data whitening, the receiver has to de-whiten (CC2500: set_whitening_rx(), CC1352: CC1101/CC2500 compatible whitening)
 
 int main() {
     PIO pio = pio0;
@@ -24,27 +26,19 @@ int main() {
     backscatter_program_init(pio, sm, offset, PIN_TX1, PIN_TX2); // two antenna setup
     //backscatter_program_init(pio, sm, offset, PIN_TX1); // one antenna setup
 
-    static uint8_t message[buffer_size(PAYLOADSIZE+2, HEADER_LEN)*4] = {0};  // include 10 header bytes
-    static uint32_t buffer[buffer_size(PAYLOADSIZE, HEADER_LEN)] = {0}; // initialize the buffer
     static uint8_t seq = 0;
     uint8_t *header_tmplate = packet_hdr_template(RECEIVER);
-    uint8_t tx_payload_buffer[PAYLOADSIZE];
+    set_payload_size(PAYLOAD_SIZE);
+    set_whitening(WHITENING);
+    Frame *frame;
 
     while (true) {
-        /* generate new data */
-        generate_data(tx_payload_buffer, PAYLOADSIZE, true);
+        /* generate new data, add header (10 byte) and pack for the 32-bit fifo */
+        frame = frame_arena_next();
+        build_frame(frame, seq, header_tmplate);
 
-        /* add header (10 byte) to packet */
-        add_header(&message[0], seq, header_tmplate);
-        /* add payload to packet */
-        memcpy(&message[HEADER_LEN], tx_payload_buffer, PAYLOADSIZE);
-
-        /* casting for 32-bit fifo */
-        for (uint8_t i=0; i < buffer_size(PAYLOADSIZE, HEADER_LEN); i++) {
-            buffer[i] = ((uint32_t) message[4*i+3]) | (((uint32_t) message[4*i+2]) << 8) | (((uint32_t) message[4*i+1]) << 16) | (((uint32_t)message[4*i]) << 24);
-        }
         /* put the data to FIFO */
-        backscatter_send(pio,sm,buffer,buffer_size(PAYLOADSIZE, HEADER_LEN));
+        backscatter_send(pio,sm,frame->words,frame->len_words);
         seq++;
         sleep_ms(TX_DURATION);
     }
@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+"""
+Tobias Mages & Wenqing Yan
+
+Plot the spectrum scans of the receiver CC2500 (SCAN_SPECTRUM in carrier-receiver-baseband/main.c).
+
+The firmware streams one record per sweep:
+  #SPECTRUM t_us=<time> f_start=<Hz> f_step=<Hz> points=<n> rssi=<RSSI register value of every point, 2 hex digits>
+with RSSI_dBm = RSSI_dec/2 - 70 (two's complement). The records are read from a log of serial-print.py and shown
+as the max-hold and mean spectrum together with a waterfall of all sweeps.
+
+usage:
+  python3 spectrum.py ../carrier-receiver-baseband/received_2024-01-01_12-00-00.txt [--out spectrum.png]
+"""
+
+import argparse
+import numpy as np
+import matplotlib.pyplot as plt
+
+
+def parse_tags(line):
+    """'#TAG key=value ...' -> dict"""
+    return dict(item.split("=", 1) for item in line.split()[1:])
+
+
+def read_spectrum(filename):
+    """returns the frequencies [Hz], the times [s] and the RSSI [dBm] of every sweep (sweeps x points)"""
+    frequencies, times, sweeps = None, [], []
+    with open(filename, errors="ignore") as f:
+        for line in f:
+            if not line.startswith("#SPECTRUM"):
+                continue
+            tags = parse_tags(line)
+            points = int(tags["points"])
+            raw = bytes.fromhex(tags["rssi"])
+            if len(raw) != points:
+                continue  # incomplete line
+            f_start, f_step = int(tags["f_start"]), int(tags["f_step"])
+            if frequencies is None:
+                frequencies = f_start + f_step * np.arange(points)
+            elif len(frequencies) != points or frequencies[0] != f_start:
+                continue  # a different scan
+            times.append(int(tags["t_us"]) / 1e6)
+            sweeps.append(np.frombuffer(raw, dtype=np.int8) / 2 - 70)
+    if frequencies is None:
+        raise SystemExit("no #SPECTRUM records in %s" % filename)
+    return frequencies, np.array(times), np.array(sweeps)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("log", help="log file with #SPECTRUM records")
+    parser.add_argument("--out", help="save the plot instead of showing it")
+    args = parser.parse_args()
+
+    frequencies, times, rssi = read_spectrum(args.log)
+    f_mhz = frequencies / 1e6
+    fig, (ax1, ax2) = plt.subplots(2, 1, sharex=True, figsize=(10, 7))
+    ax1.plot(f_mhz, rssi.max(axis=0), label="max-hold")
+    ax1.plot(f_mhz, 10 * np.log10(np.mean(10 ** (rssi / 10), axis=0)), label="mean")
+    ax1.set_ylabel("RSSI [dBm]")
+    ax1.set_title("%d sweeps, %d points, step %.1f kHz" % (len(rssi), len(f_mhz), (frequencies[1] - frequencies[0]) / 1e3
+                                                          if len(frequencies) > 1 else 0))
+    ax1.legend()
+    ax1.grid(True)
+    mesh = ax2.pcolormesh(f_mhz, times - times[0], rssi, shading="nearest")
+    ax2.set_xlabel("frequency [MHz]")
+    ax2.set_ylabel("time [s]")
+    fig.colorbar(mesh, ax=[ax1, ax2], label="RSSI [dBm]")
+    if args.out:
+        fig.savefig(args.out, dpi=150)
+    else:
+        plt.show()
+
+
+if __name__ == "__main__":
+    main()
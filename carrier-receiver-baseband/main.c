@@ -11,6 +11,7 @@
  */
 
 #include <stdio.h>
+#include <inttypes.h>
 #include <math.h>
 #include <string.h>
 #include "pico/stdlib.h"
@@ -26,6 +27,15 @@
 #include "carrier_CC2500.h"
 #include "receiver_CC2500.h"
 #include "packet_generation.h"
+#include "profiling.h"
+#include "link_counters.h"
+#include "arq.h"
+#include "link_quality.h"
+#include "adc_source.h"
+#include "usb_bridge.h"
+#include "tdma.h"
+#include "power_control.h"
+#include "usb_control.h"
 
 
 #define RADIO_SPI             spi0
@@ -41,9 +51,644 @@
 #define CLOCK_DIV1              36
 #define DESIRED_BAUD        200000
 #define TWOANTENNAS          true
+#define SIDEBAND     SIDEBAND_BOTH // SIDEBAND_UPPER/SIDEBAND_LOWER: quadrature antennas reflect a single sideband (requires TWOANTENNAS)
+#define CONTINUOUS_PHASE     false // continuous-phase FSK: subcarriers rounded to multiples of DESIRED_BAUD/2 (requires SIDEBAND_BOTH)
+#define HOPPING              false // frequency hopping: the subcarrier follows hop_sequence, one hop per carrier on-period (CLOCK_DIV0/1 are replaced by hop_dividers)
+#define SCAN_SPECTRUM        false // scan the band with the receiver at start-up and select the carrier (scan_carriers) and subcarrier (hop_dividers, with HOPPING all of them) with the least interference
+#define SCAN_START      2400000000 // [Hz]
+#define SCAN_STOP       2483500000 // [Hz]
+#define SCAN_STEP           405000 // [Hz], also the filter bandwidth of the scan (25 kHz to 405 kHz)
+#define SCAN_DWELL_US          250 // settling and RSSI response per point
+#define SCAN_SWEEPS             50 // sweeps streamed as '#SPECTRUM' records, the selection uses their max-hold
+#define PAYLOAD_SIZE             4 // payload size [byte]: even number from 2 (file index only) up to 60
+#define BURST_FRAMES             1 // frames per carrier on-period (1: start and stop the carrier for every packet)
+#define BURST_GAP_US          1000 // minimal gap between two frames of a burst [us], the receiver FIFO is read within this gap
+#define FRAME_PREAMBLE_LEN       4 // preamble bytes (1 to 8)
+#define FRAME_SYNC_LEN           4 // sync word bytes: 2 (16-bit) or 4 (32-bit)
+#define RX_PQT                   0 // receiver preamble quality threshold (0: disabled, 1-7)
+#define WHITENING            false // PN9 data whitening of length, seq and payload, de-whitened by the receiver (no long runs of identical bits)
+#define COUNTER_INTERVAL_MS  10000 // print the link counters every 10s (0: disabled)
+#define ANALYSIS             false // compare every payload with the regenerated file on the Pico and print '#LQ' summaries instead of every packet
+#define ANALYSIS_INTERVAL_MS  1000 // window of the '#LQ' summaries
+#define OFFSET_TRACKING      false // track the frequency offset with FREQEST, compensate it in FSCTRL0 and narrow the filter once converged ('#OFFSET' with the link counters)
+#define OFFSET_MARGIN        50000 // filter margin on both sides for the offset until it is tracked [Hz] (crystal tolerances of carrier, tag and receiver)
+#define OFFSET_NARROW_PACKETS   64 // tracked packets before the filter is narrowed to tracked_bandwidth_rx()
+#define OFFSET_LOST_PACKETS     16 // frames sent without a complete received frame before the narrowed filter is widened again
+
+#define CHARACTERIZE_PREAMBLE false // sweep the preamble length to find the shortest one reaching TARGET_PER
+#define TARGET_PER            0.01 // packet error rate to reach
+#define TARGET_RSSI            -70 // RSSI [dBm] at which the characterization is supposed to be performed
+#define PACKETS_PER_STEP       200 // packets per preamble length
+
+#define ADC_SOURCE           false // payload samples from the ADC (ADC_INPUT at ADC_SAMPLE_RATE, DMA into a ring) instead of generate_data(), '#SOURCE' with the link counters
+#define ADC_INPUT                0 // 0 to 3: GPIO 26 to 29
+#define ADC_SAMPLE_RATE       1000 // [samples/s], ADC_MIN_RATE to ADC_MAX_RATE; the ring overruns if the frames cannot keep up
+
+#define POWER_CONTROL        false // choose the carrier power (TX_power[]) from PER, RSSI and LQI of the local receiver for the highest goodput, '#POWER' with every summary
+#define POWER_WINDOW            50 // sent packets per decision
+#define POWER_MIN_LEVEL          1 // -30 dBm (level 0: -55 dBm)
+
+#define ARQ                  false // deliver ARQ_FILE_SIZE bytes reliably (selective-repeat ARQ, acknowledged by the local receiver) and stop
+#define ARQ_FILE_SIZE         4096 // [byte], at most 65536 (16-bit file index), PAYLOAD_SIZE - 2 byte per chunk
+#define ARQ_WINDOW               8 // outstanding chunks (1 to ARQ_MAX_WINDOW)
+#define ARQ_INITIAL_RTO_US   20000 // retransmission timeout until the acknowledgement delay has been measured
+#define ARQ_GAP_MS               1 // carrier off-time between two on-periods
+
+#define BRIDGE               false // stream the bytes of the USB host (usb-bridge.py) through the tag with credit-based flow control, PAYLOAD_SIZE - 2 byte per frame
+#define BRIDGE_GAP_MS            1 // carrier off-time between two on-periods
+
+#define CONTROL              false // binary USB control protocol (usb_control.h, pico_control.py): get/set the link parameters at runtime, runs started and stopped by the host
+#define CONTROL_AUTOSTART     true // send from boot on as without CONTROL (false: wait for START)
+
+#define TDMA                 false // one carrier on-period of TDMA_SUPERFRAMES superframes: the frames start at their slot boundaries (hardware alarm, DMA into the FIFO), '#TDMA' with the link counters
+#define TDMA_TAGS                1 // 1 or 2 tags (the second one on pio1 with PIN_TX1_2/PIN_TX2_2), slots round robin
+#define TDMA_SLOTS               8 // slots per superframe (TDMA_TAGS to TDMA_MAX_SLOTS)
+#define TDMA_GUARD_US          200 // a slot is the airtime of a frame plus this guard
+#define TDMA_SUPERFRAMES       100
+#define PIN_TX1_2                7
+#define PIN_TX2_2                8
 
 #define CARRIER_FEQ     2450000000
 
+#if BURST_FRAMES > FRAME_ARENA_SIZE
+#error "BURST_FRAMES must not exceed FRAME_ARENA_SIZE"
+#endif
+
+#if ADC_SOURCE && ((TWOANTENNAS && PIN_TX2 == ADC_FIRST_GPIO + ADC_INPUT) || (TDMA && TDMA_TAGS == 2 && (PIN_TX1_2 == ADC_FIRST_GPIO + ADC_INPUT || (TWOANTENNAS && PIN_TX2_2 == ADC_FIRST_GPIO + ADC_INPUT))))
+#error "ADC_INPUT samples a pin driven by a backscatter state-machine"
+#endif
+
+#if CONTROL && BRIDGE
+#error "CONTROL and BRIDGE both read the USB stdin"
+#endif
+
+/* the lower sideband mirrors the tones: the program swaps d0 and d1, such that symbol 0 stays the lower frequency at the receiver */
+#define PROGRAM_DIV0(d0, d1) ((SIDEBAND == SIDEBAND_LOWER) ? (d1) : (d0))
+#define PROGRAM_DIV1(d0, d1) ((SIDEBAND == SIDEBAND_LOWER) ? (d0) : (d1))
+
+/* hopping channels {d0, d1}: center offsets 3.30, 4.04, 5.01 and 2.92 MHz, all within the CC2500 deviation and filter limits */
+static const uint16_t hop_dividers[][2] = {{40, 36}, {32, 30}, {26, 24}, {46, 40}};
+static const uint8_t hop_sequence[] = {0, 2, 1, 3};
+/* carrier candidates of SCAN_SPECTRUM */
+static const uint32_t scan_carriers[] = {2405000000, 2425000000, 2450000000, 2475000000};
+
+/* link settings, changed at runtime with CONTROL (apply_param) */
+static struct backscatter_config backscatter_conf;
+static uint16_t link_dividers[2] = {CLOCK_DIV0, CLOCK_DIV1}; // d0, d1 of backscatter_conf (before PROGRAM_DIV0/1)
+static uint16_t instructionBuffer[32] = {0}; // maximal instruction size: 32
+static uint8_t *header_tmplate;
+static uint32_t carrier_feq = CARRIER_FEQ;
+static uint32_t signal_bw;
+static uint32_t tx_interval_ms = TX_DURATION;
+
+/* packets received during a burst, printed once the carrier is off */
+struct burst_rx {
+    uint8_t buffer[RX_BUFFER_SIZE];
+    Packet_status status;
+    uint64_t time_us;
+};
+static struct burst_rx burst_rx[BURST_FRAMES];
+static uint8_t burst_rx_count = 0;
+static bool burst_rx_overflow = false; // the RX FIFO is flushed once the burst is over
+
+// print the packet or, with ANALYSIS, only add it to the '#LQ' summary
+static void output_packet(uint8_t *buffer, Packet_status status, uint64_t time_us){
+    power_control_packet(buffer, status, get_payload_size());
+    if(ANALYSIS){
+        analyze_packet(buffer, status, get_payload_size());
+    }else{
+        printPacket(buffer, status, time_us);
+    }
+}
+
+// print the '#LQ' summary once the window is over
+static void poll_link_quality(){
+    uint64_t now_us = to_us_since_boot(get_absolute_time());
+    if(ANALYSIS && now_us - link_quality.start_us >= 1000 * (uint64_t) ANALYSIS_INTERVAL_MS){
+        print_link_quality(now_us);
+        if(POWER_CONTROL){
+            print_power_control(now_us);
+        }
+    }
+}
+
+// read every finished packet from the receiver FIFO while the burst continues
+static void burst_service_receiver(){
+    static uint8_t discard[RX_BUFFER_SIZE];
+    event_t evt;
+    while((evt = get_event()) != no_evt){
+        if(evt != rx_deassert_evt || burst_rx_overflow){
+            continue; // after an overflow the FIFO content is invalid until the flush
+        }
+        Packet_status status;
+        if(burst_rx_count < BURST_FRAMES){
+            struct burst_rx *rx = &burst_rx[burst_rx_count++];
+            rx->time_us = to_us_since_boot(get_absolute_time());
+            rx->status = readPacket(rx->buffer);
+            status = rx->status;
+        }else{
+            status = readPacket(discard); // more packets than frames sent: drop
+        }
+        // flushing the RX FIFO requires IDLE and sleeps for ~4 ms, the following frames of the burst would be lost
+        burst_rx_overflow |= status.overflowed;
+    }
+}
+
+/*
+ * backscatter count (up to BURST_FRAMES) frames within one carrier on-period, returns the duration [us]
+ * the receiver stays in RX between the frames and is read out within the gaps (burst_rx)
+ */
+static uint64_t transmit_burst(PIO pio, uint sm, Frame **frames, uint8_t count, uint32_t baud){
+    burst_rx_count = 0;
+    burst_rx_overflow = false;
+    RX_start_burst_listen();
+
+    startCarrier();
+    sleep_ms(1); // wait for carrier to start
+    uint64_t start_us = to_us_since_boot(get_absolute_time());
+    for(uint8_t i = 0; i < count; i++){
+        if(!backscatter_send_nowait(pio, sm, frames[i]->words, frames[i]->len_words)){
+            break; // the state-machine stopped, the remaining frames are dropped
+        }
+        while(backscatter_busy(pio, sm)){
+            burst_service_receiver();
+        }
+        // the last word is still shifted out when the FIFO runs empty
+        absolute_time_t gap_end = make_timeout_time_us(backscatter_word_duration_us(baud) + BURST_GAP_US);
+        while(!time_reached(gap_end)){
+            burst_service_receiver();
+        }
+    }
+    uint64_t duration_us = to_us_since_boot(get_absolute_time()) - start_us;
+    stopCarrier();
+    RX_start_listen(); // also recovers from burst_rx_overflow
+    return duration_us;
+}
+
+/* backscatter BURST_FRAMES new frames within one carrier on-period */
+// the length byte agrees with the RX FIFO and the payload size: the frame has been received completely (maybe with bit errors)
+static bool complete_frame(const uint8_t *buffer, Packet_status status){
+    return !status.overflowed && status.len == get_payload_size() + 2 && buffer[0] == status.len - 1;
+}
+
+// once the offset is tracked, the compensated offset needs only the residual as margin (the receiver has to be re-armed)
+static bool narrow_offset_filter(bool *narrowed){
+    if(!OFFSET_TRACKING || *narrowed || selected_rx()->offset_tracking.packets < OFFSET_NARROW_PACKETS){
+        return false;
+    }
+    set_filter_bandwidth_rx(tracked_bandwidth_rx(signal_bw));
+    *narrowed = true;
+    return true;
+}
+
+// the packet has been received as one of the frames was sent (correct CRC, same sequence number and payload)
+static bool received_as_sent(const uint8_t *buffer, Packet_status status, Frame **sent, uint8_t count){
+    uint8_t len = 2 + get_payload_size();
+    if(status.overflowed || !status.CRCcheck || status.len != len){
+        return false;
+    }
+    for(uint8_t i = 0; i < count; i++){
+        if(sent[i]->seq != buffer[1]){
+            continue;
+        }
+        // the frame after the sync word, de-whitened as by the receiver
+        uint8_t air[2 + MAX_PAYLOADSIZE];
+        memcpy(air, &sent[i]->bytes[get_header_len() - 2], len);
+        if(get_whitening()){
+            whiten(air, len);
+        }
+        return memcmp(buffer, air, len) == 0;
+    }
+    return false;
+}
+
+// returns the complete frames received during the burst
+static uint8_t send_burst(PIO pio, uint sm, uint8_t *seq, uint8_t *header_template, uint32_t baud){
+    Frame *frames[BURST_FRAMES];
+    /* generate all frames before starting the carrier */
+    for(uint8_t i = 0; i < BURST_FRAMES; i++){
+        frames[i] = frame_arena_next();
+        build_frame(frames[i], *seq, header_template);
+        (*seq)++;
+    }
+    uint64_t duration_us = transmit_burst(pio, sm, frames, BURST_FRAMES, baud);
+
+    /* print received packets and a summary of the burst */
+    uint8_t crc_pass = 0;
+    uint8_t correct = 0;
+    uint8_t complete = 0;
+    for(uint8_t i = 0; i < burst_rx_count; i++){
+        output_packet(burst_rx[i].buffer, burst_rx[i].status, burst_rx[i].time_us);
+        if(!burst_rx[i].status.overflowed && burst_rx[i].status.CRCcheck){
+            crc_pass++;
+        }
+        correct += received_as_sent(burst_rx[i].buffer, burst_rx[i].status, frames, BURST_FRAMES);
+        complete += complete_frame(burst_rx[i].buffer, burst_rx[i].status);
+    }
+    uint32_t throughput = ((uint64_t) correct) * get_payload_size() * 8 * 1000000 / duration_us;
+    printf("#BURST frames=%d received=%d crc_pass=%d correct=%d duration_us=%" PRIu64 " throughput_bps=%" PRIu32 "\n", BURST_FRAMES, burst_rx_count, crc_pass, correct, duration_us, throughput);
+    return complete;
+}
+
+// tag and receiver follow hop_sequence: the next program is loaded and the receiver retuned without calibration
+static void hop_next(PIO pio, uint sm, struct backscatter_hopping *hopping){
+    static uint8_t hop = 0;
+    uint8_t channel = hop_sequence[hop];
+    hop = (hop + 1) % count_of(hop_sequence);
+    backscatter_hop(pio, sm, hopping, channel);
+    hop_rx(channel);
+    RX_start_listen_nowait();
+}
+
+/*
+ * sweep the band with the receiver (the carrier is off), stream every sweep and select the candidate
+ * (carrier index * hopping->channels + channel) whose receive band has the least interference in the max-hold
+ * with HOPPING, every channel is used: the carrier whose worst channel has the least interference is selected (channel 0)
+ */
+static uint16_t scan_spectrum(struct backscatter_hopping *hopping){
+    static int8_t rssi[SCAN_MAX_POINTS], max_hold[SCAN_MAX_POINTS];
+    uint16_t points = (SCAN_STOP - SCAN_START) / SCAN_STEP + 1;
+    set_filter_bandwidth_rx(SCAN_STEP);
+    if(!setup_scan_rx(SCAN_START, SCAN_STEP, points, SCAN_DWELL_US)){
+        return 0;
+    }
+    for(uint16_t s = 0; s < SCAN_SWEEPS; s++){
+        scan_rx(rssi);
+        for(uint16_t i = 0; i < points; i++){
+            max_hold[i] = (s == 0) ? rssi[i] : max(max_hold[i], rssi[i]);
+        }
+        print_spectrum_rx(rssi, to_us_since_boot(get_absolute_time()));
+    }
+    end_scan_rx();
+
+    int32_t offsets[HOP_MAX_CHANNELS];
+    uint32_t bws[HOP_MAX_CHANNELS];
+    for(uint8_t i = 0; i < hopping->channels; i++){
+        offsets[i] = (SIDEBAND == SIDEBAND_LOWER) ? -((int32_t) hopping->channel[i].config.center_offset) : (int32_t) hopping->channel[i].config.center_offset;
+        bws[i] = hopping->channel[i].config.minRxBw;
+    }
+    int32_t interference;
+    if(HOPPING){
+        uint8_t carrier = select_carrier_rx(max_hold, scan_carriers, count_of(scan_carriers), offsets, bws, hopping->channels, &interference);
+        printf("#SELECT carrier=%" PRIu32 " channels=%u interference_dbm=%" PRId32 "\n", scan_carriers[carrier], hopping->channels, interference);
+        return carrier * hopping->channels;
+    }
+    uint16_t best = select_channel_rx(max_hold, scan_carriers, count_of(scan_carriers), offsets, bws, hopping->channels, &interference);
+    uint8_t channel = best % hopping->channels;
+    printf("#SELECT carrier=%" PRIu32 " d0=%u d1=%u rx=%" PRIu32 " interference_dbm=%" PRId32 "\n", scan_carriers[best / hopping->channels],
+        hop_dividers[channel][0], hop_dividers[channel][1], (uint32_t) (scan_carriers[best / hopping->channels] + offsets[channel]), interference);
+    return best;
+}
+
+// backscatter a single frame within its own carrier on-period
+static void send_frame(PIO pio, uint sm, Frame *frame, uint32_t baud){
+    startCarrier();
+    PROFILED_SLEEP_MS(1); // wait for carrier to start
+    PROFILE_START(prof_backscatter_send);
+    if(backscatter_send_nowait(pio,sm,frame->words,frame->len_words)){
+        while(backscatter_busy(pio, sm)){
+            tight_loop_contents();
+        }
+        sleep_us(backscatter_word_duration_us(baud)); // last word is still shifted out
+    }
+    PROFILE_STOP(prof_backscatter_send);
+    PROFILED_SLEEP_MS(3); // wait for the receiver to finish the packet
+    stopCarrier();
+}
+
+// wait until the receiver finished a packet, returns false if no packet has been received within the timeout
+static bool receive_packet(uint8_t *buffer, Packet_status *status, uint32_t timeout_us){
+    absolute_time_t timeout = make_timeout_time_us(timeout_us);
+    bool synchronized = false;
+    while(!time_reached(timeout)){
+        switch(get_event()){
+            case rx_assert_evt:
+                synchronized = true;
+            break;
+            case rx_deassert_evt:
+                *status = readPacket(buffer);
+                RX_start_listen();
+                return true;
+            case no_evt:
+            break;
+        }
+    }
+    if(synchronized){
+        RX_start_listen(); // sync word without end of packet
+    }
+    return false;
+}
+
+/*
+ * find the shortest preamble which still reaches TARGET_PER
+ * for each preamble length PACKETS_PER_STEP frames are sent, a frame only counts if it has been received without any error
+ */
+static void characterize_preamble(PIO pio, uint sm, uint8_t *seq, uint32_t baud){
+    uint8_t rx_buffer[RX_BUFFER_SIZE];
+    Packet_status status;
+    uint8_t shortest = 0;
+    printf("\nCharacterizing the preamble length (target PER: %.3f at %d dBm):\n", TARGET_PER, TARGET_RSSI);
+    for(uint8_t preamble_len = 1; preamble_len <= MAX_PREAMBLE_LEN; preamble_len++){
+        set_framing(preamble_len, FRAME_SYNC_LEN);
+        uint8_t *header_template = packet_hdr_template(RECEIVER);
+        uint32_t received = 0;
+        uint32_t correct  = 0;
+        int32_t rssi_sum  = 0;
+        for(uint16_t n = 0; n < PACKETS_PER_STEP; n++){
+            Frame *frame = frame_arena_next();
+            build_frame(frame, *seq, header_template);
+            (*seq)++;
+            send_frame(pio, sm, frame, baud);
+            if(!receive_packet(rx_buffer, &status, 2000) || status.overflowed){
+                continue;
+            }
+            received++;
+            rssi_sum += status.RSSI;
+            // compare length, seq and payload with the transmitted frame
+            uint8_t len = get_payload_size() + 2;
+            if(get_whitening()){
+                whiten(rx_buffer, len); // the frame is kept as sent
+            }
+            if(status.len == len && memcmp(rx_buffer, &frame->bytes[get_header_len()-2], len) == 0){
+                correct++;
+            }
+        }
+        double per = 1.0 - ((double) correct)/((double) PACKETS_PER_STEP);
+        int32_t rssi = (received > 0) ? rssi_sum/((int32_t) received) : 0;
+        printf("#PREAMBLE len=%d sync=%d pqt=%d sent=%d received=%" PRIu32 " correct=%" PRIu32 " per=%.4f rssi=%" PRId32 "\n", preamble_len, 8*FRAME_SYNC_LEN, RX_PQT, PACKETS_PER_STEP, received, correct, per, rssi);
+        int32_t rssi_error = rssi - TARGET_RSSI;
+        if(received > 0 && abs(rssi_error) > 3){
+            printf("WARNING: the measured RSSI differs from TARGET_RSSI by more than 3 dB\n");
+        }
+        if(per <= TARGET_PER && shortest == 0){
+            shortest = preamble_len;
+        }
+    }
+    if(shortest > 0){
+        printf("#PREAMBLE shortest=%d\n", shortest);
+    }else{
+        printf("#PREAMBLE shortest=none (target PER not reached)\n");
+    }
+    set_framing(FRAME_PREAMBLE_LEN, FRAME_SYNC_LEN);
+}
+
+/*
+ * deliver ARQ_FILE_SIZE bytes with the selective-repeat ARQ (see arq.h): every carrier on-period carries the
+ * chunks selected by the ARQ (up to BURST_FRAMES), the local receive path acknowledges them
+ */
+static void transfer_file(PIO pio, uint sm, uint8_t *seq, uint8_t *header_template, uint32_t baud, struct backscatter_hopping *hopping){
+    static struct arq arq;
+    uint8_t rx_buffer[RX_BUFFER_SIZE];
+    Packet_status status;
+    if(!arq_init(&arq, ARQ_FILE_SIZE, get_payload_size(), ARQ_WINDOW, ARQ_INITIAL_RTO_US, to_us_since_boot(get_absolute_time()))){
+        return;
+    }
+    printf("\nTransferring %d byte in %d chunks (window: %d chunks):\n", ARQ_FILE_SIZE, arq.chunks, ARQ_WINDOW);
+    absolute_time_t next_report = make_timeout_time_ms(COUNTER_INTERVAL_MS);
+    while(!arq_done(&arq)){
+        uint64_t now_us = to_us_since_boot(get_absolute_time());
+        Frame *frames[BURST_FRAMES];
+        uint8_t count = 0;
+        int32_t chunk;
+        while(count < BURST_FRAMES && (chunk = arq_next_chunk(&arq, now_us)) >= 0){
+            frames[count] = frame_arena_next();
+            arq_build_frame(&arq, chunk, frames[count], *seq, header_template);
+            arq_sent(&arq, chunk, now_us);
+            (*seq)++;
+            count++;
+        }
+        if(count == 0){
+            // window full: wait for the next timeout
+            sleep_until(from_us_since_boot(arq_next_timeout_us(&arq)));
+            continue;
+        }
+        if(hopping != NULL){
+            hop_next(pio, sm, hopping);
+        }
+        if(BURST_FRAMES > 1){
+            transmit_burst(pio, sm, frames, count, baud);
+            for(uint8_t i = 0; i < burst_rx_count; i++){
+                output_packet(burst_rx[i].buffer, burst_rx[i].status, burst_rx[i].time_us);
+                arq_ack_packet(&arq, burst_rx[i].buffer, burst_rx[i].status, burst_rx[i].time_us);
+            }
+        }else{
+            send_frame(pio, sm, frames[0], baud);
+            if(receive_packet(rx_buffer, &status, 2000)){
+                uint64_t time_us = to_us_since_boot(get_absolute_time());
+                output_packet(rx_buffer, status, time_us);
+                arq_ack_packet(&arq, rx_buffer, status, time_us);
+            }
+        }
+        if(COUNTER_INTERVAL_MS > 0 && time_reached(next_report)){
+            arq_print(&arq, to_us_since_boot(get_absolute_time()));
+            print_link_counters(to_us_since_boot(get_absolute_time()));
+            next_report = make_timeout_time_ms(COUNTER_INTERVAL_MS);
+        }
+        poll_link_quality();
+        PROFILED_SLEEP_MS(ARQ_GAP_MS);
+    }
+    arq_print(&arq, to_us_since_boot(get_absolute_time()));
+    print_link_counters(to_us_since_boot(get_absolute_time()));
+    if(ANALYSIS){
+        print_link_quality(to_us_since_boot(get_absolute_time()));
+    }
+}
+
+/*
+ * stream the bytes of the USB host (see usb_bridge.h): every carrier on-period carries up to BURST_FRAMES frames of
+ * the stream, the host is paced by the credits, the local receive path counts the delivered frames
+ */
+static void bridge_stream(PIO pio, uint sm, uint8_t *seq, uint8_t *header_template, uint32_t baud, struct backscatter_hopping *hopping){
+    uint8_t rx_buffer[RX_BUFFER_SIZE];
+    Packet_status status;
+    absolute_time_t next_report = make_timeout_time_ms(COUNTER_INTERVAL_MS);
+    while(!usb_bridge_done()){
+        Frame *frames[BURST_FRAMES];
+        uint8_t count = 0;
+        while(count < BURST_FRAMES && source_ready()){
+            frames[count] = frame_arena_next();
+            build_frame(frames[count], *seq, header_template);
+            (*seq)++;
+            count++;
+        }
+        if(count == 0){
+            usb_bridge_wait(100); // the host is behind its credits
+            continue;
+        }
+        if(hopping != NULL){
+            hop_next(pio, sm, hopping);
+        }
+        if(BURST_FRAMES > 1){
+            transmit_burst(pio, sm, frames, count, baud);
+            for(uint8_t i = 0; i < burst_rx_count; i++){
+                output_packet(burst_rx[i].buffer, burst_rx[i].status, burst_rx[i].time_us);
+                usb_bridge_packet(burst_rx[i].buffer, burst_rx[i].status, frames, count);
+            }
+        }else{
+            send_frame(pio, sm, frames[0], baud);
+            if(receive_packet(rx_buffer, &status, 2000)){
+                output_packet(rx_buffer, status, to_us_since_boot(get_absolute_time()));
+                usb_bridge_packet(rx_buffer, status, frames, 1);
+            }
+        }
+        if(COUNTER_INTERVAL_MS > 0 && time_reached(next_report)){
+            usb_bridge_print(to_us_since_boot(get_absolute_time()));
+            print_link_counters(to_us_since_boot(get_absolute_time()));
+            next_report = make_timeout_time_ms(COUNTER_INTERVAL_MS);
+        }
+        sleep_ms(BRIDGE_GAP_MS);
+    }
+    usb_bridge_print(to_us_since_boot(get_absolute_time()));
+    print_link_counters(to_us_since_boot(get_absolute_time()));
+}
+
+/*
+ * TDMA_SUPERFRAMES superframes within one carrier on-period: the main loop only builds the frames of the tags
+ * (tdma_queue) and reads the receiver, the alarm interrupt starts every frame at its slot boundary
+ */
+static void tdma_run(PIO pio, uint sm, uint8_t *seq, uint8_t *header_template, uint32_t baud){
+    static uint16_t instructions[32];
+    struct backscatter_config config;
+    uint32_t frame_us = (uint32_t) (((get_frame_len() + 3) / 4) * 32 * 1000000ull / baud) + 1;
+    if(!tdma_init(TDMA_SLOTS, frame_us + TDMA_GUARD_US) || TDMA_TAGS < 1 || TDMA_TAGS > 2){
+        return;
+    }
+    uint32_t masks[2] = {0, 0};
+    for(uint8_t s = 0; s < TDMA_SLOTS; s++){
+        masks[s % TDMA_TAGS] |= 1u << s;
+    }
+    tdma_add_tag(pio, sm, masks[0], baud);
+    if(TDMA_TAGS == 2){
+        // the second tag uses the current link settings of the first one (CONTROL, SCAN_SPECTRUM)
+        uint16_t d0 = link_dividers[0], d1 = link_dividers[1];
+        if(!backscatter_program_init(pio1, 0, PIN_TX1_2, PIN_TX2_2, PROGRAM_DIV0(d0, d1), PROGRAM_DIV1(d0, d1), baud, &config, instructions, TWOANTENNAS)){
+            return;
+        }
+        tdma_add_tag(pio1, 0, masks[1], baud);
+    }
+    uint8_t rx_buffer[RX_BUFFER_SIZE];
+    reset_link_counters();
+    RX_start_burst_listen();
+    startCarrier();
+    tdma_start(to_us_since_boot(get_absolute_time()), TDMA_SUPERFRAMES);
+    while(tdma_running()){
+        for(uint8_t t = 0; t < TDMA_TAGS; t++){
+            if(tdma_ready(t)){
+                Frame *frame = frame_arena_next();
+                build_frame(frame, *seq, header_template);
+                (*seq)++;
+                tdma_queue(t, frame);
+            }
+        }
+        if(get_event() == rx_deassert_evt){
+            Packet_status status = readPacket(rx_buffer);
+            output_packet(rx_buffer, status, to_us_since_boot(get_absolute_time()));
+            if(status.overflowed){
+                RX_start_burst_listen();
+            }
+        }
+    }
+    sleep_us(tdma.slot_us); // the last frame
+    stopCarrier();
+    RX_start_listen();
+    tdma_print(to_us_since_boot(get_absolute_time()));
+    print_link_counters(to_us_since_boot(get_absolute_time()));
+}
+
+// tune the receiver to the subcarrier of backscatter_conf
+static void tune_receiver(){
+    if(SIDEBAND == SIDEBAND_LOWER){
+        set_frecuency_rx(carrier_feq - backscatter_conf.center_offset); // the tones are mirrored (PROGRAM_DIV0/1)
+    }else{
+        set_frecuency_rx(carrier_feq + backscatter_conf.center_offset);
+    }
+    set_frequency_deviation_rx(backscatter_conf.deviation);
+    set_datarate_rx(backscatter_conf.baudrate);
+    signal_bw = backscatter_conf.minRxBw;
+    set_filter_bandwidth_rx(OFFSET_TRACKING ? signal_bw + 2*OFFSET_MARGIN : signal_bw);
+}
+
+/*
+ * CONTROL_SET of the host (see usb_control.h), called between two carrier on-periods: the state-machine is
+ * regenerated and carrier and receiver are retuned, returns false if the value cannot be applied
+ */
+static bool apply_param(uint8_t param, uint32_t *value){
+    uint32_t *params = usb_control.params;
+    switch(param){
+        case PARAM_CARRIER_FREQ:
+        case PARAM_CLOCK_DIV0:
+        case PARAM_CLOCK_DIV1:
+        case PARAM_BAUD: {
+            if(HOPPING){
+                printf("ERROR: with HOPPING the channels follow hop_dividers and CARRIER_FEQ.\n");
+                return false;
+            }
+            uint16_t d0 = (param == PARAM_CLOCK_DIV0) ? *value : params[PARAM_CLOCK_DIV0];
+            uint16_t d1 = (param == PARAM_CLOCK_DIV1) ? *value : params[PARAM_CLOCK_DIV1];
+            uint32_t baud = backscatter_achievable_baud((param == PARAM_BAUD) ? *value : params[PARAM_BAUD]);
+            // the new program has to fit before the running one is replaced
+            uint16_t instructions[32];
+            struct pio_program program;
+            struct backscatter_layout layout;
+            if(param != PARAM_CARRIER_FREQ && !generatePIOprogram(PROGRAM_DIV0(d0, d1), PROGRAM_DIV1(d0, d1), baud, instructions, &program, TWOANTENNAS, &layout)){
+                return false;
+            }
+            RX_stop_listen();
+            if(param == PARAM_CARRIER_FREQ){
+                carrier_feq = *value;
+                set_frecuency_tx(carrier_feq);
+            }else{
+                // stop the state-machine before its program is removed, backscatter_program_init() enables it again
+                pio_sm_set_enabled(pio0, 0, false);
+                pio_clear_instruction_memory(pio0);
+                backscatter_program_init(pio0, 0, PIN_TX1, PIN_TX2, PROGRAM_DIV0(d0, d1), PROGRAM_DIV1(d0, d1), baud, &backscatter_conf, instructionBuffer, TWOANTENNAS);
+                link_dividers[0] = d0;
+                link_dividers[1] = d1;
+            }
+            if(param == PARAM_BAUD){
+                *value = baud;
+            }
+            tune_receiver();
+            RX_start_listen();
+            return true;
+        }
+        case PARAM_PAYLOAD_SIZE:
+            return set_payload_size(*value);
+        case PARAM_TX_INTERVAL_MS:
+            tx_interval_ms = *value;
+            return true;
+        case PARAM_RECEIVER:
+            header_tmplate = packet_hdr_template(*value);
+            return true;
+        case PARAM_POWER_LEVEL:
+            if(POWER_CONTROL){
+                printf("ERROR: with POWER_CONTROL the power control chooses the level.\n");
+                return false;
+            }
+            set_power_level_tx(*value);
+            return true;
+        case PARAM_PREAMBLE_LEN:
+        case PARAM_SYNC_LEN: {
+            uint8_t preamble_len = (param == PARAM_PREAMBLE_LEN) ? *value : params[PARAM_PREAMBLE_LEN];
+            uint8_t sync_len = (param == PARAM_SYNC_LEN) ? *value : params[PARAM_SYNC_LEN];
+            if(!set_framing(preamble_len, sync_len)){
+                return false;
+            }
+            RX_stop_listen();
+            set_sync_mode_rx(8*sync_len);
+            RX_start_listen();
+            return true;
+        }
+        case PARAM_WHITENING:
+            RX_stop_listen();
+            set_whitening(*value);
+            set_whitening_rx(*value);
+            RX_start_listen();
+            return true;
+    }
+    return false;
+}
+
 int main() {
     /* setup SPI */
     stdio_init_all();
@@ -68,24 +713,43 @@ int main() {
     bi_decl(bi_1pin_with_name(CARRIER_CSN, "SPI Carrier CS"));
 
     sleep_ms(5000);
+    PROFILE_INIT();
 
     /* setup backscatter state machine */
     PIO pio = pio0;
     uint sm = 0;
-    struct backscatter_config backscatter_conf;
-    uint16_t instructionBuffer[32] = {0}; // maximal instruction size: 32
-    backscatter_program_init(pio, sm, PIN_TX1, PIN_TX2, CLOCK_DIV0, CLOCK_DIV1, DESIRED_BAUD, &backscatter_conf, instructionBuffer, TWOANTENNAS);
+    static struct backscatter_hopping hopping;
+    set_sideband(SIDEBAND);
+    set_continuous_phase(CONTINUOUS_PHASE);
+    uint16_t program_dividers[count_of(hop_dividers)][2];
+    for(uint8_t i = 0; i < count_of(hop_dividers); i++){
+        program_dividers[i][0] = PROGRAM_DIV0(hop_dividers[i][0], hop_dividers[i][1]);
+        program_dividers[i][1] = PROGRAM_DIV1(hop_dividers[i][0], hop_dividers[i][1]);
+    }
+    bool channels_ready = (HOPPING || SCAN_SPECTRUM) && backscatter_hopping_init(pio, sm, PIN_TX1, PIN_TX2, program_dividers, count_of(hop_dividers), DESIRED_BAUD, &hopping, TWOANTENNAS);
+    bool hopping_enabled = HOPPING && channels_ready;
+    if(channels_ready){
+        backscatter_conf = hopping.channel[0].config;
+        link_dividers[0] = hop_dividers[0][0];
+        link_dividers[1] = hop_dividers[0][1];
+    }else if(!backscatter_program_init(pio, sm, PIN_TX1, PIN_TX2, PROGRAM_DIV0(CLOCK_DIV0, CLOCK_DIV1), PROGRAM_DIV1(CLOCK_DIV0, CLOCK_DIV1), DESIRED_BAUD, &backscatter_conf, instructionBuffer, TWOANTENNAS)){
+        printf("ERROR: CLOCK_DIV0, CLOCK_DIV1 and DESIRED_BAUD give no backscatter program, stopped.\n");
+        while(true){
+            sleep_ms(1000);
+        }
+    }
 
-    static uint8_t message[buffer_size(PAYLOADSIZE+2, HEADER_LEN)*4] = {0};  // include 10 header bytes
-    static uint32_t buffer[buffer_size(PAYLOADSIZE, HEADER_LEN)] = {0}; // initialize the buffer
     static uint8_t seq = 0;
-    uint8_t *header_tmplate = packet_hdr_template(RECEIVER);
-    uint8_t tx_payload_buffer[PAYLOADSIZE];
+    set_payload_size(PAYLOAD_SIZE);
+    set_framing(FRAME_PREAMBLE_LEN, FRAME_SYNC_LEN);
+    set_whitening(WHITENING);
+    header_tmplate = packet_hdr_template(RECEIVER);
+    Frame *frame;
 
     /* Setup carrier */
     printf("\nConfiguring one CC2500 as carrier generator:\n");
     setupCarrier();
-    set_frecuency_tx(CARRIER_FEQ);
+    set_frecuency_tx(carrier_feq);
     sleep_ms(1);
 
     /* Start Receiver */
@@ -95,16 +759,101 @@ int main() {
     uint8_t rx_buffer[RX_BUFFER_SIZE];
     uint64_t time_us;
     setupReceiver();
-    set_frecuency_rx(CARRIER_FEQ + backscatter_conf.center_offset);
-    set_frequency_deviation_rx(backscatter_conf.deviation);
-    set_datarate_rx(backscatter_conf.baudrate);
-    set_filter_bandwidth_rx(backscatter_conf.minRxBw);
+    if(SCAN_SPECTRUM && channels_ready){
+        uint16_t best = scan_spectrum(&hopping);
+        carrier_feq = scan_carriers[best / hopping.channels];
+        set_frecuency_tx(carrier_feq);
+        if(!hopping_enabled){
+            backscatter_hop(pio, sm, &hopping, best % hopping.channels);
+            backscatter_conf = hopping.channel[best % hopping.channels].config;
+            link_dividers[0] = hop_dividers[best % hopping.channels][0];
+            link_dividers[1] = hop_dividers[best % hopping.channels][1];
+        }
+    }
+    tune_receiver();
+    set_sync_mode_rx(8*FRAME_SYNC_LEN);
+    set_preamble_quality_rx(RX_PQT);
+    set_whitening_rx(WHITENING);
+    if(hopping_enabled){
+        // calibrate every channel once, the filter covers the widest channel
+        uint32_t f_carriers[HOP_MAX_CHANNELS], f_devs[HOP_MAX_CHANNELS], rx_bw = 0;
+        for(uint8_t i = 0; i < hopping.channels; i++){
+            struct backscatter_config *conf = &hopping.channel[i].config;
+            f_carriers[i] = (SIDEBAND == SIDEBAND_LOWER) ? carrier_feq - conf->center_offset : carrier_feq + conf->center_offset;
+            f_devs[i] = conf->deviation;
+            rx_bw = max(rx_bw, conf->minRxBw);
+        }
+        signal_bw = rx_bw;
+        set_filter_bandwidth_rx(OFFSET_TRACKING ? signal_bw + 2*OFFSET_MARGIN : signal_bw);
+        setup_channels_rx(f_carriers, f_devs, hopping.channels);
+    }
+    set_offset_tracking_rx(OFFSET_TRACKING);
+    bool offset_narrowed = false;
+    uint32_t offset_lost = 0; // frames sent since the last complete received frame
     sleep_ms(1);
     RX_start_listen();
     printf("started listening\n");
     bool rx_ready = true;
+    bool send;
+
+    if(CHARACTERIZE_PREAMBLE){
+        characterize_preamble(pio, sm, &seq, backscatter_conf.baudrate);
+    }
+
+    if(ARQ){
+        reset_link_counters();
+        reset_link_quality(to_us_since_boot(get_absolute_time()));
+        transfer_file(pio, sm, &seq, header_tmplate, backscatter_conf.baudrate, hopping_enabled ? &hopping : NULL);
+        /* the file has been delivered: stop */
+        RX_stop_listen();
+        stopCarrier();
+        while(true){
+            PROFILE_POLL_USB(); // 'p': print timing histograms
+            sleep_ms(100);
+        }
+    }
+
+    if(BRIDGE){
+        /* one stream after the other, '#BRIDGE ready' every second while waiting */
+        reset_link_counters();
+        while(true){
+            if(usb_bridge_accept(1000)){
+                bridge_stream(pio, sm, &seq, header_tmplate, backscatter_conf.baudrate, hopping_enabled ? &hopping : NULL);
+            }
+        }
+    }
+
+    if(TDMA){
+        tdma_run(pio, sm, &seq, header_tmplate, backscatter_conf.baudrate);
+    }
+
+    if(ADC_SOURCE){
+        set_data_source(adc_source(ADC_INPUT, ADC_SAMPLE_RATE));
+    }
 
     /* loop */
+    reset_link_counters();
+    reset_link_quality(to_us_since_boot(get_absolute_time()));
+    if(POWER_CONTROL){
+        setup_power_control(TX_POWER_MAX_LEVEL, POWER_MIN_LEVEL, TX_POWER_MAX_LEVEL, POWER_WINDOW, to_us_since_boot(get_absolute_time()));
+    }
+    if(CONTROL){
+        const uint32_t params[CONTROL_PARAMS] = {
+            [PARAM_CARRIER_FREQ] = carrier_feq,
+            [PARAM_CLOCK_DIV0] = link_dividers[0],
+            [PARAM_CLOCK_DIV1] = link_dividers[1],
+            [PARAM_BAUD] = backscatter_conf.baudrate,
+            [PARAM_PAYLOAD_SIZE] = PAYLOAD_SIZE,
+            [PARAM_TX_INTERVAL_MS] = TX_DURATION,
+            [PARAM_RECEIVER] = RECEIVER,
+            [PARAM_POWER_LEVEL] = power_level_tx(),
+            [PARAM_PREAMBLE_LEN] = FRAME_PREAMBLE_LEN,
+            [PARAM_SYNC_LEN] = FRAME_SYNC_LEN,
+            [PARAM_WHITENING] = WHITENING,
+        };
+        usb_control_init(params, apply_param, CONTROL_AUTOSTART);
+    }
+    absolute_time_t next_report = make_timeout_time_ms(COUNTER_INTERVAL_MS);
     while (true) {
         evt = get_event();
         switch(evt){
@@ -116,38 +865,82 @@ int main() {
                 // finished receiving
                 time_us = to_us_since_boot(get_absolute_time());
                 status = readPacket(rx_buffer);
-                printPacket(rx_buffer,status,time_us);
+                output_packet(rx_buffer,status,time_us);
+                if(complete_frame(rx_buffer, status)){
+                    offset_lost = 0;
+                }
+                narrow_offset_filter(&offset_narrowed);
                 RX_start_listen();
                 rx_ready = true;
             break;
             case no_evt:
-                // backscatter new packet if receiver is listening
-                if (rx_ready){
-                    /* generate new data */
-                    generate_data(tx_payload_buffer, PAYLOADSIZE, true);
-
-                    /* add header (10 byte) to packet */
-                    add_header(&message[0], seq, header_tmplate);
-                    /* add payload to packet */
-                    memcpy(&message[HEADER_LEN], tx_payload_buffer, PAYLOADSIZE);
-
-                    /* casting for 32-bit fifo */
-                    for (uint8_t i=0; i < buffer_size(PAYLOADSIZE, HEADER_LEN); i++) {
-                        buffer[i] = ((uint32_t) message[4*i+3]) | (((uint32_t) message[4*i+2]) << 8) | (((uint32_t) message[4*i+1]) << 16) | (((uint32_t)message[4*i]) << 24);
+                // backscatter new packet if receiver is listening (with CONTROL: while a run of the host is active) and the samples of the next frame are ready
+                send = rx_ready && (!CONTROL || usb_control_may_send()) && source_ready();
+                if (send && hopping_enabled){
+                    hop_next(pio, sm, &hopping);
+                }
+                if (send && BURST_FRAMES > 1){
+                    uint8_t complete = send_burst(pio, sm, &seq, header_tmplate, backscatter_conf.baudrate);
+                    offset_lost = complete ? 0 : offset_lost + BURST_FRAMES;
+                    if(narrow_offset_filter(&offset_narrowed)){
+                        RX_start_listen();
+                    }
+                    for(uint8_t i = 0; CONTROL && i < BURST_FRAMES; i++){
+                        usb_control_sent(to_us_since_boot(get_absolute_time()));
                     }
+                }else if (send){
+                    /* generate new data, add header (10 byte) and pack for the 32-bit fifo */
+                    frame = frame_arena_next();
+                    build_frame(frame, seq, header_tmplate);
+
                     /* put the data to FIFO (start backscattering) */
-                    startCarrier();
-                    sleep_ms(1); // wait for carrier to start
-                    backscatter_send(pio,sm,buffer,buffer_size(PAYLOADSIZE, HEADER_LEN));
-                    sleep_ms(ceil((((double) buffer_size(PAYLOADSIZE, HEADER_LEN))*8000.0)/((double) DESIRED_BAUD))+3); // wait transmission duration (+3ms)
-                    stopCarrier();
+                    send_frame(pio, sm, frame, backscatter_conf.baudrate);
                     /* increase seq number*/ 
                     seq++;
+                    offset_lost++;
+                    if(CONTROL){
+                        usb_control_sent(to_us_since_boot(get_absolute_time()));
+                    }
+                }
+                if(OFFSET_TRACKING && offset_narrowed && offset_lost > OFFSET_LOST_PACKETS){ // the last frame may still be pending
+                    // the offset left the narrowed filter: widen it again, the compensation is kept and converges anew
+                    selected_rx()->offset_tracking.packets = 0;
+                    set_filter_bandwidth_rx(signal_bw + 2*OFFSET_MARGIN);
+                    RX_start_listen();
+                    offset_narrowed = false;
+                    offset_lost = 0;
+                }
+                if(rx_ready){
+                    update_power_control(to_us_since_boot(get_absolute_time()), get_payload_size()); // the carrier is off
+                }
+                // with backpressure of the data source: send as fast as the receiver allows until the ring drains
+                if(!source_backpressure() && CONTROL){
+                    usb_control_sleep_ms(tx_interval_ms); // the commands of the host are executed while waiting
+                }else if(!source_backpressure()){
+                    PROFILED_SLEEP_MS(TX_DURATION);
                 }
-                sleep_ms(TX_DURATION);
             break;
         }
-        sleep_ms(1);
+        if(COUNTER_INTERVAL_MS > 0 && time_reached(next_report)){
+            print_link_counters(to_us_since_boot(get_absolute_time()));
+            if(POWER_CONTROL){
+                print_power_control(to_us_since_boot(get_absolute_time()));
+            }
+            if(OFFSET_TRACKING){
+                print_offset_tracking_rx(to_us_since_boot(get_absolute_time()));
+            }
+            if(ADC_SOURCE){
+                print_data_source(to_us_since_boot(get_absolute_time()));
+            }
+            next_report = make_timeout_time_ms(COUNTER_INTERVAL_MS);
+        }
+        poll_link_quality();
+        if(CONTROL){
+            usb_control_sleep_ms(1);
+        }else{
+            PROFILE_POLL_USB(); // 'p': print timing histograms
+            PROFILED_SLEEP_MS(1);
+        }
     }
 
     /* stop carrier and receiver - never reached */
@@ -0,0 +1,300 @@
+#!/usr/bin/env python3
+"""
+Tobias Mages & Wenqing Yan
+
+Host library of the binary control protocol of carrier-receiver-baseband (CONTROL, project_pico_libs/usb_control.h):
+get/set the link parameters, start and stop runs and fetch the counters without flashing again.
+
+Frame (both directions, values little endian):
+  0xA5 | command | tag | len | payload | CRC-8 (polynomial 0x07 over command, tag, len and payload)
+The response carries command | 0x80, the tag of the request and the status as first payload byte. The text output
+of the Pico (packets, '#' summaries) is passed line by line to on_line and written to the log.
+
+library:
+  from pico_control import PicoControl
+  with PicoControl("/dev/ttyACM0", log="received.txt") as pico:
+      pico.stop()
+      pico.configure(baud=100000, payload_size=20, tx_interval_ms=10)
+      pico.start(1000)
+      pico.wait()
+      print(pico.counters())
+
+command line:
+  python3 pico_control.py /dev/ttyACM0 get
+  python3 pico_control.py /dev/ttyACM0 set baud=100000 payload_size=20
+  python3 pico_control.py /dev/ttyACM0 start 1000 --wait
+  python3 pico_control.py /dev/ttyACM0 counters
+  python3 pico_control.py /dev/ttyACM0 ping -n 1000                   # round-trip time
+  python3 pico_control.py /dev/ttyACM0 --log sweep.txt sweep baud=50000,100000,200000 --packets 500
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+SYNC = 0xA5
+RESPONSE = 0x80
+
+PING, GET, SET, GET_ALL, START, STOP, STATUS, COUNTERS = range(1, 9)
+
+PARAMS = ["carrier_freq", "clock_div0", "clock_div1", "baud", "payload_size", "tx_interval_ms", "receiver",
+          "power_level", "preamble_len", "sync_len", "whitening"]
+
+STATUS_TEXT = {0: "ok", 1: "CRC error", 2: "unknown command", 3: "invalid length", 4: "unknown parameter",
+               5: "invalid value"}
+
+COUNTER_NAMES = ["tx", "stall", "con", "coff", "rx", "crc", "ovf", "drop", "noeop",
+                 "lq_rx", "lq_expected", "lq_correct", "lq_crc", "lq_ovf", "lq_len", "lq_bits", "lq_bit_errors",
+                 "lq_rssi_sum", "lq_rssi_min", "lq_rssi_max"]
+
+
+def crc8(data):
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def encode(command, tag, payload=b""):
+    body = bytes([command, tag, len(payload)]) + payload
+    return bytes([SYNC]) + body + bytes([crc8(body)])
+
+
+class ControlError(Exception):
+    def __init__(self, command, status, payload=b""):
+        super().__init__("command 0x%02x: %s" % (command, STATUS_TEXT.get(status, "status %d" % status)))
+        self.status = status
+        self.payload = payload
+
+
+class PicoControl:
+    """one Pico on a serial port (or any object with read(), write() and in_waiting)"""
+
+    def __init__(self, port, timeout=0.5, retries=1, log=None, on_line=None):
+        if isinstance(port, str):
+            import serial
+            port = serial.Serial(port, 115200, timeout=0.01)
+        self.ser = port
+        self.timeout = timeout
+        self.retries = retries
+        self.log = open(log, "ab") if isinstance(log, str) else log
+        self.on_line = on_line
+        self.tag = 0
+        self.text = b""           # incomplete line
+        self.frame = b""          # incomplete response
+        self.responses = []
+        self.dropped = 0          # responses with a CRC error
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def close(self):
+        if self.log:
+            self.log.close()
+        self.ser.close()
+
+    # ---- stream: text lines and responses ----
+
+    def _text(self, data):
+        if self.log:
+            self.log.write(data)
+        lines = (self.text + data).split(b"\n")
+        self.text = lines.pop()
+        if self.on_line:
+            for line in lines:
+                self.on_line(line.rstrip(b"\r").decode("utf-8", errors="replace"))
+
+    def _feed(self, data):
+        """split the received bytes into text and responses (the text never contains SYNC)"""
+        while data:
+            if not self.frame:
+                start = data.find(bytes([SYNC]))
+                if start < 0:
+                    self._text(data)
+                    return
+                self._text(data[:start])
+                self.frame, data = data[start:start + 1], data[start + 1:]
+            # header first, then the rest of the frame once len is known
+            size = 5 + self.frame[3] if len(self.frame) >= 4 else 4
+            take = size - len(self.frame)
+            self.frame, data = self.frame + data[:take], data[take:]
+            if len(self.frame) >= 5 and len(self.frame) == 5 + self.frame[3]:
+                frame, self.frame = self.frame, b""
+                if crc8(frame[1:-1]) == frame[-1]:
+                    self.responses.append(frame)
+                else:
+                    self.dropped += 1
+
+    def poll(self):
+        """read what has arrived (text lines go to on_line and the log)"""
+        waiting = self.ser.in_waiting
+        if waiting:
+            self._feed(self.ser.read(waiting))
+
+    def command(self, command, payload=b""):
+        """send a request and return the payload of the response (after the status), raises ControlError"""
+        for attempt in range(self.retries + 1):
+            self.tag = (self.tag + 1) & 0xFF
+            self.ser.write(encode(command, self.tag, payload))
+            deadline = time.monotonic() + self.timeout
+            while time.monotonic() < deadline:
+                self._feed(self.ser.read(self.ser.in_waiting or 1))
+                while self.responses:
+                    r = self.responses.pop(0)
+                    if r[2] == self.tag and r[1] == command | RESPONSE:
+                        if r[4] != 0:
+                            raise ControlError(command, r[4], r[5:-1])
+                        return r[5:-1]
+        raise TimeoutError("no response to command 0x%02x" % command)
+
+    # ---- commands ----
+
+    def ping(self, data=b"ping"):
+        """round-trip time [s]"""
+        start = time.perf_counter()
+        if self.command(PING, data) != data:
+            raise ValueError("ping: wrong echo")
+        return time.perf_counter() - start
+
+    @staticmethod
+    def param_id(name):
+        if isinstance(name, int):
+            return name
+        return PARAMS.index(name)
+
+    def get(self, name):
+        return struct.unpack("<BI", self.command(GET, bytes([self.param_id(name)])))[1]
+
+    def set(self, name, value):
+        """returns the value as applied (e.g. the achievable baud rate)"""
+        return struct.unpack("<BI", self.command(SET, struct.pack("<BI", self.param_id(name), int(value))))[1]
+
+    def get_all(self):
+        r = self.command(GET_ALL)
+        values = struct.unpack("<%dI" % r[0], r[1:])
+        return {PARAMS[i] if i < len(PARAMS) else i: v for i, v in enumerate(values)}
+
+    def configure(self, **params):
+        """set several parameters, returns the applied values"""
+        return {name: self.set(name, value) for name, value in params.items()}
+
+    def start(self, packets=0):
+        """reset the counters and send packets frames (0: until stop())"""
+        self.command(START, struct.pack("<I", packets))
+
+    def stop(self):
+        self.command(STOP)
+
+    def status(self):
+        running, sent, packets, run_ms, commands, errors = struct.unpack("<BIIIII", self.command(STATUS))
+        return {"running": bool(running), "sent": sent, "packets": packets, "run_ms": run_ms, "commands": commands,
+                "errors": errors}
+
+    def drain(self, seconds):
+        """receive the text output for some time"""
+        end = time.monotonic() + seconds
+        while time.monotonic() < end:
+            self._feed(self.ser.read(self.ser.in_waiting or 1))
+
+    def wait(self, timeout=None, interval=0.05, settle=0.1):
+        """wait for the end of the run (and settle for the last packet to be received), returns the status"""
+        deadline = None if timeout is None else time.monotonic() + timeout
+        while True:
+            s = self.status()
+            if not s["running"] or (deadline and time.monotonic() > deadline):
+                self.drain(settle)
+                return s
+            self.drain(interval)
+
+    def counters(self):
+        """link counters since start() and the link quality of the current '#LQ' window (ANALYSIS)"""
+        return dict(zip(COUNTER_NAMES, struct.unpack("<17Iihh", self.command(COUNTERS))))
+
+
+def parse_assignments(items):
+    result = {}
+    for item in items:
+        name, value = item.split("=", 1)
+        if name not in PARAMS:
+            sys.exit("unknown parameter %s (%s)" % (name, ", ".join(PARAMS)))
+        result[name] = value
+    return result
+
+
+def print_tags(tag, values):
+    print(tag + " " + " ".join("%s=%s" % (k, v) for k, v in values.items()))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port", help="serial port of the Pico")
+    parser.add_argument("--log", help="append the text output of the Pico to this file")
+    parser.add_argument("--echo", action="store_true", help="print the text output of the Pico")
+    parser.add_argument("--timeout", type=float, default=0.5, help="response timeout [s]")
+    sub = parser.add_subparsers(dest="action", required=True)
+    sub.add_parser("get").add_argument("names", nargs="*")
+    sub.add_parser("set").add_argument("assignments", nargs="+", help="name=value")
+    p = sub.add_parser("start")
+    p.add_argument("packets", type=int, nargs="?", default=0)
+    p.add_argument("--wait", action="store_true")
+    sub.add_parser("stop")
+    sub.add_parser("status")
+    sub.add_parser("counters")
+    p = sub.add_parser("ping")
+    p.add_argument("-n", type=int, default=100)
+    p = sub.add_parser("sweep", help="one run per value: set, start, wait, counters")
+    p.add_argument("assignment", help="name=value1,value2,...")
+    p.add_argument("--packets", type=int, default=500)
+    args = parser.parse_args()
+
+    on_line = print if args.echo else None
+    with PicoControl(args.port, timeout=args.timeout, log=args.log, on_line=on_line) as pico:
+        if args.action == "get":
+            values = pico.get_all()
+            print_tags("#PARAMS", {k: v for k, v in values.items() if not args.names or k in args.names})
+        elif args.action == "set":
+            print_tags("#SET", pico.configure(**parse_assignments(args.assignments)))
+        elif args.action == "start":
+            pico.start(args.packets)
+            if args.wait:
+                print_tags("#STATUS", pico.wait())
+                print_tags("#COUNTERS", pico.counters())
+        elif args.action == "stop":
+            pico.stop()
+        elif args.action == "status":
+            print_tags("#STATUS", pico.status())
+        elif args.action == "counters":
+            print_tags("#COUNTERS", pico.counters())
+        elif args.action == "ping":
+            rtt = sorted(pico.ping() for _ in range(args.n))
+            print("#PING n=%d mean_ms=%.3f p50_ms=%.3f p99_ms=%.3f max_ms=%.3f" % (args.n, 1000 * sum(rtt) / len(rtt),
+                  1000 * rtt[len(rtt) // 2], 1000 * rtt[int(0.99 * (len(rtt) - 1))], 1000 * rtt[-1]))
+        elif args.action == "sweep":
+            name, values = args.assignment.split("=", 1)
+            parse_assignments([name + "=0"])
+            pico.stop()
+            for value in values.split(","):
+                try:
+                    applied = pico.set(name, value)
+                except ControlError as e:
+                    print_tags("#SWEEP", {name: value, "error": STATUS_TEXT.get(e.status).replace(" ", "_")})
+                    continue
+                pico.start(args.packets)
+                s = pico.wait()
+                c = pico.counters()
+                print_tags("#SWEEP", {name: applied, "sent": c["tx"], "received": c["rx"], "crc": c["crc"],
+                                      "loss": "%.4f" % (1 - c["rx"] / max(c["tx"], 1)), "run_ms": s["run_ms"]})
+
+
+if __name__ == "__main__":
+    import serial
+    try:
+        main()
+    except (ControlError, TimeoutError, serial.SerialException) as e:
+        sys.exit("ERROR: %s" % e)
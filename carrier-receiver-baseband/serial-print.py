@@ -1,38 +1,311 @@
-import serial
-from os import name
+#!/usr/bin/env python3
+"""
+Tobias Mages & Wenqing Yan
+
+Capture the output of the Pico into a log file and show the link live.
+
+The port is read in blocks (whatever has arrived, at least one byte), the log receives the bytes unchanged. Complete
+lines are parsed as they arrive:
+  - packets of printPacket() ('HH:MM:SS.mmm | <bytes> | <rssi> CRC pass/error'): the data following the file index
+    is compared with the regenerated file (generate_sample() of packet_generation.c) as analyze_packet() of
+    project_pico_libs/link_quality.c does; the sequence numbers between two verified packets (correct CRC or no bit
+    error) give the packets sent,
+  - summary lines ('#TAG key=value ...'): the last line of every tag is shown.
+The statistics cover the last --window seconds of the Pico time stamps in buckets of --window/BUCKETS, i.e. the
+memory does not grow with the packets: PER (1 - correct/expected), BER, RSSI percentiles, packets/s and goodput
+(bits of the data of the correct packets). The view is redrawn --refresh times per second; --echo prints the lines
+instead (as before).
+
+usage:
+  python3 serial-print.py                       # select the port, log to received_<date>_<time>.txt
+  python3 serial-print.py /dev/ttyACM0 --window 5 --payload 60
+  python3 serial-print.py --replay received.txt  # evaluate a log as fast as possible (no log file)
+"""
+
+import argparse
+import sys
+import time
 from datetime import datetime
+from os import name
+
+BUCKETS = 10                 # buckets per window
+RSSI_MIN, RSSI_MAX = -128, 0 # RSSI histogram [dBm]
+DEFAULT_SEED = 0xABCD
+FILE_BYTES = 1 << 16         # the 16-bit file index wraps, generate_sample() restarts with DEFAULT_SEED
+SUMMARY_TAGS = 8             # last summary lines shown
+
+
+def reference_file():
+    """the bytes generated by generate_sample() from file position 0 to 65535 (16-bit samples, MSB first)"""
+    import math
+    seed = DEFAULT_SEED
+    data = bytearray(FILE_BYTES)
+    for position in range(0, FILE_BYTES, 2):
+        seed = (seed * 1664525 + 1013904223) & 0xFFFFFFFF
+        u1 = seed / 0xFFFFFFFF
+        seed = (seed * 1664525 + 1013904223) & 0xFFFFFFFF
+        u2 = seed / 0xFFFFFFFF
+        tmp = 0x7FF * math.sqrt(-2.0 * math.log(u1)) if u1 > 0 else math.inf
+        sample = int(max(0.0, min(float(0x3FFFFF), tmp * math.cos(2.0 * math.pi * u2) + 0x1FFF))) & 0xFFFF
+        data[position] = sample >> 8
+        data[position + 1] = sample & 0xFF
+    return bytes(data + data[:256])  # a payload may wrap around the end of the file
+
+
+class Bucket:
+    __slots__ = ("start", "received", "expected", "correct", "crc", "overflows", "length", "bits", "bit_errors",
+                 "data_bits", "rssi")
+
+    def __init__(self, start):
+        self.start = start
+        self.received = self.expected = self.correct = self.crc = self.overflows = self.length = 0
+        self.bits = self.bit_errors = self.data_bits = 0
+        self.rssi = [0] * (RSSI_MAX - RSSI_MIN + 1)
+
+
+class LinkStats:
+    """rolling statistics of the packets within the last window seconds (Pico time)"""
+
+    def __init__(self, window, payload=None):
+        self.window = window
+        self.width = window / BUCKETS
+        self.buckets = []
+        self.payload = payload             # None: most frequent length byte
+        self.length_counts = [0] * 256
+        self.file = reference_file()
+        self.last_seq = None
+        self.last_index = 0
+        self.candidate = None              # (seq, index) of a correct packet not following the last verified one
+        self.now = 0.0
+        self.first = None                  # time of the first packet since the start of the Pico
+        self.packets = 0
+        self.lines = 0
+        self.summaries = {}
+
+    def bucket(self, t):
+        if self.buckets and t < self.buckets[-1].start:
+            self.buckets.clear()  # the Pico has been restarted
+            self.first = t
+        if self.first is None:
+            self.first = t
+        if not self.buckets or t >= self.buckets[-1].start + self.width:
+            self.buckets.append(Bucket(t - (t % self.width)))
+            if len(self.buckets) > BUCKETS + 1:
+                self.buckets.pop(0)
+        self.now = t
+        return self.buckets[-1]
+
+    def data_errors(self, data, index):
+        reference = self.file[index:index + len(data)]
+        return (int.from_bytes(data, "big") ^ int.from_bytes(reference, "big")).bit_count()
+
+    def packet(self, t, frame, rssi, crc_ok):
+        b = self.bucket(t)
+        self.packets += 1
+        b.received += 1
+        b.rssi[min(max(rssi, RSSI_MIN), RSSI_MAX) - RSSI_MIN] += 1
+        b.crc += not crc_ok
+        self.length_counts[frame[0]] += 1
+        payload = self.payload if self.payload else max(range(256), key=self.length_counts.__getitem__) - 1
+        if len(frame) != payload + 2 or frame[0] != payload + 1 or payload < 2:
+            b.length += 1
+            return
+        seq, index, data = frame[1], (frame[2] << 8) | frame[3], frame[4:]
+        errors = self.data_errors(data, index)
+        consistent = self.last_seq is None or self.follows(self.last_seq, self.last_index, seq, index, len(data))
+        if not consistent and errors > 0:
+            # the file index might be corrupted itself: the index expected from the sequence number explains the data better
+            expected_index = (self.last_index + ((seq - self.last_seq) & 0xFF) * len(data)) & 0xFFFF
+            expected_errors = (index ^ expected_index).bit_count()
+            if expected_errors < errors:
+                errors = min(errors, expected_errors + self.data_errors(data, expected_index))
+        if crc_ok or (errors == 0 and consistent):
+            # verified: the packets since the last verified one were sent
+            b.expected += ((seq - self.last_seq) & 0xFF) if self.last_seq is not None else 1
+            self.last_seq, self.last_index, self.candidate = seq, index, None
+        elif errors == 0:
+            # correct data but the sequence number does not fit: either this packet (corrupted sequence number) or
+            # the last verified one is wrong, the next correct packet following this one decides
+            if self.candidate and self.follows(*self.candidate, seq, index, len(data)):
+                b.expected += ((seq - self.candidate[0]) & 0xFF) + 1
+                self.last_seq, self.last_index, self.candidate = seq, index, None
+                consistent = True
+            else:
+                self.candidate = (seq, index)
+        b.bits += 8 * payload
+        b.bit_errors += errors
+        if errors == 0 and (crc_ok or consistent):
+            b.correct += 1
+            b.data_bits += 8 * len(data)
+
+    @staticmethod
+    def follows(last_seq, last_index, seq, index, data_len):
+        """the file index advances by data_len per sequence number"""
+        return ((seq - last_seq) & 0xFF) > 0 and index == (last_index + ((seq - last_seq) & 0xFF) * data_len) & 0xFFFF
+
+    def overflow(self, t):
+        self.bucket(t).overflows += 1
+
+    def summary(self, line):
+        tag = line.split(" ", 1)[0]
+        if tag in self.summaries or len(self.summaries) < SUMMARY_TAGS:
+            self.summaries[tag] = line
 
-log = True
-time = datetime.now()
-logfile = f'./received_{time.year:04}-{time.month:02}-{time.day:02}_{time.hour:02}-{time.minute:02}-{time.second:02}.txt'
-
-# print available ports
-if name == 'nt':  # sys.platform == 'win32':
-    from serial.tools.list_ports_windows import comports
-elif name == 'posix':
-    from serial.tools.list_ports_posix import comports
-else:
-    print('Sorry, your platform is not supported.')
-
-# ask which to use
-if len(comports()) == 0:
-    print('Sorry, no serial ports are available.')
-else:
+    def totals(self):
+        """sums over the window, the duration covered and the RSSI percentiles"""
+        active = [b for b in self.buckets if b.start > self.now - self.window]
+        total = Bucket(0)
+        for b in active:
+            for key in Bucket.__slots__[1:-1]:
+                setattr(total, key, getattr(total, key) + getattr(b, key))
+            total.rssi = [x + y for x, y in zip(total.rssi, b.rssi)]
+        duration = (self.now - max(active[0].start, self.first)) if active else 0.0
+        percentiles = []
+        count = sum(total.rssi)
+        for p in (0.1, 0.5, 0.9):
+            acc = 0
+            for i, n in enumerate(total.rssi):
+                acc += n
+                if count and acc >= p * count:
+                    percentiles.append(i + RSSI_MIN)
+                    break
+        return total, max(duration, 1e-3), percentiles
+
+    def view(self):
+        t, duration, p = self.totals()
+        per = 1.0 - min(t.correct / t.expected, 1.0) if t.expected else 0.0
+        ber = t.bit_errors / t.bits if t.bits else 0.0
+        rssi = "%d / %d / %d dBm" % tuple(p) if p else "-"
+        lines = [
+            "window %.1f s (Pico %.1f s)   packets %d   lines %d" % (duration, self.now, self.packets, self.lines),
+            "received %6d   expected %6d   correct %6d   crc %d   overflow %d   length %d"
+            % (t.received, t.expected, t.correct, t.crc, t.overflows, t.length),
+            "PER %.4f   BER %.2e   RSSI p10/p50/p90 %s" % (per, ber, rssi),
+            "%.1f packets/s   goodput %.0f bit/s" % (t.received / duration, t.data_bits / duration),
+            "",
+        ] + [self.summaries[k] for k in sorted(self.summaries)]
+        return lines
+
+
+def pico_time(stamp):
+    """'HH:MM:SS.mmm' -> seconds"""
+    h, m, s = stamp.split(b":")
+    return 3600 * int(h) + 60 * int(m) + float(s)
+
+
+def parse_line(stats, line):
+    stats.lines += 1
+    if line.startswith(b"#"):
+        stats.summary(line.decode("utf-8", errors="replace"))
+        return
+    fields = line.split(b"|")
+    if len(fields) != 3:
+        return
+    try:
+        t = pico_time(fields[0].strip())
+        if fields[1].startswith(b" packet overflow"):
+            stats.overflow(t)
+            return
+        status = fields[2].split()
+        stats.packet(t, bytes.fromhex(fields[1].decode()), int(status[0]), status[-1] == b"pass")
+    except (ValueError, IndexError):
+        pass  # a line corrupted on the USB
+
+
+class Capture:
+    """assembles lines from blocks of bytes, logs and parses them"""
+
+    def __init__(self, stats, log=None, echo=False):
+        self.stats = stats
+        self.log = log
+        self.echo = echo
+        self.pending = b""
+
+    def feed(self, block):
+        if self.log:
+            self.log.write(block)
+        if self.echo:
+            sys.stdout.write(block.decode("utf-8", errors="replace"))
+        lines = (self.pending + block).split(b"\n")
+        self.pending = lines.pop()
+        for line in lines:
+            parse_line(self.stats, line.rstrip(b"\r"))
+
+
+def draw(lines):
+    sys.stdout.write("\x1b[H\x1b[J" + "\n".join(lines) + "\n")
+    sys.stdout.flush()
+
+
+def select_port():
+    """list the ports and ask which one to use"""
+    if name == 'nt':  # sys.platform == 'win32':
+        from serial.tools.list_ports_windows import comports
+    elif name == 'posix':
+        from serial.tools.list_ports_posix import comports
+    else:
+        sys.exit('Sorry, your platform is not supported.')
+    if len(comports()) == 0:
+        sys.exit('Sorry, no serial ports are available.')
     print('The available serial ports are:')
     for p in comports():
         print(f'- {p}')
     port = input('\nWhich port would you like to use? ')
-    if (port in [str(p).split(' ')[0] for p in comports()]):
-        print(f'Starting to read from {port}...')
-        with serial.Serial(port, 115200)  as ser:
-            if log:
-                with open(logfile,'a',newline='\n') as openfile:
-                    while True:
-                        rec = ser.read().decode("utf-8")
-                        print(rec,end='')
-                        openfile.write(rec)
-            else:
-                while True:
-                    print(ser.read().decode("utf-8"),end='')
-    else:
-        print('Sorry, the provided ports was not part of the list.')
+    if port not in [str(p).split(' ')[0] for p in comports()]:
+        sys.exit('Sorry, the provided ports was not part of the list.')
+    return port
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port", nargs="?", help="serial port of the Pico (default: ask)")
+    parser.add_argument("--window", type=float, default=10.0, help="statistics window [s]")
+    parser.add_argument("--refresh", type=float, default=4.0, help="view updates per second")
+    parser.add_argument("--payload", type=int, help="payload size of the tag [byte] (default: most frequent length byte)")
+    parser.add_argument("--log", help="log file (default: received_<date>_<time>.txt)")
+    parser.add_argument("--no-log", action="store_true", help="do not write a log file")
+    parser.add_argument("--echo", action="store_true", help="print the lines instead of the view")
+    parser.add_argument("--replay", help="evaluate a log file instead of reading a port")
+    args = parser.parse_args()
+    stats = LinkStats(args.window, args.payload)
+
+    if args.replay:
+        capture = Capture(stats, echo=args.echo)
+        start = time.perf_counter()
+        with open(args.replay, "rb") as f:
+            while block := f.read(1 << 16):
+                capture.feed(block)
+        capture.feed(b"\n")
+        elapsed = time.perf_counter() - start
+        if not args.echo:
+            draw(stats.view())
+        print("#SERIAL lines=%d packets=%d seconds=%.2f lines_per_s=%.0f" % (stats.lines, stats.packets, elapsed, stats.lines / elapsed))
+        return
+
+    import serial
+    port = args.port or select_port()
+    now = datetime.now()
+    logfile = args.log or f'./received_{now.year:04}-{now.month:02}-{now.day:02}_{now.hour:02}-{now.minute:02}-{now.second:02}.txt'
+    log = None if args.no_log else open(logfile, "ab")
+    capture = Capture(stats, log, args.echo)
+    print(f'Starting to read from {port}...')
+    period = 1.0 / args.refresh
+    next_draw = time.monotonic()
+    try:
+        with serial.Serial(port, 115200, timeout=period) as ser:
+            while True:
+                block = ser.read(ser.in_waiting or 1)
+                if block:
+                    capture.feed(block)
+                if not args.echo and time.monotonic() >= next_draw:
+                    draw(stats.view() + ["", "log: %s" % (logfile if log else "-")])
+                    next_draw = time.monotonic() + period
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if log:
+            log.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+"""
+Tobias Mages & Wenqing Yan
+
+Stream a file through the tag (BRIDGE in main.c, see ../project_pico_libs/usb_bridge.h).
+
+The Pico announces '#BRIDGE ready payload=<byte> ring=<byte>' every second. The script sends '#SEND size=<byte>',
+then writes the file as far as the credits allow ('#CREDIT granted=<byte>': bytes which may have been sent in total)
+and logs every line of the Pico (the received packets, '#BRIDGE', '#CNT') until '#BRIDGEDONE'. The log can be
+evaluated like those of serial-print.py.
+
+usage:
+  python3 usb-bridge.py /dev/ttyACM0 file.bin [--log received.txt]
+"""
+
+import argparse
+import time
+import serial
+
+
+def parse_tags(line):
+    """'#TAG key=value ...' -> dict"""
+    return dict(item.split("=", 1) for item in line.split()[1:] if "=" in item)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port", help="serial port of the Pico")
+    parser.add_argument("file", help="file to stream")
+    parser.add_argument("--log", help="write all lines of the Pico to this file")
+    args = parser.parse_args()
+
+    data = open(args.file, "rb").read()
+    log = open(args.log, "a", newline="\n") if args.log else None
+    written = 0
+    start = None
+    with serial.Serial(args.port, 115200, timeout=1) as ser:
+        while True:
+            line = ser.readline().decode("utf-8", errors="ignore").strip()
+            if not line:
+                continue
+            if log:
+                log.write(line + "\n")
+            if line.startswith("#BRIDGE ready") and start is None:
+                print(line)
+                ser.write(b"#SEND size=%d\n" % len(data))
+                start = time.time()
+            elif line.startswith("#CREDIT") and start is not None:
+                granted = int(parse_tags(line)["granted"])
+                if granted > written:
+                    ser.write(data[written:granted])
+                    written = granted
+            elif line.startswith("#BRIDGE") or line.startswith("#CNT"):
+                print(line)
+                if line.startswith("#BRIDGEDONE"):
+                    break
+    duration = time.time() - start
+    print(f"host: {len(data)} byte in {duration:.1f} s ({8 * len(data) / duration:.0f} bit/s)")
+    if log:
+        log.close()
+
+
+if __name__ == "__main__":
+    main()
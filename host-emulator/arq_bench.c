@@ -0,0 +1,196 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * arq_bench: reliable file delivery of carrier-receiver-baseband/main.c (ARQ) against the CC2500 model
+ *
+ * Every carrier on-period carries one chunk selected by the selective-repeat ARQ (arq.c): the frame is injected into
+ * the CC2500 model 1 ms after the carrier start, lost with the packet error rate -e (CRC error), read with
+ * readPacket() 3 ms after its end and acknowledged with arq_ack_packet() (same timing as send_frame() and
+ * receive_packet() of main.c). With -c the chunks are sent in file order over and over again instead (no ARQ, the
+ * behavior without acknowledgements) until every chunk has been received once. All times are virtual.
+ *
+ * usage: arq_bench [-s <file size>] [-p <payload>] [-b <baud>] [-e <packet error rate>] [-w <window>] [-t <initial timeout us>] [-g <gap ms>] [-c]
+ *   -c: cycle the file without ARQ
+ *
+ * The data of every delivered chunk is compared with the file generated in order (content_errors).
+ *
+ * Output: '#ARQ'/'#ARQDONE key=value ...' (with -c '#CYCLEDONE key=value ...'), '#ARQBENCH key=value ...', the link
+ * counters ('#CNT') and the model statistics ('#CC2500').
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pico/stdlib.h"
+#include "pico/util/queue.h"
+#include "hardware/spi.h"
+#include "receiver_CC2500.h"
+#include "packet_generation.h"
+#include "link_counters.h"
+#include "arq.h"
+#include "cc2500_model.h"
+
+#define CARRIER_FEQ     2450000000
+#define CENTER_OFFSET      3298611
+#define DEVIATION           173611
+#define RECEIVER              2500
+#define CARRIER_START_US      1000 // send_frame(): wait for the carrier to start
+#define RX_FINISH_US          3000 // send_frame(): wait for the receiver to finish the packet
+#define RX_TIMEOUT_US         2000 // receive_packet()
+
+static struct cc2500_model radio;
+static uint8_t *header_tmplate;
+static uint8_t air_offset;   // the CC2500 receives the bytes after the sync word
+static uint8_t air_len;
+static double packet_error_rate;
+static uint32_t baud;
+static uint8_t reference[ARQ_MAX_FILE_SIZE + MAX_PAYLOADSIZE]; // the file, generated in order
+static uint32_t content_errors = 0;
+
+/* acknowledge a packet, its data has to match the file at its index (arq_build_frame() regenerates it with seek_data()) */
+static void acknowledge(struct arq *arq, uint8_t *buffer, Packet_status status, uint64_t time_us){
+    if(arq_ack_packet(arq, buffer, status, time_us)){
+        uint16_t index = (((uint16_t) buffer[2]) << 8) | buffer[3];
+        content_errors += memcmp(&buffer[4], &reference[index], arq->chunk_size) != 0;
+    }
+}
+
+/* one carrier on-period with one frame, returns true if a packet has been read (buffer, status, time_us) */
+static bool on_period(Frame *frame, uint8_t *buffer, Packet_status *status, uint64_t *time_us){
+    uint64_t sync_us = time_us_64() + CARRIER_START_US + (uint64_t) (get_header_len() - 2) * 8 * 1000000 / baud;
+    // a packet error flips a bit of the payload: the receiver fails the CRC
+    uint8_t air[CC2500_MAX_PACKET];
+    memcpy(air, &frame->bytes[air_offset], air_len);
+    if((rand() / (RAND_MAX + 1.0)) < packet_error_rate){
+        air[air_len - CRC_LEN - 1] ^= 0x01;
+    }
+    cc2500_model_inject(&radio, sync_us, air, air_len, -60);
+    link_counters.packets_sent++;
+    sleep_us(CARRIER_START_US + (uint64_t) 4 * frame->len_words * 8 * 1000000 / baud + RX_FINISH_US);
+    absolute_time_t timeout = make_timeout_time_us(RX_TIMEOUT_US);
+    while(!time_reached(timeout)){
+        if(get_event() == rx_deassert_evt){
+            *status = readPacket(buffer);
+            *time_us = time_us_64();
+            RX_start_listen();
+            return true;
+        }
+        sleep_us(10);
+    }
+    RX_start_listen();
+    return false;
+}
+
+static void usage(const char *name){
+    fprintf(stderr, "usage: %s [-s <file size>] [-p <payload>] [-b <baud>] [-e <packet error rate>] [-w <window>] [-t <initial timeout us>] [-g <gap ms>] [-c]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv){
+    uint32_t file_size = 4096;
+    uint8_t payload = PAYLOADSIZE;
+    int window = 8;
+    uint32_t initial_rto_us = 20000;
+    uint32_t gap_ms = 1;
+    bool cycle = false;
+    baud = 200000;
+    packet_error_rate = 0.1;
+    int opt;
+    while((opt = getopt(argc, argv, "s:p:b:e:w:t:g:c")) != -1){
+        switch(opt){
+            case 's': file_size = atoi(optarg); break;
+            case 'p': payload = atoi(optarg); break;
+            case 'b': baud = atoi(optarg); break;
+            case 'e': packet_error_rate = atof(optarg); break;
+            case 'w': window = atoi(optarg); break;
+            case 't': initial_rto_us = atoi(optarg); break;
+            case 'g': gap_ms = atoi(optarg); break;
+            case 'c': cycle = true; break;
+            default: usage(argv[0]);
+        }
+    }
+    if(!set_payload_size(payload) || packet_error_rate < 0 || packet_error_rate >= 1 || window < 1 || window > ARQ_MAX_WINDOW){
+        usage(argv[0]);
+    }
+    stdio_init_all();
+    spi_init(RADIO_SPI, 5 * 1000000); // SPI0 at 5MHz.
+    gpio_init(RX_CSN);
+    gpio_set_dir(RX_CSN, GPIO_OUT);
+    gpio_put(RX_CSN, 1);
+    cc2500_model_init(&radio, RADIO_SPI, RX_CSN, RX_GDO0_PIN);
+
+    setupReceiver();
+    set_frecuency_rx(CARRIER_FEQ + CENTER_OFFSET);
+    set_frequency_deviation_rx(DEVIATION);
+    set_datarate_rx(baud);
+    set_filter_bandwidth_rx(baud + 2*DEVIATION);
+    sleep_ms(1);
+    RX_start_listen();
+    reset_link_counters();
+
+    header_tmplate = packet_hdr_template(RECEIVER);
+    air_offset = get_header_len() - 2;
+    air_len = 2 + get_payload_size() + CRC_LEN;
+    srand(1);
+    uint8_t buffer[RX_BUFFER_SIZE];
+    Packet_status status;
+    uint64_t time_us;
+    uint8_t seq = 0;
+    static struct arq arq;
+    if(!arq_init(&arq, file_size, payload, window, initial_rto_us, time_us_64())){
+        return 1;
+    }
+    file_position = 0;
+    for(uint32_t i = 0; i < (uint32_t) arq.chunks * arq.chunk_size; i += 2){
+        uint16_t sample = generate_sample();
+        reference[i] = sample >> 8;
+        reference[i + 1] = sample & 0xFF;
+    }
+
+    if(cycle){
+        // the chunks in file order, as without acknowledgements: the receiver keeps the first copy of each chunk
+        uint32_t transmissions = 0;
+        uint64_t start_us = time_us_64();
+        while(!arq_done(&arq)){
+            uint16_t chunk = transmissions % arq.chunks;
+            Frame *frame = frame_arena_next();
+            arq_build_frame(&arq, chunk, frame, seq++, header_tmplate);
+            arq.next = max(arq.next, chunk + 1); // the window does not apply
+            transmissions++;
+            if(on_period(frame, buffer, &status, &time_us)){
+                acknowledge(&arq, buffer, status, time_us);
+            }
+            sleep_ms(gap_ms);
+        }
+        uint64_t duration_us = arq.done_us - start_us;
+        uint32_t file_bytes = arq.file_size;
+        printf("#CYCLEDONE file_bytes=%u chunks=%u completion_ms=%.1f transmissions=%u overhead=%.3f goodput_bps=%.0f per=%.3f\n",
+            file_bytes, arq.chunks, duration_us / 1000.0, transmissions, ((double) transmissions - arq.chunks) / arq.chunks,
+            8.0 * file_bytes * 1000000.0 / duration_us, packet_error_rate);
+        printf("#ARQBENCH per=%.3f content_errors=%u\n", packet_error_rate, content_errors);
+    }else{
+        uint32_t waits = 0;
+        while(!arq_done(&arq)){
+            int32_t chunk = arq_next_chunk(&arq, time_us_64());
+            if(chunk < 0){
+                waits++;
+                sleep_us(arq_next_timeout_us(&arq) - time_us_64()); // window full: wait for the next timeout
+                continue;
+            }
+            Frame *frame = frame_arena_next();
+            arq_build_frame(&arq, chunk, frame, seq++, header_tmplate);
+            arq_sent(&arq, chunk, time_us_64());
+            if(on_period(frame, buffer, &status, &time_us)){
+                acknowledge(&arq, buffer, status, time_us);
+            }
+            sleep_ms(gap_ms);
+        }
+        arq_print(&arq, time_us_64());
+        printf("#ARQBENCH per=%.3f window=%d initial_rto_us=%u window_full_waits=%u content_errors=%u\n", packet_error_rate, window, initial_rto_us, waits, content_errors);
+    }
+    print_link_counters(time_us_64());
+    cc2500_model_print_stats(&radio, "receiver");
+    return 0;
+}
@@ -0,0 +1,235 @@
+#!/usr/bin/env python3
+"""
+Tobias Mages & Wenqing Yan
+
+Micro-benchmark suite of the hot paths: gives every optimization a baseline and detects regressions.
+
+  1. micro_bench times the kernels of project_pico_libs on the host: generate_sample(), generate_data(),
+     add_header(), pack_frame(), build_frame(), generatePIOprogram() over a grid of configurations and
+     the register calculations of the set_*_rx() functions (see micro_bench.c).
+  2. The log parsing of ../stats/functions.py is timed on the logs in ../stats/logs: readfile() per
+     line and compute_ber() per packet (the reference data is generated before timing).
+  3. --m0plus: instruction counts per call for an Arm Cortex-M0+. micro_bench is compiled with
+     -mcpu=cortex-m0plus -mthumb -mfloat-abi=soft and run in qemu-arm with the instruction counting
+     plugin (libinsn.so), once with 0 and once with N iterations per kernel; the difference is divided
+     by the calls. The counts are independent of the host and its load, but the C library (e.g. log,
+     sqrt, cos of generate_sample()) is the one of the cross toolchain and not the Pico SDK's.
+
+The output is a CSV table (kernel, metric, value, calls, checksum). A previous output can be given as
+--baseline: the ratio to the baseline is added and the script exits with 1 if any kernel is slower than
+allowed. The threshold is --threshold or the 'threshold' column of the baseline (per kernel and metric).
+A different checksum means the kernel computes different results and is reported as a warning.
+
+usage:
+  mkdir build; cd build; cmake ..; make; cd ..
+  python3 benchmarks.py --out baseline.csv
+  python3 benchmarks.py --baseline baseline.csv --threshold 0.1
+  python3 benchmarks.py --m0plus --no-logs --plugin /usr/lib/qemu/plugins/libinsn.so
+"""
+
+import argparse
+import contextlib
+import csv
+import glob
+import io
+import os
+import re
+import statistics
+import subprocess
+import sys
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+DEFAULT_TOOL = os.path.join(HERE, "build", "micro_bench")
+DEFAULT_LOGS = os.path.join(HERE, "..", "stats", "logs", "*.txt")
+DEFAULT_M0PLUS_BUILD = os.path.join(HERE, "build-m0plus")
+M0PLUS_FLAGS = "-mcpu=cortex-m0plus -mthumb -mfloat-abi=soft"
+PLUGIN_PATHS = ["/usr/lib/qemu/plugins/libinsn.so", "/usr/local/lib/qemu/plugins/libinsn.so",
+                "/usr/lib/x86_64-linux-gnu/qemu/plugins/libinsn.so"]
+FIELDS = ["kernel", "metric", "value", "calls", "checksum", "baseline", "ratio", "threshold"]
+
+
+def parse_tags(line):
+    """'#TAG key=value ...' -> dict"""
+    return dict(item.split("=", 1) for item in line.split()[1:])
+
+
+# ----------------- #
+# host: micro_bench #
+# ----------------- #
+
+def run_micro_bench(tool, kernels, min_time_ms, repetitions, payload):
+    cmd = [tool, "-t", str(min_time_ms), "-r", str(repetitions), "-p", str(payload)]
+    for kernel in kernels:
+        cmd += ["-k", kernel]
+    result = subprocess.run(cmd, capture_output=True, text=True)
+    if result.returncode != 0:
+        sys.exit("micro_bench failed: %s" % result.stderr.strip())
+    rows = []
+    for line in result.stdout.splitlines():
+        if line.startswith("#BENCH"):
+            tags = parse_tags(line)
+            rows.append({"kernel": tags["kernel"], "metric": "ns_per_call", "value": float(tags["ns_per_call"]),
+                         "calls": int(tags["calls"]), "checksum": tags["checksum"]})
+    return rows
+
+
+# --------------------------- #
+# host: log parsing (Python)  #
+# --------------------------- #
+
+def time_min(function, repetitions):
+    times = []
+    for _ in range(repetitions):
+        start = time.perf_counter()
+        function()
+        times.append(time.perf_counter() - start)
+    return min(times)
+
+
+def run_log_parsing(pattern, repetitions):
+    files = sorted(glob.glob(pattern))
+    if not files:
+        print("skipping the log parsing: no logs at %s" % pattern, file=sys.stderr)
+        return []
+    sys.path.insert(0, os.path.join(HERE, "..", "stats"))
+    try:
+        import functions
+    except ImportError as error:
+        print("skipping the log parsing: ../stats/functions.py cannot be imported (%s)" % error, file=sys.stderr)
+        return []
+
+    lines = sum(1 for f in files for _ in open(f))
+    frames = [functions.readfile(f) for f in files]
+    packets = sum(len(df) for df in frames)
+    quiet = contextlib.redirect_stdout(io.StringIO())  # compute_ber() prints the number of packets
+    with quiet:
+        ber = [functions.compute_ber(df, PACKET_LEN=None) for df in frames]  # generates the reference data
+
+    def parse():
+        for f in files:
+            functions.readfile(f)
+
+    def compute():
+        with contextlib.redirect_stdout(io.StringIO()):
+            for df in frames:
+                functions.compute_ber(df, PACKET_LEN=None)
+
+    return [
+        {"kernel": "log_readfile", "metric": "ns_per_call", "value": 1e9 * time_min(parse, repetitions) / lines,
+         "calls": lines, "checksum": "%d" % packets},
+        {"kernel": "log_compute_ber", "metric": "ns_per_call", "value": 1e9 * time_min(compute, repetitions) / packets,
+         "calls": packets, "checksum": "%.6f" % statistics.fmean(ber)},
+    ]
+
+
+# ------------------------------------- #
+# Cortex-M0+ instruction-count model    #
+# ------------------------------------- #
+
+def build_m0plus(build_dir, cc):
+    configure = ["cmake", "-S", HERE, "-B", build_dir, "-DCMAKE_SYSTEM_NAME=Linux", "-DCMAKE_SYSTEM_PROCESSOR=arm",
+                 "-DCMAKE_C_COMPILER=%s" % cc, "-DCMAKE_C_FLAGS=%s" % M0PLUS_FLAGS, "-DCMAKE_EXE_LINKER_FLAGS=-static"]
+    for cmd in (configure, ["cmake", "--build", build_dir, "--target", "micro_bench"]):
+        result = subprocess.run(cmd, capture_output=True, text=True)
+        if result.returncode != 0:
+            sys.exit("building micro_bench for the Cortex-M0+ failed:\n%s%s" % (result.stdout, result.stderr))
+    return os.path.join(build_dir, "micro_bench")
+
+
+def count_instructions(qemu, plugin, tool, kernel, iterations, payload):
+    cmd = [qemu, "-plugin", plugin, "-d", "plugin", tool, "-k", kernel, "-i", str(iterations), "-p", str(payload)]
+    result = subprocess.run(cmd, capture_output=True, text=True)
+    counts = re.findall(r"insns:\s*(\d+)", result.stderr + result.stdout)
+    if result.returncode != 0 or not counts:
+        sys.exit("instruction counting failed (%s):\n%s" % (" ".join(cmd), result.stderr.strip()))
+    bench = [parse_tags(line) for line in result.stdout.splitlines() if line.startswith("#BENCH")]
+    return int(counts[-1]), bench[0]
+
+
+def run_m0plus(args, kernels):
+    plugin = args.plugin or next((p for p in PLUGIN_PATHS if os.path.exists(p)), None)
+    if plugin is None:
+        sys.exit("libinsn.so of qemu not found, use --plugin")
+    tool = build_m0plus(args.m0plus_build, args.cc)
+    if not kernels:
+        kernels = subprocess.run([args.qemu, tool, "-l"], capture_output=True, text=True, check=True).stdout.split()
+    rows = []
+    for kernel in kernels:
+        idle, _ = count_instructions(args.qemu, plugin, tool, kernel, 0, args.payload)
+        total, bench = count_instructions(args.qemu, plugin, tool, kernel, args.m0plus_iterations, args.payload)
+        calls = int(bench["calls"])
+        rows.append({"kernel": kernel, "metric": "m0plus_instructions_per_call", "value": (total - idle) / calls,
+                     "calls": calls, "checksum": bench["checksum"]})
+    return rows
+
+
+# ---------- #
+# regression #
+# ---------- #
+
+def compare(rows, baseline_file, default_threshold):
+    """adds baseline/ratio/threshold to the rows, returns the number of regressions"""
+    with open(baseline_file, newline="") as f:
+        baseline = {(r["kernel"], r["metric"]): r for r in csv.DictReader(f)}
+    regressions = 0
+    for row in rows:
+        ref = baseline.get((row["kernel"], row["metric"]))
+        if ref is None:
+            continue
+        threshold = float(ref["threshold"]) if ref.get("threshold") else default_threshold
+        row["baseline"] = float(ref["value"])
+        row["ratio"] = row["value"] / row["baseline"] if row["baseline"] > 0 else float("inf")
+        row["threshold"] = threshold
+        if row["ratio"] > 1.0 + threshold:
+            print("REGRESSION: %s %s %.2f -> %.2f (+%.1f%%, threshold %.1f%%)" % (row["kernel"], row["metric"],
+                  row["baseline"], row["value"], 100 * (row["ratio"] - 1), 100 * threshold), file=sys.stderr)
+            regressions += 1
+        if ref.get("checksum") and ref["checksum"] != row["checksum"]:
+            print("WARNING: %s computes different results than the baseline (checksum %s, baseline %s)" % (
+                  row["kernel"], row["checksum"], ref["checksum"]), file=sys.stderr)
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--kernel", action="append", default=[], help="run only this micro_bench kernel (repeatable)")
+    parser.add_argument("--payload", type=int, default=60, help="payload size [byte]")
+    parser.add_argument("--min-time-ms", type=float, default=50, help="minimal duration of one timed run")
+    parser.add_argument("--repetitions", type=int, default=5, help="timed runs per kernel (the fastest is reported)")
+    parser.add_argument("--tool", default=DEFAULT_TOOL, help="path of micro_bench")
+    parser.add_argument("--logs", default=DEFAULT_LOGS, help="log files for the log parsing (glob)")
+    parser.add_argument("--no-logs", action="store_true", help="skip the log parsing")
+    parser.add_argument("--m0plus", action="store_true", help="add instruction counts of a Cortex-M0+ (qemu-arm)")
+    parser.add_argument("--m0plus-only", action="store_true", help="only the Cortex-M0+ instruction counts")
+    parser.add_argument("--m0plus-iterations", type=int, default=64, help="iterations per kernel in qemu-arm")
+    parser.add_argument("--m0plus-build", default=DEFAULT_M0PLUS_BUILD, help="build directory of the cross build")
+    parser.add_argument("--cc", default="arm-linux-gnueabi-gcc", help="Arm cross compiler (soft-float ABI)")
+    parser.add_argument("--qemu", default="qemu-arm", help="qemu user-mode emulator")
+    parser.add_argument("--plugin", help="path of the qemu plugin libinsn.so")
+    parser.add_argument("--baseline", help="CSV of a previous run to compare with")
+    parser.add_argument("--threshold", type=float, default=0.15, help="allowed relative slowdown against the baseline")
+    parser.add_argument("--out", help="CSV output file (default: stdout)")
+    args = parser.parse_args()
+
+    rows = []
+    if not args.m0plus_only:
+        if not os.path.exists(args.tool):
+            sys.exit("micro_bench not found at %s, build it first (see the usage above)" % args.tool)
+        rows += run_micro_bench(args.tool, args.kernel, args.min_time_ms, args.repetitions, args.payload)
+        if not args.no_logs and not args.kernel:
+            rows += run_log_parsing(args.logs, args.repetitions)
+    if args.m0plus or args.m0plus_only:
+        rows += run_m0plus(args, args.kernel)
+
+    regressions = compare(rows, args.baseline, args.threshold) if args.baseline else 0
+    with (open(args.out, "w", newline="") if args.out else contextlib.nullcontext(sys.stdout)) as out:
+        writer = csv.DictWriter(out, fieldnames=FIELDS, extrasaction="ignore")
+        writer.writeheader()
+        for row in rows:
+            writer.writerow({k: ("%.4g" % v if isinstance(v, float) else v) for k, v in row.items()})
+    sys.exit(1 if regressions else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,203 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * bridge_bench: USB-to-backscatter bridge of carrier-receiver-baseband/main.c (BRIDGE) against the CC2500 model
+ *
+ * The host announces the stream ('#SEND size=') and writes its bytes with host_usb_write() up to the granted credits
+ * (usb_bridge.granted, '#CREDIT' of the firmware), optionally limited to a host rate. Every carrier on-period carries
+ * one frame of the stream: the frame is injected into the CC2500 model 1 ms after the carrier start, lost with the
+ * packet error rate -e (CRC error) and read with readPacket() 3 ms after its end (same timing as send_frame() and
+ * receive_packet() of main.c). All times are virtual.
+ *
+ * usage: bridge_bench [-s <stream size>] [-p <payload>] [-b <baud>] [-e <packet error rate>] [-u <host bytes/s>] [-g <gap ms>] [-i <file>]
+ *   -u: the host writes at most this many bytes per second (0: as fast as the credits allow)
+ *   -i: stream this file instead of random bytes (-s is ignored)
+ *
+ * The data of every delivered frame is compared with the stream at its offset (content_errors).
+ *
+ * Output: '#BRIDGE'/'#BRIDGEDONE key=value ...', '#BRIDGEBENCH key=value ...', the link counters ('#CNT') and the
+ * model statistics ('#CC2500').
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pico/stdlib.h"
+#include "pico/util/queue.h"
+#include "hardware/spi.h"
+#include "receiver_CC2500.h"
+#include "packet_generation.h"
+#include "link_counters.h"
+#include "usb_bridge.h"
+#include "cc2500_model.h"
+
+#define CARRIER_FEQ     2450000000
+#define CENTER_OFFSET      3298611
+#define DEVIATION           173611
+#define RECEIVER              2500
+#define CARRIER_START_US      1000 // send_frame(): wait for the carrier to start
+#define RX_FINISH_US          3000 // send_frame(): wait for the receiver to finish the packet
+#define RX_TIMEOUT_US         2000 // receive_packet()
+#define MAX_STREAM        (1 << 24)
+
+static struct cc2500_model radio;
+static uint8_t *header_tmplate;
+static uint8_t air_offset;   // the CC2500 receives the bytes after the sync word
+static uint8_t air_len;
+static double packet_error_rate;
+static uint32_t baud;
+static uint8_t *stream;
+static uint32_t stream_size;
+static uint32_t written = 0; // bytes written by the host
+static uint32_t host_rate = 0;
+static uint64_t host_start_us;
+
+/* the host: write the stream up to the credits (and the host rate) */
+static void host_write(){
+    uint32_t limit = usb_bridge.granted;
+    if(host_rate > 0){
+        limit = min(limit, (uint32_t) ((time_us_64() - host_start_us) * host_rate / 1000000));
+    }
+    if(limit > written){
+        written += host_usb_write(&stream[written], limit - written);
+    }
+}
+
+/* one carrier on-period with one frame, returns true if a packet has been read (buffer, status) */
+static bool on_period(Frame *frame, uint8_t *buffer, Packet_status *status){
+    uint64_t sync_us = time_us_64() + CARRIER_START_US + (uint64_t) (get_header_len() - 2) * 8 * 1000000 / baud;
+    // a packet error flips a bit of the payload: the receiver fails the CRC
+    uint8_t air[CC2500_MAX_PACKET];
+    memcpy(air, &frame->bytes[air_offset], air_len);
+    if((rand() / (RAND_MAX + 1.0)) < packet_error_rate){
+        air[air_len - CRC_LEN - 1] ^= 0x01;
+    }
+    cc2500_model_inject(&radio, sync_us, air, air_len, -60);
+    link_counters.packets_sent++;
+    sleep_us(CARRIER_START_US + (uint64_t) 4 * frame->len_words * 8 * 1000000 / baud + RX_FINISH_US);
+    absolute_time_t timeout = make_timeout_time_us(RX_TIMEOUT_US);
+    while(!time_reached(timeout)){
+        if(get_event() == rx_deassert_evt){
+            *status = readPacket(buffer);
+            RX_start_listen();
+            return true;
+        }
+        sleep_us(10);
+    }
+    RX_start_listen();
+    return false;
+}
+
+static void usage(const char *name){
+    fprintf(stderr, "usage: %s [-s <stream size>] [-p <payload>] [-b <baud>] [-e <packet error rate>] [-u <host bytes/s>] [-g <gap ms>] [-i <file>]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv){
+    stream_size = 65536;
+    uint8_t payload = 60;
+    uint32_t gap_ms = 1;
+    const char *input = NULL;
+    baud = 200000;
+    packet_error_rate = 0.0;
+    int opt;
+    while((opt = getopt(argc, argv, "s:p:b:e:u:g:i:")) != -1){
+        switch(opt){
+            case 's': stream_size = atoi(optarg); break;
+            case 'p': payload = atoi(optarg); break;
+            case 'b': baud = atoi(optarg); break;
+            case 'e': packet_error_rate = atof(optarg); break;
+            case 'u': host_rate = atoi(optarg); break;
+            case 'g': gap_ms = atoi(optarg); break;
+            case 'i': input = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+    if(!set_payload_size(payload) || packet_error_rate < 0 || packet_error_rate >= 1){
+        usage(argv[0]);
+    }
+    stream = malloc(MAX_STREAM);
+    if(input != NULL){
+        FILE *f = fopen(input, "rb");
+        if(f == NULL){
+            perror(input);
+            return 1;
+        }
+        stream_size = fread(stream, 1, MAX_STREAM, f);
+        fclose(f);
+    }else{
+        srand(2);
+        stream_size = min(stream_size, MAX_STREAM);
+        for(uint32_t i = 0; i < stream_size; i++){
+            stream[i] = rand() & 0xFF;
+        }
+    }
+    stdio_init_all();
+    spi_init(RADIO_SPI, 5 * 1000000); // SPI0 at 5MHz.
+    gpio_init(RX_CSN);
+    gpio_set_dir(RX_CSN, GPIO_OUT);
+    gpio_put(RX_CSN, 1);
+    cc2500_model_init(&radio, RADIO_SPI, RX_CSN, RX_GDO0_PIN);
+
+    setupReceiver();
+    set_frecuency_rx(CARRIER_FEQ + CENTER_OFFSET);
+    set_frequency_deviation_rx(DEVIATION);
+    set_datarate_rx(baud);
+    set_filter_bandwidth_rx(baud + 2*DEVIATION);
+    sleep_ms(1);
+    RX_start_listen();
+    reset_link_counters();
+
+    header_tmplate = packet_hdr_template(RECEIVER);
+    air_offset = get_header_len() - 2;
+    air_len = 2 + get_payload_size() + CRC_LEN;
+    srand(1);
+
+    /* the host announces the stream */
+    char line[32];
+    snprintf(line, sizeof(line), "#SEND size=%u\n", stream_size);
+    host_usb_write((uint8_t *) line, strlen(line));
+    if(!usb_bridge_accept(1000)){
+        return 1;
+    }
+    host_start_us = time_us_64();
+
+    /* loop of bridge_stream() with one frame per on-period */
+    uint8_t buffer[RX_BUFFER_SIZE];
+    Packet_status status;
+    uint8_t seq = 0;
+    uint32_t chunk = get_payload_size() - 2;
+    uint32_t offsets[256];   // stream offset of the frame with this sequence number
+    uint32_t content_errors = 0, max_level = 0;
+    host_write();
+    while(!usb_bridge_done()){
+        if(!source_ready()){
+            usb_bridge_wait(100);
+            host_write();
+            continue;
+        }
+        max_level = max(max_level, source_level());
+        Frame *frame = frame_arena_next();
+        offsets[seq] = 2 * usb_bridge.source.consumed;
+        build_frame(frame, seq, header_tmplate);
+        seq++;
+        if(on_period(frame, buffer, &status)){
+            usb_bridge_packet(buffer, status, &frame, 1);
+            if(!status.overflowed && status.CRCcheck && buffer[0] == 1 + get_payload_size()){
+                uint32_t offset = offsets[buffer[1]];
+                uint32_t len = min(chunk, stream_size - offset);
+                content_errors += memcmp(&buffer[4], &stream[offset], len) != 0;
+            }
+        }
+        host_write();
+        sleep_ms(gap_ms);
+        host_write();
+    }
+    usb_bridge_print(time_us_64());
+    printf("#BRIDGEBENCH per=%.3f host_rate=%u written=%u max_level=%u content_errors=%u\n", packet_error_rate, host_rate, written, max_level, content_errors);
+    print_link_counters(time_us_64());
+    cc2500_model_print_stats(&radio, "receiver");
+    return 0;
+}
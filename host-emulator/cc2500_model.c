@@ -0,0 +1,572 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * behavioral model of the CC2500 SPI interface
+ * see cc2500_model.h, register descriptions: CC2500 datasheet (SWRS040C)
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#include "hardware/spi.h"
+#include "cc2500_model.h"
+
+#define F_XOSC_MODEL    26000000.0
+
+#define REG_IOCFG0      0x02
+#define REG_PKTLEN      0x06
+#define REG_PKTCTRL1    0x07
+#define REG_PKTCTRL0    0x08
+#define REG_CHANNR      0x0A
+#define REG_FSCTRL0     0x0C
+#define REG_FREQ2       0x0D
+#define REG_FREQ1       0x0E
+#define REG_FREQ0       0x0F
+#define REG_MDMCFG4     0x10
+#define REG_MDMCFG3     0x11
+#define REG_MDMCFG1     0x13
+#define REG_MDMCFG0     0x14
+#define REG_DEVIATN     0x15
+#define REG_MCSM1       0x17
+#define REG_MCSM0       0x18
+#define REG_FOCCFG      0x19
+#define REG_FSCAL3      0x23
+#define REG_FSCAL2      0x24
+#define REG_FSCAL1      0x25
+
+#define SRES            0x30
+#define SFSTXON         0x31
+#define SXOFF           0x32
+#define SCAL            0x33
+#define SRX             0x34
+#define STX             0x35
+#define SIDLE           0x36
+#define SPWD            0x39
+#define SFRX            0x3A
+#define SFTX            0x3B
+#define PATABLE         0x3E
+#define FIFO            0x3F
+
+#define GDO0_SYNC_EOP   0x06
+
+// reset values of the configuration registers 0x00-0x2E
+static const uint8_t reset_values[0x2F] = {
+    0x29, 0x2E, 0x3F, 0x07, 0xD3, 0x91, 0xFF, 0x04, 0x45, 0x00, 0x00, 0x0F, 0x00, 0x5E, 0xC4, 0xEC,
+    0x8C, 0x22, 0x02, 0x22, 0xF8, 0x47, 0x07, 0x30, 0x04, 0x36, 0x6C, 0x03, 0x40, 0x91, 0x87, 0x6B,
+    0xF8, 0x56, 0x10, 0xA9, 0x0A, 0x20, 0x0D, 0x41, 0x00, 0x59, 0x7F, 0x3F, 0x88, 0x31, 0x0B,
+};
+
+// MARCSTATE values of the modeled states
+static const uint8_t marcstate[8] = {0x01, 0x0D, 0x13, 0x12, 0x08, 0x0C, 0x11, 0x16};
+
+static struct cc2500_model *models[CC2500_MAX_MODELS];
+static uint8_t model_count = 0;
+
+// ---------------- //
+// helper functions //
+// ---------------- //
+
+static uint64_t us_to_cycles(uint64_t us){
+    return us * (HOST_CLOCK_HZ / 1000000);
+}
+
+static void set_gdo0(struct cc2500_model *m, bool level){
+    m->gdo0 = level;
+    if(m->gdo0_pin >= 0){
+        host_gpio_drive(m->gdo0_pin, level);
+    }
+}
+
+static void flush_rx(struct cc2500_model *m){
+    m->rx_head = 0;
+    m->rx_level = 0;
+    m->rx_overflow = false;
+}
+
+static bool push_rx(struct cc2500_model *m, uint8_t value){
+    if(m->rx_level == CC2500_FIFO_SIZE){
+        m->rx_overflow = true;
+        return false;
+    }
+    m->rx_fifo[(m->rx_head + m->rx_level) % CC2500_FIFO_SIZE] = value;
+    m->rx_level++;
+    return true;
+}
+
+static uint8_t pop_rx(struct cc2500_model *m){
+    if(m->rx_level == 0){
+        return 0; // underflow: undefined on the chip
+    }
+    uint8_t value = m->rx_fifo[m->rx_head];
+    m->rx_head = (m->rx_head + 1) % CC2500_FIFO_SIZE;
+    m->rx_level--;
+    return value;
+}
+
+static uint64_t byte_cycles(struct cc2500_model *m){
+    return (uint64_t) llround(8.0 * HOST_CLOCK_HZ / cc2500_model_datarate(m));
+}
+
+/* calibration result: a deterministic function of the frequency */
+static uint8_t calibration_fscal1(struct cc2500_model *m){
+    return (m->regs[REG_FREQ1] ^ m->regs[REG_FREQ0] ^ m->regs[REG_CHANNR]) & 0x3F;
+}
+
+static void calibrate(struct cc2500_model *m){
+    m->regs[REG_FSCAL3] = (m->regs[REG_FSCAL3] & 0xF0) | 0x0A;
+    m->regs[REG_FSCAL2] = 0x0A;
+    m->regs[REG_FSCAL1] = calibration_fscal1(m);
+    m->stats.calibrations++;
+}
+
+/* the synthesizer only locks if FSCAL3/2/1 hold the calibration of the current frequency */
+static bool calibrated(struct cc2500_model *m){
+    return (m->regs[REG_FSCAL3] & 0x0F) == 0x0A && (m->regs[REG_FSCAL2] & 0x3F) == 0x0A
+        && (m->regs[REG_FSCAL1] & 0x3F) == calibration_fscal1(m);
+}
+
+/* channel filter bandwidth of MDMCFG4 [Hz] */
+static double filter_bandwidth(struct cc2500_model *m){
+    uint8_t chanbw_e = m->regs[REG_MDMCFG4] >> 6;
+    uint8_t chanbw_m = (m->regs[REG_MDMCFG4] >> 4) & 0x03;
+    return F_XOSC_MODEL / (8.0 * (4 + chanbw_m) * (1 << chanbw_e));
+}
+
+/* RSSI register in RX: the noise floor and the power of the interferers within the channel filter */
+static uint8_t rssi_register(struct cc2500_model *m){
+    if(m->receiving){
+        return m->current.rssi;
+    }
+    if(m->state != CC2500_RX || !m->locked || host_cycles < m->rx_ready_cycle){
+        return m->last_rssi; // not updated
+    }
+    double f = cc2500_model_frequency(m);
+    double bw = filter_bandwidth(m);
+    double power_mw = pow(10.0, CC2500_NOISE_FLOOR_DBM / 10.0);
+    for(uint8_t i = 0; i < m->interferer_count; i++){
+        struct cc2500_interferer *in = &m->interferers[i];
+        double overlap = fmin(f + bw/2, in->f_center + in->bandwidth/2) - fmax(f - bw/2, in->f_center - in->bandwidth/2);
+        if(overlap > 0){
+            power_mw += pow(10.0, in->power_dbm / 10.0) * fmin(overlap / in->bandwidth, 1.0);
+        }
+    }
+    double rssi = 2.0 * (10.0 * log10(power_mw) + 70.0); // RSSI_dBm = RSSI_dec/2 - 70
+    return (uint8_t) (int8_t) fmax(fmin(round(rssi), 127), -128);
+}
+
+static void end_reception(struct cc2500_model *m){
+    m->receiving = false;
+    if(m->gdo0){
+        set_gdo0(m, false);
+    }
+}
+
+static void enter_rx(struct cc2500_model *m, uint64_t now){
+    bool autocal = ((m->regs[REG_MCSM0] >> 4) & 0x03) == 1; // calibrate when going from IDLE to RX/TX
+    uint64_t delay = CC2500_SETTLING_US;
+    if(m->state == CC2500_IDLE && autocal){
+        calibrate(m);
+        delay += CC2500_CALIBRATION_US;
+    }
+    m->locked = calibrated(m);
+    m->state = CC2500_RX;
+    m->rx_entry_cycle = now;
+    m->rx_ready_cycle = now + us_to_cycles(delay);
+}
+
+/* after a packet: MCSM1.RXOFF_MODE */
+static void rx_off(struct cc2500_model *m){
+    switch((m->regs[REG_MCSM1] >> 2) & 0x03){
+        case 3: m->state = CC2500_RX; break;      // stay in RX, no calibration
+        case 2: m->state = CC2500_TX; break;
+        case 1: m->state = CC2500_FSTXON; break;
+        default: m->state = CC2500_IDLE; break;
+    }
+}
+
+// --------- //
+// reception //
+// --------- //
+
+/* standard normal sample of a deterministic generator */
+static double gaussian(struct cc2500_model *m){
+    double u[2];
+    for(uint8_t i = 0; i < 2; i++){
+        m->noise_state = m->noise_state * 1664525u + 1013904223u;
+        u[i] = ((m->noise_state >> 8) + 0.5) / (double) (1u << 24);
+    }
+    return sqrt(-2.0 * log(u[0])) * cos(2.0 * M_PI * u[1]);
+}
+
+/* FREQEST of a packet: offset to the synthesizer (incl. FSCTRL0), limited by FOCCFG.FOC_LIMIT,
+ * returns false if the signal (Carson bandwidth) does not fit into the channel filter */
+static bool estimate_offset(struct cc2500_model *m, uint64_t cycle){
+    double step = F_XOSC_MODEL / (1 << 14);
+    double t = (double) cycle / HOST_CLOCK_HZ;
+    double residual = m->offset_hz + m->drift_hz_per_s * t - ((int8_t) m->regs[REG_FSCTRL0]) * step;
+    uint8_t foc_limit = m->regs[REG_FOCCFG] & 0x03;
+    double limit = (foc_limit == 0) ? 0.0 : filter_bandwidth(m) / (double) (16 >> foc_limit);
+    if(fabs(residual) > limit){
+        m->stats.offset_exceeded++;
+    }
+    double estimate = fmax(fmin(residual + m->offset_noise_hz * gaussian(m), limit), -limit);
+    m->freqest = (uint8_t) (int8_t) fmax(fmin(round(estimate / step), 127), -128);
+    double deviation = F_XOSC_MODEL / (1 << 17) * (8 + (m->regs[REG_DEVIATN] & 0x07)) * (1 << ((m->regs[REG_DEVIATN] >> 4) & 0x07));
+    double signal_bw = cc2500_model_datarate(m) + 2 * deviation;
+    return fabs(residual) <= (filter_bandwidth(m) - signal_bw) / 2;
+}
+
+// PKTCTRL0.WHITE_DATA: XOR with the PN9 sequence (x^9 + x^5 + 1, all ones at the first byte after the sync word)
+static void dewhiten(uint8_t *data, uint16_t len){
+    uint16_t key = 0x1FF;
+    for(uint16_t i = 0; i < len; i++){
+        data[i] ^= key & 0xFF;
+        for(uint8_t b = 0; b < 8; b++){
+            key = (key >> 1) | ((((key >> 5) ^ key) & 1) << 8);
+        }
+    }
+}
+
+static uint8_t packet_byte(const struct cc2500_packet *p, uint16_t i){
+    return (i < p->len) ? p->data[i] : 0x00;
+}
+
+// PKTCTRL0.CRC_EN: CRC-16 (x^16 + x^15 + x^2 + 1, all ones initially) over the first len bytes after the sync word
+static uint16_t packet_crc(const struct cc2500_packet *p, uint16_t len){
+    uint16_t crc = 0xFFFF;
+    for(uint16_t i = 0; i < len; i++){
+        uint8_t value = packet_byte(p, i);
+        for(uint8_t b = 0; b < 8; b++){
+            bool feedback = ((value >> (7 - b)) ^ (crc >> 15)) & 1;
+            crc = (crc << 1) ^ (feedback ? 0x8005 : 0x0000);
+        }
+    }
+    return crc;
+}
+
+static void start_reception(struct cc2500_model *m, struct cc2500_packet *p){
+    m->current = *p;
+    m->receiving = true;
+    m->current_bytes = 0;
+    p = &m->current;
+    if(m->regs[REG_PKTCTRL0] & 0x40){
+        dewhiten(p->data, p->len);
+    }
+    if((m->regs[REG_PKTCTRL0] & 0x03) == 0){
+        m->current_expected = m->regs[REG_PKTLEN];            // fixed length
+    }else{
+        m->current_expected = 1 + (uint16_t) p->data[0];       // variable length: length byte + payload
+    }
+    uint16_t crc = ((uint16_t) packet_byte(p, m->current_expected) << 8) | packet_byte(p, m->current_expected + 1);
+    p->crc_ok = (m->regs[REG_PKTCTRL0] & 0x04) && packet_crc(p, m->current_expected) == crc;
+    p->lqi = p->crc_ok ? 5 : 60;
+    if(m->regs[REG_IOCFG0] == GDO0_SYNC_EOP){
+        set_gdo0(m, true);
+    }
+}
+
+/* write the bytes that arrived until now into the FIFO, finish the packet if complete */
+static void continue_reception(struct cc2500_model *m, uint64_t now){
+    struct cc2500_packet *p = &m->current;
+    uint64_t bt = byte_cycles(m);
+    bool variable = (m->regs[REG_PKTCTRL0] & 0x03) != 0;
+    uint64_t arrived = (now - p->sync_cycle) / bt;
+    while(m->receiving && m->current_bytes < m->current_expected && m->current_bytes < arrived){
+        uint8_t value = packet_byte(p, m->current_bytes);
+        if(m->current_bytes == 0 && variable && value > m->regs[REG_PKTLEN]){
+            m->stats.length_discarded++;        // the packet is discarded, the radio keeps listening
+            end_reception(m);
+            return;
+        }
+        if(!push_rx(m, value)){
+            m->stats.overflows++;
+            m->state = CC2500_RXFIFO_OVERFLOW;
+            end_reception(m);
+            return;
+        }
+        m->current_bytes++;
+    }
+    // end of packet after the two CRC bytes
+    if(m->receiving && arrived >= (uint64_t) m->current_expected + 2){
+        m->last_rssi = p->rssi;
+        m->last_lqi = (p->crc_ok ? 0x80 : 0x00) | (p->lqi & 0x7F);
+        if(m->regs[REG_PKTCTRL1] & 0x04){       // APPEND_STATUS
+            if(!push_rx(m, m->last_rssi) || !push_rx(m, m->last_lqi)){
+                m->stats.overflows++;
+                m->state = CC2500_RXFIFO_OVERFLOW;
+                end_reception(m);
+                return;
+            }
+        }
+        m->stats.received++;
+        end_reception(m);
+        rx_off(m);
+    }
+}
+
+static uint64_t reception_end(struct cc2500_model *m){
+    return m->current.sync_cycle + ((uint64_t) m->current_expected + 2) * byte_cycles(m);
+}
+
+void cc2500_model_update(struct cc2500_model *m){
+    uint64_t now = host_cycles;
+    while(true){
+        if(m->receiving){
+            continue_reception(m, now);
+        }
+        if(m->pending_count == 0){
+            return;
+        }
+        struct cc2500_packet *p = &m->pending[m->pending_head];
+        if(p->sync_cycle > now){
+            return;
+        }
+        if(m->receiving && p->sync_cycle < reception_end(m)){
+            m->stats.missed_busy++;
+        }else if(m->receiving){
+            return; // the current packet ends first (continue_reception catches up with now)
+        }else if(m->state == CC2500_RX && p->sync_cycle >= m->rx_ready_cycle && m->locked){
+            if(estimate_offset(m, p->sync_cycle)){
+                start_reception(m, p);
+            }else{
+                m->stats.missed_offset++;
+            }
+        }else if(m->state == CC2500_RX && p->sync_cycle >= m->rx_ready_cycle){
+            m->stats.missed_unlocked++;
+        }else{
+            m->stats.missed_not_listening++;
+        }
+        m->pending_head = (m->pending_head + 1) % CC2500_MAX_PENDING;
+        m->pending_count--;
+    }
+}
+
+static void update_all(){
+    for(uint8_t i = 0; i < model_count; i++){
+        cc2500_model_update(models[i]);
+    }
+}
+
+// ------------ //
+// SPI access   //
+// ------------ //
+
+static void strobe(struct cc2500_model *m, uint8_t cmd){
+    uint64_t now = host_cycles;
+    switch(cmd){
+        case SRES:
+            memcpy(m->regs, reset_values, sizeof(m->regs));
+            memset(m->patable, 0, sizeof(m->patable));
+            m->patable[0] = 0xC6;
+            m->state = CC2500_IDLE;
+            flush_rx(m);
+            m->tx_level = 0;
+            if(m->receiving){
+                end_reception(m);
+            }
+            break;
+        case SFSTXON:
+            m->state = CC2500_FSTXON;
+            break;
+        case SCAL:
+            if(m->state == CC2500_IDLE){
+                calibrate(m);
+            }
+            break;
+        case SRX:
+            if(m->state == CC2500_IDLE || m->state == CC2500_FSTXON || m->state == CC2500_TX){
+                enter_rx(m, now);
+            }
+            break;
+        case STX:
+            if(m->state == CC2500_IDLE || m->state == CC2500_FSTXON || m->state == CC2500_RX){
+                if(m->receiving){
+                    m->stats.aborted++;
+                    end_reception(m);
+                }
+                m->state = CC2500_TX;
+            }
+            break;
+        case SIDLE:
+        case SXOFF:
+        case SPWD:
+            if(m->receiving){
+                m->stats.aborted++;
+                end_reception(m);
+            }
+            m->state = CC2500_IDLE;
+            break;
+        case SFRX:
+            if(m->state == CC2500_IDLE || m->state == CC2500_RXFIFO_OVERFLOW){
+                flush_rx(m);
+                m->state = CC2500_IDLE;
+            }
+            break;
+        case SFTX:
+            if(m->state == CC2500_IDLE || m->state == CC2500_TXFIFO_UNDERFLOW){
+                m->tx_level = 0;
+                m->state = CC2500_IDLE;
+            }
+            break;
+        default: // SWOR, SAFC, SWORRST, SNOP
+            break;
+    }
+}
+
+static uint8_t read_status_register(struct cc2500_model *m, uint8_t address){
+    switch(address){
+        case 0x30: return 0x80;                                        // PARTNUM
+        case 0x31: return 0x03;                                        // VERSION
+        case 0x32: return m->freqest;                                  // FREQEST
+        case 0x33: return m->last_lqi;                                 // LQI
+        case 0x34: return rssi_register(m);                            // RSSI
+        case 0x35: return marcstate[m->state];                         // MARCSTATE
+        case 0x38: return (m->last_lqi & 0x80) | (m->receiving ? 0x08 : 0x00) | (m->gdo0 ? 0x01 : 0x00); // PKTSTATUS
+        case 0x39: return 0x94;                                        // VCO_VC_DAC
+        case 0x3A: return m->tx_level;                                 // TXBYTES
+        case 0x3B: return (m->rx_overflow ? 0x80 : 0x00) | m->rx_level; // RXBYTES
+        default:   return 0x00;
+    }
+}
+
+static uint8_t chip_status(struct cc2500_model *m, bool read){
+    uint8_t fifo = read ? m->rx_level : (CC2500_FIFO_SIZE - m->tx_level);
+    return (m->state << 4) | (fifo > 15 ? 15 : fifo);
+}
+
+static uint8_t transfer(void *ctx, uint8_t mosi){
+    struct cc2500_model *m = ctx;
+    cc2500_model_update(m);
+    if(!m->in_access){
+        // header byte: R/W, burst, address
+        m->read = mosi & 0x80;
+        m->burst = mosi & 0x40;
+        m->address = mosi & 0x3F;
+        uint8_t status = chip_status(m, m->read);
+        if(m->address >= 0x30 && m->address <= 0x3D && !(m->read && m->burst)){
+            strobe(m, m->address); // command strobe, no data byte
+        }else{
+            m->in_access = true;
+        }
+        return status;
+    }
+    // data byte
+    uint8_t miso = chip_status(m, m->read);
+    if(m->address < 0x2F){
+        if(m->read){
+            miso = m->regs[m->address];
+        }else{
+            m->regs[m->address] = mosi;
+        }
+        if(m->burst){
+            m->address++;
+        }
+    }else if(m->address == PATABLE){
+        if(m->read){
+            miso = m->patable[m->patable_index];
+        }else{
+            m->patable[m->patable_index] = mosi;
+        }
+        m->patable_index = (m->patable_index + 1) % 8;
+    }else if(m->address == FIFO){
+        if(m->read){
+            miso = pop_rx(m);
+        }else if(m->tx_level < CC2500_FIFO_SIZE){
+            m->tx_level++;
+        }
+    }else if(m->address >= 0x30){
+        miso = read_status_register(m, m->address);
+    }
+    if(!m->burst || (m->address >= 0x30 && m->address <= 0x3D)){
+        m->in_access = false; // single access: the next byte is a header
+    }
+    return miso;
+}
+
+static void chip_select(void *ctx, bool level){
+    struct cc2500_model *m = ctx;
+    if(level){ // de-asserted: the access ends, the PATABLE index is reset
+        m->in_access = false;
+        m->patable_index = 0;
+    }
+}
+
+// ---------- //
+// interface  //
+// ---------- //
+
+bool cc2500_model_init(struct cc2500_model *m, spi_inst_t *spi, uint cs_pin, int gdo0_pin){
+    if(model_count == CC2500_MAX_MODELS){
+        printf("ERROR: too many CC2500 models.\n");
+        return false;
+    }
+    memset(m, 0, sizeof(*m));
+    m->cs_pin = cs_pin;
+    m->gdo0_pin = gdo0_pin;
+    strobe(m, SRES);
+    if(!host_spi_attach(spi, cs_pin, transfer, m) || !host_gpio_listen(cs_pin, chip_select, m)){
+        return false;
+    }
+    models[model_count] = m;
+    model_count++;
+    host_register_advance(update_all);
+    return true;
+}
+
+bool cc2500_model_inject(struct cc2500_model *m, uint64_t sync_us, const uint8_t *data, uint16_t len, int16_t rssi){
+    if(m->pending_count == CC2500_MAX_PENDING){
+        return false;
+    }
+    struct cc2500_packet *p = &m->pending[(m->pending_head + m->pending_count) % CC2500_MAX_PENDING];
+    p->sync_cycle = us_to_cycles(sync_us);
+    p->len = (len > CC2500_MAX_PACKET) ? CC2500_MAX_PACKET : len;
+    memcpy(p->data, data, p->len);
+    p->rssi = (uint8_t) (int8_t) ((rssi + 70) * 2); // RSSI_dBm = RSSI_dec/2 - 70
+    m->pending_count++;
+    m->stats.injected++;
+    return true;
+}
+
+bool cc2500_model_add_interferer(struct cc2500_model *m, double f_center, double bandwidth, double power_dbm){
+    if(m->interferer_count == CC2500_MAX_INTERFERERS || bandwidth <= 0){
+        return false;
+    }
+    m->interferers[m->interferer_count++] = (struct cc2500_interferer){.f_center = f_center, .bandwidth = bandwidth, .power_dbm = power_dbm};
+    return true;
+}
+
+double cc2500_model_frequency(struct cc2500_model *m){
+    uint32_t freq = ((uint32_t) m->regs[REG_FREQ2] << 16) | ((uint32_t) m->regs[REG_FREQ1] << 8) | m->regs[REG_FREQ0];
+    double spacing = F_XOSC_MODEL / (1 << 18) * (256 + m->regs[REG_MDMCFG0]) * (1 << (m->regs[REG_MDMCFG1] & 0x03));
+    return F_XOSC_MODEL / (1 << 16) * freq + m->regs[REG_CHANNR] * spacing;
+}
+
+void cc2500_model_set_offset(struct cc2500_model *m, double offset_hz, double drift_hz_per_s, double noise_hz){
+    m->offset_hz = offset_hz;
+    m->drift_hz_per_s = drift_hz_per_s;
+    m->offset_noise_hz = noise_hz;
+    m->noise_state = 1;
+}
+
+double cc2500_model_offset(struct cc2500_model *m){
+    return m->offset_hz + m->drift_hz_per_s * host_cycles / (double) HOST_CLOCK_HZ;
+}
+
+uint16_t cc2500_model_pending(struct cc2500_model *m){
+    return m->pending_count + (m->receiving ? 1 : 0);
+}
+
+double cc2500_model_datarate(struct cc2500_model *m){
+    uint8_t drate_e = m->regs[REG_MDMCFG4] & 0x0F;
+    uint8_t drate_m = m->regs[REG_MDMCFG3];
+    return (256.0 + drate_m) * ((double) (1 << drate_e)) * F_XOSC_MODEL / ((double) (1 << 28));
+}
+
+void cc2500_model_print_stats(struct cc2500_model *m, const char *name){
+    printf("#CC2500 %s injected=%u received=%u missed_not_listening=%u missed_busy=%u missed_unlocked=%u overflows=%u aborted=%u length_discarded=%u calibrations=%u offset_exceeded=%u missed_offset=%u\n",
+        name, m->stats.injected, m->stats.received, m->stats.missed_not_listening, m->stats.missed_busy, m->stats.missed_unlocked,
+        m->stats.overflows, m->stats.aborted, m->stats.length_discarded, m->stats.calibrations, m->stats.offset_exceeded, m->stats.missed_offset);
+}
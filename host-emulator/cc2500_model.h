@@ -0,0 +1,158 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * behavioral model of the CC2500 SPI interface
+ *
+ * The model is attached to the host SPI (chip select) and GDO0 and covers:
+ *  - command strobes and the state transitions IDLE/RX/TX/FSTXON/RXFIFO_OVERFLOW,
+ *    incl. calibration and settling time when entering RX (MCSM0.FS_AUTOCAL) and MCSM1.RXOFF_MODE,
+ *  - the calibration result in FSCAL3/2/1 (SCAL or FS_AUTOCAL): without a calibration the values written
+ *    to FSCAL3/2/1 have to match the frequency, otherwise the synthesizer does not lock (fast hopping),
+ *  - single and burst access of the configuration registers and the PATABLE,
+ *  - the status registers (burst read of 0x30-0x3D) and the chip status byte,
+ *  - FREQEST of every packet: carrier offset (with drift and noise) relative to the synthesizer incl. the
+ *    compensation in FSCTRL0, limited to the FOC range of FOCCFG.FOC_LIMIT; a packet is lost if the
+ *    offset shifts its Carson bandwidth (data rate + 2 * deviation) out of the channel filter,
+ *  - the RSSI register in RX: noise floor and interferers (flat spectrum) within the channel filter at the
+ *    frequency of FREQ2..0, CHANNR and the channel spacing,
+ *  - the 64 byte RX FIFO with overflow, the appended status bytes (RSSI, LQI/CRC_OK), CRC_OK is computed from
+ *    the two CRC bytes after the packet (PKTCTRL0.CRC_EN, CRC-16 of the datasheet) such that bit errors fail it,
+ *  - data whitening (PKTCTRL0.WHITE_DATA): the bytes after the sync word are de-whitened with the PN9 sequence,
+ *  - GDO0 with IOCFG0 = 0x06: asserts when the sync word has been received, de-asserts at the end
+ *    of the packet, when the RX FIFO overflows or the reception is aborted.
+ * Packets are injected with the time at which their sync word ends. The bytes arrive at the data
+ * rate configured in MDMCFG4/MDMCFG3, a packet is lost if the radio is not listening at that time.
+ * Timing of the datasheet is approximated, radio effects (noise, sync word errors) are not modeled.
+ *
+ */
+
+#ifndef CC2500_MODEL
+#define CC2500_MODEL
+
+#include "pico/stdlib.h"
+#include "hardware/spi.h"
+
+#define CC2500_FIFO_SIZE            64
+#define CC2500_MAX_PACKET          256 // length byte + 255 byte
+#define CC2500_MAX_PENDING         256 // injected packets not yet received
+#define CC2500_MAX_MODELS            4
+#define CC2500_CALIBRATION_US      721 // IDLE -> RX with calibration (FS_AUTOCAL = 1)
+#define CC2500_SETTLING_US          89 // IDLE -> RX without calibration
+#define CC2500_MAX_INTERFERERS       8
+#define CC2500_NOISE_FLOOR_DBM    -100.0
+
+enum cc2500_state {
+    CC2500_IDLE              = 0,
+    CC2500_RX                = 1,
+    CC2500_TX                = 2,
+    CC2500_FSTXON            = 3,
+    CC2500_CALIBRATE         = 4,
+    CC2500_SETTLING          = 5,
+    CC2500_RXFIFO_OVERFLOW   = 6,
+    CC2500_TXFIFO_UNDERFLOW  = 7,
+};
+
+struct cc2500_packet {
+    uint64_t sync_cycle;                 // end of the sync word [virtual clock cycles]
+    uint8_t  data[CC2500_MAX_PACKET];    // bytes after the sync word as sent: length byte, payload, CRC
+    uint16_t len;
+    uint8_t  rssi;                       // RSSI register value
+    uint8_t  lqi;                        // LQI (7 bit)
+    bool     crc_ok;                     // computed when the reception starts
+};
+
+struct cc2500_interferer {
+    double f_center;                     // [Hz]
+    double bandwidth;                    // [Hz], the power is spread evenly
+    double power_dbm;
+};
+
+struct cc2500_stats {
+    uint32_t injected;
+    uint32_t received;                   // complete packets written to the RX FIFO
+    uint32_t missed_not_listening;       // not in RX (or still calibrating/settling) at the sync word
+    uint32_t missed_busy;                // sync word during the reception of another packet
+    uint32_t overflows;                  // RX FIFO overflows
+    uint32_t aborted;                    // receptions aborted by a strobe
+    uint32_t length_discarded;           // length byte larger than PKTLEN
+    uint32_t missed_unlocked;            // in RX, but FSCAL3/2/1 do not match the frequency
+    uint32_t calibrations;               // SCAL and FS_AUTOCAL
+    uint32_t offset_exceeded;            // packets whose offset exceeds the FOC range
+    uint32_t missed_offset;              // packets shifted out of the channel filter
+};
+
+struct cc2500_model {
+    uint8_t  regs[0x2F];
+    uint8_t  patable[8];
+    uint8_t  patable_index;
+    enum cc2500_state state;
+    uint64_t rx_entry_cycle;             // last transition into RX (SRX)
+    uint64_t rx_ready_cycle;             // end of calibration and settling
+    bool     locked;                     // synthesizer calibrated for the frequency when entering RX
+    uint8_t  freqest;                    // FREQEST status register
+    double   offset_hz;                  // carrier offset of the packets at time 0
+    double   drift_hz_per_s;
+    double   offset_noise_hz;            // standard deviation of FREQEST
+    uint32_t noise_state;
+    // FIFOs
+    uint8_t  rx_fifo[CC2500_FIFO_SIZE];
+    uint8_t  rx_head, rx_level;
+    bool     rx_overflow;
+    uint8_t  tx_level;
+    // SPI access
+    bool     in_access;                  // header received, data bytes follow
+    bool     read, burst;
+    uint8_t  address;
+    // reception
+    struct cc2500_packet pending[CC2500_MAX_PENDING];
+    uint16_t pending_head, pending_count;
+    bool     receiving;
+    struct cc2500_packet current;
+    uint16_t current_bytes;              // bytes of the current packet written to the FIFO
+    uint16_t current_expected;           // bytes of the current packet to be written to the FIFO
+    uint8_t  last_rssi, last_lqi;
+    struct cc2500_interferer interferers[CC2500_MAX_INTERFERERS];
+    uint8_t  interferer_count;
+    // pins
+    uint     cs_pin;
+    int      gdo0_pin;                   // -1: not connected
+    bool     gdo0;
+    struct cc2500_stats stats;
+};
+
+/* reset the model and attach it to spi (chip select cs_pin) and gdo0_pin (-1: not connected) */
+bool cc2500_model_init(struct cc2500_model *m, spi_inst_t *spi, uint cs_pin, int gdo0_pin);
+
+/*
+ * inject a packet which is received by the model
+ * sync_us: end of the sync word [us since boot], non-decreasing between calls
+ * data/len: bytes after the sync word as sent (length byte + payload + CRC), corrupted bytes fail the CRC
+ * rssi: [dBm]
+ * returns false if too many packets are pending
+ */
+bool cc2500_model_inject(struct cc2500_model *m, uint64_t sync_us, const uint8_t *data, uint16_t len, int16_t rssi);
+
+/* add a source of interference seen by the RSSI register, returns false if there are too many */
+bool cc2500_model_add_interferer(struct cc2500_model *m, double f_center, double bandwidth, double power_dbm);
+
+/* frequency offset of the received packets: offset_hz + drift_hz_per_s * t, FREQEST has a noise of noise_hz (std) */
+void cc2500_model_set_offset(struct cc2500_model *m, double offset_hz, double drift_hz_per_s, double noise_hz);
+
+/* current carrier offset of the packets [Hz] */
+double cc2500_model_offset(struct cc2500_model *m);
+
+/* frequency of FREQ2..0, CHANNR and MDMCFG1/MDMCFG0 [Hz] */
+double cc2500_model_frequency(struct cc2500_model *m);
+
+/* number of injected packets whose sync word is still in the future or which are being received */
+uint16_t cc2500_model_pending(struct cc2500_model *m);
+
+/* data rate configured in MDMCFG4/MDMCFG3 [baud] */
+double cc2500_model_datarate(struct cc2500_model *m);
+
+/* process all events up to the current time (called automatically when time advances or on SPI access) */
+void cc2500_model_update(struct cc2500_model *m);
+
+void cc2500_model_print_stats(struct cc2500_model *m, const char *name);
+
+#endif
@@ -0,0 +1,368 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * config_planner: enumerate and rank every feasible (CLOCK_DIV0, CLOCK_DIV1, DESIRED_BAUD) setting
+ *
+ * For the antenna mode (-a), the sideband (-s) and continuous phase (-c), every divider pair d0 > d1 of the range
+ * -d (even dividers unless -c) is combined with every baud-rate of the range -b which backscatter_program_init()
+ * can use: round(CLKFREQ / k) for k clock cycles per symbol. The state-machine shifts a symbol every
+ * CLKFREQ / baud cycles (rounded down), the receiver is configured with the baud-rate. A setting is feasible if
+ *  - the baud-rate is within the limits of the receiver (-r 2500: CC2500, 1352: CC1352),
+ *  - the deviation is within the limits of the receiver (380 kHz, 1 MHz),
+ *  - the modulation index 2 * deviation / baud is at least -m (default 0.5) and the CC2500 can set the deviation
+ *    (DEVIATN of at least 1587 Hz),
+ *  - the CC2500 channel filter covers the signal (baud + 2 * deviation up to 812.5 kHz),
+ *  - the data rate of the CC2500 registers (calc_datarate_rx()) differs from the symbol rate of the state-machine
+ *    by at most -q and the deviation of the registers (calc_frequency_deviation_rx()) by at most -Q,
+ *  - generatePIOprogram() fits the program into the instruction memory.
+ * The CC1352 is configured with SmartRF Studio: its filter and registers are not checked.
+ * The cheap checks come first, the settings are distributed over -j threads. The feasible settings are ranked by
+ * -k: rate (bit rate, then spectral occupancy), occupancy (occupancy, then bit rate) or efficiency (bit rate per
+ * occupied Hz). The occupancy is the Carson bandwidth (baud + 2 * deviation), twice with both sidebands.
+ *
+ * usage: config_planner [-a <antennas>] [-s both|upper|lower] [-c] [-r 2500|1352] [-b <min>:<max baud>] [-d <min>:<max divider>]
+ *                       [-m <min index>] [-q <rate error>] [-Q <deviation error>] [-k rate|occupancy|efficiency] [-n <top>] [-o <csv>]
+ *                       [-j <threads>]
+ *
+ * Output: the best -n settings as '#PLAN key=value ...' (and as CSV with -o), '#PLANNER key=value ...' with the number
+ * of settings rejected by every check. Every thread only keeps its best -n settings, which are merged at the end.
+ *
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "backscatter.h"
+#include "receiver_CC2500.h"
+
+#define CLOCK_HZ           ((uint32_t) CLKFREQ * 1000000)
+#define CC2500_MIN_BAUD      1200
+#define CC2500_MAX_BAUD    500000
+#define CC2500_MIN_DEV       1587 // DEVIATN_E = 0, DEVIATN_M = 0
+#define CC2500_MAX_DEV     380000
+#define CC2500_MAX_BW      812500
+#define CC1352_MIN_BAUD     20000
+#define CC1352_MAX_BAUD   1000000
+#define CC1352_MAX_DEV    1000000
+
+struct plan {
+    uint16_t d0, d1;
+    uint32_t baud;             // DESIRED_BAUD (achievable, used for the receiver)
+    uint32_t cycles;           // per symbol of the state-machine
+    uint32_t center_offset, deviation, rx_bw, filter_bw, occupancy;
+    uint8_t  instructions;
+    float    rate_error, dev_error;
+};
+
+enum reject { REJECT_RATE, REJECT_DEVIATION, REJECT_INDEX, REJECT_BANDWIDTH, REJECT_QUANTIZATION, REJECT_PROGRAM, REJECTS };
+static const char *reject_names[REJECTS] = {"rate", "deviation", "index", "bandwidth", "quantization", "program"};
+
+struct worker {
+    pthread_t thread;
+    struct plan *best;         // max-heap of the best -n plans, the worst one at the root
+    uint32_t kept, feasible;
+    uint64_t rejected[REJECTS];
+    uint64_t combinations;
+};
+
+static bool two_antennas = true;
+static bool both_sidebands = true;
+static bool cc2500 = true;
+static uint32_t min_baud, max_baud, max_dev;
+static uint16_t min_div = 4, max_div = 128, div_step = 2;
+static double min_index = 0.5, max_rate_error = 0.01, max_dev_error = 0.1;
+static uint32_t k_first, k_last;    // cycles per symbol
+static atomic_uint k_next;
+static uint32_t top = 20;           // plans kept per worker
+
+static void reject(struct worker *w, enum reject r){
+    w->rejected[r]++;
+}
+
+static enum {RANK_RATE, RANK_OCCUPANCY, RANK_EFFICIENCY} rank = RANK_RATE;
+
+static double bit_rate(const struct plan *p){
+    return ((double) CLOCK_HZ) / p->cycles;
+}
+
+static int compare_plans(const void *a, const void *b){
+    const struct plan *x = a, *y = b;
+    double rx = bit_rate(x), ry = bit_rate(y);
+    double keys[2][2] = {{-rx, x->occupancy}, {-ry, y->occupancy}};
+    if(rank == RANK_OCCUPANCY){
+        keys[0][0] = x->occupancy; keys[0][1] = -rx;
+        keys[1][0] = y->occupancy; keys[1][1] = -ry;
+    }else if(rank == RANK_EFFICIENCY){
+        keys[0][0] = -rx / x->occupancy; keys[0][1] = -rx;
+        keys[1][0] = -ry / y->occupancy; keys[1][1] = -ry;
+    }
+    for(uint8_t i = 0; i < 2; i++){
+        if(keys[0][i] != keys[1][i]){
+            return (keys[0][i] < keys[1][i]) ? -1 : 1;
+        }
+    }
+    if(x->instructions != y->instructions){
+        return (x->instructions < y->instructions) ? -1 : 1;
+    }
+    return (x->d0 != y->d0) ? x->d0 - y->d0 : x->d1 - y->d1;
+}
+
+// keep a feasible plan if it is among the best -n plans of the worker (bounded max-heap)
+static void keep(struct worker *w, const struct plan *p){
+    w->feasible++;
+    uint32_t i;
+    if(w->kept < top){
+        // sift up from the new leaf
+        for(i = w->kept++; i > 0 && compare_plans(&w->best[(i - 1) / 2], p) < 0; i = (i - 1) / 2){
+            w->best[i] = w->best[(i - 1) / 2];
+        }
+    }else if(top > 0 && compare_plans(p, &w->best[0]) < 0){
+        // replace the worst plan, sift down from the root
+        i = 0;
+        for(uint32_t c = 1; c < top; c = 2 * i + 1){
+            if(c + 1 < top && compare_plans(&w->best[c + 1], &w->best[c]) > 0){
+                c++;
+            }
+            if(compare_plans(&w->best[c], p) <= 0){
+                break;
+            }
+            w->best[i] = w->best[c];
+            i = c;
+        }
+    }else{
+        return;
+    }
+    w->best[i] = *p;
+}
+
+static double relative(double value, double reference){
+    return ((value > reference) ? value - reference : reference - value) / reference;
+}
+
+// all divider pairs at one baud-rate
+static void plan_baud(struct worker *w, uint32_t baud){
+    uint32_t cycles = CLOCK_HZ / baud;
+    double symbol_rate = ((double) CLOCK_HZ) / cycles;
+    uint8_t e, m;
+    float rate_error = cc2500 ? relative(calc_datarate_rx(baud, &e, &m), symbol_rate) : 0;
+    uint16_t buffer[PIO_MAX_INSTRUCTIONS];
+    struct pio_program program;
+    struct backscatter_layout layout = {0};
+    for(uint32_t d0 = min_div + div_step; d0 <= max_div; d0 += div_step){
+        // the deviation grows with d0 - d1 (unless continuous phase): d1 descends until it exceeds the limit
+        for(uint32_t d1 = d0 - div_step; d1 >= min_div; d1 -= div_step){
+            w->combinations++;
+            if(baud < min_baud || baud > max_baud){
+                reject(w, REJECT_RATE);
+                continue;
+            }
+            bool generated = false;
+            if(get_continuous_phase()){
+                // the subcarriers depend on the program
+                if(!generatePIOprogram(d0, d1, baud, buffer, &program, two_antennas, &layout)){
+                    reject(w, REJECT_PROGRAM);
+                    continue;
+                }
+                generated = true;
+            }
+            struct backscatter_config config;
+            backscatter_compute_config(d0, d1, baud, &layout, &config);
+            if(config.deviation > max_dev){
+                reject(w, REJECT_DEVIATION);
+                if(!get_continuous_phase()){
+                    uint32_t smaller = (d1 - min_div) / div_step; // pairs with a larger deviation
+                    w->combinations += smaller;
+                    w->rejected[REJECT_DEVIATION] += smaller;
+                    break;
+                }
+                continue;
+            }
+            if(2.0 * config.deviation < min_index * baud || (cc2500 && config.deviation < CC2500_MIN_DEV)){
+                reject(w, REJECT_INDEX);
+                continue;
+            }
+            struct plan p = {.d0 = d0, .d1 = d1, .baud = baud, .cycles = cycles, .center_offset = config.center_offset,
+                .deviation = config.deviation, .rx_bw = config.minRxBw, .filter_bw = config.minRxBw,
+                .occupancy = (both_sidebands ? 2 : 1) * config.minRxBw, .rate_error = rate_error};
+            if(cc2500){
+                if(config.minRxBw > CC2500_MAX_BW){
+                    reject(w, REJECT_BANDWIDTH);
+                    continue;
+                }
+                p.filter_bw = calc_filter_bandwidth_rx(config.minRxBw, &e, &m);
+                p.dev_error = relative(calc_frequency_deviation_rx(config.deviation, &e, &m), config.deviation);
+                if(rate_error > max_rate_error || p.dev_error > max_dev_error){
+                    reject(w, REJECT_QUANTIZATION);
+                    continue;
+                }
+            }
+            if(!generated && !generatePIOprogram(d0, d1, baud, buffer, &program, two_antennas, &layout)){
+                reject(w, REJECT_PROGRAM);
+                continue;
+            }
+            p.instructions = program.length;
+            keep(w, &p);
+        }
+    }
+}
+
+static void *work(void *arg){
+    struct worker *w = arg;
+    uint32_t k;
+    while((k = atomic_fetch_add(&k_next, 1)) <= k_last){
+        // the baud-rate of k cycles as returned by backscatter_achievable_baud()
+        plan_baud(w, backscatter_achievable_baud((CLOCK_HZ + k/2) / k));
+    }
+    return NULL;
+}
+
+static bool parse_range(const char *arg, uint32_t *low, uint32_t *high){
+    return sscanf(arg, "%" SCNu32 ":%" SCNu32, low, high) == 2 && *low > 0 && *low <= *high;
+}
+
+static void usage(const char *name){
+    fprintf(stderr, "usage: %s [-a <antennas>] [-s both|upper|lower] [-c] [-r 2500|1352] [-b <min>:<max baud>] [-d <min>:<max divider>]\n"
+                    "       [-m <min index>] [-q <rate error>] [-Q <deviation error>] [-k rate|occupancy|efficiency] [-n <top>] [-o <csv>] [-j <threads>]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv){
+    enum backscatter_sideband sideband = SIDEBAND_BOTH;
+    bool continuous = false;
+    uint32_t receiver = 2500;
+    uint32_t baud_range[2] = {0, 0}, div_range[2] = {4, 128};
+    const char *csv = NULL;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    while((opt = getopt(argc, argv, "a:s:cr:b:d:m:q:Q:k:n:o:j:")) != -1){
+        switch(opt){
+            case 'a': two_antennas = atoi(optarg) == 2; break;
+            case 's':
+                if(!strcmp(optarg, "both")) sideband = SIDEBAND_BOTH;
+                else if(!strcmp(optarg, "upper")) sideband = SIDEBAND_UPPER;
+                else if(!strcmp(optarg, "lower")) sideband = SIDEBAND_LOWER;
+                else usage(argv[0]);
+                break;
+            case 'c': continuous = true; break;
+            case 'r': receiver = atoi(optarg); break;
+            case 'b': if(!parse_range(optarg, &baud_range[0], &baud_range[1])) usage(argv[0]); break;
+            case 'd': if(!parse_range(optarg, &div_range[0], &div_range[1])) usage(argv[0]); break;
+            case 'm': min_index = atof(optarg); break;
+            case 'q': max_rate_error = atof(optarg); break;
+            case 'Q': max_dev_error = atof(optarg); break;
+            case 'k':
+                if(!strcmp(optarg, "rate")) rank = RANK_RATE;
+                else if(!strcmp(optarg, "occupancy")) rank = RANK_OCCUPANCY;
+                else if(!strcmp(optarg, "efficiency")) rank = RANK_EFFICIENCY;
+                else usage(argv[0]);
+                break;
+            case 'n': top = atoi(optarg); break;
+            case 'o': csv = optarg; break;
+            case 'j': threads = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if((receiver != 2500 && receiver != 1352) || threads < 1 || div_range[1] > 0xFFFF || (sideband != SIDEBAND_BOTH && (!two_antennas || continuous))){
+        usage(argv[0]);
+    }
+    cc2500 = receiver == 2500;
+    min_baud = cc2500 ? CC2500_MIN_BAUD : CC1352_MIN_BAUD;
+    max_baud = cc2500 ? CC2500_MAX_BAUD : CC1352_MAX_BAUD;
+    max_dev  = cc2500 ? CC2500_MAX_DEV : CC1352_MAX_DEV;
+    if(baud_range[0] == 0){
+        baud_range[0] = max(min_baud, 20000);
+        baud_range[1] = max_baud;
+    }
+    min_div = max(div_range[0], 4);
+    max_div = div_range[1];
+    div_step = continuous ? 1 : 2;
+    if(!continuous && min_div % 2){
+        min_div++;
+    }
+    both_sidebands = sideband == SIDEBAND_BOTH;
+    set_sideband(sideband);
+    set_continuous_phase(continuous);
+    k_first = CLOCK_HZ / baud_range[1];
+    k_last = CLOCK_HZ / baud_range[0];
+    atomic_store(&k_next, k_first);
+
+    /* enumerate in parallel, the error messages of generatePIOprogram() are discarded */
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    struct worker *workers = calloc(threads, sizeof(struct worker));
+    for(long t = 0; t < threads; t++){
+        workers[t].best = malloc(max(top, 1) * sizeof(struct plan));
+        pthread_create(&workers[t].thread, NULL, work, &workers[t]);
+    }
+    uint64_t combinations = 0, rejected[REJECTS] = {0};
+    uint32_t feasible = 0;
+    for(long t = 0; t < threads; t++){
+        pthread_join(workers[t].thread, NULL);
+        combinations += workers[t].combinations;
+        feasible += workers[t].feasible;
+        for(uint8_t r = 0; r < REJECTS; r++){
+            rejected[r] += workers[t].rejected[r];
+        }
+    }
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(devnull);
+    close(saved_stdout);
+
+    /* rank: merge the best plans of all workers */
+    struct plan *plans = malloc(max(threads * top, 1) * sizeof(struct plan));
+    uint32_t n = 0;
+    for(long t = 0; t < threads; t++){
+        memcpy(&plans[n], workers[t].best, workers[t].kept * sizeof(struct plan));
+        n += workers[t].kept;
+        free(workers[t].best);
+    }
+    qsort(plans, n, sizeof(struct plan), compare_plans);
+    n = min(n, top);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double elapsed_ms = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+
+    for(uint32_t i = 0; i < n; i++){
+        struct plan *p = &plans[i];
+        printf("#PLAN rank=%" PRIu32 " d0=%u d1=%u baud=%" PRIu32 " bit_rate=%.0f center_offset=%" PRIu32 " deviation=%" PRIu32 " rx_bw=%" PRIu32 " filter_bw=%" PRIu32 " occupancy=%" PRIu32 " instructions=%u rate_error=%.4f dev_error=%.4f\n",
+            i + 1, p->d0, p->d1, p->baud, bit_rate(p), p->center_offset, p->deviation, p->rx_bw, p->filter_bw, p->occupancy,
+            p->instructions, p->rate_error, p->dev_error);
+    }
+    printf("#PLANNER receiver=%" PRIu32 " antennas=%d sideband=%s continuous=%d bauds=%" PRIu32 " dividers=%u:%u combinations=%" PRIu64 " feasible=%" PRIu32,
+        receiver, two_antennas ? 2 : 1, both_sidebands ? "both" : (sideband == SIDEBAND_UPPER ? "upper" : "lower"), continuous,
+        k_last - k_first + 1, min_div, max_div, combinations, feasible);
+    for(uint8_t r = 0; r < REJECTS; r++){
+        printf(" %s=%" PRIu64, reject_names[r], rejected[r]);
+    }
+    printf(" threads=%ld time_ms=%.0f\n", threads, elapsed_ms);
+
+    if(csv != NULL){
+        FILE *f = fopen(csv, "w");
+        if(f == NULL){
+            perror(csv);
+            return 1;
+        }
+        fprintf(f, "rank,d0,d1,baud,bit_rate,center_offset,deviation,rx_bw,filter_bw,occupancy,instructions,rate_error,dev_error\n");
+        for(uint32_t i = 0; i < n; i++){
+            struct plan *p = &plans[i];
+            fprintf(f, "%" PRIu32 ",%u,%u,%" PRIu32 ",%.0f,%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%u,%.5f,%.5f\n", i + 1, p->d0, p->d1, p->baud, bit_rate(p), p->center_offset,
+                p->deviation, p->rx_bw, p->filter_bw, p->occupancy, p->instructions, p->rate_error, p->dev_error);
+        }
+        fclose(f);
+    }
+    free(plans);
+    free(workers);
+    return 0;
+}
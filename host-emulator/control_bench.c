@@ -0,0 +1,545 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * control_bench: binary USB control protocol (usb_control.c) in the main loop of carrier-receiver-baseband/main.c
+ * (CONTROL) against the CC2500 models
+ *
+ * The firmware loop sends one frame per carrier on-period while a run is active (injected into the receiver model
+ * 1 ms after the carrier start and read once the TX interval is over, lost with the packet error rate -e) and
+ * executes the commands while it waits (usb_control_sleep_ms()). The settings are applied as by apply_param() of
+ * main.c, except that the generated state-machine is not loaded: the tag is replaced by the injection.
+ *
+ * Without -P, a host script runs against the firmware: it sets payload, baud and TX interval, checks the rejection
+ * of invalid values, parameters, commands and a corrupted frame, starts a run of -n packets, pings and polls the
+ * status at random times (0 to -g ms apart) until the run is done and fetches the counters. The latency of every
+ * command is the virtual time from the last byte of the request to the response (without the USB transfers).
+ *
+ * With -P, the firmware runs in real time on a pseudo-terminal (its name is printed to stderr) for -t seconds: the
+ * commands come from the terminal (e.g. pico_control.py of carrier-receiver-baseband), the text output and the
+ * responses go to it.
+ *
+ * usage: control_bench [-n <packets>] [-p <payload>] [-b <baud>] [-i <TX interval ms>] [-e <packet error rate>] [-g <host gap ms>] [-P] [-t <seconds>]
+ *
+ * Output: '#RUN' of the firmware, '#CONTROLBENCH key=value ...', the link counters ('#CNT') and the model
+ * statistics ('#CC2500').
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include "pico/stdlib.h"
+#include "pico/stdio_usb.h"
+#include "hardware/spi.h"
+#include "backscatter.h"
+#include "receiver_CC2500.h"
+#include "carrier_CC2500.h"
+#include "packet_generation.h"
+#include "link_counters.h"
+#include "link_quality.h"
+#include "usb_control.h"
+#include "cc2500_model.h"
+
+#define CARRIER_FEQ     2450000000
+#define CLOCK_DIV0              40
+#define CLOCK_DIV1              36
+#define RECEIVER              2500
+#define TWOANTENNAS           true
+#define CARRIER_START_US      1000 // send_frame(): wait for the carrier to start
+#define RX_FINISH_US          3000 // send_frame(): wait for the receiver to finish the packet
+#define MAX_COMMANDS        100000
+
+static struct cc2500_model carrier, radio;
+static struct backscatter_config backscatter_conf;
+static uint8_t *header_tmplate;
+static uint32_t carrier_feq = CARRIER_FEQ;
+static uint32_t tx_interval_ms = 250;
+static double packet_error_rate = 0.0;
+
+// ------------------------------------- //
+// firmware: apply_param() of main.c     //
+// ------------------------------------- //
+
+static void tune_receiver(){
+    set_frecuency_rx(carrier_feq + backscatter_conf.center_offset);
+    set_frequency_deviation_rx(backscatter_conf.deviation);
+    set_datarate_rx(backscatter_conf.baudrate);
+    set_filter_bandwidth_rx(backscatter_conf.minRxBw);
+}
+
+static bool configure_tag(uint16_t d0, uint16_t d1, uint32_t baud){
+    uint16_t instructions[32];
+    struct pio_program program;
+    struct backscatter_layout layout;
+    if(!generatePIOprogram(d0, d1, baud, instructions, &program, TWOANTENNAS, &layout)){
+        return false;
+    }
+    backscatter_compute_config(d0, d1, baud, &layout, &backscatter_conf);
+    return true;
+}
+
+static bool apply_param(uint8_t param, uint32_t *value){
+    uint32_t *params = usb_control.params;
+    switch(param){
+        case PARAM_CARRIER_FREQ:
+        case PARAM_CLOCK_DIV0:
+        case PARAM_CLOCK_DIV1:
+        case PARAM_BAUD: {
+            uint16_t d0 = (param == PARAM_CLOCK_DIV0) ? *value : params[PARAM_CLOCK_DIV0];
+            uint16_t d1 = (param == PARAM_CLOCK_DIV1) ? *value : params[PARAM_CLOCK_DIV1];
+            uint32_t baud = backscatter_achievable_baud((param == PARAM_BAUD) ? *value : params[PARAM_BAUD]);
+            if(param != PARAM_CARRIER_FREQ && !configure_tag(d0, d1, baud)){
+                return false;
+            }
+            RX_stop_listen();
+            if(param == PARAM_CARRIER_FREQ){
+                carrier_feq = *value;
+                set_frecuency_tx(carrier_feq);
+            }
+            if(param == PARAM_BAUD){
+                *value = baud;
+            }
+            tune_receiver();
+            RX_start_listen();
+            return true;
+        }
+        case PARAM_PAYLOAD_SIZE:
+            return set_payload_size(*value);
+        case PARAM_TX_INTERVAL_MS:
+            tx_interval_ms = *value;
+            return true;
+        case PARAM_RECEIVER:
+            header_tmplate = packet_hdr_template(*value);
+            return true;
+        case PARAM_POWER_LEVEL:
+            set_power_level_tx(*value);
+            return true;
+        case PARAM_PREAMBLE_LEN:
+        case PARAM_SYNC_LEN: {
+            uint8_t preamble_len = (param == PARAM_PREAMBLE_LEN) ? *value : params[PARAM_PREAMBLE_LEN];
+            uint8_t sync_len = (param == PARAM_SYNC_LEN) ? *value : params[PARAM_SYNC_LEN];
+            if(!set_framing(preamble_len, sync_len)){
+                return false;
+            }
+            RX_stop_listen();
+            set_sync_mode_rx(8*sync_len);
+            RX_start_listen();
+            return true;
+        }
+        case PARAM_WHITENING:
+            RX_stop_listen();
+            set_whitening(*value);
+            set_whitening_rx(*value);
+            RX_start_listen();
+            return true;
+    }
+    return false;
+}
+
+/* send_frame() of main.c: the frame is injected into the receiver model instead of being backscattered */
+static void send_frame(Frame *frame){
+    uint32_t baud = backscatter_conf.baudrate;
+    startCarrier();
+    uint64_t sync_us = time_us_64() + CARRIER_START_US + (uint64_t) (get_header_len() - 2) * 8 * 1000000 / baud;
+    // a packet error flips a bit of the payload: the receiver fails the CRC
+    uint8_t air[CC2500_MAX_PACKET];
+    uint8_t air_len = 2 + get_payload_size() + CRC_LEN;
+    memcpy(air, &frame->bytes[get_header_len() - 2], air_len);
+    if((rand() / (RAND_MAX + 1.0)) < packet_error_rate){
+        air[air_len - CRC_LEN - 1] ^= 0x01;
+    }
+    cc2500_model_inject(&radio, sync_us, air, air_len, -60);
+    link_counters.packets_sent++;
+    sleep_us(CARRIER_START_US + (uint64_t) 4 * frame->len_words * 8 * 1000000 / baud + backscatter_word_duration_us(baud) + RX_FINISH_US);
+    stopCarrier();
+}
+
+// ------------------------------------- //
+// host script                           //
+// ------------------------------------- //
+
+enum host_phase { SETUP, RUN, FINISH, DONE };
+
+struct host_step {
+    uint8_t command;
+    uint8_t payload[8];
+    uint8_t len;
+    bool    corrupt;          // wrong CRC
+    uint8_t expect;           // status
+};
+
+static struct {
+    enum host_phase phase;
+    uint8_t step;
+    uint32_t packets;         // of the run
+    uint32_t gap_ms;
+    uint64_t due_us;          // next request
+    bool     waiting;
+    uint8_t  tag;
+    uint8_t  command;
+    uint8_t  expect;
+    uint64_t request_us;      // last byte of the request written
+    uint8_t  response[CONTROL_MAX_PAYLOAD + 5];
+    uint8_t  received;
+    uint32_t latencies[MAX_COMMANDS];
+    uint32_t commands, failed;
+    uint32_t counters[9];     // CONTROL_COUNTERS: link counters
+    uint32_t baud;            // applied
+} host;
+
+static struct host_step setup_steps[16];
+static uint8_t setup_count = 0;
+
+static void add_step(uint8_t command, uint8_t param, bool with_value, uint32_t value, bool corrupt, uint8_t expect){
+    struct host_step *s = &setup_steps[setup_count++];
+    memset(s, 0, sizeof(*s));
+    s->command = command;
+    s->corrupt = corrupt;
+    s->expect = expect;
+    if(command == CONTROL_GET || command == CONTROL_SET){
+        s->payload[s->len++] = param;
+    }
+    if(with_value){
+        for(uint8_t i = 0; i < 4; i++){
+            s->payload[s->len++] = (value >> (8 * i)) & 0xFF;
+        }
+    }
+}
+
+static uint8_t crc8(const uint8_t *data, uint8_t len){
+    uint8_t crc = 0;
+    for(uint8_t i = 0; i < len; i++){
+        crc ^= data[i];
+        for(uint8_t b = 0; b < 8; b++){
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static uint32_t u32(const uint8_t *data){
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24);
+}
+
+static void request(const struct host_step *s){
+    uint8_t frame[CONTROL_MAX_PAYLOAD + 5];
+    frame[0] = CONTROL_SYNC;
+    frame[1] = s->command;
+    frame[2] = ++host.tag;
+    frame[3] = s->len;
+    memcpy(&frame[4], s->payload, s->len);
+    frame[4 + s->len] = crc8(&frame[1], 3 + s->len) ^ (s->corrupt ? 0x5A : 0);
+    host_usb_write(frame, 5 + s->len);
+    host.command = s->command;
+    host.expect = s->expect;
+    host.request_us = time_us_64();
+    host.waiting = true;
+}
+
+static void check(bool ok, const char *what){
+    if(!ok){
+        host.failed++;
+        printf("WARNING: check failed: %s (tag %u)\n", what, host.tag);
+    }
+}
+
+static void schedule_next(){
+    host.due_us = time_us_64() + (host.gap_ms ? (uint64_t) (rand() % (1000 * host.gap_ms)) : 0);
+}
+
+/* a complete response of the firmware */
+static void response(const uint8_t *r){
+    uint8_t len = r[3];
+    const uint8_t *p = &r[5];
+    check(crc8(&r[1], 3 + len) == r[4 + len], "response CRC");
+    check(r[2] == host.tag && r[1] == (host.command | CONTROL_RESPONSE), "tag and command");
+    check(r[4] == host.expect, "status");
+    if(host.commands < MAX_COMMANDS){
+        host.latencies[host.commands] = time_us_64() - host.request_us;
+    }
+    host.commands++;
+    host.waiting = false;
+    switch(host.command){
+        case CONTROL_GET_ALL:
+            check(p[0] == CONTROL_PARAMS, "parameter count");
+        break;
+        case CONTROL_SET:
+            if(r[4] == CONTROL_OK && p[0] == PARAM_BAUD){
+                host.baud = u32(&p[1]);
+            }
+        break;
+        case CONTROL_STATUS:
+            if(host.phase == RUN && !p[0]){
+                check(u32(&p[1]) == host.packets, "packets of the run");
+                host.phase = FINISH;
+                host.step = 0;
+            }
+        break;
+        case CONTROL_COUNTERS:
+            for(uint8_t i = 0; i < 9; i++){
+                host.counters[i] = u32(&p[4 * i]);
+            }
+            check(host.counters[0] == host.packets, "packets sent since START");
+        break;
+    }
+    schedule_next();
+}
+
+// collect the raw output of usb_control.c at the time it is written
+static void capture_out(const char *buf, int len){
+    for(int i = 0; i < len; i++){
+        uint8_t byte = buf[i];
+        if(host.received == 0 && byte != CONTROL_SYNC){
+            continue;
+        }
+        host.response[host.received++] = byte;
+        if(host.received >= 5 && host.received == 5 + host.response[3]){
+            host.received = 0;
+            response(host.response);
+        }
+    }
+}
+
+/* the host: the next request once the last one has been answered and the gap is over */
+static void host_advance(){
+    if(host.waiting || host.phase == DONE || time_us_64() < host.due_us){
+        return;
+    }
+    struct host_step s = {0};
+    switch(host.phase){
+        case SETUP:
+            s = setup_steps[host.step++];
+            if(host.step == setup_count){
+                host.phase = RUN;
+            }
+        break;
+        case RUN:
+            // alternate PING (8 bytes) and STATUS until the run is done
+            if(host.commands % 2 == 0){
+                s.command = CONTROL_PING;
+                s.len = 8;
+            }else{
+                s.command = CONTROL_STATUS;
+            }
+        break;
+        case FINISH:
+            s.command = (host.step++ == 0) ? CONTROL_COUNTERS : CONTROL_STOP;
+            if(host.step == 2){
+                host.phase = DONE;
+            }
+        break;
+        case DONE:
+        break;
+    }
+    request(&s);
+}
+
+// ------------------------------------- //
+// pseudo-terminal                       //
+// ------------------------------------- //
+
+static int pty_master = -1;
+static uint64_t real_start_us, virtual_start_us;
+static uint8_t pty_pending[256];
+static uint32_t pty_pending_len = 0;
+
+static uint64_t real_us(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+/* keep the virtual time at the real time and pass the bytes of the terminal to getchar_timeout_us() */
+static void pty_advance(){
+    uint64_t virtual_us = time_us_64() - virtual_start_us;
+    uint64_t elapsed_us = real_us() - real_start_us;
+    if(virtual_us > elapsed_us){
+        usleep(virtual_us - elapsed_us);
+    }
+    struct pollfd p = {.fd = pty_master, .events = POLLIN};
+    if(pty_pending_len == 0 && poll(&p, 1, 0) > 0 && (p.revents & POLLIN)){
+        ssize_t n = read(pty_master, pty_pending, sizeof(pty_pending));
+        pty_pending_len = (n > 0) ? n : 0;
+    }
+    if(pty_pending_len > 0){
+        uint32_t accepted = host_usb_write(pty_pending, pty_pending_len);
+        memmove(pty_pending, &pty_pending[accepted], pty_pending_len - accepted);
+        pty_pending_len -= accepted;
+    }
+}
+
+static bool open_pty(){
+    pty_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if(pty_master < 0 || grantpt(pty_master) != 0 || unlockpt(pty_master) != 0){
+        perror("posix_openpt");
+        return false;
+    }
+    const char *name = ptsname(pty_master);
+    int slave = open(name, O_RDWR | O_NOCTTY); // kept open: the master stays valid without a client
+    struct termios t;
+    tcgetattr(slave, &t);
+    cfmakeraw(&t);
+    tcsetattr(slave, TCSANOW, &t);
+    fprintf(stderr, "#CONTROLBENCH pty=%s\n", name);
+    fflush(stdout);
+    dup2(pty_master, STDOUT_FILENO);
+    return true;
+}
+
+static void usage(const char *name){
+    fprintf(stderr, "usage: %s [-n <packets>] [-p <payload>] [-b <baud>] [-i <TX interval ms>] [-e <packet error rate>] [-g <host gap ms>] [-P] [-t <seconds>]\n", name);
+    exit(1);
+}
+
+static int compare_u32(const void *a, const void *b){
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv){
+    uint32_t packets = 500;
+    uint8_t payload = 20;
+    uint32_t baud = 100000;
+    uint32_t interval_ms = 20;
+    uint32_t seconds = 300;
+    bool pty = false;
+    host.gap_ms = 20;
+    int opt;
+    while((opt = getopt(argc, argv, "n:p:b:i:e:g:Pt:")) != -1){
+        switch(opt){
+            case 'n': packets = atoi(optarg); break;
+            case 'p': payload = atoi(optarg); break;
+            case 'b': baud = atoi(optarg); break;
+            case 'i': interval_ms = atoi(optarg); break;
+            case 'e': packet_error_rate = atof(optarg); break;
+            case 'g': host.gap_ms = atoi(optarg); break;
+            case 'P': pty = true; break;
+            case 't': seconds = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if(packets == 0 || packet_error_rate < 0 || packet_error_rate >= 1){
+        usage(argv[0]);
+    }
+    stdio_init_all();
+    spi_init(RADIO_SPI, 5 * 1000000);
+    gpio_init(RX_CSN);
+    gpio_set_dir(RX_CSN, GPIO_OUT);
+    gpio_put(RX_CSN, 1);
+    gpio_init(CARRIER_CSN);
+    gpio_set_dir(CARRIER_CSN, GPIO_OUT);
+    gpio_put(CARRIER_CSN, 1);
+    cc2500_model_init(&carrier, RADIO_SPI, CARRIER_CSN, -1);
+    cc2500_model_init(&radio, RADIO_SPI, RX_CSN, RX_GDO0_PIN);
+
+    /* setup of main.c with the #defines */
+    set_payload_size(4);
+    header_tmplate = packet_hdr_template(RECEIVER);
+    setupCarrier();
+    set_frecuency_tx(carrier_feq);
+    setupReceiver();
+    configure_tag(CLOCK_DIV0, CLOCK_DIV1, backscatter_achievable_baud(200000));
+    tune_receiver();
+    set_sync_mode_rx(8*4);
+    sleep_ms(1);
+    RX_start_listen();
+    const uint32_t params[CONTROL_PARAMS] = {
+        [PARAM_CARRIER_FREQ] = carrier_feq,
+        [PARAM_CLOCK_DIV0] = CLOCK_DIV0,
+        [PARAM_CLOCK_DIV1] = CLOCK_DIV1,
+        [PARAM_BAUD] = backscatter_achievable_baud(200000),
+        [PARAM_PAYLOAD_SIZE] = 4,
+        [PARAM_TX_INTERVAL_MS] = tx_interval_ms,
+        [PARAM_RECEIVER] = RECEIVER,
+        [PARAM_POWER_LEVEL] = power_level_tx(),
+        [PARAM_PREAMBLE_LEN] = 4,
+        [PARAM_SYNC_LEN] = 4,
+        [PARAM_WHITENING] = 0,
+    };
+    usb_control_init(params, apply_param, false);
+    reset_link_counters();
+    reset_link_quality(time_us_64());
+
+    if(pty){
+        if(!open_pty()){
+            return 1;
+        }
+        real_start_us = real_us();
+        virtual_start_us = time_us_64();
+        host_register_advance(pty_advance);
+    }else{
+        add_step(CONTROL_GET_ALL, 0, false, 0, false, CONTROL_OK);
+        add_step(CONTROL_SET, PARAM_PAYLOAD_SIZE, true, payload, false, CONTROL_OK);
+        add_step(CONTROL_SET, PARAM_BAUD, true, baud, false, CONTROL_OK);
+        add_step(CONTROL_SET, PARAM_TX_INTERVAL_MS, true, interval_ms, false, CONTROL_OK);
+        add_step(CONTROL_SET, PARAM_PAYLOAD_SIZE, true, MAX_PAYLOADSIZE + 1, false, CONTROL_ERR_VALUE);
+        add_step(CONTROL_SET, PARAM_CLOCK_DIV0, true, 0xFFFF, false, CONTROL_ERR_VALUE);
+        add_step(CONTROL_GET, CONTROL_PARAMS, false, 0, false, CONTROL_ERR_PARAM);
+        add_step(CONTROL_PING, 0, false, 0, true, CONTROL_ERR_CRC);
+        add_step(0x7F, 0, false, 0, false, CONTROL_ERR_COMMAND);
+        add_step(CONTROL_START, 0, true, packets, false, CONTROL_OK);
+        host.packets = packets;
+        srand(3);
+        host_usb_capture(true);
+        stdio_usb.out_chars = capture_out;
+        host_register_advance(host_advance);
+    }
+
+    /* loop of main.c with CONTROL (one frame per on-period) */
+    uint8_t rx_buffer[RX_BUFFER_SIZE];
+    uint8_t seq = 0;
+    bool rx_ready = true;
+    uint64_t end_us = time_us_64() + 1000000ull * seconds;
+    while(host.phase != DONE && time_us_64() < end_us){
+        switch(get_event()){
+            case rx_assert_evt:
+                rx_ready = false;
+            break;
+            case rx_deassert_evt: {
+                uint64_t time_us = time_us_64();
+                Packet_status status = readPacket(rx_buffer);
+                analyze_packet(rx_buffer, status, get_payload_size());
+                if(pty){
+                    printPacket(rx_buffer, status, time_us);
+                }
+                RX_start_listen();
+                rx_ready = true;
+            }
+            break;
+            case no_evt:
+                if(rx_ready && usb_control_may_send()){
+                    Frame *frame = frame_arena_next();
+                    build_frame(frame, seq, header_tmplate);
+                    send_frame(frame);
+                    seq++;
+                    usb_control_sent(time_us_64());
+                }
+                usb_control_sleep_ms(tx_interval_ms);
+            break;
+        }
+        usb_control_sleep_ms(1);
+    }
+    if(pty){
+        return 0;
+    }
+
+    uint32_t n = min(host.commands, MAX_COMMANDS);
+    uint64_t sum = 0;
+    for(uint32_t i = 0; i < n; i++){
+        sum += host.latencies[i];
+    }
+    qsort(host.latencies, n, sizeof(uint32_t), compare_u32);
+    printf("#CONTROLBENCH commands=%u failed=%u errors=%u latency_mean_us=%.0f latency_p50_us=%u latency_p99_us=%u latency_max_us=%u interval_ms=%u payload=%u baud=%u sent=%u received=%u crc=%u\n",
+        host.commands, host.failed, usb_control.errors, n ? (double) sum / n : 0.0, n ? host.latencies[n / 2] : 0,
+        n ? host.latencies[(uint32_t) (0.99 * (n - 1))] : 0, n ? host.latencies[n - 1] : 0, interval_ms, get_payload_size(),
+        host.baud, host.counters[0], host.counters[4], host.counters[5]);
+    print_link_counters(time_us_64());
+    cc2500_model_print_stats(&radio, "receiver");
+    return host.failed > 0 || host.phase != DONE;
+}
@@ -0,0 +1,110 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * virtual clock of the host emulator
+ * see include/pico/stdlib.h
+ *
+ */
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+
+#define MAX_TICKS          4
+#define LOOP_CYCLES        8 // cycles of one iteration of a busy-wait loop
+
+uint64_t host_cycles = 0;
+static void (*ticks[MAX_TICKS])(void);
+static uint8_t tick_count = 0;
+static void (*advances[MAX_TICKS])(void);
+static uint8_t advance_count = 0;
+static bool advancing = false;
+
+static bool add_hook(void (**hooks)(void), uint8_t *count, void (*hook)(void)){
+    for(uint8_t i = 0; i < *count; i++){
+        if(hooks[i] == hook){
+            return true;
+        }
+    }
+    if(*count == MAX_TICKS){
+        printf("ERROR: too many peripheral models registered.\n");
+        return false;
+    }
+    hooks[*count] = hook;
+    (*count)++;
+    return true;
+}
+
+bool host_register_tick(void (*tick)(void)){
+    return add_hook(ticks, &tick_count, tick);
+}
+
+bool host_register_advance(void (*advance)(void)){
+    return add_hook(advances, &advance_count, advance);
+}
+
+void host_advance_cycles(uint64_t cycles){
+    if(tick_count == 0){
+        host_cycles += cycles; // nothing to simulate cycle by cycle
+    }else{
+        for(uint64_t c = 0; c < cycles; c++){
+            host_cycles++;
+            for(uint8_t i = 0; i < tick_count; i++){
+                ticks[i]();
+            }
+        }
+    }
+    // event-driven models catch up (they may call GPIO IRQ callbacks, which may consume time again)
+    if(!advancing){
+        advancing = true;
+        for(uint8_t i = 0; i < advance_count; i++){
+            advances[i]();
+        }
+        advancing = false;
+    }
+}
+
+bool stdio_init_all(){
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    return true;
+}
+
+/* the host build has no USB console, the character commands are never received */
+absolute_time_t get_absolute_time(){
+    return host_cycles / (HOST_CLOCK_HZ / 1000000);
+}
+
+uint32_t time_us_32(){
+    return (uint32_t) get_absolute_time();
+}
+
+uint64_t time_us_64(){
+    return get_absolute_time();
+}
+
+absolute_time_t make_timeout_time_us(uint64_t us){
+    return get_absolute_time() + us;
+}
+
+absolute_time_t make_timeout_time_ms(uint32_t ms){
+    return get_absolute_time() + 1000 * ((uint64_t) ms);
+}
+
+bool time_reached(absolute_time_t t){
+    return get_absolute_time() >= t;
+}
+
+void sleep_us(uint64_t us){
+    host_advance_cycles(us * (HOST_CLOCK_HZ / 1000000));
+}
+
+void sleep_ms(uint32_t ms){
+    sleep_us(1000 * ((uint64_t) ms));
+}
+
+void busy_wait_us(uint64_t us){
+    sleep_us(us);
+}
+
+void tight_loop_contents(){
+    host_advance_cycles(LOOP_CYCLES);
+}
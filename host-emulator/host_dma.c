@@ -0,0 +1,116 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * DMA of the host emulator: memory to the TX FIFO of a PIO state-machine
+ * see include/hardware/dma.h
+ *
+ */
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+
+struct host_dma {
+    bool claimed;
+    dma_channel_config config;
+    const uint32_t *read_addr;
+    uint32_t transfer_count;
+};
+
+static struct host_dma channels[NUM_DMA_CHANNELS];
+
+// called for every cycle: every busy channel writes one word if its FIFO has space
+static void dma_tick(){
+    for(uint i = 0; i < NUM_DMA_CHANNELS; i++){
+        struct host_dma *d = &channels[i];
+        if(d->transfer_count == 0){
+            continue;
+        }
+        PIO pio = (d->config.dreq & 0x08) ? pio1 : pio0;
+        uint sm = d->config.dreq & 0x03;
+        if(pio_sm_is_tx_fifo_full(pio, sm)){
+            continue;
+        }
+        pio_sm_put(pio, sm, *d->read_addr);
+        if(d->config.read_increment){
+            d->read_addr++;
+        }
+        d->transfer_count--;
+    }
+}
+
+static void start(uint channel){
+    struct host_dma *d = &channels[channel];
+    if(d->config.size != DMA_SIZE_32 || d->config.write_increment || d->config.dreq >= 16 || (d->config.dreq & 0x04)){
+        printf("ERROR: the host DMA only transfers 32-bit words into a PIO TX FIFO.\n");
+        d->transfer_count = 0;
+        return;
+    }
+    host_register_tick(dma_tick);
+}
+
+int dma_claim_unused_channel(bool required){
+    for(uint i = 0; i < NUM_DMA_CHANNELS; i++){
+        if(!channels[i].claimed){
+            channels[i].claimed = true;
+            return i;
+        }
+    }
+    if(required){
+        printf("ERROR: no DMA channel left.\n");
+    }
+    return -1;
+}
+
+void dma_channel_unclaim(uint channel){
+    channels[channel].claimed = false;
+    channels[channel].transfer_count = 0;
+}
+
+dma_channel_config dma_channel_get_default_config(uint channel){
+    (void) channel;
+    return (dma_channel_config){.size = DMA_SIZE_32, .read_increment = true, .write_increment = false, .dreq = 0x3F};
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size){
+    c->size = size;
+}
+
+void channel_config_set_read_increment(dma_channel_config *c, bool incr){
+    c->read_increment = incr;
+}
+
+void channel_config_set_write_increment(dma_channel_config *c, bool incr){
+    c->write_increment = incr;
+}
+
+void channel_config_set_dreq(dma_channel_config *c, uint dreq){
+    c->dreq = dreq;
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr, const volatile void *read_addr, uint transfer_count, bool trigger){
+    (void) write_addr;
+    struct host_dma *d = &channels[channel];
+    d->config = *config;
+    d->read_addr = (const uint32_t *) read_addr;
+    d->transfer_count = trigger ? transfer_count : 0;
+    if(trigger){
+        start(channel);
+    }
+}
+
+void dma_channel_transfer_from_buffer_now(uint channel, const volatile void *read_addr, uint32_t transfer_count){
+    struct host_dma *d = &channels[channel];
+    d->read_addr = (const uint32_t *) read_addr;
+    d->transfer_count = transfer_count;
+    start(channel);
+}
+
+bool dma_channel_is_busy(uint channel){
+    return channels[channel].transfer_count > 0;
+}
+
+void dma_channel_abort(uint channel){
+    channels[channel].transfer_count = 0;
+}
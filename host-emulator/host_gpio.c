@@ -0,0 +1,91 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * GPIOs of the host emulator
+ * see include/hardware/gpio.h
+ *
+ */
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+
+struct host_gpio {
+    bool level;
+    bool out;
+    uint32_t irq_events;
+    void (*listener)(void *ctx, bool level);
+    void *ctx;
+};
+
+static struct host_gpio gpios[NUM_BANK0_GPIOS];
+static gpio_irq_callback_t irq_callback = NULL;
+
+void gpio_init(uint gpio){
+    gpios[gpio].out = false;
+    gpios[gpio].level = false;
+}
+
+void gpio_set_dir(uint gpio, bool out){
+    gpios[gpio].out = out;
+}
+
+void gpio_set_function(uint gpio, enum gpio_function fn){
+    (void) gpio;
+    (void) fn;
+}
+
+void gpio_put(uint gpio, bool value){
+    bool changed = (gpios[gpio].level != value);
+    gpios[gpio].level = value;
+    if(changed && gpios[gpio].listener != NULL){
+        gpios[gpio].listener(gpios[gpio].ctx, value);
+    }
+}
+
+bool gpio_get(uint gpio){
+    return gpios[gpio].level;
+}
+
+void gpio_pull_up(uint gpio){
+    gpios[gpio].level = true;
+}
+
+void gpio_pull_down(uint gpio){
+    gpios[gpio].level = false;
+}
+
+void gpio_set_irq_enabled(uint gpio, uint32_t events, bool enabled){
+    if(enabled){
+        gpios[gpio].irq_events |= events;
+    }else{
+        gpios[gpio].irq_events &= ~events;
+    }
+}
+
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t events, bool enabled, gpio_irq_callback_t callback){
+    gpio_set_irq_enabled(gpio, events, enabled);
+    irq_callback = callback; // one callback for all GPIOs, like the SDK
+}
+
+bool host_gpio_listen(uint gpio, void (*listener)(void *ctx, bool level), void *ctx){
+    if(gpios[gpio].listener != NULL && gpios[gpio].listener != listener){
+        printf("ERROR: GPIO %d is already used by another device model.\n", gpio);
+        return false;
+    }
+    gpios[gpio].listener = listener;
+    gpios[gpio].ctx = ctx;
+    return true;
+}
+
+void host_gpio_drive(uint gpio, bool level){
+    struct host_gpio *g = &gpios[gpio];
+    if(g->level == level){
+        return;
+    }
+    g->level = level;
+    uint32_t event = level ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL;
+    if((g->irq_events & event) && irq_callback != NULL){
+        irq_callback(gpio, event);
+    }
+}
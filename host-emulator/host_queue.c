@@ -0,0 +1,64 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * queue of the host emulator
+ * see include/pico/util/queue.h
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/util/queue.h"
+
+void queue_init(queue_t *q, uint element_size, uint element_count){
+    q->data = calloc(element_count + 1, element_size);
+    q->element_size = element_size;
+    q->element_count = element_count + 1;
+    q->wptr = 0;
+    q->rptr = 0;
+}
+
+void queue_free(queue_t *q){
+    free(q->data);
+    q->data = NULL;
+}
+
+uint queue_get_level(queue_t *q){
+    return (q->wptr + q->element_count - q->rptr) % q->element_count;
+}
+
+bool queue_is_empty(queue_t *q){
+    return q->wptr == q->rptr;
+}
+
+bool queue_is_full(queue_t *q){
+    return queue_get_level(q) == (uint) (q->element_count - 1);
+}
+
+bool queue_try_add(queue_t *q, const void *data){
+    if(queue_is_full(q)){
+        return false;
+    }
+    memcpy(&q->data[q->wptr * q->element_size], data, q->element_size);
+    q->wptr = (q->wptr + 1) % q->element_count;
+    return true;
+}
+
+bool queue_try_peek(queue_t *q, void *data){
+    if(queue_is_empty(q)){
+        return false;
+    }
+    if(data != NULL){
+        memcpy(data, &q->data[q->rptr * q->element_size], q->element_size);
+    }
+    return true;
+}
+
+bool queue_try_remove(queue_t *q, void *data){
+    if(!queue_try_peek(q, data)){
+        return false;
+    }
+    q->rptr = (q->rptr + 1) % q->element_count;
+    return true;
+}
@@ -0,0 +1,67 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * SPI of the host emulator
+ * see include/hardware/spi.h
+ *
+ */
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/spi.h"
+
+spi_inst_t spi0_emu;
+spi_inst_t spi1_emu;
+
+uint spi_init(spi_inst_t *spi, uint baudrate){
+    return spi_set_baudrate(spi, baudrate);
+}
+
+uint spi_set_baudrate(spi_inst_t *spi, uint baudrate){
+    spi->baudrate = baudrate;
+    return baudrate;
+}
+
+bool host_spi_attach(spi_inst_t *spi, uint cs_pin, uint8_t (*transfer)(void *ctx, uint8_t mosi), void *ctx){
+    if(spi->device_count == HOST_SPI_MAX_DEVICES){
+        printf("ERROR: too many SPI devices.\n");
+        return false;
+    }
+    spi->devices[spi->device_count] = (struct host_spi_device){.cs_pin = cs_pin, .transfer = transfer, .ctx = ctx};
+    spi->device_count++;
+    return true;
+}
+
+static uint8_t transfer_byte(spi_inst_t *spi, uint8_t mosi){
+    uint8_t miso = 0xFF; // no device selected: pulled up
+    if(spi->baudrate > 0){
+        host_advance_cycles((8 * (uint64_t) HOST_CLOCK_HZ) / spi->baudrate);
+    }
+    for(uint8_t i = 0; i < spi->device_count; i++){
+        if(!gpio_get(spi->devices[i].cs_pin)){
+            miso = spi->devices[i].transfer(spi->devices[i].ctx, mosi);
+        }
+    }
+    return miso;
+}
+
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len){
+    for(size_t i = 0; i < len; i++){
+        transfer_byte(spi, src[i]);
+    }
+    return len;
+}
+
+int spi_read_blocking(spi_inst_t *spi, uint8_t repeated_tx_data, uint8_t *dst, size_t len){
+    for(size_t i = 0; i < len; i++){
+        dst[i] = transfer_byte(spi, repeated_tx_data);
+    }
+    return len;
+}
+
+int spi_write_read_blocking(spi_inst_t *spi, const uint8_t *src, uint8_t *dst, size_t len){
+    for(size_t i = 0; i < len; i++){
+        dst[i] = transfer_byte(spi, src[i]);
+    }
+    return len;
+}
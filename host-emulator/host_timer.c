@@ -0,0 +1,77 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * hardware alarms of the host emulator
+ * see include/hardware/timer.h
+ *
+ */
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/timer.h"
+
+struct host_alarm {
+    bool claimed;
+    bool armed;
+    uint64_t target_cycle;
+    hardware_alarm_callback_t callback;
+};
+
+static struct host_alarm alarms[NUM_TIMERS];
+
+// called for every cycle: fire the alarms whose target has been reached
+static void alarm_tick(){
+    for(uint i = 0; i < NUM_TIMERS; i++){
+        struct host_alarm *a = &alarms[i];
+        if(a->armed && host_cycles >= a->target_cycle){
+            a->armed = false;
+            if(a->callback != NULL){
+                a->callback(i); // may arm the alarm again
+            }
+        }
+    }
+}
+
+void hardware_alarm_claim(uint alarm_num){
+    if(alarms[alarm_num].claimed){
+        printf("ERROR: hardware alarm %u is already claimed.\n", alarm_num);
+    }
+    alarms[alarm_num].claimed = true;
+}
+
+int hardware_alarm_claim_unused(bool required){
+    for(uint i = 0; i < NUM_TIMERS; i++){
+        if(!alarms[i].claimed){
+            alarms[i].claimed = true;
+            return i;
+        }
+    }
+    if(required){
+        printf("ERROR: no hardware alarm left.\n");
+    }
+    return -1;
+}
+
+void hardware_alarm_unclaim(uint alarm_num){
+    alarms[alarm_num].claimed = false;
+    alarms[alarm_num].armed = false;
+}
+
+void hardware_alarm_set_callback(uint alarm_num, hardware_alarm_callback_t callback){
+    alarms[alarm_num].callback = callback;
+}
+
+bool hardware_alarm_set_target(uint alarm_num, absolute_time_t t){
+    uint64_t target_cycle = to_us_since_boot(t) * (HOST_CLOCK_HZ / 1000000);
+    if(target_cycle <= host_cycles){
+        return true;
+    }
+    alarms[alarm_num].target_cycle = target_cycle;
+    alarms[alarm_num].armed = true;
+    host_register_tick(alarm_tick);
+    return false;
+}
+
+void hardware_alarm_cancel(uint alarm_num){
+    alarms[alarm_num].armed = false;
+}
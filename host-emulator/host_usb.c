@@ -0,0 +1,79 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * USB serial of the host emulator: the bytes of the USB host (host_usb_write()) are read with
+ * getchar_timeout_us(), the raw output of stdio_usb.out_chars() goes to stdout or to host_usb_read()
+ * see include/pico/stdlib.h and include/pico/stdio_usb.h
+ *
+ */
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "pico/stdio_usb.h"
+
+static uint8_t usb_rx[HOST_USB_BUFFER];
+static uint32_t usb_rx_written = 0;
+static uint32_t usb_rx_read = 0;
+
+uint32_t host_usb_write(const uint8_t *data, uint32_t len){
+    uint32_t accepted = 0;
+    while(accepted < len && usb_rx_written - usb_rx_read < HOST_USB_BUFFER){
+        usb_rx[usb_rx_written % HOST_USB_BUFFER] = data[accepted++];
+        usb_rx_written++;
+    }
+    return accepted;
+}
+
+// the host only writes between the calls of the firmware: an empty buffer stays empty until the timeout
+int getchar_timeout_us(uint32_t timeout_us){
+    if(usb_rx_read == usb_rx_written){
+        sleep_us(timeout_us);
+        return PICO_ERROR_TIMEOUT;
+    }
+    return usb_rx[usb_rx_read++ % HOST_USB_BUFFER];
+}
+
+static uint8_t usb_tx[HOST_USB_BUFFER];
+static uint32_t usb_tx_written = 0;
+static uint32_t usb_tx_read = 0;
+static bool usb_tx_capture = false;
+
+void host_usb_capture(bool enabled){
+    usb_tx_capture = enabled;
+}
+
+uint32_t host_usb_read(uint8_t *data, uint32_t max){
+    uint32_t read = 0;
+    while(read < max && usb_tx_read < usb_tx_written){
+        data[read++] = usb_tx[usb_tx_read++ % HOST_USB_BUFFER];
+    }
+    return read;
+}
+
+// raw output: the oldest bytes are overwritten if the host does not read them
+static void usb_out_chars(const char *buf, int len){
+    if(!usb_tx_capture){
+        fwrite(buf, 1, len, stdout);
+        fflush(stdout);
+        return;
+    }
+    for(int i = 0; i < len; i++){
+        usb_tx[usb_tx_written++ % HOST_USB_BUFFER] = (uint8_t) buf[i];
+    }
+    if(usb_tx_written - usb_tx_read > HOST_USB_BUFFER){
+        usb_tx_read = usb_tx_written - HOST_USB_BUFFER;
+    }
+}
+
+static void usb_out_flush(){
+    fflush(stdout);
+}
+
+stdio_driver_t stdio_usb = {
+    .out_chars = usb_out_chars,
+    .out_flush = usb_out_flush,
+};
+
+void stdio_flush(){
+    fflush(stdout);
+}
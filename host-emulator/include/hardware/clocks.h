@@ -0,0 +1,17 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * host replacement of the Pico SDK hardware/clocks.h
+ *
+ */
+
+#ifndef HOST_HARDWARE_CLOCKS
+#define HOST_HARDWARE_CLOCKS
+
+#include "pico/stdlib.h"
+
+enum clock_index { clk_gpout0 = 0, clk_gpout1, clk_gpout2, clk_gpout3, clk_ref, clk_sys, clk_peri, clk_usb, clk_adc, clk_rtc };
+
+static inline uint32_t clock_get_hz(enum clock_index clk_index) { (void) clk_index; return HOST_CLOCK_HZ; }
+
+#endif
@@ -0,0 +1,40 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * host replacement of the Pico SDK hardware/dma.h
+ *
+ * Only transfers of 32-bit words from memory into the TX FIFO of a PIO state-machine are emulated: the DREQ
+ * (pio_get_dreq()) selects the FIFO, the write address is ignored. A channel writes one word per system clock
+ * cycle while the FIFO is not full (see host_dma.c).
+ *
+ */
+
+#ifndef HOST_HARDWARE_DMA
+#define HOST_HARDWARE_DMA
+
+#include "pico/stdlib.h"
+
+#define NUM_DMA_CHANNELS 12
+
+enum dma_channel_transfer_size { DMA_SIZE_8 = 0, DMA_SIZE_16 = 1, DMA_SIZE_32 = 2 };
+
+typedef struct {
+    enum dma_channel_transfer_size size;
+    bool read_increment;
+    bool write_increment;
+    uint dreq;
+} dma_channel_config;
+
+int dma_claim_unused_channel(bool required);
+void dma_channel_unclaim(uint channel);
+dma_channel_config dma_channel_get_default_config(uint channel);
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size);
+void channel_config_set_read_increment(dma_channel_config *c, bool incr);
+void channel_config_set_write_increment(dma_channel_config *c, bool incr);
+void channel_config_set_dreq(dma_channel_config *c, uint dreq);
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr, const volatile void *read_addr, uint transfer_count, bool trigger);
+void dma_channel_transfer_from_buffer_now(uint channel, const volatile void *read_addr, uint32_t transfer_count);
+bool dma_channel_is_busy(uint channel);
+void dma_channel_abort(uint channel);
+
+#endif
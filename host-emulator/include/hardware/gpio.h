@@ -0,0 +1,54 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * host replacement of the Pico SDK hardware/gpio.h
+ *
+ * Outputs are stored and forwarded to listeners (e.g. the chip select of an SPI device model),
+ * inputs are driven by the device models with host_gpio_drive(), which calls the GPIO IRQ callback.
+ *
+ */
+
+#ifndef HOST_HARDWARE_GPIO
+#define HOST_HARDWARE_GPIO
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef unsigned int uint;
+
+#define NUM_BANK0_GPIOS 30
+#define GPIO_OUT 1
+#define GPIO_IN  0
+
+enum gpio_irq_level {
+    GPIO_IRQ_LEVEL_LOW  = 0x1u,
+    GPIO_IRQ_LEVEL_HIGH = 0x2u,
+    GPIO_IRQ_EDGE_FALL  = 0x4u,
+    GPIO_IRQ_EDGE_RISE  = 0x8u,
+};
+
+enum gpio_function { GPIO_FUNC_XIP = 0, GPIO_FUNC_SPI, GPIO_FUNC_UART, GPIO_FUNC_I2C, GPIO_FUNC_PWM, GPIO_FUNC_SIO, GPIO_FUNC_PIO0, GPIO_FUNC_PIO1, GPIO_FUNC_GPCK, GPIO_FUNC_USB, GPIO_FUNC_NULL = 0x1f };
+
+typedef void (*gpio_irq_callback_t)(uint gpio, uint32_t event_mask);
+
+void gpio_init(uint gpio);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_set_function(uint gpio, enum gpio_function fn);
+void gpio_put(uint gpio, bool value);
+bool gpio_get(uint gpio);
+void gpio_pull_up(uint gpio);
+void gpio_pull_down(uint gpio);
+void gpio_set_irq_enabled(uint gpio, uint32_t events, bool enabled);
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t events, bool enabled, gpio_irq_callback_t callback);
+
+// ---------------- //
+// device models    //
+// ---------------- //
+
+/* call listener(ctx, level) whenever the firmware changes the output level of gpio */
+bool host_gpio_listen(uint gpio, void (*listener)(void *ctx, bool level), void *ctx);
+
+/* drive an input from a device model, edges trigger the IRQ callback if enabled */
+void host_gpio_drive(uint gpio, bool level);
+
+#endif
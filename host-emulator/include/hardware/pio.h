@@ -0,0 +1,128 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * host replacement of the Pico SDK hardware/pio.h
+ *
+ * The functions are backed by a cycle-accurate emulator of the PIO state-machines (pio_emulator.c).
+ * All instructions are supported except WAIT, IN, PUSH and IRQ (executed as NOP). The state-machines
+ * advance with the virtual clock of include/pico/stdlib.h, i.e. while the firmware sleeps or blocks.
+ *
+ */
+
+#ifndef HOST_HARDWARE_PIO
+#define HOST_HARDWARE_PIO
+
+#include "pico/stdlib.h"
+
+#define NUM_PIO_STATE_MACHINES 4
+#define PIO_INSTRUCTION_COUNT 32
+#define PIO_FDEBUG_TXSTALL_LSB 24
+#define PIO_FDEBUG_TXOVER_LSB  16
+
+struct pio_program {
+    const uint16_t *instructions;
+    uint8_t length;
+    int8_t origin; // required instruction memory origin or -1
+};
+
+enum pio_fifo_join { PIO_FIFO_JOIN_NONE = 0, PIO_FIFO_JOIN_TX = 1, PIO_FIFO_JOIN_RX = 2 };
+
+typedef struct {
+    uint8_t  wrap_bottom, wrap_top;
+    uint8_t  set_base, set_count;
+    uint8_t  out_base, out_count;
+    uint8_t  in_base;
+    uint8_t  sideset_base, sideset_bits; // sideset_bits includes the enable bit if optional
+    bool     sideset_opt, sideset_pindirs;
+    bool     out_shift_right, autopull;
+    uint8_t  pull_threshold;
+    enum pio_fifo_join join;
+    uint32_t clkdiv; // 16.8 fixed point
+} pio_sm_config;
+
+/* emulated state of one state-machine */
+struct pio_sm_state {
+    bool     enabled;
+    pio_sm_config config;
+    uint8_t  pc;
+    uint32_t x, y, isr, osr;
+    uint8_t  osr_count;   // number of bits shifted out of the OSR
+    uint32_t fifo[8];
+    uint8_t  fifo_level, fifo_head;
+    uint8_t  delay;       // remaining delay cycles of the current instruction
+    uint32_t clk_acc;     // clock divider accumulator (16.8 fixed point)
+    uint16_t executed;    // instruction executed in the last step, PIO_EMU_NO_INSTR if stalled or delayed
+};
+#define PIO_EMU_NO_INSTR 0xFFFF
+
+typedef struct pio_hw {
+    uint32_t fdebug;                        // write 1 to clear, see pio_emulator.c
+    uint32_t fdebug_flags;                  // emulator copy of FDEBUG
+    uint16_t instr_mem[PIO_INSTRUCTION_COUNT];
+    uint32_t used_instr;                    // bitmap of allocated instruction memory
+    uint32_t pins, pindirs;                 // GPIO levels and directions driven by this PIO
+    uint32_t txf[NUM_PIO_STATE_MACHINES];   // only the address is used (DMA write address), see host_dma.c
+    struct pio_sm_state sm[NUM_PIO_STATE_MACHINES];
+    void (*trace)(struct pio_hw *pio);      // called after every system clock cycle
+} pio_hw_t;
+typedef pio_hw_t *PIO;
+
+extern pio_hw_t pio0_emu, pio1_emu;
+#define pio0 (&pio0_emu)
+#define pio1 (&pio1_emu)
+
+// --------------- //
+// emulator access //
+// --------------- //
+
+/* trace hook, e.g. to record the pin levels */
+void pio_emu_set_trace(PIO pio, void (*trace)(PIO pio));
+
+/* advance all enabled state-machines of both PIOs by one system clock cycle */
+void pio_emu_tick();
+
+// ------------- //
+// hardware/pio.h //
+// ------------- //
+
+bool pio_can_add_program(PIO pio, const struct pio_program *program);
+bool pio_can_add_program_at_offset(PIO pio, const struct pio_program *program, uint offset);
+uint pio_add_program(PIO pio, const struct pio_program *program);
+void pio_add_program_at_offset(PIO pio, const struct pio_program *program, uint offset);
+void pio_remove_program(PIO pio, const struct pio_program *program, uint loaded_offset);
+void pio_clear_instruction_memory(PIO pio);
+
+void pio_gpio_init(PIO pio, uint pin);
+int pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out);
+
+pio_sm_config pio_get_default_sm_config();
+void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap);
+void sm_config_set_set_pins(pio_sm_config *c, uint set_base, uint set_count);
+void sm_config_set_out_pins(pio_sm_config *c, uint out_base, uint out_count);
+void sm_config_set_in_pins(pio_sm_config *c, uint in_base);
+void sm_config_set_sideset(pio_sm_config *c, uint bit_count, bool optional, bool pindirs);
+void sm_config_set_sideset_pins(pio_sm_config *c, uint sideset_base);
+void sm_config_set_fifo_join(pio_sm_config *c, enum pio_fifo_join join);
+void sm_config_set_out_shift(pio_sm_config *c, bool shift_right, bool autopull, uint pull_threshold);
+void sm_config_set_clkdiv_int_frac(pio_sm_config *c, uint16_t div_int, uint8_t div_frac);
+void sm_config_set_clkdiv(pio_sm_config *c, float div);
+
+int pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_sm_restart(PIO pio, uint sm);
+void pio_sm_clear_fifos(PIO pio, uint sm);
+void pio_sm_set_clkdiv_int_frac(PIO pio, uint sm, uint16_t div_int, uint8_t div_frac);
+void pio_sm_set_wrap(PIO pio, uint sm, uint wrap_target, uint wrap);
+void pio_sm_exec(PIO pio, uint sm, uint instr);
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t pin_values, uint32_t pin_mask);
+
+uint pio_sm_get_tx_fifo_level(PIO pio, uint sm);
+bool pio_sm_is_tx_fifo_empty(PIO pio, uint sm);
+bool pio_sm_is_tx_fifo_full(PIO pio, uint sm);
+void pio_sm_put(PIO pio, uint sm, uint32_t data);
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data);
+
+/* DREQ_PIO0_TX0 + 8 * PIO + sm (TX) or + 4 (RX) */
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx);
+
+#endif
@@ -0,0 +1,43 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * host replacement of the Pico SDK hardware/spi.h
+ *
+ * Every transferred byte is forwarded to the device model whose chip select (active low) is asserted
+ * and takes 8 SPI clock cycles of virtual time.
+ *
+ */
+
+#ifndef HOST_HARDWARE_SPI
+#define HOST_HARDWARE_SPI
+
+#include "pico/stdlib.h"
+
+#define HOST_SPI_MAX_DEVICES 4
+
+struct host_spi_device {
+    uint cs_pin;
+    uint8_t (*transfer)(void *ctx, uint8_t mosi); // returns MISO
+    void *ctx;
+};
+
+typedef struct spi_inst {
+    uint baudrate;
+    struct host_spi_device devices[HOST_SPI_MAX_DEVICES];
+    uint8_t device_count;
+} spi_inst_t;
+
+extern spi_inst_t spi0_emu, spi1_emu;
+#define spi0 (&spi0_emu)
+#define spi1 (&spi1_emu)
+
+uint spi_init(spi_inst_t *spi, uint baudrate);
+uint spi_set_baudrate(spi_inst_t *spi, uint baudrate);
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len);
+int spi_read_blocking(spi_inst_t *spi, uint8_t repeated_tx_data, uint8_t *dst, size_t len);
+int spi_write_read_blocking(spi_inst_t *spi, const uint8_t *src, uint8_t *dst, size_t len);
+
+/* attach a device model with the chip select cs_pin */
+bool host_spi_attach(spi_inst_t *spi, uint cs_pin, uint8_t (*transfer)(void *ctx, uint8_t mosi), void *ctx);
+
+#endif
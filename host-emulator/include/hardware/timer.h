@@ -0,0 +1,29 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * host replacement of the Pico SDK hardware/timer.h (hardware alarms)
+ *
+ * An alarm fires in the system clock cycle of its target time (no interrupt latency), its callback runs
+ * within the advance of the virtual clock like an interrupt handler (see host_timer.c).
+ *
+ */
+
+#ifndef HOST_HARDWARE_TIMER
+#define HOST_HARDWARE_TIMER
+
+#include "pico/stdlib.h"
+
+#define NUM_TIMERS 4
+
+typedef void (*hardware_alarm_callback_t)(uint alarm_num);
+
+void hardware_alarm_claim(uint alarm_num);
+int hardware_alarm_claim_unused(bool required);
+void hardware_alarm_unclaim(uint alarm_num);
+void hardware_alarm_set_callback(uint alarm_num, hardware_alarm_callback_t callback);
+
+/* returns true (and does not arm the alarm) if the target time has already passed */
+bool hardware_alarm_set_target(uint alarm_num, absolute_time_t t);
+void hardware_alarm_cancel(uint alarm_num);
+
+#endif
@@ -0,0 +1,15 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * host replacement of the Pico SDK pico/binary_info.h: the declarations are dropped
+ *
+ */
+
+#ifndef HOST_PICO_BINARY_INFO
+#define HOST_PICO_BINARY_INFO
+
+#define bi_decl(_decl)
+#define bi_1pin_with_name(p0, name) 0
+#define bi_3pins_with_func(p0, p1, p2, func) 0
+
+#endif
@@ -0,0 +1,20 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * host replacement of the Pico SDK pico/stdio_usb.h: the USB console driver, out_chars() writes without the CR/LF
+ * translation of printf (to stdout or, with host_usb_capture(), to the buffer read by host_usb_read())
+ * see host_usb.c
+ *
+ */
+
+#ifndef HOST_PICO_STDIO_USB
+#define HOST_PICO_STDIO_USB
+
+typedef struct stdio_driver {
+    void (*out_chars)(const char *buf, int len);
+    void (*out_flush)(void);
+} stdio_driver_t;
+
+extern stdio_driver_t stdio_usb;
+
+#endif
@@ -0,0 +1,82 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * host replacement of the Pico SDK pico/stdlib.h
+ *
+ * Time is virtual: it is counted in system clock cycles (125 MHz) and only advances when the firmware
+ * sleeps, busy-waits (tight_loop_contents) or blocks on a peripheral. Cycle-accurate models (e.g. the
+ * PIO emulator) are called for every cycle, event-driven models (e.g. the CC2500 model) once the time
+ * has advanced, see host_clock.c. Without cycle-accurate models, sleeping costs no host time.
+ *
+ */
+
+#ifndef HOST_PICO_STDLIB
+#define HOST_PICO_STDLIB
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "hardware/gpio.h"
+
+typedef unsigned int uint;
+typedef uint64_t absolute_time_t; // [us]
+
+#define PICO_ERROR_TIMEOUT (-1)
+#define HOST_CLOCK_HZ 125000000
+#define count_of(a) (sizeof(a)/sizeof((a)[0]))
+
+// ----------- //
+// host clock  //
+// ----------- //
+
+/* cycles since boot */
+extern uint64_t host_cycles;
+
+/* advance the virtual time and run all registered peripheral models */
+void host_advance_cycles(uint64_t cycles);
+
+/* register a peripheral model which is called for every system clock cycle */
+bool host_register_tick(void (*tick)(void));
+
+/* register an event-driven peripheral model which is called whenever the time has advanced */
+bool host_register_advance(void (*advance)(void));
+
+// --------- //
+// host USB  //
+// --------- //
+
+#define HOST_USB_BUFFER 4096
+
+/* bytes sent by the USB host, read by getchar_timeout_us(); returns the bytes accepted (buffer of HOST_USB_BUFFER) */
+uint32_t host_usb_write(const uint8_t *data, uint32_t len);
+
+/* collect the raw output of the firmware (stdio_usb.out_chars()) for host_usb_read() instead of writing it to stdout */
+void host_usb_capture(bool enabled);
+
+/* bytes written by the firmware with stdio_usb.out_chars() while capturing; returns the bytes read (up to max) */
+uint32_t host_usb_read(uint8_t *data, uint32_t max);
+
+// ------------- //
+// pico/stdlib.h //
+// ------------- //
+
+bool stdio_init_all();
+int getchar_timeout_us(uint32_t timeout_us);
+void stdio_flush();
+
+static inline uint64_t to_us_since_boot(absolute_time_t t) { return t; }
+static inline absolute_time_t from_us_since_boot(uint64_t us) { return us; }
+absolute_time_t get_absolute_time();
+uint32_t time_us_32();
+uint64_t time_us_64();
+absolute_time_t make_timeout_time_us(uint64_t us);
+absolute_time_t make_timeout_time_ms(uint32_t ms);
+bool time_reached(absolute_time_t t);
+
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+void busy_wait_us(uint64_t us);
+void tight_loop_contents();
+
+#endif
@@ -0,0 +1,29 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * host replacement of the Pico SDK pico/util/queue.h (single core, no locking)
+ *
+ */
+
+#ifndef HOST_PICO_QUEUE
+#define HOST_PICO_QUEUE
+
+#include "pico/stdlib.h"
+
+typedef struct {
+    uint8_t *data;
+    uint16_t element_size;
+    uint16_t element_count; // capacity + 1
+    uint16_t wptr, rptr;
+} queue_t;
+
+void queue_init(queue_t *q, uint element_size, uint element_count);
+void queue_free(queue_t *q);
+uint queue_get_level(queue_t *q);
+bool queue_is_empty(queue_t *q);
+bool queue_is_full(queue_t *q);
+bool queue_try_add(queue_t *q, const void *data);
+bool queue_try_remove(queue_t *q, void *data);
+bool queue_try_peek(queue_t *q, void *data);
+
+#endif
@@ -0,0 +1,419 @@
+#!/usr/bin/env python3
+"""
+Tobias Mages & Wenqing Yan
+
+End-to-end software model of the backscatter link: predicts the bit error rate (BER) and packet error
+rate (PER) against the SNR for any (d0, d1, baud, twoAntennas, sideband, continuous phase) configuration.
+
+  1. pio_waveform runs the state-machine of generatePIOprogram() in the PIO emulator and provides the
+     antenna waveform of a training sequence and the frames (header + generate_data() payload).
+  2. The waveform of every symbol (given the previous symbol) is mixed to the receiver frequency
+     CARRIER_FEQ + center_offset and integrated to the simulation sample rate once ("templates").
+     With a single sideband (set_sideband()), the reflection is pin1 + j*pin2 (90 degree RF phase difference
+     between the antenna paths) and the lower sideband is received at CARRIER_FEQ - center_offset.
+     With continuous phase (set_continuous_phase()), the templates start at the low level and the sign of
+     every symbol follows the parity of the half-periods sent before it.
+     The baseband of millions of bits is assembled from these templates with one vectorized
+     scatter-add, the carrier itself (DC after the backscatter mixing) is not part of the model.
+  3. Channel and receiver: AWGN, channel filter of bandwidth minRxBw (windowed sinc), 2-FSK frequency
+     discriminator with integrate-and-dump over each bit period of the receiver. The filtered noise
+     is drawn directly in the frequency domain (one batched inverse FFT per SNR value).
+     Bit synchronization: the receiver aligns its bit clock to every transition of the transmitted bits
+     (and to the start of every frame) and runs with its own data rate in between. With --rate-offset
+     (data rate of the receiver relative to the symbol rate - 1), the bit periods drift away from the
+     symbols within a run of identical bits; a run of n bits is decided as round(n / (1 + rate-offset))
+     bits, i.e. a long run loses or gains a bit and shifts the rest of the frame. With a rate offset of
+     0 the timing is ideal. --whitening simulates the frames with data whitening (set_whitening(), the
+     PN9 sequence breaks the runs), 'both' simulates every configuration with and without. --sensor
+     replaces the generate_data() samples by a constant reading (a sensor at rest, e.g. 0x800: ADC at
+     mid-scale), whose frames contain long runs.
+  4. The decisions are compared bit by bit against the transmitted frames, BER and PER are computed
+     over the payload (the header is assumed to be detected, the whitening is removed by an XOR and does
+     not change the number of errors). Payload bits which the receiver does not decide count as errors.
+  5. Spectrum: the noise-free reflection of the first frames at the full clock rate, mixed to the receiver
+     frequency. occupied_bw_99 is the bandwidth which contains 99% of the power within +-minRxBw,
+     out_of_band_db the power outside of +-minRxBw/2 relative to the power within.
+
+The SNR is the ratio of the received signal power to the noise power within minRxBw.
+Configurations are simulated in parallel (one process per configuration).
+
+usage:
+  mkdir build; cd build; cmake ..; make; cd ..
+  python3 link_simulator.py --config 40,36,200000,2 --config 40,36,200000,1 --snr 0:16:2 --bits 2000000
+  python3 link_simulator.py --config 40,36,200000,2,upper --config 38,37,200000,2,cp --rx-bw-factor 0.8
+  python3 link_simulator.py --config 40,36,200000,2 --snr 10 --rate-offset 0.06 --whitening both
+  (--config d0,d1,baud,antennas[,mode], mode: both, upper, lower or cp; the output is a CSV table)
+"""
+
+import argparse
+import math
+import multiprocessing
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+import numpy as np
+
+CHUNK_SYMBOLS = 1 << 16   # symbols per processing chunk (bounds the memory)
+NOISE_BLOCK = 4096        # the filtered noise is generated in the frequency domain in blocks of this size
+TRACE_SYMBOL_FLAG = 0x80  # bit 7 of the trace: first cycle of a symbol
+TRACE_VALUE_FLAG = 0x40   # bit 6 of the trace: value of the symbol
+MODES = {"both": None, "upper": "-u", "lower": "-l", "cp": "-c"}  # option of pio_waveform
+SIDEBAND_LOWER = 2        # enum backscatter_sideband
+SPECTRUM_SYMBOLS = 4096   # symbols of the spectrum estimate
+DEFAULT_TOOL = os.path.join(os.path.dirname(os.path.abspath(__file__)), "build", "pio_waveform")
+
+
+# ---------------------------------- #
+# state-machine waveform and frames  #
+# ---------------------------------- #
+
+def run_pio_waveform(tool, d0, d1, baud, antennas, mode, payload, frames, whitening=False, sensor=None):
+    """run pio_waveform, returns (configuration dict, trace, frames as uint8 array)"""
+    with tempfile.TemporaryDirectory() as tmp:
+        trace_file = os.path.join(tmp, "trace.bin")
+        frames_file = os.path.join(tmp, "frames.bin")
+        cmd = [tool, "-0", str(d0), "-1", str(d1), "-b", str(baud), "-p", str(payload),
+               "-n", str(frames), "-t", trace_file, "-f", frames_file]
+        if antennas == 1:
+            cmd.append("-s")
+        if MODES[mode]:
+            cmd.append(MODES[mode])
+        if whitening:
+            cmd.append("-w")
+        if sensor is not None:
+            cmd += ["-a", str(sensor)]
+        result = subprocess.run(cmd, capture_output=True, text=True)
+        match = re.search(r"^#CONFIG (.*)$", result.stdout, re.MULTILINE)
+        if result.returncode != 0 or match is None:
+            raise RuntimeError("pio_waveform failed for d0=%d d1=%d baud=%d: %s" % (d0, d1, baud, result.stdout.strip()))
+        config = {k: int(v) for k, v in (item.split("=") for item in match.group(1).split())}
+        trace = np.fromfile(trace_file, dtype=np.uint8)
+        frame_data = np.fromfile(frames_file, dtype=np.uint8)
+    return config, trace, frame_data
+
+
+def learn_symbols(trace, config):
+    """antenna waveform of each symbol given the previous symbol: array [prev*2 + bit, cycle]"""
+    starts = np.flatnonzero(trace & TRACE_SYMBOL_FLAG)
+    bits = (trace[starts] & TRACE_VALUE_FLAG) > 0
+    L = config["cycles_per_symbol"]
+    if np.any(np.diff(starts) != L):
+        raise RuntimeError("the symbol duration of the state-machine is not constant")
+    pin1 = (trace & 1).astype(np.float64)
+    pin2 = ((trace >> 1) & 1).astype(np.float64)
+    peak = 1.0
+    if not config["two_antennas"]:
+        reflection = pin1
+    elif config["sideband"]:
+        reflection = pin1 + 1j * pin2  # quadrature antennas
+    else:
+        reflection = pin1 + pin2  # both antennas switch in phase
+        peak = 2.0
+    symbols = np.full((4, L), np.nan, dtype=reflection.dtype)
+    for k in range(1, len(starts) - 1):
+        key = 2 * bits[k - 1] + bits[k]
+        waveform = reflection[starts[k]:starts[k] + L]
+        if config["continuous_phase"] and pin1[starts[k]]:
+            waveform = peak - waveform  # the template starts at the low level
+        if np.isnan(symbols[key, 0]):
+            symbols[key] = waveform
+        elif not np.array_equal(symbols[key], waveform):
+            raise RuntimeError("the waveform of a symbol depends on more than the previous symbol")
+    if np.isnan(symbols).any():
+        raise RuntimeError("the training sequence does not contain all symbol transitions")
+    if config["continuous_phase"]:
+        return symbols - peak / 2  # symmetric around zero, such that the sign can be flipped
+    return symbols - symbols.mean()  # the DC component is the carrier itself
+
+
+# ---------- #
+# link model #
+# ---------- #
+
+class LinkModel:
+    """decimated and mixed symbol templates of one configuration"""
+
+    def __init__(self, config, symbols, bw_factor=1.0):
+        self.config = config
+        self.symbols = symbols
+        clock = config["clock"]
+        self.L = config["cycles_per_symbol"]
+        self.bw = bw_factor * config["min_rx_bw"]
+        self.half_periods = np.array([config["half_periods0"], config["half_periods1"]], dtype=np.int64)
+        lower = config["sideband"] == SIDEBAND_LOWER
+        self.f_mix = -config["center_offset"] if lower else config["center_offset"]
+        # simulation sample rate: channel filter and a few samples per symbol
+        self.D = max(1, int(clock // max(2.5 * self.bw, 8 * config["baud"])))
+        self.fs = clock / self.D
+        # templates for every possible alignment of the symbol start within a sample
+        self.g = math.gcd(self.L, self.D)
+        residues = np.arange(0, self.D, self.g)
+        self.T = (self.D - 1 + self.L - 1) // self.D + 1
+        i = np.arange(self.L)
+        mix = np.exp(-2j * np.pi * self.f_mix * i / clock)
+        self.templates = np.zeros((4, len(residues), self.T), dtype=np.complex128)
+        for key in range(4):
+            mixed = symbols[key] * mix
+            for n, r in enumerate(residues):
+                j = (r + i) // self.D
+                self.templates[key, n] = (np.bincount(j, weights=mixed.real, minlength=self.T)
+                                          + 1j * np.bincount(j, weights=mixed.imag, minlength=self.T)) / self.D
+        # channel filter: windowed sinc with cut-off minRxBw/2
+        ntaps = 8 * int(math.ceil(self.fs / self.bw)) + 1
+        t = np.arange(ntaps) - (ntaps - 1) / 2
+        h = (self.bw / self.fs) * np.sinc(self.bw / self.fs * t) * np.hamming(ntaps)
+        self.h = h / h.sum()
+        self.H = np.fft.fft(self.h, NOISE_BLOCK)
+        self.guard = int(math.ceil(ntaps * self.D / self.L)) + 2  # guard symbols at the chunk edges
+        # the symbol with the larger frequency is decided when the discriminator output is positive
+        self.sign = 1.0 if config["d1"] < config["d0"] else -1.0
+        if lower:
+            self.sign = -self.sign  # the lower sideband mirrors the tones
+
+    def synthesize(self, bits, prev_bit, first_symbol):
+        """complex baseband of the symbols bits, starting with absolute symbol index first_symbol"""
+        clock = self.config["clock"]
+        n = len(bits)
+        k = first_symbol + np.arange(n, dtype=np.int64)
+        t0 = k * self.L                                   # absolute start cycle of every symbol
+        base = t0 // self.D - (t0[0] // self.D)
+        residue = (t0 % self.D) // self.g
+        key, sign = self.keys(bits, prev_bit)
+        phase = np.exp(-2j * np.pi * ((self.f_mix * t0) % clock) / clock)   # exact for large t0
+        values = self.templates[key, residue] * (sign * phase)[:, None]
+        index = (base[:, None] + np.arange(self.T)).ravel()
+        length = int(base[-1]) + self.T
+        x = (np.bincount(index, weights=values.real.ravel(), minlength=length)
+             + 1j * np.bincount(index, weights=values.imag.ravel(), minlength=length))
+        return x, t0 - (t0[0] // self.D) * self.D
+
+    def keys(self, bits, prev_bit):
+        """template index and sign of every symbol (continuous phase: parity of the half-periods before)"""
+        bits = bits.astype(np.int64)
+        prev = np.concatenate(([prev_bit], bits[:-1])).astype(np.int64)
+        toggles = np.concatenate(([0], np.cumsum(self.half_periods[bits])[:-1]))
+        sign = 1.0 - 2.0 * (toggles % 2) if self.config["continuous_phase"] else np.ones(len(bits))
+        return 2 * prev + bits, sign
+
+    def spectrum(self, bits):
+        """occupied bandwidth (99% of the power within +-minRxBw) and out-of-band power of the noise-free reflection"""
+        clock = self.config["clock"]
+        bits = bits[:SPECTRUM_SYMBOLS]
+        key, sign = self.keys(bits, 0)
+        x = (self.symbols[key] * sign[:, None]).ravel()
+        x = x * np.exp(-2j * np.pi * self.f_mix * np.arange(len(x)) / clock)
+        power = np.abs(np.fft.fft(x * np.hanning(len(x)))) ** 2
+        f = np.fft.fftfreq(len(x), 1 / clock)
+        span = self.config["min_rx_bw"]
+        inside = np.abs(f) <= span
+        order = np.argsort(f[inside])
+        f_span, p_span = f[inside][order], power[inside][order]
+        cumulative = np.cumsum(p_span) / p_span.sum()
+        occupied = f_span[np.searchsorted(cumulative, 0.995)] - f_span[np.searchsorted(cumulative, 0.005)]
+        in_band = np.abs(f_span) <= span / 2
+        out_of_band_db = 10 * math.log10(p_span[~in_band].sum() / p_span[in_band].sum())
+        return occupied, out_of_band_db
+
+    def filter(self, x):
+        """linear-phase FIR filter, output aligned to the input"""
+        return np.convolve(x, self.h, mode="same")
+
+    def filtered_noise(self, rng, n, sigma2):
+        """n samples of complex white noise (variance sigma2 per sample) after the channel filter"""
+        blocks = -(-n // NOISE_BLOCK)
+        scale = math.sqrt(NOISE_BLOCK * sigma2 / 2)
+        spectrum = rng.standard_normal((blocks, NOISE_BLOCK)) + 1j * rng.standard_normal((blocks, NOISE_BLOCK))
+        return np.fft.ifft(spectrum * (scale * self.H), axis=-1).ravel()[:n]
+
+    def discriminate(self, y, t0, t1):
+        """integrate-and-dump of the instantaneous frequency over the bit periods [t0, t1) [cycles], returns the decisions"""
+        freq = np.zeros(len(y))
+        freq[1:] = np.angle(y[1:] * np.conj(y[:-1]))
+        cumulative = np.concatenate(([0.0], np.cumsum(freq)))
+        start = -(-t0 // self.D)                       # first sample within the bit period
+        stop = -(-t1 // self.D)
+        stop = np.minimum(stop, len(y))
+        mean = (cumulative[stop] - cumulative[start]) / np.maximum(stop - start, 1)
+        return (self.sign * mean) > 0
+
+
+# ------------------ #
+# bit synchronization #
+# ------------------ #
+
+def receiver_bits(bits, frame_bits, L, rate_offset):
+    """
+    bit periods of the receiver: aligned to every transition and frame start, rate_offset relative to the symbol rate
+    returns (start and stop cycle of every bit period, index of the transmitted bit it is compared with (-1: none),
+    frame of every bit period, number of bit periods per frame)
+    """
+    n = len(bits)
+    k = np.arange(n)
+    new_run = np.ones(n, dtype=bool)
+    new_run[1:] = bits[1:] != bits[:-1]
+    new_run |= (k % frame_bits) == 0
+    run_start = np.flatnonzero(new_run)
+    run_len = np.diff(np.append(run_start, n))
+    period = L * (1.0 + rate_offset)
+    decided = np.maximum(np.rint(run_len / (1.0 + rate_offset)).astype(np.int64), 1)
+    run = np.repeat(np.arange(len(run_start)), decided)
+    j = np.arange(len(run)) - np.repeat(np.cumsum(decided) - decided, decided)
+    start = run_start[run] * L + np.rint(j * period).astype(np.int64)
+    stop = start + int(round(period))
+    frame = run_start[run] // frame_bits
+    frames = n // frame_bits
+    first = np.searchsorted(frame, np.arange(frames))
+    position = np.arange(len(run)) - first[frame]
+    expected = np.where(position < frame_bits, frame * frame_bits + position, -1)
+    return start, stop, expected, frame, np.bincount(frame, minlength=frames)
+
+
+# ---------- #
+# simulation #
+# ---------- #
+
+def simulate_config(task):
+    """simulate one configuration for all SNR values, returns a list of result rows"""
+    (d0, d1, baud, antennas, mode), whitening, args, seed = task
+    frames = max(1, -(-args.bits // (8 * args.payload)))
+    try:
+        config, trace, frame_data = run_pio_waveform(args.tool, d0, d1, baud, antennas, mode, args.payload, frames, whitening, args.sensor)
+        model = LinkModel(config, learn_symbols(trace, config), args.rx_bw_factor)
+    except RuntimeError as error:
+        print("skipping configuration: %s" % error, file=sys.stderr)  # e.g. the program does not fit
+        return []
+    rng = np.random.default_rng(seed)
+
+    bits = np.unpackbits(frame_data)
+    n_bits = len(bits)
+    frame_bits = 8 * config["frame_bytes"]
+    position = np.arange(n_bits) % frame_bits
+    payload_start, payload_stop = 8 * config["header_len"], 8 * (config["header_len"] + config["payload"])
+    is_payload = (position >= payload_start) & (position < payload_stop)
+    occupied_bw, out_of_band_db = model.spectrum(bits)
+
+    # bit periods of the receiver, payload bits without a bit period are errors at every SNR
+    rx_start, rx_stop, expected, rx_frame, rx_count = receiver_bits(bits, frame_bits, model.L, args.rate_offset)
+    compared = expected >= 0
+    compared[compared] = is_payload[expected[compared]]
+    missing = np.clip(payload_stop - np.maximum(rx_count, payload_start), 0, None)
+
+    snrs = args.snr
+    bit_errors = np.full(len(snrs), missing.sum(), dtype=np.int64)
+    frame_errors = np.tile(missing, (len(snrs), 1))
+    decisions = np.zeros((len(snrs), n_bits), dtype=bool) if args.save_decisions else None
+    signal_power = []
+
+    for start in range(0, n_bits, CHUNK_SYMBOLS):
+        stop = min(n_bits, start + CHUNK_SYMBOLS)
+        lo = max(0, start - model.guard)
+        hi = min(n_bits, stop + model.guard)
+        prev_bit = bits[lo - 1] if lo > 0 else 0
+        x, t0 = model.synthesize(bits[lo:hi], prev_bit, lo)
+        clean = model.filter(x)
+        power = np.mean(np.abs(clean) ** 2)
+        signal_power.append(power)
+        # the bit periods of the receiver starting within the chunk, in cycles from the first sample of x
+        inner = slice(*np.searchsorted(rx_start, [start * model.L, stop * model.L]))
+        origin = lo * model.L - t0[0]
+        for s, snr_db in enumerate(snrs):
+            sigma2 = power * model.fs / (model.bw * 10 ** (snr_db / 10))
+            y = clean + model.filtered_noise(rng, len(x), sigma2)
+            decided = model.discriminate(y, rx_start[inner] - origin, rx_stop[inner] - origin)
+            valid = compared[inner]
+            errors = decided[valid] != bits[expected[inner][valid]].astype(bool)
+            bit_errors[s] += np.count_nonzero(errors)
+            frame_errors[s] += np.bincount(rx_frame[inner][valid][errors], minlength=frames)
+            if decisions is not None:
+                decisions[s, expected[inner][valid]] = decided[valid]
+
+    rows = []
+    payload_bits = np.count_nonzero(is_payload)
+    for s, snr_db in enumerate(snrs):
+        ebn0_db = snr_db + 10 * math.log10(model.bw / config["baud"])
+        packet_errors = np.count_nonzero(frame_errors[s])
+        rows.append({
+            "d0": d0, "d1": d1, "baud": config["baud"], "antennas": antennas, "mode": mode,
+            "whitening": int(whitening), "rate_offset": args.rate_offset,
+            "center_offset": config["center_offset"], "deviation": config["deviation"], "min_rx_bw": config["min_rx_bw"],
+            "rx_bw": round(model.bw), "occupied_bw_99": round(occupied_bw), "out_of_band_db": round(out_of_band_db, 2),
+            "snr_db": snr_db, "ebn0_db": round(ebn0_db, 2),
+            "bits": payload_bits, "bit_errors": int(bit_errors[s]), "ber": bit_errors[s] / payload_bits,
+            "packets": frames, "packet_errors": packet_errors, "per": packet_errors / frames,
+            "ber_noncoherent_fsk": 0.5 * math.exp(-0.5 * 10 ** (ebn0_db / 10)),
+        })
+        if decisions is not None:
+            name = "decisions_%d_%d_%d_%d_%s_%s%g.npy" % (d0, d1, baud, antennas, mode, "w_" if whitening else "", snr_db)
+            np.save(os.path.join(args.save_decisions, name), np.packbits(decisions[s]))
+    return rows
+
+
+def parse_snr(text):
+    """'0:16:2' -> [0, 2, ..., 16], '3,6,9' -> [3, 6, 9]"""
+    if ":" in text:
+        start, stop, step = (float(v) for v in text.split(":"))
+        return list(np.round(np.arange(start, stop + step / 2, step), 6))
+    return [float(v) for v in text.split(",")]
+
+
+def parse_config(text):
+    items = text.split(",")
+    mode = items.pop() if len(items) == 5 else "both"
+    try:
+        values = [int(v) for v in items]
+    except ValueError:
+        values = []
+    if len(values) == 3:
+        values.append(2)
+    if len(values) != 4 or values[3] not in (1, 2) or mode not in MODES or (mode in ("upper", "lower") and values[3] != 2):
+        raise argparse.ArgumentTypeError("expected d0,d1,baud[,antennas (1 or 2)[,mode (both, upper, lower (two antennas) or cp)]]")
+    return tuple(values) + (mode,)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--config", type=parse_config, action="append",
+                        help="d0,d1,baud[,antennas[,mode]], can be repeated (default: 40,36,200000,2)")
+    parser.add_argument("--snr", type=parse_snr, default=parse_snr("0:16:2"), help="SNR values [dB], start:stop:step or list")
+    parser.add_argument("--bits", type=int, default=1000000, help="simulated bits per configuration")
+    parser.add_argument("--payload", type=int, default=60, help="payload size [byte]")
+    parser.add_argument("--rx-bw-factor", type=float, default=1.0, help="channel filter bandwidth relative to minRxBw")
+    parser.add_argument("--rate-offset", type=float, default=0.0,
+                        help="data rate of the receiver relative to the symbol rate - 1, e.g. 0.01 (default: 0, ideal timing)")
+    parser.add_argument("--whitening", choices=("off", "on", "both"), default="off", help="data whitening of the frames")
+    parser.add_argument("--sensor", type=lambda v: int(v, 0), help="constant payload samples (e.g. 0x800) instead of generate_data()")
+    parser.add_argument("--jobs", type=int, default=os.cpu_count(), help="parallel processes")
+    parser.add_argument("--seed", type=int, default=1, help="seed of the noise generator")
+    parser.add_argument("--tool", default=DEFAULT_TOOL, help="path of pio_waveform")
+    parser.add_argument("--save-decisions", metavar="DIR", help="store the bit decisions (np.packbits) per configuration and SNR")
+    parser.add_argument("--out", help="CSV output file (default: stdout)")
+    args = parser.parse_args()
+    configs = args.config or [(40, 36, 200000, 2, "both")]
+    if not os.path.exists(args.tool):
+        sys.exit("pio_waveform not found at %s, build it first (see the usage above)" % args.tool)
+    if abs(args.rate_offset) >= 0.3:
+        sys.exit("--rate-offset has to be within +-0.3")
+    if args.save_decisions:
+        os.makedirs(args.save_decisions, exist_ok=True)
+
+    whitening = {"off": [False], "on": [True], "both": [False, True]}[args.whitening]
+    tasks = [(c, w, args, args.seed + i) for i, c in enumerate(configs) for w in whitening]  # same noise with and without
+    out = open(args.out, "w") if args.out else sys.stdout
+    header = None
+    with multiprocessing.Pool(min(args.jobs, len(tasks))) as pool:
+        for rows in pool.imap(simulate_config, tasks):
+            for row in rows:
+                if header is None:
+                    header = list(row.keys())
+                    print(",".join(header), file=out)
+                print(",".join(("%.6g" % row[k]) if isinstance(row[k], float) else str(row[k]) for k in header), file=out)
+            out.flush()
+    if args.out:
+        out.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,327 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * micro_bench: execution time of the hot paths of project_pico_libs
+ *
+ * Kernels:
+ *  - generate_sample, generate_data, add_header, pack_frame, build_frame (packet_generation.c),
+ *  - build_frame_whitened: build_frame() with data whitening (set_whitening()),
+ *  - generate_pio_program: generatePIOprogram() for every configuration of the grid that fits into
+ *    the instruction memory (backscatter.c),
+ *  - rx_register_math: calc_*_rx() register calculations of the set_*_rx() functions (receiver_CC2500.c),
+ *  - analyze_packet: on-receiver comparison of a received payload with the regenerated file (link_quality.c).
+ * Each kernel is calibrated to run at least -t milliseconds and repeated -r times, the minimum and the
+ * median time per call are reported. The checksum is computed from a reset state and identifies the
+ * results (e.g. to compare builds for different targets).
+ * With -i the calibration is skipped and every kernel runs exactly <iterations> once, which is used to
+ * count instructions with an external model (see benchmarks.py --m0plus).
+ *
+ * usage: micro_bench [-k <kernel>] [-p <payload>] [-t <min. time ms>] [-r <repetitions>] [-i <iterations>] [-l]
+ *   -k: run only this kernel (can be repeated)
+ *   -l: list the kernels
+ *
+ * Output: '#BENCH kernel=... calls=... ns_per_call=... median_ns_per_call=... checksum=...'
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "backscatter.h"
+#include "packet_generation.h"
+#include "receiver_CC2500.h"
+#include "link_quality.h"
+
+#define RECEIVER             2500
+#define MAX_KERNELS            16
+#define MAX_REPETITIONS        32
+#define MAX_GRID              512
+#define CARRIER_FEQ    2450000000
+
+struct grid_config {
+    uint16_t d0, d1;
+    uint32_t baud;
+    bool twoAntennas;
+};
+
+/* configurations of generate_pio_program, only those which fit into the instruction memory */
+static struct grid_config grid[MAX_GRID];
+static uint16_t grid_len = 0;
+static const uint32_t grid_bauds[] = {50000, 100000, 150000, 200000, 250000};
+
+/* receiver settings of rx_register_math */
+static const uint32_t rx_deviations[] = {50000, 100000, 173611, 250000, 350000};
+static const uint32_t rx_offsets[] = {1000000, 2000000, 3298611, 4000000};
+
+static uint8_t *header_tmplate;
+static uint8_t buffer[MAX_FRAME_WORDS*4];
+static Frame frame;
+
+// ------- //
+// kernels //
+// ------- //
+
+static uint32_t kernel_generate_sample(uint32_t iterations){
+    uint32_t checksum = 0;
+    for(uint32_t i = 0; i < iterations; i++){
+        checksum += generate_sample();
+    }
+    return checksum;
+}
+
+static uint32_t kernel_generate_data(uint32_t iterations){
+    uint32_t checksum = 0;
+    for(uint32_t i = 0; i < iterations; i++){
+        generate_data(buffer, get_payload_size(), true);
+        checksum += buffer[get_payload_size() - 1];
+    }
+    return checksum;
+}
+
+static uint32_t kernel_add_header(uint32_t iterations){
+    uint32_t checksum = 0;
+    for(uint32_t i = 0; i < iterations; i++){
+        add_header(buffer, (uint8_t) i, header_tmplate);
+        checksum += buffer[get_header_len() - 2] + buffer[get_header_len() - 1];
+    }
+    return checksum;
+}
+
+static uint32_t kernel_pack_frame(uint32_t iterations){
+    uint32_t checksum = 0;
+    for(uint32_t i = 0; i < iterations; i++){
+        frame.bytes[0] = (uint8_t) i;
+        pack_frame(&frame);
+        checksum += frame.words[0] ^ frame.words[frame.len_words - 1];
+    }
+    return checksum;
+}
+
+static uint32_t kernel_build_frame(uint32_t iterations){
+    uint32_t checksum = 0;
+    for(uint32_t i = 0; i < iterations; i++){
+        build_frame(&frame, (uint8_t) i, header_tmplate);
+        checksum += frame.words[frame.len_words - 1];
+    }
+    return checksum;
+}
+
+static uint32_t kernel_build_frame_whitened(uint32_t iterations){
+    set_whitening(true);
+    uint32_t checksum = kernel_build_frame(iterations);
+    set_whitening(false);
+    return checksum;
+}
+
+static uint32_t kernel_generate_pio_program(uint32_t iterations){
+    uint16_t instructionBuffer[32];
+    struct pio_program program;
+    uint32_t checksum = 0;
+    for(uint32_t i = 0; i < iterations; i++){
+        for(uint16_t c = 0; c < grid_len; c++){
+            generatePIOprogram(grid[c].d0, grid[c].d1, grid[c].baud, instructionBuffer, &program, grid[c].twoAntennas, NULL);
+            checksum += program.length + instructionBuffer[program.length - 1];
+        }
+    }
+    return checksum;
+}
+
+static uint32_t kernel_rx_register_math(uint32_t iterations){
+    uint32_t checksum = 0;
+    uint32_t freq;
+    uint8_t e, m, channel, channspc_e;
+    for(uint32_t i = 0; i < iterations; i++){
+        for(uint8_t b = 0; b < count_of(grid_bauds); b++){
+            for(uint8_t d = 0; d < count_of(rx_deviations); d++){
+                checksum += calc_datarate_rx(grid_bauds[b], &e, &m);
+                checksum += calc_frequency_deviation_rx(rx_deviations[d], &e, &m);
+                checksum += calc_filter_bandwidth_rx(grid_bauds[b] + 2*rx_deviations[d], &e, &m);
+                checksum += calc_frecuency_rx(CARRIER_FEQ + rx_offsets[d % count_of(rx_offsets)], &freq, &channel, &channspc_e, &m);
+            }
+        }
+    }
+    return checksum;
+}
+
+static uint32_t kernel_analyze_packet(uint32_t iterations){
+    // the bytes after the sync word as read by readPacket(), one bit error in the last data byte
+    uint8_t received[RX_BUFFER_SIZE];
+    Packet_status status = {.overflowed = false, .len = get_payload_size() + 2, .RSSI = -60, .CRCcheck = true, .LinkQualityIndicator = 5};
+    memcpy(received, &frame.bytes[get_header_len() - 2], status.len);
+    received[status.len - 1] ^= 0x01;
+    reset_link_quality(0);
+    for(uint32_t i = 0; i < iterations; i++){
+        analyze_packet(received, status, get_payload_size());
+    }
+    return link_quality.bits + link_quality.bit_errors;
+}
+
+struct kernel {
+    const char *name;
+    uint32_t (*run)(uint32_t iterations); // returns a checksum of the results
+    uint32_t calls;                       // calls of the benchmarked function per iteration
+};
+
+static struct kernel kernels[] = {
+    {"generate_sample",      kernel_generate_sample,      1},
+    {"generate_data",        kernel_generate_data,        1},
+    {"add_header",           kernel_add_header,           1},
+    {"pack_frame",           kernel_pack_frame,           1},
+    {"build_frame",          kernel_build_frame,          1},
+    {"build_frame_whitened", kernel_build_frame_whitened, 1},
+    {"generate_pio_program", kernel_generate_pio_program, 0}, // grid_len, see setup_grid()
+    {"rx_register_math",     kernel_rx_register_math,     4 * count_of(grid_bauds) * count_of(rx_deviations)},
+    {"analyze_packet",       kernel_analyze_packet,       1},
+};
+
+// ----- //
+// setup //
+// ----- //
+
+/* every kernel starts from the same state of the data generator */
+static void reset_state(){
+    file_position = 0; // resets the seed with the next sample
+}
+
+/* keep the configurations for which generatePIOprogram() succeeds (its error messages are discarded) */
+static void setup_grid(){
+    uint16_t instructionBuffer[32];
+    struct pio_program program;
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    for(uint16_t d0 = 16; d0 <= 80; d0 += 4){
+        for(uint16_t delta = 2; delta <= 8; delta *= 2){
+            for(uint8_t b = 0; b < count_of(grid_bauds); b++){
+                for(uint8_t antennas = 1; antennas <= 2; antennas++){
+                    struct grid_config c = {.d0 = d0, .d1 = d0 - delta, .baud = grid_bauds[b], .twoAntennas = antennas == 2};
+                    if(grid_len < MAX_GRID && generatePIOprogram(c.d0, c.d1, c.baud, instructionBuffer, &program, c.twoAntennas, NULL)){
+                        grid[grid_len] = c;
+                        grid_len++;
+                    }
+                }
+            }
+        }
+    }
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(devnull);
+    close(saved_stdout);
+}
+
+// ------- //
+// timing  //
+// ------- //
+
+static double now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return 1e9 * ts.tv_sec + ts.tv_nsec;
+}
+
+static volatile uint32_t sink; // the result of a timed run is kept, such that the kernel is not optimized away
+
+static double time_ns(struct kernel *k, uint32_t iterations){
+    reset_state();
+    double start = now_ns();
+    sink = k->run(iterations);
+    return now_ns() - start;
+}
+
+static int compare_double(const void *a, const void *b){
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/* fixed_iterations < 0: calibrate the iterations with min_time_ns */
+static void run_kernel(struct kernel *k, double min_time_ns, uint8_t repetitions, int64_t fixed_iterations){
+    reset_state();
+    uint32_t checksum = k->run(1);
+
+    uint32_t iterations = fixed_iterations;
+    if(fixed_iterations < 0){
+        // calibrate: double the iterations until a run takes at least min_time_ns
+        iterations = 1;
+        while(time_ns(k, iterations) < min_time_ns && iterations < (1u << 30)){
+            iterations *= 2;
+        }
+    }else{
+        repetitions = 1;
+    }
+    double t[MAX_REPETITIONS];
+    for(uint8_t r = 0; r < repetitions; r++){
+        t[r] = time_ns(k, iterations);
+    }
+    qsort(t, repetitions, sizeof(double), compare_double);
+    uint64_t calls = (uint64_t) iterations * k->calls;
+    printf("#BENCH kernel=%s calls=%llu ns_per_call=%.2f median_ns_per_call=%.2f checksum=0x%08x\n",
+        k->name, (unsigned long long) calls, calls ? t[0] / calls : 0.0, calls ? t[repetitions / 2] / calls : 0.0, checksum);
+}
+
+static void usage(const char *name){
+    fprintf(stderr, "usage: %s [-k <kernel>] [-p <payload>] [-t <min. time ms>] [-r <repetitions>] [-i <iterations>] [-l]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv){
+    const char *selected[MAX_KERNELS];
+    uint8_t selected_len = 0;
+    uint8_t payload = MAX_PAYLOADSIZE;
+    double min_time_ms = 50;
+    int repetitions = 5;
+    int64_t iterations = -1;
+    bool list = false;
+    int opt;
+    while((opt = getopt(argc, argv, "k:p:t:r:i:l")) != -1){
+        switch(opt){
+            case 'k': if(selected_len < MAX_KERNELS){ selected[selected_len++] = optarg; } break;
+            case 'p': payload = atoi(optarg); break;
+            case 't': min_time_ms = atof(optarg); break;
+            case 'r': repetitions = atoi(optarg); break;
+            case 'i': iterations = atoll(optarg); break;
+            case 'l': list = true; break;
+            default: usage(argv[0]);
+        }
+    }
+    if(repetitions < 1 || repetitions > MAX_REPETITIONS || !set_payload_size(payload)){
+        usage(argv[0]);
+    }
+    if(list){
+        for(uint8_t i = 0; i < count_of(kernels); i++){
+            printf("%s\n", kernels[i].name);
+        }
+        return 0;
+    }
+
+    header_tmplate = packet_hdr_template(RECEIVER);
+    build_frame(&frame, 0, header_tmplate);
+    setup_grid();
+    for(uint8_t i = 0; i < count_of(kernels); i++){
+        if(kernels[i].run == kernel_generate_pio_program){
+            kernels[i].calls = grid_len;
+        }
+    }
+    printf("#CONFIG payload=%u header_len=%u pio_grid=%u min_time_ms=%.1f repetitions=%d iterations=%lld\n",
+        payload, get_header_len(), grid_len, min_time_ms, repetitions, (long long) iterations);
+
+    for(uint8_t s = 0; s < max(selected_len, 1); s++){
+        bool found = false;
+        for(uint8_t i = 0; i < count_of(kernels); i++){
+            if(selected_len == 0 || strcmp(selected[s], kernels[i].name) == 0){
+                run_kernel(&kernels[i], 1e6 * min_time_ms, repetitions, iterations);
+                found = true;
+            }
+        }
+        if(!found){
+            fprintf(stderr, "ERROR: unknown kernel %s (see -l)\n", selected[s]);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,184 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * multi_bench: several receivers on one SPI bus (multi_receiver.c) against one CC2500 model per receiver
+ *
+ * Diversity (default): every packet is injected into all models, each copy fails the CRC independently with the
+ * probability -e and gets an independent RSSI (-60 +- 10 dBm). FDMA (-F): every receiver has a tag of its own on
+ * another channel (-F <spacing Hz>), the tags send at the rate -r each with staggered starts. The models do not
+ * filter by frequency, a packet is only injected into the model of its channel. All times are virtual.
+ *
+ * usage: multi_bench [-R <receivers>] [-r <packets/s>] [-n <packets per tag>] [-p <payload>] [-b <baud>] [-e <CRC error rate>] [-F <spacing Hz>] [-v]
+ *
+ * Every receiver re-arms with RX_start_listen() (~4 ms), i.e. the packet interval has to exceed the receivers
+ * times 4 ms in diversity mode.
+ *
+ * Output: '#MULTI key=value ...' of the receivers, '#MULTIBENCH key=value ...' with the packets delivered with correct
+ * content (single: receiver 0 alone), the link counters ('#CNT') and the model statistics ('#CC2500').
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pico/stdlib.h"
+#include "pico/util/queue.h"
+#include "hardware/spi.h"
+#include "receiver_CC2500.h"
+#include "multi_receiver.h"
+#include "packet_generation.h"
+#include "link_counters.h"
+#include "cc2500_model.h"
+
+#define CARRIER_FEQ     2450000000
+#define CENTER_OFFSET      3298611
+#define DEVIATION           173611
+#define RECEIVER              2500
+#define INJECT_HORIZON_US    20000 // inject packets this far ahead of the virtual time
+#define DRAIN_US             50000 // keep running after the last packet
+
+static const uint cs_pins[MAX_RECEIVERS]   = {RX_CSN, 20, 14, 15};
+static const uint gdo0_pins[MAX_RECEIVERS] = {RX_GDO0_PIN, 22, 12, 13};
+
+static double uniform(){
+    return rand() / (RAND_MAX + 1.0);
+}
+
+static void usage(const char *name){
+    fprintf(stderr, "usage: %s [-R <receivers>] [-r <packets/s>] [-n <packets per tag>] [-p <payload>] [-b <baud>] [-e <CRC error rate>] [-F <spacing Hz>] [-v]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv){
+    int receivers = 2;
+    double rate = 50;
+    uint32_t packets = 5000;
+    uint8_t payload = PAYLOADSIZE;
+    uint32_t baud = 200000;
+    double crc_error_rate = 0.2;
+    uint32_t spacing = 0;
+    bool verbose = false;
+    int opt;
+    while((opt = getopt(argc, argv, "R:r:n:p:b:e:F:v")) != -1){
+        switch(opt){
+            case 'R': receivers = atoi(optarg); break;
+            case 'r': rate = atof(optarg); break;
+            case 'n': packets = atoi(optarg); break;
+            case 'p': payload = atoi(optarg); break;
+            case 'b': baud = atoi(optarg); break;
+            case 'e': crc_error_rate = atof(optarg); break;
+            case 'F': spacing = atoi(optarg); break;
+            case 'v': verbose = true; break;
+            default: usage(argv[0]);
+        }
+    }
+    bool fdma = spacing > 0;
+    if(receivers < 1 || receivers > MAX_RECEIVERS || rate <= 0 || !set_payload_size(payload) || crc_error_rate < 0 || crc_error_rate >= 1){
+        usage(argv[0]);
+    }
+    stdio_init_all();
+    spi_init(RADIO_SPI, 5 * 1000000); // SPI0 at 5MHz.
+
+    static struct cc2500_model radio[MAX_RECEIVERS];
+    for(int i = 0; i < receivers; i++){
+        cc2500_model_init(&radio[i], RADIO_SPI, cs_pins[i], gdo0_pins[i]);
+    }
+    if(!setup_multi_rx(cs_pins, gdo0_pins, receivers, fdma ? MULTI_FDMA : MULTI_DIVERSITY)){
+        return 1;
+    }
+    for(int i = 0; i < receivers; i++){
+        select_rx(multi_rx.rx[i]);
+        set_frecuency_rx(CARRIER_FEQ + CENTER_OFFSET + (fdma ? i * spacing : 0));
+        set_frequency_deviation_rx(DEVIATION);
+        set_datarate_rx(baud);
+        set_filter_bandwidth_rx(baud + 2*DEVIATION);
+    }
+    select_rx(&default_rx);
+    sleep_ms(1);
+    multi_start_listen();
+    reset_link_counters();
+
+    /* reference frames, indexed by the channel (FDMA) and the sequence number */
+    static Frame reference[MAX_RECEIVERS][256];
+    uint8_t *header_tmplate = packet_hdr_template(RECEIVER);
+    uint8_t offset = get_header_len() - 2; // the CC2500 receives the bytes after the sync word
+    uint8_t air_len = get_header_len() - offset + get_payload_size(); // in the RX FIFO, the CRC follows on the air
+    uint8_t air[CC2500_MAX_PACKET];
+    int tags = fdma ? receivers : 1;
+    uint64_t interval_us = (uint64_t) (1e6 / rate);
+    uint64_t next_sync_us[MAX_RECEIVERS];
+    uint32_t injected[MAX_RECEIVERS] = {0};
+    uint64_t start_us = time_us_64();
+    uint64_t last_sync_us = start_us;
+    for(int t = 0; t < tags; t++){
+        next_sync_us[t] = start_us + 1000 + t * interval_us / tags;
+    }
+    uint32_t delivered = 0, content_ok = 0;
+    srand(1);
+
+    bool injecting = true;
+    while(injecting || time_us_64() < last_sync_us + DRAIN_US){
+        /* inject the upcoming packets */
+        injecting = false;
+        for(int t = 0; t < tags; t++){
+            injecting |= injected[t] < packets;
+            if(injected[t] >= packets || next_sync_us[t] > time_us_64() + INJECT_HORIZON_US){
+                continue;
+            }
+            Frame *frame = &reference[t][injected[t] % 256];
+            if(fdma){
+                seek_data(injected[t] * (get_payload_size() - 2)); // every tag sends the file from the start
+            }
+            build_frame(frame, (uint8_t) injected[t], header_tmplate);
+            for(int i = 0; i < receivers; i++){
+                if(fdma && i != t){
+                    continue;
+                }
+                // every copy fails the CRC independently: a flipped bit of the payload
+                memcpy(air, &frame->bytes[offset], air_len + CRC_LEN);
+                if(uniform() < crc_error_rate){
+                    air[air_len - 1] ^= 0x01;
+                }
+                int16_t rssi = -70 + (int16_t) (20 * uniform());
+                cc2500_model_inject(&radio[i], next_sync_us[t], air, air_len + CRC_LEN, rssi);
+            }
+            last_sync_us = max(last_sync_us, next_sync_us[t]);
+            next_sync_us[t] += interval_us;
+            injected[t]++;
+        }
+
+        /* receive loop of receiver-CC2500/main.c (RECEIVERS > 1) */
+        struct multi_packet packet;
+        if(poll_multi_rx(&packet)){
+            if(verbose){
+                printf("%u | ", packet.receiver);
+                printPacket(packet.buffer, packet.status, packet.time_us);
+            }
+            delivered++;
+            if(packet.status.CRCcheck && packet.status.len == air_len){
+                Frame *ref = &reference[fdma ? packet.receiver : 0][packet.buffer[1]];
+                content_ok += memcmp(packet.buffer, &ref->bytes[offset], air_len) == 0;
+            }
+        }
+        sleep_us(10);
+    }
+    double virtual_s = (time_us_64() - start_us) / 1e6;
+    uint32_t total = 0;
+    for(int t = 0; t < tags; t++){
+        total += injected[t];
+    }
+
+    print_multi_rx(time_us_64());
+    printf("#MULTIBENCH mode=%s receivers=%d rate=%.1f payload=%u per=%.3f injected=%u delivered=%u content_ok=%u loss=%.4f single_loss=%.4f throughput_bps=%.0f virtual_s=%.3f\n",
+        fdma ? "fdma" : "diversity", receivers, rate, payload, crc_error_rate, total, delivered, content_ok,
+        1.0 - ((double) content_ok) / total, fdma ? 0.0 : 1.0 - ((double) multi_rx.crc_pass[0]) / total,
+        8.0 * content_ok * get_payload_size() / virtual_s, virtual_s);
+    print_link_counters(time_us_64());
+    char name[16];
+    for(int i = 0; i < receivers; i++){
+        snprintf(name, sizeof(name), "receiver%d", i);
+        cc2500_model_print_stats(&radio[i], name);
+    }
+    return 0;
+}
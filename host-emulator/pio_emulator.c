@@ -0,0 +1,532 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * cycle-accurate emulator of the RP2040 PIO state-machines
+ * see include/hardware/pio.h
+ *
+ * Timing follows the RP2040 datasheet (chapter 3): every instruction takes one cycle plus its delay,
+ * side-set is applied when the instruction starts (also if it stalls) and the delay only starts
+ * once the instruction completed. An OUT with autopull stalls while the OSR is empty and the TX FIFO
+ * holds no data, which sets the TXSTALL flag in FDEBUG.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+
+#define OP_JMP   0x0
+#define OP_WAIT  0x1
+#define OP_IN    0x2
+#define OP_OUT   0x3
+#define OP_PULL  0x4 // PUSH/PULL
+#define OP_MOV   0x5
+#define OP_IRQ   0x6
+#define OP_SET   0x7
+
+pio_hw_t pio0_emu;
+pio_hw_t pio1_emu;
+
+// ---------------- //
+// helper functions //
+// ---------------- //
+
+static void write_pins(PIO pio, uint8_t base, uint8_t count, uint32_t value){
+    for(uint8_t i = 0; i < count; i++){
+        uint32_t mask = 1u << ((base + i) % 32);
+        if((value >> i) & 1){
+            pio->pins |= mask;
+        }else{
+            pio->pins &= ~mask;
+        }
+    }
+}
+
+static void write_pindirs(PIO pio, uint8_t base, uint8_t count, uint32_t value){
+    for(uint8_t i = 0; i < count; i++){
+        uint32_t mask = 1u << ((base + i) % 32);
+        if((value >> i) & 1){
+            pio->pindirs |= mask;
+        }else{
+            pio->pindirs &= ~mask;
+        }
+    }
+}
+
+static uint8_t fifo_depth(struct pio_sm_state *s){
+    return (s->config.join == PIO_FIFO_JOIN_TX) ? 8 : 4;
+}
+
+static bool fifo_pop(struct pio_sm_state *s, uint32_t *data){
+    if(s->fifo_level == 0){
+        return false;
+    }
+    *data = s->fifo[s->fifo_head];
+    s->fifo_head = (s->fifo_head + 1) % 8;
+    s->fifo_level--;
+    return true;
+}
+
+static uint32_t bit_reverse(uint32_t v){
+    uint32_t r = 0;
+    for(uint8_t i = 0; i < 32; i++){
+        r = (r << 1) | ((v >> i) & 1);
+    }
+    return r;
+}
+
+/* shift bit_count bits out of the OSR */
+static uint32_t shift_out(struct pio_sm_state *s, uint8_t bit_count){
+    uint32_t data;
+    if(bit_count == 32){
+        data = s->osr;
+        s->osr = 0;
+    }else if(s->config.out_shift_right){
+        data = s->osr & ((1u << bit_count) - 1);
+        s->osr >>= bit_count;
+    }else{
+        data = s->osr >> (32 - bit_count);
+        s->osr <<= bit_count;
+    }
+    s->osr_count = (s->osr_count + bit_count > 32) ? 32 : s->osr_count + bit_count;
+    return data;
+}
+
+/* 
+ * FDEBUG is write-1-to-clear: the firmware writes the flags to clear into pio->fdebug, which is
+ * detected and applied with the next access of the emulator.
+ */
+static void sync_fdebug(PIO pio){
+    if(pio->fdebug != pio->fdebug_flags){
+        pio->fdebug_flags &= ~pio->fdebug;
+        pio->fdebug = pio->fdebug_flags;
+    }
+}
+
+static void set_fdebug(PIO pio, uint32_t flag){
+    sync_fdebug(pio);
+    pio->fdebug_flags |= flag;
+    pio->fdebug = pio->fdebug_flags;
+}
+
+static void mark_stall(PIO pio, uint sm){
+    set_fdebug(pio, 1u << (PIO_FDEBUG_TXSTALL_LSB + sm));
+}
+
+// --------- //
+// execution //
+// --------- //
+
+/* execute one instruction, returns false if the instruction stalled */
+static bool execute(PIO pio, uint sm, uint16_t instr, bool *jumped){
+    struct pio_sm_state *s = &pio->sm[sm];
+    uint8_t opcode = instr >> 13;
+    uint8_t arg1   = (instr >> 5) & 0x7;
+    uint8_t arg2   = instr & 0x1F;
+    uint32_t data;
+    *jumped = false;
+    switch(opcode){
+        case OP_JMP: {
+            bool cond = false;
+            switch(arg1){
+                case 0: cond = true; break;
+                case 1: cond = (s->x == 0); break;
+                case 2: cond = (s->x != 0); s->x--; break;
+                case 3: cond = (s->y == 0); break;
+                case 4: cond = (s->y != 0); s->y--; break;
+                case 5: cond = (s->x != s->y); break;
+                case 6: cond = false; break; // no input pins
+                case 7: cond = (s->osr_count < s->config.pull_threshold); break;
+            }
+            if(cond){
+                s->pc = arg2;
+                *jumped = true;
+            }
+            return true;
+        }
+        case OP_OUT: {
+            uint8_t bit_count = (arg2 == 0) ? 32 : arg2;
+            if(s->config.autopull && s->osr_count >= s->config.pull_threshold){
+                if(!fifo_pop(s, &s->osr)){
+                    mark_stall(pio, sm);
+                    return false;
+                }
+                s->osr_count = 0;
+            }
+            data = shift_out(s, bit_count);
+            switch(arg1){
+                case 0: write_pins(pio, s->config.out_base, s->config.out_count, data); break;
+                case 1: s->x = data; break;
+                case 2: s->y = data; break;
+                case 3: break; // null
+                case 4: write_pindirs(pio, s->config.out_base, s->config.out_count, data); break;
+                case 5: s->pc = data & 0x1F; *jumped = true; break;
+                case 6: s->isr = data; break;
+                case 7: break; // exec: not supported
+            }
+            return true;
+        }
+        case OP_PULL: {
+            if(!(instr & 0x0080)){
+                return true; // push: RX FIFO not emulated
+            }
+            bool if_empty = instr & 0x0040;
+            bool block    = instr & 0x0020;
+            if(if_empty && s->osr_count < s->config.pull_threshold){
+                return true;
+            }
+            if(!fifo_pop(s, &s->osr)){
+                if(block){
+                    mark_stall(pio, sm);
+                    return false;
+                }
+                s->osr = s->x; // non-blocking pull from an empty FIFO copies X
+            }
+            s->osr_count = 0;
+            return true;
+        }
+        case OP_MOV: {
+            uint8_t src = arg2 & 0x7;
+            uint8_t op  = (arg2 >> 3) & 0x3;
+            switch(src){
+                case 0: data = (pio->pins >> s->config.in_base) | (s->config.in_base ? (pio->pins << (32 - s->config.in_base)) : 0); break;
+                case 1: data = s->x; break;
+                case 2: data = s->y; break;
+                case 5: data = 0; break; // status
+                case 6: data = s->isr; break;
+                case 7: data = s->osr; break;
+                default: data = 0; break;
+            }
+            if(op == 1){
+                data = ~data;
+            }else if(op == 2){
+                data = bit_reverse(data);
+            }
+            switch(arg1){
+                case 0: write_pins(pio, s->config.out_base, s->config.out_count, data); break;
+                case 1: s->x = data; break;
+                case 2: s->y = data; break;
+                case 5: s->pc = data & 0x1F; *jumped = true; break;
+                case 6: s->isr = data; break;
+                case 7: s->osr = data; s->osr_count = 0; break;
+                default: break;
+            }
+            return true;
+        }
+        case OP_SET: {
+            switch(arg1){
+                case 0: write_pins(pio, s->config.set_base, s->config.set_count, arg2); break;
+                case 1: s->x = arg2; break;
+                case 2: s->y = arg2; break;
+                case 4: write_pindirs(pio, s->config.set_base, s->config.set_count, arg2); break;
+                default: break;
+            }
+            return true;
+        }
+        default: // WAIT, IN, IRQ
+            return true;
+    }
+}
+
+/* side-set of an instruction (executed by the program or by pio_sm_exec()) */
+static void apply_sideset(PIO pio, struct pio_sm_state *s, uint16_t instr){
+    uint8_t field = (instr >> 8) & 0x1F;
+    uint8_t side_bits = s->config.sideset_bits;
+    if(side_bits > 0){
+        uint8_t side = field >> (5 - side_bits);
+        uint8_t value_bits = side_bits;
+        bool enabled = true;
+        if(s->config.sideset_opt){
+            value_bits = side_bits - 1;
+            enabled = (side >> value_bits) & 1;
+            side &= (1u << value_bits) - 1;
+        }
+        if(enabled && s->config.sideset_pindirs){
+            write_pindirs(pio, s->config.sideset_base, value_bits, side);
+        }else if(enabled){
+            write_pins(pio, s->config.sideset_base, value_bits, side);
+        }
+    }
+}
+
+/* one cycle of the state-machine clock */
+static void step(PIO pio, uint sm){
+    struct pio_sm_state *s = &pio->sm[sm];
+    s->executed = PIO_EMU_NO_INSTR;
+    if(s->delay > 0){
+        s->delay--;
+        return;
+    }
+    uint16_t instr = pio->instr_mem[s->pc];
+    uint8_t field = (instr >> 8) & 0x1F;
+    uint8_t side_bits = s->config.sideset_bits;
+    // side-set takes effect at the start of the instruction, also if it stalls
+    apply_sideset(pio, s, instr);
+    bool jumped;
+    if(!execute(pio, sm, instr, &jumped)){
+        return;
+    }
+    s->executed = instr;
+    s->delay = field & ((1u << (5 - side_bits)) - 1);
+    if(!jumped){
+        s->pc = (s->pc == s->config.wrap_top) ? s->config.wrap_bottom : (s->pc + 1) % PIO_INSTRUCTION_COUNT;
+    }
+}
+
+static void tick_pio(PIO pio){
+    sync_fdebug(pio);
+    for(uint sm = 0; sm < NUM_PIO_STATE_MACHINES; sm++){
+        struct pio_sm_state *s = &pio->sm[sm];
+        if(!s->enabled){
+            continue;
+        }
+        s->clk_acc += 256;
+        if(s->clk_acc >= s->config.clkdiv){
+            s->clk_acc -= s->config.clkdiv;
+            step(pio, sm);
+        }else{
+            s->executed = PIO_EMU_NO_INSTR;
+        }
+    }
+    if(pio->trace != NULL){
+        pio->trace(pio);
+    }
+}
+
+void pio_emu_tick(){
+    tick_pio(pio0);
+    tick_pio(pio1);
+}
+
+void pio_emu_set_trace(PIO pio, void (*trace)(PIO pio)){
+    pio->trace = trace;
+    host_register_tick(pio_emu_tick);
+}
+
+// ------------------ //
+// instruction memory //
+// ------------------ //
+
+static uint32_t program_mask(const struct pio_program *program, uint offset){
+    uint32_t mask = (program->length == 32) ? 0xFFFFFFFF : ((1u << program->length) - 1);
+    return mask << offset;
+}
+
+bool pio_can_add_program_at_offset(PIO pio, const struct pio_program *program, uint offset){
+    if(offset + program->length > PIO_INSTRUCTION_COUNT || (program->origin >= 0 && program->origin != (int8_t) offset)){
+        return false;
+    }
+    return (pio->used_instr & program_mask(program, offset)) == 0;
+}
+
+static int find_offset(PIO pio, const struct pio_program *program){
+    if(program->origin >= 0){
+        return pio_can_add_program_at_offset(pio, program, program->origin) ? program->origin : -1;
+    }
+    // same search order as the SDK: highest free offset first
+    for(int offset = PIO_INSTRUCTION_COUNT - program->length; offset >= 0; offset--){
+        if(pio_can_add_program_at_offset(pio, program, offset)){
+            return offset;
+        }
+    }
+    return -1;
+}
+
+bool pio_can_add_program(PIO pio, const struct pio_program *program){
+    return find_offset(pio, program) >= 0;
+}
+
+void pio_add_program_at_offset(PIO pio, const struct pio_program *program, uint offset){
+    if(!pio_can_add_program_at_offset(pio, program, offset)){
+        printf("ERROR: no program space at offset %d\n", offset);
+        return;
+    }
+    for(uint8_t i = 0; i < program->length; i++){
+        uint16_t instr = program->instructions[i];
+        // relocate JMP targets like the SDK does
+        pio->instr_mem[offset + i] = ((instr >> 13) == OP_JMP) ? (instr + offset) : instr;
+    }
+    pio->used_instr |= program_mask(program, offset);
+}
+
+uint pio_add_program(PIO pio, const struct pio_program *program){
+    int offset = find_offset(pio, program);
+    if(offset < 0){
+        printf("ERROR: no program space\n");
+        return 0;
+    }
+    pio_add_program_at_offset(pio, program, offset);
+    return offset;
+}
+
+void pio_remove_program(PIO pio, const struct pio_program *program, uint loaded_offset){
+    pio->used_instr &= ~program_mask(program, loaded_offset);
+}
+
+void pio_clear_instruction_memory(PIO pio){
+    pio->used_instr = 0;
+    memset(pio->instr_mem, 0, sizeof(pio->instr_mem));
+}
+
+// ---------------- //
+// state-machines   //
+// ---------------- //
+
+void pio_gpio_init(PIO pio, uint pin){
+    (void) pio;
+    (void) pin;
+}
+
+int pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out){
+    (void) sm;
+    write_pindirs(pio, pin_base, pin_count, is_out ? 0xFFFFFFFF : 0);
+    return 0;
+}
+
+pio_sm_config pio_get_default_sm_config(){
+    pio_sm_config c;
+    memset(&c, 0, sizeof(c));
+    c.wrap_top = PIO_INSTRUCTION_COUNT - 1;
+    c.autopull = false;
+    c.out_shift_right = true;
+    c.pull_threshold = 32;
+    c.out_count = 32;
+    c.clkdiv = 256;
+    return c;
+}
+
+void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap){
+    c->wrap_bottom = wrap_target;
+    c->wrap_top = wrap;
+}
+
+void sm_config_set_set_pins(pio_sm_config *c, uint set_base, uint set_count){
+    c->set_base = set_base;
+    c->set_count = set_count;
+}
+
+void sm_config_set_out_pins(pio_sm_config *c, uint out_base, uint out_count){
+    c->out_base = out_base;
+    c->out_count = out_count;
+}
+
+void sm_config_set_in_pins(pio_sm_config *c, uint in_base){
+    c->in_base = in_base;
+}
+
+void sm_config_set_sideset(pio_sm_config *c, uint bit_count, bool optional, bool pindirs){
+    c->sideset_bits = bit_count;
+    c->sideset_opt = optional;
+    c->sideset_pindirs = pindirs;
+}
+
+void sm_config_set_sideset_pins(pio_sm_config *c, uint sideset_base){
+    c->sideset_base = sideset_base;
+}
+
+void sm_config_set_fifo_join(pio_sm_config *c, enum pio_fifo_join join){
+    c->join = join;
+}
+
+void sm_config_set_out_shift(pio_sm_config *c, bool shift_right, bool autopull, uint pull_threshold){
+    c->out_shift_right = shift_right;
+    c->autopull = autopull;
+    c->pull_threshold = (pull_threshold == 0) ? 32 : pull_threshold;
+}
+
+void sm_config_set_clkdiv_int_frac(pio_sm_config *c, uint16_t div_int, uint8_t div_frac){
+    c->clkdiv = (((uint32_t) div_int) << 8) | div_frac;
+}
+
+void sm_config_set_clkdiv(pio_sm_config *c, float div){
+    uint16_t div_int = (uint16_t) div;
+    sm_config_set_clkdiv_int_frac(c, div_int, (uint8_t) ((div - div_int) * 256));
+}
+
+int pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config){
+    struct pio_sm_state *s = &pio->sm[sm];
+    memset(s, 0, sizeof(*s));
+    s->config = *config;
+    s->pc = initial_pc;
+    s->osr_count = 32; // empty
+    s->executed = PIO_EMU_NO_INSTR;
+    sync_fdebug(pio);
+    pio->fdebug_flags &= ~(1u << (PIO_FDEBUG_TXSTALL_LSB + sm));
+    pio->fdebug = pio->fdebug_flags;
+    return 0;
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled){
+    pio->sm[sm].enabled = enabled;
+    if(enabled){
+        host_register_tick(pio_emu_tick);
+    }
+}
+
+void pio_sm_restart(PIO pio, uint sm){
+    struct pio_sm_state *s = &pio->sm[sm];
+    s->delay = 0;
+    s->osr_count = 32;
+    s->isr = 0;
+    s->clk_acc = 0;
+}
+
+void pio_sm_clear_fifos(PIO pio, uint sm){
+    pio->sm[sm].fifo_level = 0;
+    pio->sm[sm].fifo_head = 0;
+}
+
+void pio_sm_set_clkdiv_int_frac(PIO pio, uint sm, uint16_t div_int, uint8_t div_frac){
+    sm_config_set_clkdiv_int_frac(&pio->sm[sm].config, div_int, div_frac);
+}
+
+void pio_sm_set_wrap(PIO pio, uint sm, uint wrap_target, uint wrap){
+    sm_config_set_wrap(&pio->sm[sm].config, wrap_target, wrap);
+}
+
+void pio_sm_exec(PIO pio, uint sm, uint instr){
+    bool jumped;
+    apply_sideset(pio, &pio->sm[sm], instr);
+    execute(pio, sm, instr, &jumped);
+}
+
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t pin_values, uint32_t pin_mask){
+    pio->pins = (pio->pins & ~pin_mask) | (pin_values & pin_mask);
+}
+
+uint pio_sm_get_tx_fifo_level(PIO pio, uint sm){
+    sync_fdebug(pio);
+    return pio->sm[sm].fifo_level;
+}
+
+bool pio_sm_is_tx_fifo_empty(PIO pio, uint sm){
+    sync_fdebug(pio);
+    return pio->sm[sm].fifo_level == 0;
+}
+
+bool pio_sm_is_tx_fifo_full(PIO pio, uint sm){
+    return pio->sm[sm].fifo_level == fifo_depth(&pio->sm[sm]);
+}
+
+void pio_sm_put(PIO pio, uint sm, uint32_t data){
+    struct pio_sm_state *s = &pio->sm[sm];
+    sync_fdebug(pio);
+    if(pio_sm_is_tx_fifo_full(pio, sm)){
+        set_fdebug(pio, 1u << (PIO_FDEBUG_TXOVER_LSB + sm));
+        return;
+    }
+    s->fifo[(s->fifo_head + s->fifo_level) % 8] = data;
+    s->fifo_level++;
+}
+
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data){
+    while(pio_sm_is_tx_fifo_full(pio, sm)){
+        host_advance_cycles(1);
+    }
+    pio_sm_put(pio, sm, data);
+}
+
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx){
+    return ((pio == pio1) ? 8 : 0) + (is_tx ? 0 : 4) + sm;
+}
@@ -0,0 +1,265 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * pio_waveform: antenna waveform of the backscatter state-machine
+ *
+ * The state-machine is generated and started with backscatter_program_init() exactly as on the Pico
+ * and executed by the PIO emulator. The tool writes
+ *  - a trace of a training sequence (one byte per system clock cycle: bit 0 = antenna pin 1,
+ *    bit 1 = antenna pin 2, bit 6 = value of the symbol, bit 7 = first cycle of the symbol),
+ *  - the frames (header + payload from generate_data() or a sensor at rest, whitened with -w) which are to be simulated,
+ * and prints the modulation parameters as '#CONFIG key=value ...'. See link_simulator.py.
+ * With two antennas, the phase of pin2 relative to pin1 is measured on the full periods of every symbol
+ * and the suppression of the mirror sideband of the reflection pin1 + j*pin2 on the whole symbols:
+ * '#SIDEBAND symbol=... pin2_phase_deg=... expected_deg=... suppression_db=...'. The tool fails if the
+ * phase differs from the one of the selected sideband.
+ *
+ * usage: pio_waveform -0 <d0> -1 <d1> -b <baud> [-s | -u | -l] [-c] [-p <payload>] [-P <preamble>]
+ *                     [-S <sync>] [-w] [-a <sample>] [-n <frames>] [-t <trace file>] [-f <frames file>]
+ *   -s: single antenna (twoAntennas = false)
+ *   -u/-l: single sideband, upper/lower (pin2 lags/leads pin1 by a quarter period)
+ *   -c: continuous phase (set_continuous_phase())
+ *   -w: data whitening of the frames (set_whitening())
+ *   -a: the payload samples come from a data source which always reads this value (e.g. an ADC at rest)
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "backscatter.h"
+#include "packet_generation.h"
+
+#define PIN_TX1             6
+#define PIN_TX2            27
+#define RECEIVER         2500
+#define TRACE_CYCLES  (1 << 20) // maximal trace length
+#define MAX_PHASE_ERROR   0.5 // [degree]
+
+#define OUT_X_1_MASK   0xE0FF // ignore delay and side-set
+#define OUT_X_1        (ASM_OUT | (ASM_X_REG << 5) | 1)
+
+// all four transitions between 0 and 1 occur several times
+static uint32_t training_words[] = {0x33CC5AA5, 0x0FF0F00F, 0x96C3A55A};
+
+static uint8_t trace[TRACE_CYCLES];
+static uint32_t trace_len = 0;
+static bool trace_started = false;
+
+static void record(PIO pio){
+    struct pio_sm_state *s = &pio->sm[0];
+    bool symbol_start = (s->executed != PIO_EMU_NO_INSTR) && ((s->executed & OUT_X_1_MASK) == OUT_X_1);
+    trace_started = trace_started || symbol_start;
+    if(!trace_started || trace_len == TRACE_CYCLES){
+        return;
+    }
+    uint8_t sample = ((pio->pins >> PIN_TX1) & 1) | (((pio->pins >> PIN_TX2) & 1) << 1);
+    if(symbol_start){
+        sample |= 0x80 | ((s->x & 1) << 6);
+    }
+    trace[trace_len] = sample;
+    trace_len++;
+}
+
+/* DFT of (pin - mean) at 'cycles_per_period' within the trace [start, start+len) */
+static void pin_dft(uint32_t start, uint32_t len, uint8_t pin, double cycles_per_period, double *re, double *im){
+    double mean = 0;
+    for(uint32_t n = 0; n < len; n++){
+        mean += (trace[start + n] >> pin) & 1;
+    }
+    mean /= len;
+    for(uint32_t n = 0; n < len; n++){
+        double v = ((trace[start + n] >> pin) & 1) - mean;
+        *re += v * cos(2 * M_PI * n / cycles_per_period);
+        *im -= v * sin(2 * M_PI * n / cycles_per_period);
+    }
+}
+
+/*
+ * phase of pin2 relative to pin1 and suppression of the mirror sideband for the symbol 'value'
+ * returns false if the phase is not the expected one of the sideband
+ */
+static bool check_sideband(uint8_t value, uint16_t d, uint32_t cycles_per_symbol, enum backscatter_sideband sideband){
+    double period = 2*(d/2);                                  // cycles of a full period (high d/2, low d/2)
+    uint32_t full_periods = ((cycles_per_symbol - 4) / d) * period;
+    double p1_re = 0, p1_im = 0, p2_re = 0, p2_im = 0;      // full periods, after out x,1, branch and loading x
+    double s1_re = 0, s1_im = 0, s2_re = 0, s2_im = 0;      // whole symbols
+    uint32_t symbols = 0;
+    uint32_t previous_start = 0;
+    for(uint32_t i = 0; i + cycles_per_symbol <= trace_len; i++){
+        if(!(trace[i] & 0x80)){
+            continue;
+        }
+        bool counted = previous_start > 0 && (((trace[i] >> 6) & 1) == value); // the first symbol has no defined predecessor
+        previous_start = i + 1;
+        if(!counted){
+            continue;
+        }
+        pin_dft(i + 3, full_periods, 0, period, &p1_re, &p1_im);
+        pin_dft(i + 3, full_periods, 1, period, &p2_re, &p2_im);
+        pin_dft(i, cycles_per_symbol, 0, period, &s1_re, &s1_im);
+        pin_dft(i, cycles_per_symbol, 1, period, &s2_re, &s2_im);
+        symbols++;
+    }
+    if(symbols == 0){
+        fprintf(stderr, "ERROR: the training sequence does not contain the symbol %u\n", value);
+        return false;
+    }
+    double phase = (atan2(p2_im, p2_re) - atan2(p1_im, p1_re)) * 180 / M_PI;
+    phase = remainder(phase, 360);
+    double expected = 0;
+    if(sideband == SIDEBAND_UPPER){
+        expected = -360.0 * (d/4) / period;
+    }else if(sideband == SIDEBAND_LOWER){
+        expected = 360.0 * (d/4) / period;
+    }
+    // reflection pin1 + j*pin2: X(+f) = P1 + j*P2, X(-f) = conj(P1) + j*conj(P2)
+    double upper = hypot(s1_re - s2_im, s1_im + s2_re);
+    double lower = hypot(s1_re + s2_im, -s1_im + s2_re);
+    double wanted = (sideband == SIDEBAND_LOWER) ? lower : upper;
+    double image = (sideband == SIDEBAND_LOWER) ? upper : lower;
+    printf("#SIDEBAND symbol=%u d=%u symbols=%u pin2_phase_deg=%.2f expected_deg=%.2f suppression_db=%.1f\n",
+        value, d, symbols, phase, expected, 20 * log10(wanted / max(image, 1e-12)));
+    if(fabs(remainder(phase - expected, 360)) > MAX_PHASE_ERROR){
+        fprintf(stderr, "ERROR: the phase of pin2 (%.2f deg) does not match the sideband (%.2f deg) for the symbol %u\n", phase, expected, value);
+        return false;
+    }
+    return true;
+}
+
+/* data source reading a constant value, always half of the ring waiting */
+static uint16_t rest_ring[SOURCE_RING_SAMPLES];
+static uint16_t rest_value;
+
+static bool rest_start(struct data_source *source){
+    for(uint32_t i = 0; i < SOURCE_RING_SAMPLES; i++){
+        source->ring[i] = rest_value;
+    }
+    return true;
+}
+
+static uint32_t rest_produced(struct data_source *source){
+    return source->consumed + SOURCE_RING_SAMPLES / 2;
+}
+
+static void rest_stop(struct data_source *source){
+}
+
+static struct data_source rest_source = {.name = "rest", .start = rest_start, .produced = rest_produced, .stop = rest_stop, .ring = rest_ring};
+
+static void usage(const char *name){
+    fprintf(stderr, "usage: %s -0 <d0> -1 <d1> -b <baud> [-s | -u | -l] [-c] [-p <payload>] [-P <preamble>] [-S <sync>] [-w] [-a <sample>] [-n <frames>] [-t <trace file>] [-f <frames file>]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv){
+    uint16_t d0 = 0, d1 = 0;
+    uint32_t baud = 0;
+    bool twoAntennas = true;
+    enum backscatter_sideband sideband = SIDEBAND_BOTH;
+    bool continuousPhase = false;
+    bool whitening = false;
+    int32_t rest_sample = -1;
+    uint8_t payload = PAYLOADSIZE, preamble = PREAMBLE_LEN, sync = SYNC_LEN;
+    uint32_t frames = 0;
+    const char *trace_file = NULL, *frames_file = NULL;
+    int opt;
+    while((opt = getopt(argc, argv, "0:1:b:sulcwa:p:P:S:n:t:f:")) != -1){
+        switch(opt){
+            case '0': d0 = atoi(optarg); break;
+            case '1': d1 = atoi(optarg); break;
+            case 'b': baud = atoi(optarg); break;
+            case 's': twoAntennas = false; break;
+            case 'u': sideband = SIDEBAND_UPPER; break;
+            case 'l': sideband = SIDEBAND_LOWER; break;
+            case 'c': continuousPhase = true; break;
+            case 'w': whitening = true; break;
+            case 'a': rest_sample = strtol(optarg, NULL, 0); break;
+            case 'p': payload = atoi(optarg); break;
+            case 'P': preamble = atoi(optarg); break;
+            case 'S': sync = atoi(optarg); break;
+            case 'n': frames = atoi(optarg); break;
+            case 't': trace_file = optarg; break;
+            case 'f': frames_file = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+    if(d0 == 0 || d1 == 0 || baud == 0){
+        usage(argv[0]);
+    }
+    if(!set_payload_size(payload) || !set_framing(preamble, sync) || !set_sideband(sideband) || !set_continuous_phase(continuousPhase)){
+        return 1;
+    }
+    set_whitening(whitening);
+    if(rest_sample >= 0){
+        rest_value = (uint16_t) rest_sample;
+        if(!set_data_source(&rest_source)){
+            return 1;
+        }
+    }
+
+    /* setup backscatter state machine */
+    PIO pio = pio0;
+    uint sm = 0;
+    struct backscatter_config backscatter_conf;
+    uint16_t instructionBuffer[32] = {0}; // maximal instruction size: 32
+    struct pio_program program;
+    struct backscatter_layout layout;
+    if(!generatePIOprogram(d0, d1, baud, instructionBuffer, &program, twoAntennas, &layout)){
+        return 1;
+    }
+    pio_emu_set_trace(pio, record);
+    if(!backscatter_program_init(pio, sm, PIN_TX1, PIN_TX2, d0, d1, baud, &backscatter_conf, instructionBuffer, twoAntennas)){
+        return 1;
+    }
+
+    /* training sequence: send it and wait until the state-machine stalls at the next symbol */
+    uint32_t words = sizeof(training_words)/sizeof(training_words[0]);
+    backscatter_send_nowait(pio, sm, training_words, words);
+    uint32_t stall_mask = 1u << (PIO_FDEBUG_TXSTALL_LSB + sm);
+    pio->fdebug = stall_mask;
+    while(!pio_sm_is_tx_fifo_empty(pio, sm) || !(pio->fdebug & stall_mask)){
+        tight_loop_contents();
+    }
+    if(trace_file != NULL){
+        FILE *f = fopen(trace_file, "wb");
+        if(f == NULL || fwrite(trace, 1, trace_len, f) != trace_len){
+            fprintf(stderr, "ERROR: could not write %s\n", trace_file);
+            return 1;
+        }
+        fclose(f);
+    }
+
+    /* frames to be simulated */
+    uint8_t *header_tmplate = packet_hdr_template(RECEIVER);
+    uint8_t frame_bytes = 4*buffer_size(get_payload_size() + CRC_LEN, get_header_len());
+    if(frames_file != NULL){
+        FILE *f = fopen(frames_file, "wb");
+        if(f == NULL){
+            fprintf(stderr, "ERROR: could not write %s\n", frames_file);
+            return 1;
+        }
+        Frame frame;
+        for(uint32_t i = 0; i < frames; i++){
+            build_frame(&frame, (uint8_t) i, header_tmplate);
+            fwrite(frame.bytes, 1, frame_bytes, f);
+        }
+        fclose(f);
+    }
+
+    printf("#CONFIG d0=%u d1=%u baud=%u two_antennas=%d sideband=%d continuous_phase=%d half_periods0=%u half_periods1=%u center_offset=%u deviation=%u min_rx_bw=%u clock=%u cycles_per_symbol=%u header_len=%u payload=%u frame_bytes=%u whitening=%d trace_symbols=%u program_length=%u\n",
+        d0, d1, backscatter_conf.baudrate, twoAntennas, sideband, continuousPhase, layout.half_periods[0], layout.half_periods[1], backscatter_conf.center_offset, backscatter_conf.deviation, backscatter_conf.minRxBw,
+        HOST_CLOCK_HZ, HOST_CLOCK_HZ / backscatter_conf.baudrate, get_header_len(), get_payload_size(), frame_bytes, whitening, 32*words, program.length);
+    if(twoAntennas){
+        uint32_t cycles_per_symbol = HOST_CLOCK_HZ / backscatter_conf.baudrate;
+        bool ok = check_sideband(0, d0, cycles_per_symbol, sideband);
+        ok = check_sideband(1, d1, cycles_per_symbol, sideband) && ok;
+        if(!ok){
+            return 1;
+        }
+    }
+    return 0;
+}
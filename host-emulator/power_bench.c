@@ -0,0 +1,185 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * power_bench: adaptive carrier power (power_control.c) against a fixed carrier power
+ *
+ * Two CC2500 models share SPI0: the carrier (CARRIER_CSN) and the receiver (RX_CSN). The output power of every
+ * carrier on-period is read back from the PATABLE of the carrier model. The backscattered signal reaches the receiver
+ * with the RSSI -r at +1 dBm and follows the carrier power dB per dB, as does the carrier leaking into the receiver
+ * on the same board (-c at +1 dBm). A packet is lost with
+ *  - 1 / (1 + exp((RSSI - SENSITIVITY_DBM) / 2)) (weak signal, half of them without sync word) and
+ *  - 1 / (1 + exp((BLOCKING_DBM - leakage) / 2)) (the receiver is desensitized by the leakage, CRC error).
+ * With -m the tag moves after that many packets and the RSSI at +1 dBm becomes -R. Every carrier on-period carries
+ * one frame (same timing as send_frame()/receive_packet() of carrier-receiver-baseband/main.c). All times are virtual.
+ *
+ * usage: power_bench [-n <packets>] [-r <rssi dBm>] [-c <leakage dBm>] [-m <packets> -R <rssi dBm>] [-f <fixed level>] [-l <start level>] [-w <window>] [-p <payload>] [-b <baud>] [-g <gap ms>] [-i <print interval>]
+ *
+ * Output: '#POWERSTEP'/'#POWER' of the power control (every -i packets) and '#POWERBENCH key=value ...'.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "pico/stdlib.h"
+#include "hardware/spi.h"
+#include "receiver_CC2500.h"
+#include "carrier_CC2500.h"
+#include "packet_generation.h"
+#include "link_counters.h"
+#include "power_control.h"
+#include "cc2500_model.h"
+
+#define CARRIER_FEQ     2450000000
+#define CENTER_OFFSET      3298611
+#define DEVIATION           173611
+#define RECEIVER              2500
+#define SENSITIVITY_DBM        -88
+#define BLOCKING_DBM           -30
+#define CARRIER_START_US      1000
+#define RX_FINISH_US          3000
+#define RX_TIMEOUT_US         2000
+
+static struct cc2500_model carrier, radio;
+
+// output power of the carrier model: the PATABLE entry written by set_power_level_tx()
+static int8_t carrier_dbm(){
+    for(uint8_t i = 0; i < TX_POWER_LEVELS; i++){
+        if(TX_power[i].RegisterValue == carrier.patable[0]){
+            return TX_power[i].TX_power_dbm;
+        }
+    }
+    return -55;
+}
+
+static double logistic(double x){
+    return 1.0 / (1.0 + exp(x / 2.0));
+}
+
+static void usage(const char *name){
+    fprintf(stderr, "usage: %s [-n <packets>] [-r <rssi dBm>] [-c <leakage dBm>] [-m <packets> -R <rssi dBm>] [-f <fixed level>] [-l <start level>] [-w <window>] [-p <payload>] [-b <baud>] [-g <gap ms>] [-i <print interval>]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv){
+    uint32_t packets = 4000;
+    double rssi_max = -35, leakage_max = -25, rssi_moved = -35;
+    uint32_t move_at = 0;
+    int fixed = -1;
+    uint8_t start_level = TX_POWER_MAX_LEVEL;
+    uint16_t window = 50;
+    uint8_t payload = 20;
+    uint32_t baud = 200000;
+    uint32_t gap_ms = 5;
+    uint32_t interval = 500;
+    int opt;
+    while((opt = getopt(argc, argv, "n:r:c:m:R:f:l:w:p:b:g:i:")) != -1){
+        switch(opt){
+            case 'n': packets = atoi(optarg); break;
+            case 'r': rssi_max = atof(optarg); break;
+            case 'c': leakage_max = atof(optarg); break;
+            case 'm': move_at = atoi(optarg); break;
+            case 'R': rssi_moved = atof(optarg); break;
+            case 'f': fixed = atoi(optarg); break;
+            case 'l': start_level = atoi(optarg); break;
+            case 'w': window = atoi(optarg); break;
+            case 'p': payload = atoi(optarg); break;
+            case 'b': baud = atoi(optarg); break;
+            case 'g': gap_ms = atoi(optarg); break;
+            case 'i': interval = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if(!set_payload_size(payload) || fixed > TX_POWER_MAX_LEVEL || interval == 0){
+        usage(argv[0]);
+    }
+    stdio_init_all();
+    spi_init(RADIO_SPI, 5 * 1000000);
+    gpio_init(RX_CSN);
+    gpio_set_dir(RX_CSN, GPIO_OUT);
+    gpio_put(RX_CSN, 1);
+    gpio_init(CARRIER_CSN);
+    gpio_set_dir(CARRIER_CSN, GPIO_OUT);
+    gpio_put(CARRIER_CSN, 1);
+    cc2500_model_init(&carrier, RADIO_SPI, CARRIER_CSN, -1);
+    cc2500_model_init(&radio, RADIO_SPI, RX_CSN, RX_GDO0_PIN);
+
+    setupCarrier();
+    set_frecuency_tx(CARRIER_FEQ);
+    setupReceiver();
+    set_frecuency_rx(CARRIER_FEQ + CENTER_OFFSET);
+    set_frequency_deviation_rx(DEVIATION);
+    set_datarate_rx(baud);
+    set_filter_bandwidth_rx(baud + 2*DEVIATION);
+    sleep_ms(1);
+    RX_start_listen();
+    reset_link_counters();
+    if(fixed >= 0){
+        set_power_level_tx(fixed);
+    }else if(!setup_power_control(start_level, 0, TX_POWER_MAX_LEVEL, window, time_us_64())){
+        return 1;
+    }
+
+    uint8_t *header_tmplate = packet_hdr_template(RECEIVER);
+    uint8_t air_offset = get_header_len() - 2;
+    uint8_t air_len = 2 + get_payload_size() + CRC_LEN;
+    uint8_t air[CC2500_MAX_PACKET];
+    srand(1);
+    uint8_t buffer[RX_BUFFER_SIZE];
+    uint8_t seq = 0;
+    uint32_t correct = 0;
+    double dbm_sum = 0;
+    uint64_t start_us = time_us_64();
+    for(uint32_t k = 0; k < packets; k++){
+        /* the link of this on-period */
+        double dbm = carrier_dbm();
+        double rssi = ((move_at > 0 && k >= move_at) ? rssi_moved : rssi_max) + dbm - 1;
+        double leakage = leakage_max + dbm - 1;
+        double p_weak = logistic(rssi - SENSITIVITY_DBM);
+        double p_block = logistic(BLOCKING_DBM - leakage);
+        double u = rand() / (RAND_MAX + 1.0);
+        bool sync = u >= p_weak / 2;
+        bool crc_ok = u >= p_weak && (rand() / (RAND_MAX + 1.0)) >= p_block;
+        dbm_sum += dbm;
+
+        /* send_frame() and receive_packet() */
+        Frame *frame = frame_arena_next();
+        build_frame(frame, seq++, header_tmplate);
+        startCarrier();
+        uint64_t sync_us = time_us_64() + CARRIER_START_US + (uint64_t) (get_header_len() - 2) * 8 * 1000000 / baud;
+        if(sync){
+            // a weak or blocked packet has a bit error: the receiver fails the CRC
+            memcpy(air, &frame->bytes[air_offset], air_len);
+            if(!crc_ok){
+                air[air_len - CRC_LEN - 1] ^= 0x01;
+            }
+            cc2500_model_inject(&radio, sync_us, air, air_len, (int16_t) lround(rssi));
+        }
+        link_counters.packets_sent++;
+        sleep_us(CARRIER_START_US + (uint64_t) 4 * frame->len_words * 8 * 1000000 / baud + RX_FINISH_US);
+        stopCarrier();
+        absolute_time_t timeout = make_timeout_time_us(RX_TIMEOUT_US);
+        while(!time_reached(timeout)){
+            if(get_event() == rx_deassert_evt){
+                Packet_status status = readPacket(buffer);
+                RX_start_listen();
+                correct += status.CRCcheck && !status.overflowed;
+                power_control_packet(buffer, status, get_payload_size());
+                break;
+            }
+            sleep_us(10);
+        }
+        update_power_control(time_us_64(), get_payload_size());
+        if(fixed < 0 && (k + 1) % interval == 0){
+            print_power_control(time_us_64());
+        }
+        sleep_ms(gap_ms);
+    }
+    uint64_t duration_us = time_us_64() - start_us;
+    printf("#POWERBENCH mode=%s rssi_max=%.0f leakage_max=%.0f packets=%u correct=%u per=%.4f goodput_bps=%.0f mean_dbm=%.1f level=%u\n",
+        (fixed >= 0) ? "fixed" : "adaptive", rssi_max, leakage_max, packets, correct, 1.0 - ((double) correct) / packets,
+        8.0 * correct * get_payload_size() * 1000000.0 / duration_us, dbm_sum / packets, power_level_tx());
+    return 0;
+}
@@ -0,0 +1,319 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * rx_bench: receive path of the firmware against the CC2500 model
+ *
+ * The receiver is configured and operated with the functions of receiver_CC2500.c (same loop as
+ * receiver-CC2500/main.c) while packets (header + generate_data() payload) are injected into the
+ * CC2500 model at a fixed rate. All times are virtual, i.e. the benchmark runs as fast as the host
+ * allows and is deterministic.
+ *
+ * usage: rx_bench [-r <packets/s>] [-n <packets>] [-p <payload>] [-b <baud>] [-e <CRC error rate>] [-H <channels>] [-C]
+ *                 [-f <offset Hz>[,<drift Hz/s>[,<FREQEST noise Hz>]]] [-T] [-x <bit error rate>] [-a] [-S <samples/s>] [-W] [-B] [-v]
+ *   -e: flip a bit of the payload with this probability (the packet fails the CRC)
+ *   -H: hop to the next of <channels> calibrated channels before every re-arm (setup_channels_rx/hop_rx)
+ *   -C: with -H, retune with set_frecuency_rx() instead, i.e. calibrate at every hop
+ *   -f: carrier frequency offset of the injected packets
+ *       (the filter bandwidth gets a margin of OFFSET_MARGIN on both sides)
+ *   -T: track the offset with FREQEST and compensate it in FSCTRL0 (set_offset_tracking_rx), narrow the filter
+ *       to tracked_bandwidth_rx() after OFFSET_NARROW_PACKETS packets and widen it again after OFFSET_LOST_PACKETS
+ *       packets without a complete frame
+ *   -x: flip the bits after the length byte (incl. the CRC) with this probability (a packet with bit errors fails the CRC)
+ *   -a: analyze the packets on the receiver (analyze_packet()) instead of printing them with -v
+ *   -S: take the payloads from the synthetic data source at this sample rate (synthetic_source()), a packet slot
+ *       without enough samples stays empty (as the tag waits for source_ready())
+ *   -W: whiten the frames (set_whitening()) and de-whiten them on the receiver (set_whitening_rx())
+ *   -B: burst listening (stay in RX after a packet, no re-arm)
+ *   -v: print the received packets
+ *
+ * rx_ready_mean_us is the time from entering RX until the model is ready to receive (calibration and settling).
+ *
+ * Output: '#RXBENCH key=value ...', the link counters ('#CNT') and the model statistics ('#CC2500'), with -f also
+ * '#OFFSET' of the receiver and '#OFFSETBENCH' with the true offset, the estimate and the residual after the compensation,
+ * with -a also '#LQ' of the receiver and '#LQBENCH' with the injected bit errors within the file index and data,
+ * with -S also '#SOURCE' of the data source and '#SOURCEBENCH' with the empty packet slots.
+ *
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "pico/stdlib.h"
+#include "pico/util/queue.h"
+#include "hardware/spi.h"
+#include "receiver_CC2500.h"
+#include "packet_generation.h"
+#include "link_counters.h"
+#include "link_quality.h"
+#include "profiling.h"
+#include "cc2500_model.h"
+
+#define CARRIER_FEQ     2450000000
+#define CENTER_OFFSET      3298611
+#define DEVIATION           173611
+#define HOP_SPACING        1000000 // channel spacing of -H [Hz]
+#define OFFSET_MARGIN       100000 // filter margin for the offset of -f before it is tracked [Hz]
+#define OFFSET_NARROW_PACKETS   64 // -T: narrow the filter after this many tracked packets
+#define OFFSET_LOST_PACKETS     16 // -T: widen the narrowed filter after this many packet intervals without a complete frame
+#define RECEIVER              2500
+#define INJECT_HORIZON_US    20000 // inject packets this far ahead of the virtual time
+#define DRAIN_US             50000 // keep running after the last packet
+
+static double wall_seconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static void usage(const char *name){
+    fprintf(stderr, "usage: %s [-r <packets/s>] [-n <packets>] [-p <payload>] [-b <baud>] [-e <CRC error rate>] [-H <channels>] [-C] [-f <offset Hz>[,<drift Hz/s>[,<FREQEST noise Hz>]]] [-T] [-x <bit error rate>] [-a] [-S <samples/s>] [-W] [-B] [-v]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv){
+    double rate = 100;
+    uint32_t packets = 10000;
+    uint8_t payload = PAYLOADSIZE;
+    uint32_t baud = 200000;
+    double crc_error_rate = 0.0;
+    bool burst = false, verbose = false, recalibrate = false, tracking = false, analysis = false, whitening = false;
+    double bit_error_rate = 0.0;
+    uint32_t sample_rate = 0;
+    int channels = 0;
+    double offset_hz = 0.0, drift_hz_per_s = 0.0, offset_noise_hz = 0.0;
+    int opt;
+    while((opt = getopt(argc, argv, "r:n:p:b:e:H:Cf:Tx:aS:WBv")) != -1){
+        switch(opt){
+            case 'r': rate = atof(optarg); break;
+            case 'n': packets = atoi(optarg); break;
+            case 'p': payload = atoi(optarg); break;
+            case 'b': baud = atoi(optarg); break;
+            case 'e': crc_error_rate = atof(optarg); break;
+            case 'H': channels = atoi(optarg); break;
+            case 'C': recalibrate = true; break;
+            case 'f':
+                if(sscanf(optarg, "%lf,%lf,%lf", &offset_hz, &drift_hz_per_s, &offset_noise_hz) < 1){
+                    usage(argv[0]);
+                }
+                break;
+            case 'T': tracking = true; break;
+            case 'x': bit_error_rate = atof(optarg); break;
+            case 'a': analysis = true; break;
+            case 'S': sample_rate = atoi(optarg); break;
+            case 'W': whitening = true; break;
+            case 'B': burst = true; break;
+            case 'v': verbose = true; break;
+            default: usage(argv[0]);
+        }
+    }
+    if(rate <= 0 || !set_payload_size(payload) || channels < 0 || channels > RX_MAX_CHANNELS || (channels > 0 && burst)){
+        usage(argv[0]);
+    }
+    stdio_init_all();
+    spi_init(RADIO_SPI, 5 * 1000000); // SPI0 at 5MHz.
+    gpio_init(RX_CSN);
+    gpio_set_dir(RX_CSN, GPIO_OUT);
+    gpio_put(RX_CSN, 1);
+
+    static struct cc2500_model radio;
+    cc2500_model_init(&radio, RADIO_SPI, RX_CSN, RX_GDO0_PIN);
+    cc2500_model_set_offset(&radio, offset_hz, drift_hz_per_s, offset_noise_hz);
+    PROFILE_INIT();
+
+    /* receiver setup as in receiver-CC2500/main.c */
+    event_t evt = no_evt;
+    Packet_status status;
+    uint8_t buffer[RX_BUFFER_SIZE];
+    setupReceiver();
+    set_frecuency_rx(CARRIER_FEQ + CENTER_OFFSET);
+    set_frequency_deviation_rx(DEVIATION);
+    set_datarate_rx(baud);
+    uint32_t signal_bw = baud + 2*DEVIATION;
+    bool offset_run = offset_hz != 0.0 || drift_hz_per_s != 0.0 || tracking;
+    uint32_t filter_bw = offset_run ? signal_bw + 2*OFFSET_MARGIN : signal_bw;
+    set_filter_bandwidth_rx(filter_bw);
+    uint32_t f_carriers[RX_MAX_CHANNELS], f_devs[RX_MAX_CHANNELS];
+    for(int c = 0; c < channels; c++){
+        f_carriers[c] = CARRIER_FEQ + CENTER_OFFSET + c * HOP_SPACING;
+        f_devs[c] = DEVIATION;
+    }
+    if(channels > 0 && !recalibrate){
+        setup_channels_rx(f_carriers, f_devs, channels);
+    }
+    set_offset_tracking_rx(tracking);
+    set_whitening_rx(whitening);
+    set_whitening(whitening);
+    sleep_ms(1);
+    if(burst){
+        RX_start_burst_listen();
+    }else{
+        RX_start_listen();
+    }
+    reset_link_counters();
+    reset_link_quality(time_us_64());
+
+    /* reference frames, indexed by the sequence number */
+    static Frame reference[256];
+    uint8_t *header_tmplate = packet_hdr_template(RECEIVER);
+    uint8_t offset = get_header_len() - 2; // the CC2500 receives the bytes after the sync word
+    uint8_t air_len = get_header_len() - offset + get_payload_size(); // in the RX FIFO, the CRC follows on the air
+    uint64_t interval_us = (uint64_t) (1e6 / rate);
+    uint64_t next_sync_us = time_us_64() + 1000;
+    uint64_t last_sync_us = next_sync_us;
+    uint32_t injected = 0, received = 0, crc_pass = 0, content_ok = 0, rearms = 0;
+    uint64_t rearm_total_us = 0, rearm_max_us = 0, events = 0, ready_total_cycles = 0;
+    uint32_t hops = 0;
+    uint32_t injected_bit_errors = 0, injected_packet_errors = 0;
+    uint32_t idle_slots = 0;
+    uint8_t air[CC2500_MAX_PACKET];
+    bool narrowed = false;
+    uint32_t widened = 0;
+    uint64_t pass_us = time_us_64();
+    uint64_t start_us = time_us_64();
+    srand(1);
+    if(sample_rate > 0){
+        set_data_source(synthetic_source(sample_rate));
+    }
+    double wall_start = wall_seconds();
+
+    while(injected < packets || cc2500_model_pending(&radio) > 0 || time_us_64() < last_sync_us + DRAIN_US){
+        /* inject the upcoming packets */
+        while(injected < packets && next_sync_us <= time_us_64() + INJECT_HORIZON_US && cc2500_model_pending(&radio) < CC2500_MAX_PENDING){
+            if(!source_ready()){
+                // the tag waits for the samples of the next frame
+                idle_slots++;
+                next_sync_us += interval_us;
+                continue;
+            }
+            Frame *frame = &reference[injected % 256];
+            build_frame(frame, (uint8_t) injected, header_tmplate);
+            memcpy(air, &frame->bytes[offset], air_len + CRC_LEN);
+            uint32_t flipped = 0;
+            if((rand() / (RAND_MAX + 1.0)) < crc_error_rate){
+                air[air_len - 1] ^= 0x01;
+                flipped++;
+                injected_bit_errors++;
+            }
+            for(uint16_t bit = 8; bit_error_rate > 0 && bit < 8 * (air_len + CRC_LEN); bit++){
+                if((rand() / (RAND_MAX + 1.0)) < bit_error_rate){
+                    air[bit / 8] ^= 0x80 >> (bit % 8);
+                    flipped++;
+                    injected_bit_errors += bit >= 8 * 2 && bit < 8 * air_len; // file index and data (compared by analyze_packet())
+                }
+            }
+            injected_packet_errors += flipped > 0;
+            cc2500_model_inject(&radio, next_sync_us, air, air_len + CRC_LEN, -60);
+            last_sync_us = next_sync_us;
+            next_sync_us += interval_us;
+            injected++;
+        }
+
+        /* receive loop of receiver-CC2500/main.c */
+        evt = get_event();
+        switch(evt){
+            case rx_assert_evt:
+                // started receiving
+                events++;
+            break;
+            case rx_deassert_evt:
+                // finished receiving
+                events++;
+                uint64_t time_us = to_us_since_boot(get_absolute_time());
+                status = readPacket(buffer);
+                if(analysis){
+                    analyze_packet(buffer, status, get_payload_size());
+                }else if(verbose){
+                    printPacket(buffer,status,time_us);
+                }
+                if(!status.overflowed && status.len >= 2){
+                    received++;
+                    crc_pass += status.CRCcheck;
+                    pass_us = (status.len == air_len && buffer[0] == air_len - 1) ? time_us_64() : pass_us; // a complete frame, as main.c
+                    // the reference as sent, de-whitened as by the radio
+                    memcpy(air, &reference[buffer[1]].bytes[offset], air_len);
+                    if(whitening){
+                        whiten(air, air_len);
+                    }
+                    content_ok += (status.len == air_len) && (memcmp(buffer, air, air_len) == 0);
+                }
+                if(tracking && !narrowed && selected_rx()->offset_tracking.packets >= OFFSET_NARROW_PACKETS){
+                    filter_bw = tracked_bandwidth_rx(signal_bw);
+                    set_filter_bandwidth_rx(filter_bw); // enters IDLE
+                    narrowed = true;
+                    if(burst){
+                        RX_start_burst_listen(); // also applies the compensation
+                    }
+                }
+                if(!burst){
+                    uint64_t rearm_start = time_us_64();
+                    if(channels > 0){
+                        // the packets are received on every channel, the model does not filter by frequency
+                        hops++;
+                        if(recalibrate){
+                            set_frecuency_rx(f_carriers[hops % channels]);
+                            RX_start_listen();
+                        }else{
+                            hop_rx(hops % channels);
+                            RX_start_listen_nowait(); // as hop_next() of the firmware
+                        }
+                    }else{
+                        RX_start_listen();
+                    }
+                    ready_total_cycles += radio.rx_ready_cycle - radio.rx_entry_cycle;
+                    uint64_t rearm_us = time_us_64() - rearm_start;
+                    rearm_total_us += rearm_us;
+                    rearm_max_us = max(rearm_max_us, rearm_us);
+                    rearms++;
+                }
+            break;
+            case no_evt:
+                if(tracking && narrowed && time_us_64() - pass_us > OFFSET_LOST_PACKETS * interval_us){
+                    // as main.c of carrier-receiver-baseband: the compensation is kept and converges anew
+                    selected_rx()->offset_tracking.packets = 0;
+                    filter_bw = signal_bw + 2*OFFSET_MARGIN;
+                    set_filter_bandwidth_rx(filter_bw);
+                    if(burst){
+                        RX_start_burst_listen();
+                    }else{
+                        RX_start_listen();
+                    }
+                    narrowed = false;
+                    widened++;
+                    pass_us = time_us_64();
+                }
+            break;
+        }
+        sleep_us(10);
+    }
+    double wall = wall_seconds() - wall_start;
+    double virtual_s = (time_us_64() - start_us) / 1e6;
+
+    printf("#RXBENCH rate=%.1f baud=%" PRIu32 " payload=%u burst=%d channels=%d recalibrate=%d hops=%" PRIu32 " injected=%" PRIu32 " received=%" PRIu32 " crc_pass=%" PRIu32 " content_ok=%" PRIu32 " loss=%.4f events_per_s=%.1f rearm_mean_us=%.1f rearm_max_us=%" PRIu64 " rx_ready_mean_us=%.1f virtual_s=%.3f wall_s=%.3f speedup=%.1f\n",
+        rate, baud, payload, burst, channels, recalibrate, hops, injected, received, crc_pass, content_ok, 1.0 - ((double) content_ok) / injected,
+        events / virtual_s, rearms ? ((double) rearm_total_us) / rearms : 0.0, rearm_max_us,
+        rearms ? ((double) ready_total_cycles) / rearms / (HOST_CLOCK_HZ / 1000000) : 0.0, virtual_s, wall, virtual_s / wall);
+    print_link_counters(time_us_64());
+    if(analysis){
+        print_link_quality(time_us_64());
+        printf("#LQBENCH injected=%" PRIu32 " injected_packet_errors=%" PRIu32 " injected_bit_errors=%" PRIu32 "\n", injected, injected_packet_errors, injected_bit_errors);
+    }
+    if(sample_rate > 0){
+        print_data_source(time_us_64());
+        printf("#SOURCEBENCH sample_rate=%" PRIu32 " samples_per_packet=%u idle_slots=%" PRIu32 "\n", sample_rate, (get_payload_size() - 2) / 2, idle_slots);
+    }
+    if(offset_run){
+        print_offset_tracking_rx(time_us_64());
+        double true_offset = cc2500_model_offset(&radio);
+        double freqoff_hz = selected_rx()->offset_tracking.freqoff * FREQEST_STEP_HZ;
+        printf("#OFFSETBENCH true_offset_hz=%.0f estimate_hz=%" PRId32 " freqoff_hz=%.0f residual_hz=%.0f filter_bw=%" PRIu32 " signal_bw=%" PRIu32 " widened=%" PRIu32 "\n",
+            true_offset, offset_hz_rx(), freqoff_hz, true_offset - freqoff_hz, filter_bw, signal_bw, widened);
+    }
+    cc2500_model_print_stats(&radio, "receiver");
+#if PROFILING
+    profile_dump();
+#endif
+    return 0;
+}
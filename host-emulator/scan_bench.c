@@ -0,0 +1,149 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * scan_bench: spectrum scan of receiver_CC2500.c against the CC2500 model
+ *
+ * The receiver sweeps [f_start, f_stop] with setup_scan_rx()/scan_rx() while the model reports the noise floor and
+ * the configured interferers in its RSSI register. The max-hold over all sweeps is streamed as a '#SPECTRUM' record
+ * and selects the carrier and subcarrier with the least interference among the candidates of
+ * carrier-receiver-baseband/main.c (select_channel_rx()). All times are virtual.
+ *
+ * usage: scan_bench [-s <f_start MHz>] [-e <f_stop MHz>] [-t <f_step kHz>] [-w <filter bandwidth kHz>] [-d <dwell us>]
+ *                   [-n <sweeps>] [-i <f MHz>,<bandwidth MHz>,<dBm>] [-H] [-v]
+ *   -i: add an interferer (can be repeated), default: Wi-Fi channels 1 and 6 and a narrowband source at 2453.3 MHz
+ *   -H: select the carrier for hopping over all subcarriers (select_carrier_rx(), the worst subcarrier counts)
+ *   -v: stream every sweep
+ *
+ * Output: '#SCANBENCH key=value ...', the '#SPECTRUM' record of the max-hold and '#SELECT key=value ...'.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "pico/stdlib.h"
+#include "hardware/spi.h"
+#include "hardware/pio.h"
+#include "backscatter.h"
+#include "receiver_CC2500.h"
+#include "cc2500_model.h"
+
+#define CARRIER_FEQ     2450000000
+
+/* candidates of carrier-receiver-baseband/main.c */
+static const uint32_t scan_carriers[] = {2405000000, 2425000000, 2450000000, 2475000000};
+static const uint16_t hop_dividers[][2] = {{40, 36}, {32, 30}, {26, 24}, {46, 40}};
+
+static void usage(const char *name){
+    fprintf(stderr, "usage: %s [-s <f_start MHz>] [-e <f_stop MHz>] [-t <f_step kHz>] [-w <filter bandwidth kHz>] [-d <dwell us>] [-n <sweeps>] [-i <f MHz>,<bandwidth MHz>,<dBm>] [-H] [-v]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv){
+    double f_start = 2400.0, f_stop = 2483.5, f_step = 405.0, bw = 406.25;
+    uint32_t dwell_us = 250;
+    int sweeps = 20;
+    bool verbose = false, hopping_all = false;
+    static struct cc2500_model radio;
+    struct cc2500_interferer interferers[CC2500_MAX_INTERFERERS];
+    uint8_t interferer_count = 0;
+    int opt;
+    while((opt = getopt(argc, argv, "s:e:t:w:d:n:i:Hv")) != -1){
+        switch(opt){
+            case 's': f_start = atof(optarg); break;
+            case 'e': f_stop = atof(optarg); break;
+            case 't': f_step = atof(optarg); break;
+            case 'w': bw = atof(optarg); break;
+            case 'd': dwell_us = atoi(optarg); break;
+            case 'n': sweeps = atoi(optarg); break;
+            case 'i':
+                if(interferer_count == CC2500_MAX_INTERFERERS || sscanf(optarg, "%lf,%lf,%lf", &interferers[interferer_count].f_center,
+                        &interferers[interferer_count].bandwidth, &interferers[interferer_count].power_dbm) != 3){
+                    usage(argv[0]);
+                }
+                interferers[interferer_count].f_center *= 1e6;
+                interferers[interferer_count].bandwidth *= 1e6;
+                interferer_count++;
+                break;
+            case 'H': hopping_all = true; break;
+            case 'v': verbose = true; break;
+            default: usage(argv[0]);
+        }
+    }
+    uint32_t points = (uint32_t) ((f_stop - f_start) * 1000.0 / f_step) + 1;
+    if(sweeps < 1 || f_stop < f_start || points > SCAN_MAX_POINTS){
+        usage(argv[0]);
+    }
+    if(interferer_count == 0){
+        interferers[interferer_count++] = (struct cc2500_interferer){.f_center = 2412e6, .bandwidth = 20e6, .power_dbm = -50};
+        interferers[interferer_count++] = (struct cc2500_interferer){.f_center = 2437e6, .bandwidth = 20e6, .power_dbm = -55};
+        interferers[interferer_count++] = (struct cc2500_interferer){.f_center = 2453.3e6, .bandwidth = 1e6, .power_dbm = -65};
+    }
+    stdio_init_all();
+    spi_init(RADIO_SPI, 5 * 1000000); // SPI0 at 5MHz.
+    gpio_init(RX_CSN);
+    gpio_set_dir(RX_CSN, GPIO_OUT);
+    gpio_put(RX_CSN, 1);
+    cc2500_model_init(&radio, RADIO_SPI, RX_CSN, RX_GDO0_PIN);
+    for(uint8_t i = 0; i < interferer_count; i++){
+        cc2500_model_add_interferer(&radio, interferers[i].f_center, interferers[i].bandwidth, interferers[i].power_dbm);
+    }
+
+    /* subcarrier candidates: the programs of the hopping channels */
+    static struct backscatter_hopping hopping;
+    if(!backscatter_hopping_init(pio0, 0, 6, 27, hop_dividers, count_of(hop_dividers), 200000, &hopping, true)){
+        return 1;
+    }
+
+    /* scan */
+    setupReceiver();
+    set_filter_bandwidth_rx((uint32_t) (bw * 1000.0));
+    uint64_t setup_start = time_us_64();
+    if(!setup_scan_rx((uint32_t) (f_start * 1e6), (uint32_t) (f_step * 1000.0), points, dwell_us)){
+        return 1;
+    }
+    uint64_t setup_us = time_us_64() - setup_start;
+    static int8_t rssi[SCAN_MAX_POINTS], max_hold[SCAN_MAX_POINTS];
+    uint64_t scan_start = time_us_64();
+    for(int s = 0; s < sweeps; s++){
+        scan_rx(rssi);
+        for(uint16_t i = 0; i < points; i++){
+            max_hold[i] = (s == 0) ? rssi[i] : max(max_hold[i], rssi[i]);
+        }
+        if(verbose){
+            print_spectrum_rx(rssi, time_us_64());
+        }
+    }
+    uint64_t scan_us = time_us_64() - scan_start;
+    end_scan_rx();
+    printf("#SCANBENCH points=%u sweeps=%d dwell_us=%u setup_ms=%.1f sweep_ms=%.2f points_per_s=%.0f calibrations=%u\n",
+        points, sweeps, dwell_us, setup_us / 1e3, scan_us / 1e3 / sweeps, 1e6 * points * sweeps / scan_us, radio.stats.calibrations);
+    print_spectrum_rx(max_hold, time_us_64());
+
+    /* selection */
+    int32_t offsets[HOP_MAX_CHANNELS];
+    uint32_t bws[HOP_MAX_CHANNELS];
+    for(uint8_t o = 0; o < hopping.channels; o++){
+        offsets[o] = hopping.channel[o].config.center_offset;
+        bws[o] = hopping.channel[o].config.minRxBw;
+    }
+    int32_t interference;
+    if(hopping_all){
+        uint8_t c = select_carrier_rx(max_hold, scan_carriers, count_of(scan_carriers), offsets, bws, hopping.channels, &interference);
+        int32_t default_interference = INT32_MIN;
+        for(uint8_t o = 0; o < hopping.channels; o++){
+            uint32_t f = CARRIER_FEQ + offsets[o];
+            default_interference = max(default_interference, band_rssi_rx(max_hold, f - bws[o]/2, f + bws[o]/2));
+        }
+        printf("#SELECT carrier=%u channels=%u interference_dbm=%d default_interference_dbm=%d\n", scan_carriers[c], hopping.channels,
+            interference, default_interference);
+        return 0;
+    }
+    uint16_t best = select_channel_rx(max_hold, scan_carriers, count_of(scan_carriers), offsets, bws, hopping.channels, &interference);
+    uint8_t c = best / hopping.channels, o = best % hopping.channels;
+    uint32_t f_default = CARRIER_FEQ + offsets[0];
+    int32_t default_interference = band_rssi_rx(max_hold, f_default - bws[0]/2, f_default + bws[0]/2);
+    printf("#SELECT carrier=%u d0=%u d1=%u rx=%u interference_dbm=%d default_interference_dbm=%d\n", scan_carriers[c],
+        hop_dividers[o][0], hop_dividers[o][1], scan_carriers[c] + offsets[o], interference, default_interference);
+    return 0;
+}
@@ -0,0 +1,197 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * tdma_bench: frame timing of the TDMA slot scheduler (tdma.c) against the chain of sleeps of the main loop
+ *
+ * One or two tags (backscatter state-machines on pio0 and pio1, generated with backscatter_program_init() as on
+ * the Pico) share a superframe of -s slots round robin. A slot is the airtime of a frame plus the guard -g. The main
+ * loop builds the frames and spends a random time of up to -j us per iteration (USB prints, SPI sleeps). The PIO
+ * emulator records the first and the last symbol of every frame on the antenna:
+ *  - default: the frames are queued with tdma_queue() and started by the alarm interrupt (DMA into the FIFO),
+ *  - -S: the main loop sends the next frame with backscatter_send_nowait() and sleeps for a slot (the former loop).
+ * All times are virtual; the emulated alarm has no interrupt latency.
+ *
+ * usage: tdma_bench [-t <tags>] [-s <slots>] [-g <guard us>] [-n <superframes>] [-p <payload>] [-b <baud>] [-j <max loop jitter us>] [-S]
+ *
+ * Output: '#TDMA'/'#TDMASLOT' of the scheduler and '#TDMABENCH key=value ...': the start of the frames relative to
+ * the boundary of their slot (mean, min, max), frames which end within the guard of the next slot or later (late),
+ * overlapping frames of the two tags and the channel utilization (airtime / duration).
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "backscatter.h"
+#include "packet_generation.h"
+#include "tdma.h"
+
+#define RECEIVER         2500
+#define CLOCK_DIV0         40
+#define CLOCK_DIV1         36
+#define MAX_TAGS            2
+#define MAX_FRAMES     100000
+
+#define OUT_X_1_MASK   0xE0FF // ignore delay and side-set
+#define OUT_X_1        (ASM_OUT | (ASM_X_REG << 5) | 1)
+
+static const uint tag_pins[MAX_TAGS][2] = {{6, 27}, {7, 26}};
+
+/* frames on the antennas [cycles] */
+struct frame_span {
+    uint64_t start, end;
+};
+static struct frame_span spans[MAX_TAGS][MAX_FRAMES];
+static uint32_t span_count[MAX_TAGS];
+static uint64_t last_symbol[MAX_TAGS];
+static uint64_t symbol_cycles;
+
+// a symbol more than two symbols after the previous one starts a new frame
+static void record(PIO pio){
+    uint8_t t = (pio == pio1) ? 1 : 0;
+    struct pio_sm_state *s = &pio->sm[0];
+    if(s->executed == PIO_EMU_NO_INSTR || (s->executed & OUT_X_1_MASK) != OUT_X_1){
+        return;
+    }
+    if(span_count[t] == 0 || host_cycles - last_symbol[t] > 2 * symbol_cycles){
+        if(span_count[t] < MAX_FRAMES){
+            spans[t][span_count[t]++].start = host_cycles;
+        }
+    }
+    last_symbol[t] = host_cycles;
+    spans[t][span_count[t] - 1].end = host_cycles + symbol_cycles;
+}
+
+static void usage(const char *name){
+    fprintf(stderr, "usage: %s [-t <tags>] [-s <slots>] [-g <guard us>] [-n <superframes>] [-p <payload>] [-b <baud>] [-j <max loop jitter us>] [-S]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv){
+    int tags = 2;
+    int slots = 8;
+    uint32_t guard_us = 200;
+    uint32_t superframes = 200;
+    uint8_t payload = PAYLOADSIZE;
+    uint32_t baud = 200000;
+    uint32_t jitter_us = 1000;
+    bool sleep_chain = false;
+    int opt;
+    while((opt = getopt(argc, argv, "t:s:g:n:p:b:j:S")) != -1){
+        switch(opt){
+            case 't': tags = atoi(optarg); break;
+            case 's': slots = atoi(optarg); break;
+            case 'g': guard_us = atoi(optarg); break;
+            case 'n': superframes = atoi(optarg); break;
+            case 'p': payload = atoi(optarg); break;
+            case 'b': baud = atoi(optarg); break;
+            case 'j': jitter_us = atoi(optarg); break;
+            case 'S': sleep_chain = true; break;
+            default: usage(argv[0]);
+        }
+    }
+    if(tags < 1 || tags > MAX_TAGS || slots < tags || slots > TDMA_MAX_SLOTS || !set_payload_size(payload)){
+        usage(argv[0]);
+    }
+    stdio_init_all();
+    PIO pios[MAX_TAGS] = {pio0, pio1};
+    struct backscatter_config config;
+    uint16_t instructions[MAX_TAGS][32];
+    for(int t = 0; t < tags; t++){
+        if(!backscatter_program_init(pios[t], 0, tag_pins[t][0], tag_pins[t][1], CLOCK_DIV0, CLOCK_DIV1, baud, &config, instructions[t], true)){
+            return 1;
+        }
+        pio_emu_set_trace(pios[t], record);
+    }
+    baud = config.baudrate;
+    symbol_cycles = HOST_CLOCK_HZ / baud;
+    uint8_t *header_tmplate = packet_hdr_template(RECEIVER);
+    uint32_t frame_words = (get_frame_len() + 3) / 4;
+    uint32_t slot_us = (uint32_t) (((uint64_t) frame_words * 32 * 1000000 + baud - 1) / baud) + guard_us;
+
+    /* slot s belongs to tag s % tags */
+    if(!tdma_init(slots, slot_us)){
+        return 1;
+    }
+    for(int t = 0; t < tags; t++){
+        uint32_t mask = 0;
+        for(int s = t; s < slots; s += tags){
+            mask |= 1u << s;
+        }
+        tdma_add_tag(pios[t], 0, mask, baud);
+    }
+    srand(1);
+    uint8_t seq = 0;
+    uint64_t carrier_on_us = time_us_64();
+    uint64_t epoch_us = carrier_on_us + TDMA_CARRIER_SETTLE_US;
+    uint64_t end_us = epoch_us + (uint64_t) superframes * slots * slot_us;
+
+    if(sleep_chain){
+        /* the former loop: send, then sleep for a slot */
+        sleep_us(TDMA_CARRIER_SETTLE_US);
+        for(uint32_t k = 0; k < superframes * slots; k++){
+            int t = k % tags;
+            Frame *frame = frame_arena_next();
+            build_frame(frame, seq++, header_tmplate);
+            backscatter_send_nowait(pios[t], 0, frame->words, frame->len_words);
+            sleep_us(jitter_us ? rand() % (jitter_us + 1) : 0);
+            sleep_us(slot_us);
+        }
+        sleep_us(slot_us);
+    }else{
+        /* main loop of TDMA in carrier-receiver-baseband/main.c */
+        tdma_start(carrier_on_us, superframes);
+        while(tdma_running()){
+            for(int t = 0; t < tags; t++){
+                if(tdma_ready(t)){
+                    Frame *frame = frame_arena_next();
+                    build_frame(frame, seq++, header_tmplate);
+                    tdma_queue(t, frame);
+                }
+            }
+            sleep_us(jitter_us ? rand() % (jitter_us + 1) : 0);
+            sleep_us(10);
+        }
+        sleep_us(slot_us);
+        tdma_print(end_us);
+    }
+
+    /* frames on the antennas against the slot boundaries */
+    uint64_t cycles_per_us = HOST_CLOCK_HZ / 1000000;
+    uint64_t epoch = epoch_us * cycles_per_us, slot = (uint64_t) slot_us * cycles_per_us, guard = (uint64_t) guard_us * cycles_per_us;
+    uint32_t frames = 0, late = 0, overlaps = 0;
+    double offset_sum = 0, offset_min = 1e12, offset_max = -1e12, airtime = 0;
+    uint64_t last_end = 0;
+    for(int t = 0; t < tags; t++){
+        for(uint32_t i = 0; i < span_count[t]; i++){
+            struct frame_span *f = &spans[t][i];
+            uint64_t index = (f->start > epoch) ? (f->start - epoch) / slot : 0;
+            double offset = ((double) f->start - (double) (epoch + index * slot)) / cycles_per_us;
+            offset_sum += offset;
+            offset_min = fmin(offset_min, offset);
+            offset_max = fmax(offset_max, offset);
+            late += f->end + guard > epoch + (index + 1) * slot + guard / 2; // less than half of the guard left
+            airtime += (double) (f->end - f->start) / cycles_per_us;
+            last_end = max(last_end, f->end);
+            frames++;
+        }
+    }
+    if(tags == 2){
+        for(uint32_t i = 0, j = 0; i < span_count[0] && j < span_count[1];){
+            struct frame_span *a = &spans[0][i], *b = &spans[1][j];
+            overlaps += a->start < b->end && b->start < a->end;
+            if(a->end < b->end){
+                i++;
+            }else{
+                j++;
+            }
+        }
+    }
+    double duration = ((double) last_end / cycles_per_us) - epoch_us;
+    printf("#TDMABENCH mode=%s tags=%d slots=%d slot_us=%u guard_us=%u jitter_us=%u frames=%u offset_mean_us=%.2f offset_min_us=%.2f offset_max_us=%.2f late=%u overlaps=%u utilization=%.3f\n",
+        sleep_chain ? "sleep" : "alarm", tags, slots, slot_us, guard_us, jitter_us, frames, frames ? offset_sum / frames : 0.0,
+        frames ? offset_min : 0.0, frames ? offset_max : 0.0, late, overlaps, frames ? airtime / duration : 0.0);
+    return 0;
+}
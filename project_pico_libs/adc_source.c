@@ -0,0 +1,85 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * data source of build_frame() sampling an ADC input
+ * see adc_source.h
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "adc_source.h"
+
+#define ADC_TRANSFERS 0xFFFFFFFF // per DMA trigger (> 2 h at ADC_MAX_RATE), the channel is restarted afterwards
+
+// the DMA write address wraps at the ring size, which requires the alignment of the ring
+static uint16_t adc_ring[SOURCE_RING_SAMPLES] __attribute__((aligned(2 * SOURCE_RING_SAMPLES)));
+static struct data_source adc;
+static uint8_t adc_input = 0;
+static int adc_dma = -1;
+static uint32_t adc_completed = 0; // samples of finished DMA triggers
+
+static bool adc_start(struct data_source *source){
+    adc_dma = dma_claim_unused_channel(false);
+    if(adc_dma < 0){
+        printf("ERROR: no DMA channel left for the ADC source.\n");
+        return false;
+    }
+    adc_init();
+    adc_gpio_init(ADC_FIRST_GPIO + adc_input);
+    adc_select_input(adc_input);
+    adc_fifo_setup(true, true, 1, false, false); // FIFO with DREQ at one sample, no error bit, 12-bit samples
+    adc_set_clkdiv(((float) ADC_CLOCK_HZ) / source->sample_rate - 1); // a conversion every (1 + div) cycles
+    adc_fifo_drain();
+
+    dma_channel_config c = dma_channel_get_default_config(adc_dma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, SOURCE_RING_BITS + 1); // wrap the write address at the ring size [byte]
+    channel_config_set_dreq(&c, DREQ_ADC);
+    adc_completed = 0;
+    dma_channel_configure(adc_dma, &c, adc_ring, &adc_hw->fifo, ADC_TRANSFERS, true);
+    adc_run(true);
+    return true;
+}
+
+static uint32_t adc_produced(struct data_source *source){
+    if(!dma_channel_is_busy(adc_dma)){
+        // all transfers of the trigger done: continue at the current write address (wrapped within the ring)
+        adc_completed += ADC_TRANSFERS;
+        dma_channel_set_trans_count(adc_dma, ADC_TRANSFERS, true);
+    }
+    return adc_completed + (ADC_TRANSFERS - dma_channel_hw_addr(adc_dma)->transfer_count);
+}
+
+static void adc_stop(struct data_source *source){
+    adc_run(false);
+    dma_channel_abort(adc_dma);
+    dma_channel_unclaim(adc_dma);
+    adc_dma = -1;
+    adc_fifo_drain();
+}
+
+/*
+ * ADC source sampling input (0 to 3) at sample_rate
+ * returns NULL for invalid settings
+ */
+struct data_source *adc_source(uint8_t input, uint32_t sample_rate){
+    if(input > 3 || sample_rate < ADC_MIN_RATE || sample_rate > ADC_MAX_RATE){
+        printf("ERROR: invalid ADC source (input 0 to 3, %d to %d samples/s).\n", ADC_MIN_RATE, ADC_MAX_RATE);
+        return NULL;
+    }
+    memset(&adc, 0, sizeof(adc));
+    adc_input = input;
+    adc.name = "adc";
+    adc.sample_rate = sample_rate;
+    adc.start = adc_start;
+    adc.produced = adc_produced;
+    adc.stop = adc_stop;
+    adc.ring = adc_ring;
+    return &adc;
+}
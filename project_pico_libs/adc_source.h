@@ -0,0 +1,30 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * data source of build_frame() sampling an ADC input (see struct data_source in packet_generation.h)
+ *
+ * The ADC runs free at the sample rate, a DMA channel paced by the ADC FIFO writes every conversion into the ring
+ * (write address wrap, no interrupts and no CPU time per sample). The producer position is derived from the transfer
+ * count of the channel. The samples are 12-bit, right-aligned in 16 bit.
+ *
+ */
+
+#ifndef ADC_SOURCE_LIB
+#define ADC_SOURCE_LIB
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "packet_generation.h"
+
+#define ADC_CLOCK_HZ    48000000
+#define ADC_MIN_RATE         733 // 48 MHz / 2^16 (largest clock divider)
+#define ADC_MAX_RATE      500000 // 96 ADC clock cycles per conversion
+#define ADC_FIRST_GPIO        26 // input 0: GPIO 26, ..., input 3: GPIO 29
+
+/*
+ * ADC source sampling input (0 to 3) at sample_rate (ADC_MIN_RATE to ADC_MAX_RATE)
+ * returns NULL for invalid settings, start with set_data_source()
+ */
+struct data_source *adc_source(uint8_t input, uint32_t sample_rate);
+
+#endif
@@ -0,0 +1,144 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * selective-repeat ARQ for the reliable delivery of a file
+ * see arq.h
+ *
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "arq.h"
+
+static bool delivered(struct arq *arq, uint16_t chunk){
+    return (arq->delivered[chunk / 8] >> (chunk % 8)) & 0x01;
+}
+
+// timeout of an outstanding chunk: doubled with every retransmission
+static uint64_t deadline(struct arq *arq, uint16_t chunk){
+    struct arq_slot *slot = &arq->slot[chunk % arq->window];
+    uint64_t rto = ((uint64_t) arq->rto_us) << min(slot->transmissions - 1, ARQ_MAX_BACKOFF);
+    return slot->sent_us + min(rto, ARQ_MAX_RTO_US);
+}
+
+// RFC 6298 with a clock granularity of 1 us
+static void update_rto(struct arq *arq, uint32_t rtt_us){
+    if(!arq->rtt_valid){
+        arq->srtt_us = rtt_us;
+        arq->rttvar_us = rtt_us / 2;
+        arq->rtt_valid = true;
+    }else{
+        uint32_t deviation = (arq->srtt_us > rtt_us) ? arq->srtt_us - rtt_us : rtt_us - arq->srtt_us;
+        arq->rttvar_us = (3 * arq->rttvar_us + deviation) / 4;
+        arq->srtt_us = (7 * arq->srtt_us + rtt_us) / 8;
+    }
+    arq->rto_us = min(max(arq->srtt_us + 4 * arq->rttvar_us, ARQ_MIN_RTO_US), ARQ_MAX_RTO_US);
+}
+
+bool arq_init(struct arq *arq, uint32_t file_size, uint8_t payload, uint8_t window, uint32_t initial_rto_us, uint64_t now_us){
+    if(payload < MIN_PAYLOADSIZE + 2 || file_size == 0 || file_size > ARQ_MAX_FILE_SIZE || window == 0 || window > ARQ_MAX_WINDOW){
+        printf("ERROR: invalid ARQ setting (payload of at least %d byte, file of 1 to %d byte, window of 1 to %d chunks).\n",
+            MIN_PAYLOADSIZE + 2, ARQ_MAX_FILE_SIZE, ARQ_MAX_WINDOW);
+        return false;
+    }
+    memset(arq, 0, sizeof(struct arq));
+    arq->file_size = file_size;
+    arq->chunk_size = payload - 2;
+    arq->chunks = (file_size + arq->chunk_size - 1) / arq->chunk_size;
+    arq->window = window;
+    arq->rto_us = min(max(initial_rto_us, ARQ_MIN_RTO_US), ARQ_MAX_RTO_US);
+    arq->start_us = now_us;
+    return true;
+}
+
+int32_t arq_next_chunk(struct arq *arq, uint64_t now_us){
+    int32_t expired = -1;
+    uint64_t oldest = UINT64_MAX;
+    for(uint16_t c = arq->base; c < arq->next; c++){
+        if(!delivered(arq, c) && deadline(arq, c) <= now_us && deadline(arq, c) < oldest){
+            oldest = deadline(arq, c);
+            expired = c;
+        }
+    }
+    if(expired >= 0){
+        return expired;
+    }
+    if(arq->next < arq->chunks && arq->next < arq->base + arq->window){
+        return arq->next;
+    }
+    return -1;
+}
+
+void arq_sent(struct arq *arq, uint16_t chunk, uint64_t now_us){
+    struct arq_slot *slot = &arq->slot[chunk % arq->window];
+    if(chunk == arq->next){
+        arq->next++;
+        slot->transmissions = 0;
+    }else{
+        arq->retransmissions++;
+    }
+    slot->sent_us = now_us;
+    slot->transmissions++;
+    arq->transmissions++;
+}
+
+uint64_t arq_next_timeout_us(struct arq *arq){
+    uint64_t next = UINT64_MAX;
+    for(uint16_t c = arq->base; c < arq->next; c++){
+        if(!delivered(arq, c)){
+            next = min(next, deadline(arq, c));
+        }
+    }
+    return next;
+}
+
+void arq_build_frame(struct arq *arq, uint16_t chunk, Frame *frame, uint8_t seq, uint8_t *header_template){
+    seek_data(chunk * arq->chunk_size);
+    build_frame(frame, seq, header_template);
+}
+
+bool arq_ack_packet(struct arq *arq, const uint8_t *buffer, Packet_status status, uint64_t now_us){
+    if(status.overflowed || !status.CRCcheck || status.len < 4 || buffer[0] != 1 + 2 + arq->chunk_size){
+        return false;
+    }
+    uint16_t index = (((uint16_t) buffer[2]) << 8) | buffer[3];
+    uint16_t chunk = index / arq->chunk_size;
+    if(index % arq->chunk_size != 0 || chunk >= arq->next){
+        arq->unexpected++;
+        return false;
+    }
+    if(delivered(arq, chunk)){
+        arq->duplicates++;
+        return false;
+    }
+    arq->delivered[chunk / 8] |= 1 << (chunk % 8);
+    arq->acked++;
+    struct arq_slot *slot = &arq->slot[chunk % arq->window];
+    if(slot->transmissions == 1){
+        update_rto(arq, now_us - slot->sent_us);
+    }
+    while(arq->base < arq->next && delivered(arq, arq->base)){
+        arq->base++;
+    }
+    if(arq_done(arq)){
+        arq->done_us = now_us;
+    }
+    return true;
+}
+
+bool arq_done(struct arq *arq){
+    return arq->acked == arq->chunks;
+}
+
+void arq_print(struct arq *arq, uint64_t time_us){
+    printf("#ARQ t=%" PRIu64 " chunks=%u acked=%u base=%u tx=%" PRIu32 " retx=%" PRIu32 " dup=%" PRIu32 " unexp=%" PRIu32 " srtt_us=%" PRIu32 " rto_us=%" PRIu32 "\n", time_us/1000,
+        arq->chunks, arq->acked, arq->base, arq->transmissions, arq->retransmissions, arq->duplicates, arq->unexpected, arq->srtt_us, arq->rto_us);
+    if(arq_done(arq)){
+        uint64_t duration_us = max(arq->done_us - arq->start_us, 1);
+        printf("#ARQDONE file_bytes=%" PRIu32 " chunks=%u completion_ms=%.1f transmissions=%" PRIu32 " retransmissions=%" PRIu32 " overhead=%.3f goodput_bps=%.0f\n",
+            arq->file_size, arq->chunks, duration_us / 1000.0, arq->transmissions, arq->retransmissions,
+            ((double) arq->retransmissions) / arq->chunks, 8.0 * arq->file_size * 1000000.0 / duration_us);
+    }
+}
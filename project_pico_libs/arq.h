@@ -0,0 +1,95 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * selective-repeat ARQ for the reliable delivery of a file
+ *
+ * The file (generate_data() from file_position 0) is split into chunks of get_payload_size() - 2 byte, a chunk is
+ * identified by the file index in the first two payload bytes. Up to 'window' chunks are outstanding: the oldest
+ * unacknowledged chunk (base) and the following ones. A chunk is acknowledged by the receive path (arq_ack_packet()),
+ * out of order acknowledgements are kept. A chunk without acknowledgement is sent again after the retransmission
+ * timeout, which adapts to the measured acknowledgement delay (smoothed delay + 4 * its variation, RFC 6298, Karn's
+ * rule: no samples of retransmitted chunks) and doubles with every retransmission of the chunk.
+ *
+ */
+
+#ifndef ARQ_LIB
+#define ARQ_LIB
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "packet_generation.h"
+#include "receiver_CC2500.h"
+
+#define ARQ_MAX_WINDOW        32
+#define ARQ_MAX_FILE_SIZE  65536 // the file index is 16-bit
+#define ARQ_MAX_CHUNKS     (ARQ_MAX_FILE_SIZE / 2)
+#define ARQ_MIN_RTO_US      1000
+#define ARQ_MAX_RTO_US   2000000
+#define ARQ_MAX_BACKOFF        5 // the timeout of a chunk doubles up to 2^5 times
+
+struct arq_slot {
+  uint64_t sent_us;           // last transmission
+  uint8_t  transmissions;
+};
+
+struct arq {
+  uint32_t file_size;         // [byte]
+  uint16_t chunks;            // chunks of the file
+  uint8_t  chunk_size;        // data bytes per chunk
+  uint8_t  window;
+  uint16_t base;              // oldest chunk without acknowledgement
+  uint16_t next;              // next chunk which has never been sent
+  uint16_t acked;
+  struct arq_slot slot[ARQ_MAX_WINDOW]; // chunk % window
+  uint8_t  delivered[ARQ_MAX_CHUNKS / 8];
+  uint32_t srtt_us;           // smoothed acknowledgement delay
+  uint32_t rttvar_us;
+  uint32_t rto_us;            // retransmission timeout
+  bool     rtt_valid;
+  uint32_t transmissions;
+  uint32_t retransmissions;
+  uint32_t duplicates;        // acknowledgements of delivered chunks
+  uint32_t unexpected;        // file indices outside of the file or never sent
+  uint64_t start_us;
+  uint64_t done_us;
+};
+
+/*
+ * file_size: bytes to deliver (at most ARQ_MAX_FILE_SIZE), payload: get_payload_size() (at least 4 byte)
+ * window: outstanding chunks (1 to ARQ_MAX_WINDOW), initial_rto_us: timeout until the first delay is measured
+ * returns false for invalid settings
+ */
+bool arq_init(struct arq *arq, uint32_t file_size, uint8_t payload, uint8_t window, uint32_t initial_rto_us, uint64_t now_us);
+
+/*
+ * chunk to send now: the chunk with the oldest expired timeout, otherwise the next new chunk within the window
+ * returns -1 if the window is full and no timeout expired (see arq_next_timeout_us())
+ */
+int32_t arq_next_chunk(struct arq *arq, uint64_t now_us);
+
+/* record the transmission of a chunk (returned by arq_next_chunk()) */
+void arq_sent(struct arq *arq, uint16_t chunk, uint64_t now_us);
+
+/* time at which the next outstanding chunk times out (UINT64_MAX: none outstanding) */
+uint64_t arq_next_timeout_us(struct arq *arq);
+
+/* build the frame of a chunk: seek_data() to its file index and build_frame() */
+void arq_build_frame(struct arq *arq, uint16_t chunk, Frame *frame, uint8_t seq, uint8_t *header_template);
+
+/*
+ * acknowledge the chunk of a received packet (readPacket() buffer: length, seq, file index, data)
+ * only complete packets with a correct CRC (appended by build_frame()) count, returns true for a newly delivered chunk
+ */
+bool arq_ack_packet(struct arq *arq, const uint8_t *buffer, Packet_status status, uint64_t now_us);
+
+/* all chunks delivered */
+bool arq_done(struct arq *arq);
+
+/*
+ * '#ARQ t=<ms since boot> chunks= acked= base= tx= retx= dup= unexp= srtt_us= rto_us=' and, once done,
+ * '#ARQDONE file_bytes= chunks= completion_ms= transmissions= retransmissions= overhead= goodput_bps='
+ * (overhead: retransmissions per chunk)
+ */
+void arq_print(struct arq *arq, uint64_t time_us);
+
+#endif
@@ -5,122 +5,556 @@
  * 29-March-2023
  */
 
+#include <inttypes.h>
 #include "backscatter.h"
+#include "link_counters.h"
 
-// repeat the instruction until the desired delay has past
-int16_t repeat(uint16_t* instructionBuffer, int16_t delay, uint32_t asm_instr, uint8_t *length, uint16_t max_delay){
-    while(delay > 0){
-        uint8_t delay_part = min(max_delay, delay) - 1;
-        instructionBuffer[(*length)] = asm_instr | (((max_delay-1) & delay_part) << 8);
-        delay = delay - (delay_part + 1);
-        (*length)++;
+static enum backscatter_sideband sideband = SIDEBAND_BOTH;
+static bool continuous_phase = false;
+
+// wait until the TX FIFO is empty (empty) or has space, false if the state-machine stopped pulling words
+static bool wait_tx_fifo(PIO pio, uint sm, bool empty){
+    uint64_t timeout_us = time_us_64() + BACKSCATTER_FIFO_TIMEOUT_US;
+    while(empty ? !pio_sm_is_tx_fifo_empty(pio, sm) : pio_sm_is_tx_fifo_full(pio, sm)){
+        if(time_us_64() > timeout_us){
+            printf("ERROR: the state-machine %d does not pull from its TX FIFO (disabled or stalled), message dropped.\n", sm);
+            pio_sm_clear_fifos(pio, sm);
+            return false;
+        }
+        tight_loop_contents();
     }
+    return true;
 }
 
-// how many instructions are needed to create this delay?
-uint8_t instructionCount(uint16_t delay, uint16_t max_delay){
-    if (delay % max_delay == 0){
-        return delay/max_delay;
-    }else{
-        return delay/max_delay + 1;
-    }
-}
-
-bool generatePIOprogram(uint16_t d0,uint16_t d1, uint32_t baud, uint16_t* instructionBuffer, struct pio_program *backscatter_program, bool twoAntennas){
-    // compute label positions
-    uint16_t MAX_ASMDELAY = 0x0020; // 32
-    uint16_t OPT_SIDE_1   = 0x0000;
-    uint16_t OPT_SIDE_0   = 0x0000;
-    if (twoAntennas){
-        MAX_ASMDELAY = 0x0008;     //   8 
-        OPT_SIDE_1   = 0x1800;
-        OPT_SIDE_0   = 0x1000;
-    }
-    uint8_t get_symbol_label = 3;
-    uint8_t send_1_label = 5;
-    uint8_t loop_1_label = send_1_label + 1;
-    int16_t lastPeriodCycles1 = (((uint32_t) CLKFREQ*1000000)/baud - 4) % ((uint32_t) d1);
-    int16_t lastPeriodCycles0 = (((uint32_t) CLKFREQ*1000000)/baud - 4) % ((uint32_t) d0);
-    int16_t tmp1 = min(lastPeriodCycles1, d1/2);
-    int16_t tmp0 = min(lastPeriodCycles0, d0/2);
-    /*                                           pull high                 pull low            jmp                 high                                      low                            jmp  */
-    uint8_t send_0_label = loop_1_label + instructionCount(d1/2, MAX_ASMDELAY) + instructionCount(d1/2 - 1, MAX_ASMDELAY) + 1 + instructionCount(tmp1, MAX_ASMDELAY) + instructionCount(max(0,lastPeriodCycles1-tmp1), MAX_ASMDELAY) + 1;
-    uint8_t loop_0_label = send_0_label + 1;
-
-    // check that the program will fit into memory
-    /*                      pull high                pull low            jmp                        high                              low                               jmp  */
-    if(loop_0_label + instructionCount(d0/2, MAX_ASMDELAY) + instructionCount(d0/2 - 1, MAX_ASMDELAY) + 1 + instructionCount(tmp0, MAX_ASMDELAY) + instructionCount(max(0,lastPeriodCycles0-tmp0), MAX_ASMDELAY) + 1 >= 32){
-        printf("ERROR: The clock dividers are too small. The program would not fit into the state-machine instruction memory. Alternatively, you can disable the second antenna. This increaes the maximal delay per instruction from 8 to 32 cycles and thus significanlty reduces the required code space.");
+/*
+ * put the message into the FIFO
+ * The TXSTALL flag is cleared once the state-machine pulled the first word. If it is set again before
+ * the last word has been put, the FIFO ran empty within the message and symbols have been stretched.
+ */
+static bool put_message(PIO pio, uint sm, uint32_t *message, uint32_t len){
+    uint32_t stall_mask = 1u << (PIO_FDEBUG_TXSTALL_LSB + sm);
+    for(uint32_t i = 0; i < len; i++){
+        if(!wait_tx_fifo(pio, sm, false)){
+            return false;
+        }
+        pio_sm_put(pio, sm, message[i]);
+        if(i == 0){
+            if(!wait_tx_fifo(pio, sm, true)){
+                return false;
+            }
+            pio->fdebug = stall_mask; // write 1 to clear
+        }
+    }
+    if(len > 1 && (pio->fdebug & stall_mask)){
+        link_counters.pio_stalls++;
+    }
+    link_counters.packets_sent++;
+    return true;
+}
+
+/*
+ * Code generator of the state-machine program
+ *
+ * Every symbol takes CLKFREQ*10^6/baud cycles: out x,1 and the branch on x (2 cycles), loading the
+ * number of full periods into x (1 cycle), the full periods of d0/d1 cycles (high d/2, low d/2) and the
+ * remaining cycles (high, then low) plus one cycle for the jump to the next symbol. The generated
+ * program reproduces this waveform cycle by cycle, but packs it into as few instructions as possible:
+ *  - a level is held with the delay of several instructions or, if y is free, with a counted loop
+ *    (set y, n / jmp y-- self), which holds up to 32 instruction delays with 2 instructions,
+ *  - the number of full periods is loaded with set x, n if it fits into 5 bits (otherwise from isr/y,
+ *    which are preloaded by backscatter_program_init()),
+ *  - the second symbol branch is placed at the end of the program and wraps to out x,1 instead of
+ *    jumping, the first branch may jump into the final phase of the second one (shared tail),
+ *  - if both symbols end at the same level, the side-set of the second antenna is mandatory, which
+ *    frees the side-set enable bit and doubles the delay per instruction from 8 to 16 cycles.
+ * In single-sideband mode (set_sideband()) a period consists of four phases instead of two: pin2 (side-set)
+ * follows pin1 with a quarter period (d/4, rounded down) delay or advance, pin1 is unchanged.
+ * In continuous-phase mode (set_continuous_phase()) every half-period starts by toggling the antennas, see
+ * generate_continuous_phase().
+ * All combinations are generated and the shortest program is used.
+ * The clock divider of the state-machine is not used: the two cycles of out x,1 and the branch plus
+ * loading x hold the previous level for exactly 3 cycles, a divider would stretch this hold.
+ */
+
+#define NO_CONTROL 0xFFFF
+
+struct symbol_timing {
+    uint16_t d;             // clock divider
+    uint32_t reps;          // full periods - 1
+    uint32_t last;          // remaining cycles after the full periods
+    uint32_t tmp;           // high cycles of the remaining cycles
+    uint8_t  final_level;   // levels at the end of the symbol (bit 0: pin1, bit 1: pin2)
+    uint8_t  sideband;      // enum backscatter_sideband
+};
+
+struct pio_codegen {
+    uint16_t *buffer;
+    uint8_t   length;
+    uint8_t   max_cycles;   // cycles per instruction: 1 + maximal delay
+    uint8_t   sideset_bits; // 0: one antenna, 1: mandatory side-set, 2: optional side-set
+    bool      y_free;       // y can count delay loops
+    bool      toggle;       // levels are changed with MOV pins, ~pins (continuous phase)
+    bool      failed;       // too many instructions or the timing is not achievable
+};
+
+/* append an instruction which takes 'cycles' cycles, level: side-set level of the second antenna (-1: none) */
+static uint8_t emit(struct pio_codegen *g, uint16_t instr, int8_t level, uint32_t cycles){
+    if(g->length >= PIO_MAX_INSTRUCTIONS || cycles < 1 || cycles > g->max_cycles){
+        g->failed = true;
+        return g->length;
+    }
+    uint16_t field = cycles - 1;
+    if(g->sideset_bits == 1){
+        field |= (level & 1) << 4;
+    }else if(g->sideset_bits == 2 && level >= 0){
+        field |= 0x10 | (level << 3);
+    }
+    g->buffer[g->length] = instr | (field << 8);
+    return g->length++;
+}
+
+/* cycles of the next of 'count' instructions which share 'cycles' */
+static uint32_t share(struct pio_codegen *g, uint32_t *cycles, uint8_t *count){
+    uint32_t c = min(g->max_cycles, *cycles - (*count - 1));
+    *cycles -= c;
+    (*count)--;
+    return c;
+}
+
+/*
+ * hold the pin levels (bit 0: pin1, bit 1: pin2) for the given cycles
+ * change: the first instruction sets the levels, otherwise the levels are already set
+ * control: jump at the end (NO_CONTROL: none)
+ * returns the address of the first instruction
+ */
+static uint8_t hold(struct pio_codegen *g, uint8_t levels, uint32_t cycles, bool change, uint16_t control){
+    uint8_t start = g->length;
+    uint8_t level = levels & 1;
+    int8_t side = levels >> 1;
+    uint16_t set_instr = g->toggle ? ASM_TOGGLE_PINS : (ASM_SET_PINS | level);
+    uint16_t fill_instr = g->toggle ? ASM_NOP : (ASM_SET_PINS | level);
+    uint8_t fixed = change + (control != NO_CONTROL);
+    uint32_t count = max((cycles + g->max_cycles - 1) / g->max_cycles, fixed);
+    if(cycles < count || count > PIO_MAX_INSTRUCTIONS){
+        g->failed = true;
+        return start;
+    }
+    // counted loop: [set pins] set y, n-1 / jmp y-- self [control]
+    uint8_t others = fixed + 1;
+    uint32_t n = (cycles >= others + g->max_cycles) ? min(PIO_MAX_SET_VALUE + 1, (cycles - others) / g->max_cycles) : 0;
+    if(g->y_free && n > 0 && cycles - n * g->max_cycles <= others * g->max_cycles && others + 1 < count){
+        uint32_t rest = cycles - n * g->max_cycles;
+        if(change){
+            emit(g, set_instr, side, share(g, &rest, &others));
+        }
+        emit(g, ASM_SET_Y | (n - 1), side, share(g, &rest, &others));
+        emit(g, ASM_JMP_YMM | g->length, side, g->max_cycles);
+        if(control != NO_CONTROL){
+            emit(g, control, side, share(g, &rest, &others));
+        }
+        return start;
+    }
+    // delays of consecutive instructions
+    uint8_t remaining = count;
+    for(uint8_t i = 0; i < count; i++){
+        uint16_t instr = (i == count - 1 && control != NO_CONTROL) ? control : ((i == 0 && change) ? set_instr : fill_instr);
+        emit(g, instr, side, share(g, &cycles, &remaining));
+    }
+    return start;
+}
+
+/* phases of one full period: pin1 high d/2, low d/2, pin2 in phase or a quarter period later (upper) / earlier (lower) */
+static uint8_t period_phases(struct symbol_timing *s, uint8_t *level, uint32_t *cycles){
+    uint32_t half = s->d/2;
+    uint32_t quarter = s->d/4;
+    switch(s->sideband){
+        case SIDEBAND_UPPER:
+            level[0] = 1; level[1] = 3; level[2] = 2; level[3] = 0;
+            cycles[0] = quarter; cycles[1] = half - quarter; cycles[2] = quarter; cycles[3] = half - quarter;
+            return 4;
+        case SIDEBAND_LOWER:
+            level[0] = 3; level[1] = 1; level[2] = 0; level[3] = 2;
+            cycles[0] = half - quarter; cycles[1] = quarter; cycles[2] = half - quarter; cycles[3] = quarter;
+            return 4;
+        default:
+            level[0] = 3; level[1] = 0;
+            cycles[0] = half; cycles[1] = half;
+            return 2;
+    }
+}
+
+/* remaining phases of a symbol after the full periods: the first 'last' cycles of a period, the jump cycle is added to the last one */
+static uint8_t tail_phases(struct symbol_timing *s, uint8_t *level, uint32_t *cycles, bool *change){
+    uint8_t p_level[4];
+    uint32_t p_cycles[4];
+    uint8_t p_n = period_phases(s, p_level, p_cycles);
+    uint8_t n = 0;
+    uint32_t remaining = s->last;
+    for(uint8_t p = 0; p < p_n && remaining > 0; p++){
+        level[n] = p_level[p]; cycles[n] = min(remaining, p_cycles[p]); change[n] = true;
+        remaining -= cycles[n];
+        n++;
+    }
+    if(n == 0){
+        level[n] = p_level[p_n-1]; cycles[n] = 0; change[n] = false; n++; // the jump after the last full period
+    }
+    cycles[n-1]++;
+    return n;
+}
+
+/*
+ * generate one program variant
+ * first: symbol following the branch, the other symbol is placed at the end and wraps
+ * shared: the first symbol jumps into the final phase of the other symbol
+ */
+static bool generate_variant(struct symbol_timing *sym, uint8_t first, uint8_t sideset_bits, bool shared, uint16_t *buffer, struct backscatter_layout *layout){
+    struct pio_codegen g = {.buffer = buffer, .length = 0, .sideset_bits = sideset_bits, .failed = false};
+    g.max_cycles = 32 >> sideset_bits;
+    int8_t dispatch_level = (sideset_bits == 1) ? (sym[0].final_level >> 1) : -1;
+
+    // loop counters which do not fit into set x, n are preloaded into isr, then y
+    uint8_t counter_reg[2] = {0, 0};
+    layout->preload_count = 0;
+    for(uint8_t s = 0; s < 2; s++){
+        if(sym[s].reps > PIO_MAX_SET_VALUE){
+            counter_reg[s] = (layout->preload_count == 0) ? ASM_ISR_REG : ASM_Y_REG;
+            layout->preload_out[layout->preload_count] = ASM_OUT | (counter_reg[s] << 5) | ((sideset_bits == 1) ? (dispatch_level << 12) : 0);
+            layout->preload_value[layout->preload_count] = sym[s].reps;
+            layout->preload_count++;
+        }
+    }
+    g.y_free = layout->preload_count < 2;
+    layout->preload_pull = ASM_PULL | ((sideset_bits == 1) ? (dispatch_level << 12) : 0);
+
+    // get_symbol: out x, 1 / branch to the second symbol
+    emit(&g, ASM_OUT | (ASM_X_REG << 5) | 1, dispatch_level, 1);
+    uint8_t branch = emit(&g, (first == 1) ? ASM_JMP_NOTX : ASM_JMP_XMM, dispatch_level, 1);
+    uint8_t shared_jump = 0;
+    uint8_t final_level = 0;
+    uint32_t final_cycles = 0;
+    for(uint8_t i = 0; i < 2; i++){
+        uint8_t s = (i == 0) ? first : 1 - first;
+        struct symbol_timing *t = &sym[s];
+        // load x
+        uint8_t start = (t->reps > PIO_MAX_SET_VALUE) ? emit(&g, ASM_MOV | (ASM_X_REG << 5) | counter_reg[s], dispatch_level, 1)
+                                                      : emit(&g, ASM_SET_X | t->reps, dispatch_level, 1);
+        if(i == 1){
+            g.buffer[branch] |= start;
+        }
+        // full periods
+        uint8_t level[4];
+        uint32_t cycles[4];
+        bool change[4];
+        uint8_t n = period_phases(t, level, cycles);
+        uint8_t loop = g.length;
+        for(uint8_t p = 0; p < n; p++){
+            hold(&g, level[p], cycles[p], true, (p == n - 1) ? (ASM_JMP_XMM | loop) : NO_CONTROL);
+        }
+        // remaining cycles
+        n = tail_phases(t, level, cycles, change);
+        if(i == 0 && shared){
+            // jump into the final phase of the other symbol
+            uint8_t o_level[4];
+            uint32_t o_cycles[4];
+            bool o_change[4];
+            uint8_t o_n = tail_phases(&sym[1-first], o_level, o_cycles, o_change);
+            if(n < 2 || o_level[o_n-1] != level[n-1] || o_cycles[o_n-1] < cycles[n-1] || !o_change[o_n-1]){
+                return false;
+            }
+            final_level = level[n-1];
+            final_cycles = cycles[n-1];
+            for(uint8_t p = 0; p < n - 1; p++){
+                hold(&g, level[p], cycles[p], change[p], (p == n - 2) ? ASM_JMP : NO_CONTROL);
+            }
+            shared_jump = g.length - 1;
+            continue;
+        }
+        for(uint8_t p = 0; p < n; p++){
+            uint16_t control = NO_CONTROL;
+            if(p == n - 1 && i == 0){
+                control = ASM_JMP; // jmp get_symbol
+            }
+            if(p == n - 1 && i == 1 && shared){
+                // split the final phase: the first symbol enters at the last final_cycles cycles
+                if(cycles[p] > final_cycles){
+                    hold(&g, level[p], cycles[p] - final_cycles, change[p], NO_CONTROL);
+                }
+                g.buffer[shared_jump] |= hold(&g, final_level, final_cycles, true, NO_CONTROL);
+                continue;
+            }
+            hold(&g, level[p], cycles[p], change[p], control);
+        }
+    }
+    if(g.failed){
         return false;
     }
+    layout->wrap = g.length - 1;
+    layout->sideset_bits = sideset_bits;
+    layout->initial_level = (sideset_bits == 1) ? sym[0].final_level : 3;
+    layout->toggle = false;
+    layout->half_periods[0] = 0;
+    layout->half_periods[1] = 0;
+    return true;
+}
+
+/* half-periods of a continuous-phase symbol after the first one */
+#define CP_FIRST  0
+#define CP_SINGLE 1
+#define CP_LOOP   2
+#define CP_FINAL  3
+#define CP_MAX_ITEMS 8
+
+struct cp_item {
+    uint8_t  type;
+    uint32_t length;  // cycles of a half-period
+    uint32_t count;   // CP_LOOP: half-periods
+};
 
-    // generate state machine
-    instructionBuffer[0] = ASM_SET_PINS | OPT_SIDE_1 | 1;           //  0: set    pins, 1         side 1
-    instructionBuffer[1] = ASM_OUT | (ASM_ISR_REG << 5);            //  1: out    isr, 32   (NOTE: 32=0)
-    instructionBuffer[2] = ASM_OUT | (ASM_Y_REG   << 5);            //  2: out    y, 32     (NOTE: 32=0)
-    instructionBuffer[3] = ASM_OUT | (ASM_X_REG   << 5) |  1;       //  3: out    x, 1   
-    instructionBuffer[4] = ASM_JMP_NOTX | (0x1F & send_0_label);    //  4: jmp    !x, send_0_label
-    /*       symbol 1      */
-    instructionBuffer[5] = ASM_MOV | (ASM_X_REG << 5) | ASM_Y_REG;  //  5: mov    x, y                  
-    uint8_t length = 6;
-    // full periods
-    repeat(instructionBuffer, d1/2,     ASM_SET_PINS | OPT_SIDE_1 | 1, &length, MAX_ASMDELAY);   //    6: set    pins, 1         side 1 [delay] 
-    repeat(instructionBuffer, d1/2 - 1, ASM_SET_PINS | OPT_SIDE_0 | 0, &length, MAX_ASMDELAY);   //  ...: set    pins, 0         side 0 [delay] 
-    instructionBuffer[length] = ASM_JMP_XMM | (0x1F & loop_1_label);                             //  ...: jmp    x--, loop_1_label
-    length++;
-    // remaining period to fill symbol time
-    repeat(instructionBuffer,                          tmp1, ASM_SET_PINS | OPT_SIDE_1 | 1, &length, MAX_ASMDELAY); //  ...: set    pins, 1         side 1 [delay] 
-    repeat(instructionBuffer, max(0,lastPeriodCycles1-tmp1), ASM_SET_PINS | OPT_SIDE_0 | 0, &length, MAX_ASMDELAY); //  ...: set    pins, 0         side 0 [delay] 
-    instructionBuffer[length] = ASM_JMP | get_symbol_label;               // ...: jmp    get_symbol_label
-    length++;
-    /*       symbol 0       */
-    instructionBuffer[length] = ASM_MOV | (ASM_X_REG << 5) | ASM_ISR_REG, // ...: mov    x, isr  
-    length++; 
-    // full periods
-    repeat(instructionBuffer, d0/2,     ASM_SET_PINS | OPT_SIDE_1 | 1, &length, MAX_ASMDELAY);    // ...: set    pins, 1         side 1 [delay_part] 
-    repeat(instructionBuffer, d0/2 - 1, ASM_SET_PINS | OPT_SIDE_0 | 0, &length, MAX_ASMDELAY);    // ...: set    pins, 0         side 0 [delay_part] 
-    instructionBuffer[length] = ASM_JMP_XMM | (0x1F & loop_0_label);      //  ...: jmp    x--, loop_0_label
-    length++;
-    // remaining period to fill symbol time
-    repeat(instructionBuffer,                          tmp0, ASM_SET_PINS | OPT_SIDE_1 | 1, &length, MAX_ASMDELAY);  //  ...: set    pins, 1         side 1 [delay_part] 
-    repeat(instructionBuffer, max(0,lastPeriodCycles0-tmp0), ASM_SET_PINS | OPT_SIDE_0 | 0, &length, MAX_ASMDELAY);  //  ...: set    pins, 0         side 0 [delay_part] 
-    instructionBuffer[length] = ASM_JMP | get_symbol_label; // ...: jmp    get_symbol_label
+/* plan of a symbol of 'cycles' cycles with k half-periods: N/k cycles, N%k of them one cycle longer (first) */
+static uint8_t plan_continuous_phase(uint32_t cycles, uint32_t k, struct cp_item *items){
+    uint32_t q = cycles / k;
+    uint32_t r = cycles % k;
+    uint32_t run_length[2] = {q + 1, q};
+    uint32_t run_count[2] = {r, k - r};
+    uint8_t run = (r > 0) ? 0 : 1;
+    uint8_t n = 0;
+    items[n].type = CP_FIRST; items[n].length = run_length[run]; items[n].count = 1; n++;
+    run_count[run]--;
+    // the final half-period jumps back to the dispatch
+    uint8_t final_run = (run_count[1] > 0) ? 1 : 0;
+    run_count[final_run]--;
+    for(; run < 2; run++){
+        uint32_t c = run_count[run];
+        if(c >= 3 && items[n-1].type == CP_LOOP){
+            // a loop counter is loaded by the preceding single half-period
+            items[n].type = CP_SINGLE; items[n].length = run_length[run]; items[n].count = 1; n++;
+            c--;
+        }
+        if(c >= 3){
+            items[n].type = CP_LOOP; items[n].length = run_length[run]; items[n].count = c; n++;
+            c = 0;
+        }
+        for(; c > 0; c--){
+            items[n].type = CP_SINGLE; items[n].length = run_length[run]; items[n].count = 1; n++;
+        }
+    }
+    items[n].type = CP_FINAL; items[n].length = run_length[final_run]; items[n].count = 1; n++;
+    return n;
+}
+
+/*
+ * continuous-phase program: every half-period starts by toggling the antennas (mov pins, ~pins), the pins
+ * are read back through the IN mapping. The level at a symbol boundary is thus the one left by the previous
+ * symbol and the subcarrier phase is continuous.
+ *   get_symbol: mov pins, ~pins / out x, 1 / branch    (first 3 cycles of the first half-period)
+ *   symbol:     rest of the first half-period, single half-periods and counted loops of half-periods,
+ *               the final half-period jumps to get_symbol (or wraps)
+ * first: symbol following the branch, the other one is placed at the end and wraps
+ */
+static bool generate_continuous_phase(uint32_t cycles, uint32_t *k, uint8_t first, uint16_t *buffer, struct backscatter_layout *layout){
+    struct pio_codegen g = {.buffer = buffer, .length = 0, .max_cycles = 32, .sideset_bits = 0, .toggle = true, .failed = false};
+    struct cp_item items[2][CP_MAX_ITEMS];
+    uint8_t n[2];
+    uint8_t counter_reg[2][CP_MAX_ITEMS];
+    layout->preload_count = 0;
+    for(uint8_t s = 0; s < 2; s++){
+        n[s] = plan_continuous_phase(cycles, k[s], items[s]);
+        for(uint8_t i = 0; i < n[s]; i++){
+            if(items[s][i].type == CP_LOOP && items[s][i].count - 1 > PIO_MAX_SET_VALUE){
+                if(layout->preload_count == 2){
+                    return false;
+                }
+                counter_reg[s][i] = (layout->preload_count == 0) ? ASM_ISR_REG : ASM_Y_REG;
+                layout->preload_out[layout->preload_count] = ASM_OUT | (counter_reg[s][i] << 5);
+                layout->preload_value[layout->preload_count] = items[s][i].count - 1;
+                layout->preload_count++;
+            }
+        }
+    }
+    g.y_free = layout->preload_count < 2;
+    layout->preload_pull = ASM_PULL;
+
+    // get_symbol: toggle / out x, 1 / branch to the second symbol
+    emit(&g, ASM_TOGGLE_PINS, -1, 1);
+    emit(&g, ASM_OUT | (ASM_X_REG << 5) | 1, -1, 1);
+    uint8_t branch = emit(&g, (first == 1) ? ASM_JMP_NOTX : ASM_JMP_XMM, -1, 1);
+    for(uint8_t b = 0; b < 2; b++){
+        uint8_t s = (b == 0) ? first : 1 - first;
+        if(b == 1){
+            g.buffer[branch] |= g.length;
+        }
+        for(uint8_t i = 0; i < n[s]; i++){
+            struct cp_item *item = &items[s][i];
+            uint16_t control = NO_CONTROL;
+            if(i + 1 < n[s] && items[s][i+1].type == CP_LOOP){
+                struct cp_item *loop = &items[s][i+1];
+                control = (loop->count - 1 > PIO_MAX_SET_VALUE) ? (ASM_MOV | (ASM_X_REG << 5) | counter_reg[s][i+1])
+                                                                : (ASM_SET_X | (loop->count - 1));
+            }
+            switch(item->type){
+                case CP_FIRST:
+                    if(item->length < 3){
+                        return false;
+                    }
+                    hold(&g, 0, item->length - 3, false, control);
+                    break;
+                case CP_SINGLE:
+                    hold(&g, 0, item->length, true, control);
+                    break;
+                case CP_LOOP:
+                    hold(&g, 0, item->length, true, ASM_JMP_XMM | g.length);
+                    break;
+                case CP_FINAL:
+                    hold(&g, 0, item->length, true, (b == 0) ? ASM_JMP : NO_CONTROL);
+                    break;
+            }
+        }
+    }
+    if(g.failed){
+        return false;
+    }
+    layout->wrap = g.length - 1;
+    layout->sideset_bits = 0;
+    layout->initial_level = 0;
+    layout->toggle = true;
+    layout->half_periods[0] = k[0];
+    layout->half_periods[1] = k[1];
+    return true;
+}
+
+bool set_continuous_phase(bool enabled){
+    continuous_phase = enabled;
+    return true;
+}
+
+bool get_continuous_phase(){
+    return continuous_phase;
+}
+
+/* copy the program variant if it is shorter than the best one so far */
+static void keep_shortest(uint16_t *buffer, struct backscatter_layout *variant, uint16_t *instructionBuffer, struct backscatter_layout *best, uint8_t *best_length){
+    if(*best_length == 0 || variant->wrap + 1 < *best_length){
+        *best_length = variant->wrap + 1;
+        *best = *variant;
+        memcpy(instructionBuffer, buffer, *best_length * sizeof(uint16_t));
+    }
+}
+
+bool set_sideband(enum backscatter_sideband new_sideband){
+    if(new_sideband > SIDEBAND_LOWER){
+        printf("ERROR: invalid sideband %d. Keeping %d.\n", new_sideband, sideband);
+        return false;
+    }
+    sideband = new_sideband;
+    return true;
+}
+
+enum backscatter_sideband get_sideband(){
+    return sideband;
+}
+
+bool generatePIOprogram(uint16_t d0,uint16_t d1, uint32_t baud, uint16_t* instructionBuffer, struct pio_program *backscatter_program, bool twoAntennas, struct backscatter_layout *layout){
+    uint32_t cycles = ((uint32_t) CLKFREQ*1000000)/baud;
+    if(d0 < 4 || d1 < 4 || cycles < 4 + max(d0, d1)){
+        printf("ERROR: the clock dividers have to be between 4 and the symbol length (%" PRIu32 " cycles) minus 4.\n", cycles);
+        return false;
+    }
+    if(sideband != SIDEBAND_BOTH && !twoAntennas){
+        printf("ERROR: a single sideband requires two antennas.\n");
+        return false;
+    }
+    uint16_t buffer[PIO_MAX_INSTRUCTIONS];
+    struct backscatter_layout variant, best;
+    uint8_t best_length = 0;
+    uint16_t d[2] = {d0, d1};
+    if(continuous_phase){
+        if(sideband != SIDEBAND_BOTH){
+            printf("ERROR: continuous phase requires both sidebands (SIDEBAND_BOTH).\n");
+            return false;
+        }
+        // subcarrier frequencies rounded to multiples of baud/2, at least 4 cycles per half-period (input synchronizer)
+        uint32_t k[2];
+        for(uint8_t s = 0; s < 2; s++){
+            k[s] = (2*cycles + d[s]/2) / d[s];
+        }
+        if(k[0] == k[1] || cycles / max(k[0], k[1]) < 4){
+            printf("ERROR: continuous phase: the subcarriers of d0=%u and d1=%u at %" PRIu32 " Baud round to %" PRIu32 " and %" PRIu32 " half-periods per symbol. They have to differ and a half-period has to be at least 4 cycles.\n", d0, d1, baud, k[0], k[1]);
+            return false;
+        }
+        for(uint8_t first = 0; first < 2; first++){
+            if(generate_continuous_phase(cycles, k, first, buffer, &variant)){
+                keep_shortest(buffer, &variant, instructionBuffer, &best, &best_length);
+            }
+        }
+    }else{
+        struct symbol_timing sym[2];
+        for(uint8_t s = 0; s < 2; s++){
+            sym[s].d = d[s];
+            sym[s].reps = (cycles - 4) / d[s] - 1;
+            sym[s].last = (cycles - 4) % d[s];
+            sym[s].tmp = min(sym[s].last, d[s]/2);
+            sym[s].sideband = sideband;
+            uint8_t level[4];
+            uint32_t phase_cycles[4];
+            bool change[4];
+            sym[s].final_level = level[tail_phases(&sym[s], level, phase_cycles, change) - 1];
+        }
+        // try all variants, keep the shortest
+        uint8_t sideset_modes[2] = {2, 1}; // optional side-set, mandatory side-set (only if both symbols end at the same level)
+        uint8_t modes = ((sym[0].final_level >> 1) == (sym[1].final_level >> 1)) ? 2 : 1;
+        if(!twoAntennas){
+            sideset_modes[0] = 0;
+            modes = 1;
+        }
+        for(uint8_t m = 0; m < modes; m++){
+            for(uint8_t v = 0; v < 4; v++){
+                uint8_t first = (v & 1) ? 0 : 1;
+                bool shared = v & 2;
+                if(generate_variant(sym, first, sideset_modes[m], shared, buffer, &variant)){
+                    keep_shortest(buffer, &variant, instructionBuffer, &best, &best_length);
+                }
+            }
+        }
+    }
+    if(best_length == 0){
+        printf("ERROR: The program for d0=%u, d1=%u at %" PRIu32 " Baud does not fit into the state-machine instruction memory. Disabling the second antenna increases the maximal delay per instruction from 8 (16) to 32 cycles and thus reduces the required code space.\n", d0, d1, baud);
+        return false;
+    }
+    if(layout != NULL){
+        *layout = best;
+    }
 
     // configure program origin and length
     backscatter_program->instructions = instructionBuffer;
-    backscatter_program->length = length+1;
+    backscatter_program->length = best_length;
     backscatter_program->origin = -1;
     return true;
 }
 
-/* 
-    - based on d0/d1/baud, the modulation parameters will be computed and returned in the struct backscatter_config 
-    - pin2 is ignored if twoAntennas==false
-*/
-void backscatter_program_init(PIO pio, uint sm, uint pin1, uint pin2, uint16_t d0, uint16_t d1, uint32_t baud, struct backscatter_config *config, uint16_t *instructionBuffer, bool twoAntennas){
-    pio_sm_set_enabled(pio, sm, false); // stop state machine if running
-    // print warning at invalid settings
-    if(d0 % 2 != 0){
-        printf("WARNING: the clock divider d0 has to be an even integer. The state-machine may not function correctly");
-    }
-    if(d1 % 2 != 0){
-        printf("WARNING: the clock divider d1 has to be an even integer. The state-machine may not function correctly");
-    }
-    // correct baud-rate
+// closest baud-rate achievable with the system clock
+uint32_t backscatter_achievable_baud(uint32_t baud){
     if(((uint32_t) (CLKFREQ*pow(10,6))) % baud != 0){
-        uint32_t baud_new = round(((uint32_t) (CLKFREQ*pow(10,6))) / round(((double) CLKFREQ*pow(10,6)) / ((double) baud)));
-        printf("WARNING: a baudrate of %d Baud is not achievable with a %d MHz clock.\nTherefore, the closest achievable baud-rate %d Baud will be used.\n", baud, CLKFREQ, baud_new);
-        baud = baud_new;
+        baud = round(((uint32_t) (CLKFREQ*pow(10,6))) / round(((double) CLKFREQ*pow(10,6)) / ((double) baud)));
     }
-    // generate pio-program
-    struct pio_program backscatter_program;
-    generatePIOprogram(d0,d1,baud, instructionBuffer, &backscatter_program, twoAntennas);
+    return baud;
+}
+
+static uint32_t achievable_baud(uint32_t baud){
+    uint32_t baud_new = backscatter_achievable_baud(baud);
+    if(baud_new != baud){
+        printf("WARNING: a baudrate of %" PRIu32 " Baud is not achievable with a %d MHz clock.\nTherefore, the closest achievable baud-rate %" PRIu32 " Baud will be used.\n", baud, CLKFREQ, baud_new);
+    }
+    return baud_new;
+}
+
+// load the program at offset 0, configure the state-machine and start it
+static void load_program(PIO pio, uint sm, uint pin1, uint pin2, struct pio_program *backscatter_program, struct backscatter_layout *layout, bool twoAntennas){
     uint offset = 0;
-    pio_add_program_at_offset(pio, &backscatter_program, offset); // load program
+    pio_add_program_at_offset(pio, backscatter_program, offset); // load program
     /* print state-machine instructions */
-    //printf("state-machine length: %d\n", backscatter_program.length);
-    //for (uint16_t t = 0; t < backscatter_program.length; t++){
-    //    printf("0x%04x\n",backscatter_program.instructions[t]);
+    //printf("state-machine length: %d\n", backscatter_program->length);
+    //for (uint16_t t = 0; t < backscatter_program->length; t++){
+    //    printf("0x%04x\n",backscatter_program->instructions[t]);
     //}
     // configure the state-machine
     pio_gpio_init(pio, pin1);
@@ -131,46 +565,157 @@ void backscatter_program_init(PIO pio, uint sm, uint pin1, uint pin2, uint16_t d
     }
     // setup default state-machine config
     pio_sm_config c = pio_get_default_sm_config();
-    sm_config_set_wrap(&c, offset, offset + backscatter_program.length-1); 
+    sm_config_set_wrap(&c, offset, offset + layout->wrap);
     // setup specific state-machine config
     sm_config_set_set_pins(&c, pin1, 1);
-    if(twoAntennas){
-        sm_config_set_sideset(&c, 2, true, false);
+    if(layout->toggle){
+        // continuous phase: MOV pins, ~pins toggles the OUT pins read through the IN pins. The OUT range
+        // (wrapping at 31) includes both antennas; pins in between are only affected if they use this PIO.
+        uint base = pin1;
+        uint count = 1;
+        if(twoAntennas){
+            count = ((pin2 - pin1) & 31) + 1;
+            if(count > 16){
+                base = pin2;
+                count = ((pin1 - pin2) & 31) + 1;
+            }
+        }
+        sm_config_set_out_pins(&c, base, count);
+        sm_config_set_in_pins(&c, base);
+    }else if(twoAntennas){
+        sm_config_set_sideset(&c, layout->sideset_bits, layout->sideset_bits == 2, false);
         sm_config_set_sideset_pins(&c, pin2);
     }
     sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_TX); // We only need TX, so get an 8-deep FIFO (join RX and TX FIFO)
     sm_config_set_out_shift(&c, false, true, 32);  // OUT shifts to left (MSB first), autopull after every 32 bit
     pio_sm_init(pio, sm, offset, &c);
+    // antenna levels before the first symbol
+    uint32_t pin_mask = (1u << pin1) | (twoAntennas ? (1u << pin2) : 0);
+    uint32_t pin_values = ((layout->initial_level & 1u) << pin1) | (twoAntennas ? (((layout->initial_level >> 1) & 1u) << pin2) : 0);
+    pio_sm_set_pins_with_mask(pio, sm, pin_values, pin_mask);
+    // preload the loop counters which do not fit into the program (isr/y)
+    for(uint8_t i = 0; i < layout->preload_count; i++){
+        pio_sm_put_blocking(pio, sm, layout->preload_value[i]);
+        pio_sm_exec(pio, sm, layout->preload_pull);
+        pio_sm_exec(pio, sm, layout->preload_out[i]);
+    }
     pio_sm_set_enabled(pio, sm, true);
-    uint32_t reps0 = ((CLKFREQ*1000000/baud - 4) / d0) - 1;
-    uint32_t reps1 = ((CLKFREQ*1000000/baud - 4) / d1) - 1;
-    pio_sm_put_blocking(pio, sm, reps0); // -1 is requried since JMP 0-- is still true
-    pio_sm_put_blocking(pio, sm, reps1); // -1 is required since JMP 0-- is still true
+}
 
-    // compute configuration parameters
+// modulation parameters of a generated program
+void backscatter_compute_config(uint16_t d0, uint16_t d1, uint32_t baud, const struct backscatter_layout *layout, struct backscatter_config *config){
     uint32_t fcenter    = (CLKFREQ*1000000/d0 + CLKFREQ*1000000/d1)/2;
     uint32_t fdeviation = abs(round((((double) CLKFREQ*1000000)/((double) d1)) - ((double) fcenter)));
+    if(layout->toggle){
+        // continuous phase: half_periods*baud/2
+        fcenter    = ((layout->half_periods[0] + layout->half_periods[1]) * baud) / 4;
+        fdeviation = abs(round((layout->half_periods[1] * (double) baud) / 2 - ((double) fcenter)));
+    }
     config->baudrate    = baud;
     config->center_offset = round(fcenter);
     config->deviation   = round(fdeviation);
     config->minRxBw     = round((baud + 2*fdeviation));
-    
+}
+
+static void compute_config(uint16_t d0, uint16_t d1, uint32_t baud, struct backscatter_layout *layout, struct backscatter_config *config){
+    backscatter_compute_config(d0, d1, baud, layout, config);
+    uint32_t fdeviation = config->deviation;
     if (fdeviation > 380000){
         printf("WARNING: the deviation is too large for the CC2500\n");
     }
     if (fdeviation > 1000000){
         printf("WARNING: the deviation is too large for the CC1352\n");
     }
-    if (d0 < d1){
+    if ((sideband == SIDEBAND_LOWER) ? d0 > d1 : d0 < d1){ // the lower sideband mirrors the tones
         printf("WARNING: symbol 0 has been assigned to larger frequncy than symbol 1\n");
     }
+}
 
-    printf("Computed baseband settings: \n- baudrate: %d\n- Center offset: %d\n- deviation: %d\n- RX Bandwidth: %d\n", config->baudrate, config->center_offset, config->deviation, config->minRxBw);
+/* 
+    - based on d0/d1/baud, the modulation parameters will be computed and returned in the struct backscatter_config 
+    - pin2 is ignored if twoAntennas==false
+*/
+bool backscatter_program_init(PIO pio, uint sm, uint pin1, uint pin2, uint16_t d0, uint16_t d1, uint32_t baud, struct backscatter_config *config, uint16_t *instructionBuffer, bool twoAntennas){
+    pio_sm_set_enabled(pio, sm, false); // stop state machine if running
+    // print warning at invalid settings
+    if(d0 % 2 != 0 && !continuous_phase){
+        printf("WARNING: the clock divider d0 has to be an even integer. The state-machine may not function correctly");
+    }
+    if(d1 % 2 != 0 && !continuous_phase){
+        printf("WARNING: the clock divider d1 has to be an even integer. The state-machine may not function correctly");
+    }
+    // correct baud-rate
+    baud = achievable_baud(baud);
+    // generate pio-program
+    struct pio_program backscatter_program;
+    struct backscatter_layout layout;
+    if(!generatePIOprogram(d0,d1,baud, instructionBuffer, &backscatter_program, twoAntennas, &layout)){
+        printf("ERROR: no program for d0=%d d1=%d baud=%" PRIu32 ", the state-machine stays disabled\n", d0, d1, baud);
+        return false;
+    }
+    load_program(pio, sm, pin1, pin2, &backscatter_program, &layout, twoAntennas);
+
+    // compute configuration parameters
+    compute_config(d0, d1, baud, &layout, config);
+    printf("Computed baseband settings: \n- baudrate: %" PRIu32 "\n- Center offset: %" PRIu32 "\n- deviation: %" PRIu32 "\n- RX Bandwidth: %" PRIu32 "\n", config->baudrate, config->center_offset, config->deviation, config->minRxBw);
+    return true;
 }
 
-void backscatter_send(PIO pio, uint sm, uint32_t *message, uint32_t len) {
-    for(uint32_t i = 0; i < len; i++){
-        pio_sm_put_blocking(pio, sm, message[i]); // set pin back to low
+bool backscatter_hopping_init(PIO pio, uint sm, uint pin1, uint pin2, const uint16_t (*dividers)[2], uint8_t channels, uint32_t baud, struct backscatter_hopping *hopping, bool twoAntennas){
+    if(channels == 0 || channels > HOP_MAX_CHANNELS){
+        printf("ERROR: hopping requires 1 to %d channels\n", HOP_MAX_CHANNELS);
+        return false;
+    }
+    pio_sm_set_enabled(pio, sm, false); // stop state machine if running
+    baud = achievable_baud(baud);
+    // generate all programs upfront, a hop only reloads the instruction memory
+    for(uint8_t i = 0; i < channels; i++){
+        struct backscatter_channel *ch = &hopping->channel[i];
+        if(!generatePIOprogram(dividers[i][0], dividers[i][1], baud, ch->instructions, &ch->program, twoAntennas, &ch->layout)){
+            printf("ERROR: no program for hopping channel %d (d0=%d d1=%d)\n", i, dividers[i][0], dividers[i][1]);
+            return false;
+        }
+        compute_config(dividers[i][0], dividers[i][1], baud, &ch->layout, &ch->config);
+        printf("hopping channel %d: d0=%d d1=%d center offset %" PRIu32 " deviation %" PRIu32 " RX bandwidth %" PRIu32 " (%d instructions)\n", i, dividers[i][0], dividers[i][1], ch->config.center_offset, ch->config.deviation, ch->config.minRxBw, ch->program.length);
+    }
+    hopping->channels     = channels;
+    hopping->pin1         = pin1;
+    hopping->pin2         = pin2;
+    hopping->twoAntennas  = twoAntennas;
+    hopping->current      = 0;
+    load_program(pio, sm, pin1, pin2, &hopping->channel[0].program, &hopping->channel[0].layout, twoAntennas);
+    return true;
+}
+
+void backscatter_hop(PIO pio, uint sm, struct backscatter_hopping *hopping, uint8_t channel){
+    if(channel >= hopping->channels || channel == hopping->current){
+        return;
+    }
+    pio_sm_set_enabled(pio, sm, false);
+    pio_remove_program(pio, &hopping->channel[hopping->current].program, 0);
+    load_program(pio, sm, hopping->pin1, hopping->pin2, &hopping->channel[channel].program, &hopping->channel[channel].layout, hopping->twoAntennas);
+    hopping->current = channel;
+}
+
+bool backscatter_send(PIO pio, uint sm, uint32_t *message, uint32_t len) {
+    if(!put_message(pio, sm, message, len)){
+        return false;
     }
     sleep_ms(1); // wait for transmission to finish
+    return true;
+}
+
+/* put the message into the FIFO and return without waiting for the transmission to finish (e.g. for bursts of frames) */
+bool backscatter_send_nowait(PIO pio, uint sm, uint32_t *message, uint32_t len) {
+    return put_message(pio, sm, message, len);
+}
+
+/* is the last word of a message sent with backscatter_send_nowait() still in the FIFO? */
+bool backscatter_busy(PIO pio, uint sm) {
+    return !pio_sm_is_tx_fifo_empty(pio, sm);
+}
+
+/* duration to shift out one 32-bit FIFO word [us] */
+uint32_t backscatter_word_duration_us(uint32_t baud) {
+    return (32*1000000 + baud - 1) / baud; // ceil
 }
@@ -16,6 +16,7 @@
 #include "hardware/clocks.h"
 
 #define CLKFREQ 125
+#define BACKSCATTER_FIFO_TIMEOUT_US 50000 // longer than a FIFO word at 1 kbaud (32 ms): the state-machine stopped
 #ifndef MINMAX
 #define MINMAX
 #define max(x, y) (((x) > (y)) ? (x) : (y))
@@ -32,6 +33,15 @@
 #define ASM_X_REG     0x0001
 #define ASM_Y_REG     0x0002
 #define ASM_ISR_REG   0x0006
+#define ASM_SET_X     0xE020 // SET x
+#define ASM_SET_Y     0xE040 // SET y
+#define ASM_JMP_YMM   0x0080 // JMP y--
+#define ASM_PULL      0x80A0 // PULL block
+#define ASM_TOGGLE_PINS 0xA008 // MOV pins, ~pins
+#define ASM_NOP       0xA042 // MOV y, y
+#define PIO_MAX_INSTRUCTIONS 32
+#define PIO_MAX_SET_VALUE    31
+#define HOP_MAX_CHANNELS      8
 
 #ifndef PIO_BACKSCATTER
 #define PIO_BACKSCATTER
@@ -41,21 +51,104 @@ struct backscatter_config {
   uint32_t deviation;
   uint32_t minRxBw;
 };
+
+/*
+ * sidebands reflected with two antennas
+ * SIDEBAND_BOTH: both antennas switch in phase, the tag reflects both mirror sidebands around the carrier
+ * SIDEBAND_UPPER/LOWER: pin2 lags/leads pin1 by a quarter of the subcarrier period. Assuming a 90 degree
+ * RF phase difference between the two antenna paths, only carrier + subcarrier (upper) or carrier - subcarrier
+ * (lower) is reflected. In the lower sideband the two tones are mirrored: the receiver has to be tuned to
+ * carrier - center_offset and the symbol with the larger subcarrier frequency is the one with the lower frequency.
+ */
+enum backscatter_sideband {
+  SIDEBAND_BOTH = 0,
+  SIDEBAND_UPPER,
+  SIDEBAND_LOWER
+};
+
+/* state-machine settings of a program generated by generatePIOprogram() */
+struct backscatter_layout {
+  uint8_t  wrap;              // last instruction, the program wraps to its first instruction
+  uint8_t  sideset_bits;      // 0: one antenna, 1: mandatory side-set, 2: optional side-set
+  uint8_t  initial_level;     // antenna levels before the first symbol (bit 0: pin1, bit 1: pin2)
+  uint8_t  preload_count;     // loop counters which do not fit into a SET instruction
+  uint16_t preload_pull;      // executed to pull preload_value[i] into the OSR
+  uint16_t preload_out[2];    // executed to move it into the register
+  uint32_t preload_value[2];
+  bool     toggle;            // continuous phase: the antennas are toggled with MOV pins, ~pins (OUT and IN pins)
+  uint16_t half_periods[2];   // continuous phase: half-periods per symbol 0/1, i.e. subcarrier frequency half_periods*baud/2
+};
+
+/* pre-generated program of one subcarrier of a hopping sequence */
+struct backscatter_channel {
+  uint16_t instructions[PIO_MAX_INSTRUCTIONS];
+  struct pio_program program;
+  struct backscatter_layout layout;
+  struct backscatter_config config;
+};
+
+struct backscatter_hopping {
+  uint8_t channels;
+  uint8_t current;            // channel loaded into the instruction memory
+  uint pin1, pin2;
+  bool twoAntennas;
+  struct backscatter_channel channel[HOP_MAX_CHANNELS];
+};
 #endif
 
 // ----------- //
 // backscatter //
 // ----------- //
 
-// how many instructions are needed to create this delay?
-uint8_t instructionCount(uint16_t delay, uint16_t max_delay);
+/* select the reflected sideband(s) of the following programs (requires twoAntennas for SIDEBAND_UPPER/LOWER) */
+bool set_sideband(enum backscatter_sideband sideband);
+enum backscatter_sideband get_sideband();
+
+/*
+ * continuous-phase FSK for the following programs: the subcarrier phase is carried over the symbol boundaries.
+ * The subcarrier frequencies are rounded to multiples of baud/2 (closest to CLKFREQ/d0 and CLKFREQ/d1), such
+ * that every symbol consists of a whole number of half-periods (MSK if they differ by one). Requires SIDEBAND_BOTH.
+ */
+bool set_continuous_phase(bool enabled);
+bool get_continuous_phase();
+
+/*
+ * generate the shortest state-machine program for d0/d1/baud (see backscatter.c)
+ * layout: state-machine settings of the program (may be NULL)
+ * returns false if no program fits into the instruction memory
+ */
+bool generatePIOprogram(uint16_t d0,uint16_t d1, uint32_t baud, uint16_t* instructionBuffer, struct pio_program *backscatter_program, bool twoAntennas, struct backscatter_layout *layout);
+
+/* modulation parameters of a program of generatePIOprogram() (without warnings), baud: as passed to generatePIOprogram() */
+void backscatter_compute_config(uint16_t d0, uint16_t d1, uint32_t baud, const struct backscatter_layout *layout, struct backscatter_config *config);
+
+/* closest baud-rate achievable with the system clock (as used by backscatter_program_init(), without warning) */
+uint32_t backscatter_achievable_baud(uint32_t baud);
+
+/*
+ * based on d0/d1/baud, the modulation parameters will be computed and returned in the struct backscatter_config
+ * returns false (config unchanged, state-machine disabled) if no program fits into the instruction memory
+ */
+bool backscatter_program_init(PIO pio, uint sm, uint pin1, uint pin2, uint16_t d0, uint16_t d1, uint32_t baud, struct backscatter_config *config, uint16_t *instructionBuffer, bool twoAntennas);
+
+/*
+ * frequency hopping: generate one program per subcarrier (dividers[i] = {d0, d1}) and load channel 0
+ * the modulation parameters of every channel are returned in hopping->channel[i].config
+ * returns false if a program does not fit into the instruction memory
+ */
+bool backscatter_hopping_init(PIO pio, uint sm, uint pin1, uint pin2, const uint16_t (*dividers)[2], uint8_t channels, uint32_t baud, struct backscatter_hopping *hopping, bool twoAntennas);
+
+/* switch to the pre-generated program of the channel (only between messages, the state-machine restarts) */
+void backscatter_hop(PIO pio, uint sm, struct backscatter_hopping *hopping, uint8_t channel);
 
-// repeat the instruction until the desired delay has past
-int16_t repeat(uint16_t* instructionBuffer, int16_t delay, uint32_t asm_instr, uint8_t *length, uint16_t max_delay);
+/* returns false if the state-machine does not pull the message within BACKSCATTER_FIFO_TIMEOUT_US per word */
+bool backscatter_send(PIO pio, uint sm, uint32_t *message, uint32_t len);
 
-bool generatePIOprogram(uint16_t d0,uint16_t d1, uint32_t baud, uint16_t* instructionBuffer, struct pio_program *backscatter_program, bool twoAntennas);
+/* put the message into the FIFO and return without waiting for the transmission to finish (e.g. for bursts of frames) */
+bool backscatter_send_nowait(PIO pio, uint sm, uint32_t *message, uint32_t len);
 
-/* based on d0/d1/baud, the modulation parameters will be computed and returned in the struct backscatter_config */
-void backscatter_program_init(PIO pio, uint sm, uint pin1, uint pin2, uint16_t d0, uint16_t d1, uint32_t baud, struct backscatter_config *config, uint16_t *instructionBuffer, bool twoAntennas);
+/* is the last word of a message sent with backscatter_send_nowait() still in the FIFO? */
+bool backscatter_busy(PIO pio, uint sm);
 
-void backscatter_send(PIO pio, uint sm, uint32_t *message, uint32_t len);
+/* duration to shift out one 32-bit FIFO word [us] */
+uint32_t backscatter_word_duration_us(uint32_t baud);
@@ -14,6 +14,7 @@
  */
 
 #include <stdio.h>
+#include <inttypes.h>
 #include <string.h>
 #include <math.h>
 #include "pico/stdlib.h"
@@ -21,6 +22,8 @@
 #include "hardware/spi.h"
 #include "receiver_CC2500.h"
 #include "carrier_CC2500.h"
+#include "profiling.h"
+#include "link_counters.h"
 
 // Address Config = No address check
 // Base Frequency = 2449.999756
@@ -126,19 +129,34 @@ void setTXpower(RF_power setting) {
 }
 
 
+static uint8_t power_level = TX_POWER_MAX_LEVEL;
+
+void set_power_level_tx(uint8_t level){
+    power_level = min(level, TX_POWER_MAX_LEVEL);
+    setTXpower(TX_power[power_level]);
+}
+
+uint8_t power_level_tx(){
+    return power_level;
+}
+
 void setupCarrier(){
     write_strobe_tx(SRES);  // in case of reset without power loss - reset manually
     sleep_us(100);
     write_strobe_tx(SIDLE); // ensure IDLE mode with command strobe: SIDLE
     write_registers_tx(cc2500_unmodulated_2450MHz,16);
-    setTXpower(TX_power[17]); // set +1dBm output power (max)
+    set_power_level_tx(power_level); // +1dBm output power (max) unless a level has been chosen
 }
 
 void startCarrier(){
+    PROFILE_SCOPE(prof_carrier_switch);
+    link_counters.carrier_starts++;
     write_strobe_tx(STX); // start carrier (enter TX mode with command strobe: STX)
 }
 
 void stopCarrier(){
+    PROFILE_SCOPE(prof_carrier_switch);
+    link_counters.carrier_stops++;
     write_strobe_tx(SIDLE); // stop carrier (enter IDLE mode with command strobe: SIDLE)
 }
 
@@ -161,7 +179,7 @@ void set_frecuency_tx(uint32_t f_carrier)
 
     // print new value
     uint32_t f_carrier_calculated = floor(((double) F_XOSC) * (freq + (double) channel*(256+channspc_m)/((double) (1 << 2))) / ((double) (1 << 16)));
-    printf("set tx f_carrier [%u %u %u %u] %u\n", freq, channel, channspc_e, channspc_m, f_carrier_calculated);
+    printf("set tx f_carrier [%" PRIu32 " %u %u %u] %" PRIu32 "\n", freq, channel, channspc_e, channspc_m, f_carrier_calculated);
     
     // CHANNR, FREQ2, FREQ1, FREQ0, MDMCFG1, MDMCFG1
     RF_setting mdmcfg1 = read_register_tx(0x13);
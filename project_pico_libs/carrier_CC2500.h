@@ -29,6 +29,9 @@
 
 #define CARRIER_CSN              5
 
+#define TX_POWER_LEVELS         18 // entries of TX_power[]
+#define TX_POWER_MAX_LEVEL      17 // +1dBm
+
 #define SIDLE                 0x36
 #define   STX                 0x35
 #define  SRES                 0x30
@@ -68,6 +71,12 @@ void write_registers_tx(RF_setting* sets, uint8_t len);
 
 void setTXpower(RF_power setting);
 
+// write the PATABLE entry of TX_power[level] (0 to TX_POWER_MAX_LEVEL)
+void set_power_level_tx(uint8_t level);
+
+// level of the last set_power_level_tx()
+uint8_t power_level_tx();
+
 void setupCarrier();
 
 void startCarrier();
@@ -0,0 +1,30 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * link and driver health counters
+ * see link_counters.h
+ * 
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "link_counters.h"
+
+struct link_counters link_counters = {0};
+
+void reset_link_counters(){
+    memset(&link_counters, 0, sizeof(link_counters));
+}
+
+/* 
+ * print all counters in one compact record:
+ * #CNT t=<ms since boot> tx= stall= con= coff= rx= crc= ovf= drop= noeop=
+ */
+void print_link_counters(uint64_t time_us){
+    printf("#CNT t=%" PRIu64 " tx=%" PRIu32 " stall=%" PRIu32 " con=%" PRIu32 " coff=%" PRIu32 " rx=%" PRIu32 " crc=%" PRIu32 " ovf=%" PRIu32 " drop=%" PRIu32 " noeop=%" PRIu32 "\n",
+        time_us/1000,
+        link_counters.packets_sent, link_counters.pio_stalls, link_counters.carrier_starts, link_counters.carrier_stops,
+        link_counters.packets_received, link_counters.crc_failures, link_counters.rx_fifo_overflows, link_counters.event_drops, link_counters.sync_without_eop);
+}
@@ -0,0 +1,40 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * link and driver health counters
+ * 
+ * The counters are incremented by the backscatter, carrier and receiver libraries and allow to tell
+ * radio losses (CRC failures, sync words without end of packet) apart from firmware bottlenecks
+ * (PIO stalls, RX FIFO overflows, dropped events).
+ * 
+ */
+
+#ifndef LINK_COUNTERS_LIB
+#define LINK_COUNTERS_LIB
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+
+struct link_counters {
+  uint32_t packets_sent;      // messages put into the PIO FIFO
+  uint32_t pio_stalls;        // PIO TX FIFO ran empty within a message (FDEBUG TXSTALL)
+  uint32_t carrier_starts;
+  uint32_t carrier_stops;
+  uint32_t packets_received;  // packets read from the RX FIFO (without overflow)
+  uint32_t crc_failures;
+  uint32_t rx_fifo_overflows;
+  uint32_t event_drops;       // GDO0 events lost since the event queue was full
+  uint32_t sync_without_eop;  // sync word detected, but the packet has never been completed
+};
+
+extern struct link_counters link_counters;
+
+void reset_link_counters();
+
+/* 
+ * print all counters in one compact record:
+ * #CNT t=<ms since boot> tx= stall= con= coff= rx= crc= ovf= drop= noeop=
+ */
+void print_link_counters(uint64_t time_us);
+
+#endif
@@ -0,0 +1,142 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * on-receiver link quality: bit and packet error rate without logging every packet
+ * see link_quality.h
+ *
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <math.h>
+#include "pico/stdlib.h"
+#include "packet_generation.h"
+#include "link_quality.h"
+#include "profiling.h"
+
+#define DATA_WORDS ((MAX_PAYLOADSIZE + 3) / 4)
+
+struct link_quality link_quality = {0};
+static struct link_quality *lq = &link_quality;
+
+// the Cortex-M0+ has no population count instruction
+static uint32_t popcount32(uint32_t x){
+    x = x - ((x >> 1) & 0x55555555);
+    x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+    x = (x + (x >> 4)) & 0x0F0F0F0F;
+    return (x * 0x01010101) >> 24;
+}
+
+// bit errors of the data compared with the file at index
+static uint32_t data_errors(const uint32_t *received, uint16_t index, uint8_t data_len){
+    uint32_t reference[DATA_WORDS] = {0};
+    reference_data((uint8_t *) reference, index, data_len);
+    uint32_t errors = 0;
+    for(uint8_t w = 0; w < (data_len + 3) / 4; w++){
+        errors += popcount32(received[w] ^ reference[w]);
+    }
+    return errors;
+}
+
+void select_link_quality(struct link_quality *q){
+    lq = q;
+}
+
+void reset_link_quality(uint64_t time_us){
+    uint8_t last_seq = lq->last_seq;
+    uint16_t last_index = lq->last_index;
+    bool seq_valid = lq->seq_valid;
+    uint8_t candidate_seq = lq->candidate_seq;
+    uint16_t candidate_index = lq->candidate_index;
+    bool candidate_valid = lq->candidate_valid;
+    memset(lq, 0, sizeof(struct link_quality));
+    lq->start_us = time_us;
+    lq->last_seq = last_seq;
+    lq->last_index = last_index;
+    lq->seq_valid = seq_valid;
+    lq->candidate_seq = candidate_seq;
+    lq->candidate_index = candidate_index;
+    lq->candidate_valid = candidate_valid;
+}
+
+// the file index advances by data_len per sequence number
+static bool follows(uint8_t last_seq, uint16_t last_index, uint8_t seq, uint16_t index, uint8_t data_len){
+    uint8_t step = seq - last_seq;
+    return step > 0 && index == (uint16_t) (last_index + step * data_len);
+}
+
+// a verified packet: the packets since the last verified one (from) were sent
+static void anchor(uint8_t from, uint8_t seq, uint16_t index, uint8_t extra){
+    lq->expected += (lq->seq_valid ? (uint8_t) (seq - from) : 1) + extra;
+    lq->last_seq = seq;
+    lq->last_index = index;
+    lq->seq_valid = true;
+    lq->candidate_valid = false;
+}
+
+void analyze_packet(const uint8_t *buffer, Packet_status status, uint8_t payload_size){
+    PROFILE_SCOPE(prof_analyze_packet);
+    if(status.overflowed){
+        lq->overflows++;
+        return;
+    }
+    lq->received++;
+    lq->rssi_sum += status.RSSI;
+    lq->rssi_min = (lq->received == 1) ? status.RSSI : min(lq->rssi_min, status.RSSI);
+    lq->rssi_max = (lq->received == 1) ? status.RSSI : max(lq->rssi_max, status.RSSI);
+    if(!status.CRCcheck){
+        lq->crc_failures++;
+    }
+    if(status.len != payload_size + 2 || buffer[0] != payload_size + 1 || payload_size < MIN_PAYLOADSIZE){
+        lq->length_errors++;
+        return;
+    }
+
+    // compare the data with the reference in words, both are zero padded
+    uint8_t seq = buffer[1];
+    uint8_t data_len = payload_size - 2;
+    uint16_t index = (((uint16_t) buffer[2]) << 8) | buffer[3];
+    uint32_t received[DATA_WORDS] = {0};
+    memcpy(received, &buffer[4], data_len);
+    uint32_t errors = data_errors(received, index, data_len);
+    bool consistent = !lq->seq_valid || follows(lq->last_seq, lq->last_index, seq, index, data_len);
+    if(!consistent && errors > 0){
+        // the file index might be corrupted itself: the index expected from the sequence number explains the data better
+        uint16_t expected_index = lq->last_index + (uint8_t) (seq - lq->last_seq) * data_len;
+        uint32_t expected_errors = popcount32(index ^ expected_index);
+        if(expected_errors < errors){
+            expected_errors += data_errors(received, expected_index, data_len);
+            errors = min(errors, expected_errors);
+        }
+    }
+    if(status.CRCcheck || (errors == 0 && consistent)){
+        anchor(lq->last_seq, seq, index, 0);
+    }else if(errors == 0){
+        // correct data but the sequence number does not fit: either this packet (corrupted sequence number) or
+        // the last verified one is wrong, the next correct packet following this one decides
+        if(lq->candidate_valid && follows(lq->candidate_seq, lq->candidate_index, seq, index, data_len)){
+            anchor(lq->candidate_seq, seq, index, 1);
+            consistent = true;
+        }else{
+            lq->candidate_seq = seq;
+            lq->candidate_index = index;
+            lq->candidate_valid = true;
+        }
+    }
+    lq->bits += 8 * payload_size;
+    lq->bit_errors += errors;
+    lq->correct += errors == 0 && (status.CRCcheck || consistent);
+}
+
+void print_link_quality(uint64_t time_us){
+    uint32_t lost = (lq->expected > lq->received) ? lq->expected - lq->received : 0;
+    double ber = lq->bits ? ((double) lq->bit_errors) / lq->bits : 0.0;
+    double per = lq->expected ? 1.0 - min(((double) lq->correct) / lq->expected, 1.0) : NAN; // nothing verified yet
+    int32_t rssi = lq->received ? lq->rssi_sum / (int32_t) lq->received : 0;
+    printf("#LQ t=%" PRIu64 " window_ms=%" PRIu64 " rx=%" PRIu32 " expected=%" PRIu32 " lost=%" PRIu32 " correct=%" PRIu32 " crc=%" PRIu32 " ovf=%" PRIu32 " len=%" PRIu32 " bits=%" PRIu32 " bit_errors=%" PRIu32 " ber=%.2e per=%.4f rssi=%" PRId32 " rssi_min=%d rssi_max=%d\n",
+        time_us/1000, (time_us - lq->start_us)/1000, lq->received, lq->expected, lost, lq->correct,
+        lq->crc_failures, lq->overflows, lq->length_errors, lq->bits, lq->bit_errors,
+        ber, per, rssi, lq->rssi_min, lq->rssi_max);
+    reset_link_quality(time_us);
+}
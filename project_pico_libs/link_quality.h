@@ -0,0 +1,68 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * on-receiver link quality: bit and packet error rate without logging every packet
+ *
+ * The first two payload bytes carry the file index, the data following it is regenerated with reference_data()
+ * and compared word by word (XOR and popcount). As in compute_ber() of stats/functions.py, a packet counts
+ * 8 * payload bits. Unlike compute_ber(), a packet whose file index does not follow the last verified packet is also
+ * compared with the index expected from its sequence number (last verified packet + sequence gap * data bytes); if
+ * that explains the packet with fewer bit errors, the errors of the index bytes are counted as well instead of
+ * comparing the data with a wrong reference.
+ * As in serial-print.py, a packet is verified by a correct CRC or by error-free data whose file index follows the last
+ * verified packet; the sequence numbers between two verified packets give the packets sent. Error-free data with an
+ * inconsistent index becomes a candidate, the next error-free packet following it re-anchors the sequence numbers.
+ * The statistics cover the window since the last print_link_quality().
+ *
+ */
+
+#ifndef LINK_QUALITY_LIB
+#define LINK_QUALITY_LIB
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "receiver_CC2500.h"
+
+struct link_quality {
+  uint64_t start_us;          // start of the window
+  uint32_t received;          // packets read from the RX FIFO (without overflow)
+  uint32_t expected;          // packets sent according to the sequence numbers of the verified packets
+  uint32_t correct;           // correct data, verified by the CRC or the file index
+  uint32_t crc_failures;
+  uint32_t overflows;
+  uint32_t length_errors;     // length differs from the payload size (not compared)
+  uint32_t bits;
+  uint32_t bit_errors;
+  int32_t  rssi_sum;
+  int16_t  rssi_min;
+  int16_t  rssi_max;
+  uint8_t  last_seq;          // of the last verified packet
+  uint16_t last_index;
+  bool     seq_valid;
+  uint8_t  candidate_seq;     // error-free packet not following the last verified one
+  uint16_t candidate_index;
+  bool     candidate_valid;
+};
+
+extern struct link_quality link_quality;
+
+/* the window of the functions below (default: link_quality), e.g. one per receiver of MULTI_FDMA */
+void select_link_quality(struct link_quality *q);
+
+/* start a new window, the sequence numbers continue */
+void reset_link_quality(uint64_t time_us);
+
+/*
+ * add a packet of readPacket() (buffer: length, seq, file index, data)
+ * payload_size: payload of the transmitter (get_payload_size())
+ */
+void analyze_packet(const uint8_t *buffer, Packet_status status, uint8_t payload_size);
+
+/*
+ * print the window in one record and start a new one:
+ * #LQ t=<ms since boot> window_ms= rx= expected= lost= correct= crc= ovf= len= bits= bit_errors= ber= per= rssi= rssi_min= rssi_max=
+ * (per: 1 - correct/expected, nan without verified packets, rssi: mean [dBm])
+ */
+void print_link_quality(uint64_t time_us);
+
+#endif
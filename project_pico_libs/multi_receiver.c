@@ -0,0 +1,222 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * several CC2500 receivers on RADIO_SPI
+ * see multi_receiver.h
+ *
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "packet_generation.h"
+#include "multi_receiver.h"
+
+struct multi_rx multi_rx = {0};
+static struct cc2500_rx receivers[MAX_RECEIVERS - 1]; // receiver 0 is default_rx
+
+bool setup_multi_rx(const uint *cs_pins, const uint *gdo0_pins, uint8_t count, enum multi_mode mode){
+    if(count == 0 || count > MAX_RECEIVERS){
+        printf("ERROR: 1 to %d receivers are supported.\n", MAX_RECEIVERS);
+        return false;
+    }
+    struct cc2500_rx *previous = selected_rx();
+    memset(&multi_rx, 0, sizeof(multi_rx));
+    multi_rx.mode = mode;
+    for(uint8_t i = 0; i < count; i++){
+        struct cc2500_rx *r = (i == 0) ? &default_rx : &receivers[i - 1];
+        if(!init_rx(r, cs_pins[i], gdo0_pins[i])){
+            select_rx(previous);
+            return false;
+        }
+        select_rx(r);
+        setupReceiver();
+        multi_rx.rx[i] = r;
+        multi_rx.count++;
+    }
+    select_rx(previous);
+    return true;
+}
+
+void multi_start_listen(){
+    struct cc2500_rx *previous = selected_rx();
+    for(uint8_t i = 0; i < multi_rx.count; i++){
+        select_rx(multi_rx.rx[i]);
+        RX_start_listen();
+    }
+    select_rx(previous);
+}
+
+// sequence number and file index are complete (length byte agrees with the RX FIFO)
+static bool has_header(const uint8_t *buffer, Packet_status status){
+    return status.len >= 4 && status.len <= RX_BUFFER_SIZE && buffer[0] == status.len - 1;
+}
+
+/*
+ * the data of generate_data() at the file index of the copy
+ * (the samples of a data source have no reference: the CRC decides)
+ */
+static bool verified(const uint8_t *buffer, Packet_status status){
+    if(!has_header(buffer, status)){
+        return false;
+    }
+    if(get_data_source() != NULL){
+        return status.CRCcheck;
+    }
+    uint8_t reference[RX_BUFFER_SIZE];
+    uint16_t index = (((uint16_t) buffer[2]) << 8) | buffer[3];
+    reference_data(reference, index, status.len - 4);
+    return memcmp(&buffer[4], reference, status.len - 4) == 0;
+}
+
+// a copy is better with verified data, then with a correct CRC, then with a higher RSSI
+static bool better(const uint8_t *a_buffer, Packet_status a, const uint8_t *b_buffer, Packet_status b){
+    bool a_verified = verified(a_buffer, a);
+    bool b_verified = verified(b_buffer, b);
+    if(a_verified != b_verified){
+        return a_verified;
+    }
+    if(a.CRCcheck != b.CRCcheck){
+        return a.CRCcheck;
+    }
+    return a.RSSI > b.RSSI;
+}
+
+// deliver the pending packet of the diversity mode (to the caller or to the queue)
+static void deliver(struct multi_packet *packet){
+    *packet = multi_rx.pending;
+    multi_rx.pending.valid = false;
+    multi_rx.delivered++;
+    multi_rx.delivered_crc_pass += packet->status.CRCcheck;
+    multi_rx.copies += packet->copies;
+}
+
+/*
+ * add a copy to the pending packet, returns true if the previous packet has been delivered
+ * (if a packet has already been delivered in this poll, the previous one is queued: copies of three packets in one poll)
+ */
+static bool combine(uint8_t receiver, const uint8_t *buffer, Packet_status status, uint64_t time_us, struct multi_packet *packet, bool found){
+    struct multi_packet *pending = &multi_rx.pending;
+    bool delivered = false;
+    if(pending->valid){
+        // sequence number and file index, with or without CRC
+        bool same_seq = has_header(buffer, status) && has_header(pending->buffer, pending->status) && memcmp(&buffer[1], &pending->buffer[1], 3) == 0;
+        bool same = same_seq && time_us - pending->time_us <= DIVERSITY_HOLD_US && !(pending->seen & (1 << receiver));
+        if(same){
+            pending->copies++;
+            pending->seen |= 1 << receiver;
+            if(better(buffer, status, pending->buffer, pending->status)){
+                memcpy(pending->buffer, buffer, RX_BUFFER_SIZE);
+                pending->status = status;
+                pending->receiver = receiver;
+            }
+            return false;
+        }
+        deliver(found ? &multi_rx.queue[multi_rx.queued++] : packet);
+        delivered = true;
+    }
+    memcpy(pending->buffer, buffer, RX_BUFFER_SIZE);
+    pending->status = status;
+    pending->time_us = time_us;
+    pending->receiver = receiver;
+    pending->copies = 1;
+    pending->seen = 1 << receiver;
+    pending->valid = true;
+    return delivered;
+}
+
+// next event of the selected receiver is the end of a packet
+static bool packet_ready(){
+    event_t evt;
+    while((evt = get_event()) != no_evt){
+        if(evt == rx_deassert_evt){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool poll_multi_rx(struct multi_packet *packet){
+    if(multi_rx.queued > 0){
+        *packet = multi_rx.queue[0];
+        memmove(&multi_rx.queue[0], &multi_rx.queue[1], --multi_rx.queued * sizeof(struct multi_packet));
+        return true;
+    }
+    struct cc2500_rx *previous = selected_rx();
+    uint8_t buffer[RX_BUFFER_SIZE];
+    uint8_t rearm = 0;
+    bool found = false;
+    // read the copies of all receivers before re-arming any of them (RX_start_listen() takes several ms)
+    uint8_t first = multi_rx.next;
+    for(uint8_t n = 0; n < multi_rx.count && !(found && multi_rx.mode == MULTI_FDMA); n++){
+        uint8_t i = (first + n) % multi_rx.count;
+        select_rx(multi_rx.rx[i]);
+        if(!packet_ready()){
+            continue;
+        }
+        uint64_t time_us = to_us_since_boot(get_absolute_time());
+        Packet_status status = readPacket(buffer);
+        rearm |= 1 << i;
+        multi_rx.next = (i + 1) % multi_rx.count;
+        if(status.overflowed){
+            continue; // counted by link_counters
+        }
+        multi_rx.packets[i]++;
+        multi_rx.crc_pass[i] += status.CRCcheck;
+        if(multi_rx.mode == MULTI_FDMA){
+            memcpy(packet->buffer, buffer, RX_BUFFER_SIZE);
+            packet->status = status;
+            packet->time_us = time_us;
+            packet->receiver = i;
+            packet->copies = 1;
+            packet->seen = 1 << i;
+            packet->valid = true;
+            multi_rx.delivered++;
+            multi_rx.delivered_crc_pass += status.CRCcheck;
+            multi_rx.copies++;
+            found = true;
+        }else{
+            found |= combine(i, buffer, status, time_us, packet, found);
+        }
+    }
+    for(uint8_t i = 0; i < multi_rx.count; i++){
+        if(rearm & (1 << i)){
+            select_rx(multi_rx.rx[i]);
+            RX_start_listen();
+        }
+    }
+    select_rx(previous);
+    if(!found && multi_rx.pending.valid){
+        uint64_t now_us = to_us_since_boot(get_absolute_time());
+        if(multi_rx.pending.copies == multi_rx.count || now_us - multi_rx.pending.time_us > DIVERSITY_HOLD_US){
+            deliver(packet);
+            found = true;
+        }
+    }
+    return found;
+}
+
+// ' key=<receiver 0>,<receiver 1>,...'
+static void print_per_receiver(const char *key, const uint32_t *values){
+    printf(" %s=", key);
+    for(uint8_t i = 0; i < multi_rx.count; i++){
+        printf((i == 0) ? "%" PRIu32 : ",%" PRIu32, values[i]);
+    }
+}
+
+void print_multi_rx(uint64_t time_us){
+    uint32_t overflows[MAX_RECEIVERS], no_eop[MAX_RECEIVERS], drops[MAX_RECEIVERS];
+    for(uint8_t i = 0; i < multi_rx.count; i++){
+        overflows[i] = multi_rx.rx[i]->counters.rx_fifo_overflows;
+        no_eop[i] = multi_rx.rx[i]->counters.sync_without_eop;
+        drops[i] = multi_rx.rx[i]->counters.event_drops;
+    }
+    printf("#MULTI t=%" PRIu64 " mode=%s receivers=%u", time_us/1000, (multi_rx.mode == MULTI_FDMA) ? "fdma" : "diversity", multi_rx.count);
+    print_per_receiver("packets", multi_rx.packets);
+    print_per_receiver("crc_pass", multi_rx.crc_pass);
+    print_per_receiver("ovf", overflows);
+    print_per_receiver("noeop", no_eop);
+    print_per_receiver("drop", drops);
+    printf(" delivered=%" PRIu32 " delivered_crc_pass=%" PRIu32 " copies=%" PRIu32 "\n", multi_rx.delivered, multi_rx.delivered_crc_pass, multi_rx.copies);
+}
@@ -0,0 +1,78 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * several CC2500 receivers on RADIO_SPI (separate chip select and GDO0 pins, see struct cc2500_rx)
+ *
+ * MULTI_DIVERSITY: all receivers listen to the same subcarrier (e.g. with separate antennas) and every packet is
+ *   delivered once: the best copy (data verified with reference_data() first, then CRC pass, then RSSI). Copies belong
+ *   to the same packet if they have been read within DIVERSITY_HOLD_US and carry the same sequence number and file
+ *   index (with or without CRC; a copy with a corrupted header is delivered as a packet of its own). A packet is
+ *   delivered as soon as every receiver has a copy, after DIVERSITY_HOLD_US or when the next packet arrives (if a
+ *   packet has already been delivered in this poll, it is queued and delivered by the next poll).
+ * MULTI_FDMA: every receiver listens to another channel (tags on different subcarriers), all packets are delivered
+ *   with the index of their receiver.
+ *
+ * Receiver 0 is default_rx, i.e. the functions of receiver_CC2500.h keep working on it after poll_multi_rx().
+ *
+ */
+
+#ifndef MULTI_RECEIVER_LIB
+#define MULTI_RECEIVER_LIB
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "receiver_CC2500.h"
+
+#define MAX_RECEIVERS            4
+#define DIVERSITY_HOLD_US     3000 // wait this long for the copies of the other receivers
+
+enum multi_mode {MULTI_DIVERSITY, MULTI_FDMA};
+
+struct multi_packet {
+  uint8_t  buffer[RX_BUFFER_SIZE];
+  Packet_status status;
+  uint64_t time_us;           // read from the first receiver
+  uint8_t  receiver;          // receiver of the delivered copy
+  uint8_t  copies;            // diversity: receivers with a copy
+  uint8_t  seen;              // diversity: bit per receiver with a copy
+  bool     valid;
+};
+
+struct multi_rx {
+  struct cc2500_rx *rx[MAX_RECEIVERS];
+  uint8_t  count;
+  enum multi_mode mode;
+  uint8_t  next;              // receiver polled first (round robin)
+  struct multi_packet pending; // diversity: best copy of the current packet
+  struct multi_packet queue[MAX_RECEIVERS - 1]; // diversity: packets completed after the one delivered by a poll
+  uint8_t  queued;
+  uint32_t packets[MAX_RECEIVERS];  // read from the RX FIFO (without overflow)
+  uint32_t crc_pass[MAX_RECEIVERS];
+  uint32_t delivered;
+  uint32_t delivered_crc_pass;
+  uint32_t copies;            // diversity: copies of the delivered packets
+};
+
+extern struct multi_rx multi_rx;
+
+/*
+ * set up count receivers with these pins (receiver 0: default_rx) with setupReceiver(), configure each of them
+ * afterwards with select_rx(multi_rx.rx[i]) and the set_*_rx() functions
+ */
+bool setup_multi_rx(const uint *cs_pins, const uint *gdo0_pins, uint8_t count, enum multi_mode mode);
+
+/* RX_start_listen() on all receivers */
+void multi_start_listen();
+
+/* poll all receivers and re-arm them after a packet, returns true with the next packet (the selection is kept) */
+bool poll_multi_rx(struct multi_packet *packet);
+
+/*
+ * print the statistics since setup_multi_rx():
+ * #MULTI t=<ms since boot> mode= receivers= packets=<per receiver> crc_pass=<per receiver> ovf=<per receiver> noeop=<per receiver>
+ *        drop=<per receiver> delivered= delivered_crc_pass= copies=
+ * (ovf, noeop, drop: the link counters of every receiver, see struct cc2500_rx)
+ */
+void print_multi_rx(uint64_t time_us);
+
+#endif
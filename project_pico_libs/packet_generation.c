@@ -6,20 +6,48 @@
  */
 
 #include <stdio.h>
+#include <inttypes.h>
 #include <string.h>
 #include <math.h>
 #include "pico/stdlib.h"
 #include "packet_generation.h"
+#include "profiling.h"
 
 #define DEFAULT_SEED 0xABCD
+#define RND_A 1664525
+#define RND_C 1013904223
 uint32_t seed = DEFAULT_SEED;
 
-uint8_t packet_hdr_2500[HEADER_LEN] = {0xaa, 0xaa, 0xaa, 0xaa, 0xd3, 0x91, 0xd3, 0x91, 0x00, 0x00};    // CC2500, the last two byte one for the payload length. and another is seq number
-uint8_t packet_hdr_1352[HEADER_LEN] = {0xaa, 0xaa, 0xaa, 0xaa, 0x93, 0x0b, 0x51, 0xde, 0x00, 0x00};    // CC1352P7, the last two byte one for the payload length. and another is seq number
+uint8_t packet_hdr_2500[MAX_HEADER_LEN] = {0xaa, 0xaa, 0xaa, 0xaa, 0xd3, 0x91, 0xd3, 0x91, 0x00, 0x00};    // CC2500, the last two byte one for the payload length. and another is seq number
+uint8_t packet_hdr_1352[MAX_HEADER_LEN] = {0xaa, 0xaa, 0xaa, 0xaa, 0x93, 0x0b, 0x51, 0xde, 0x00, 0x00};    // CC1352P7, the last two byte one for the payload length. and another is seq number
+static const uint8_t sync_2500[4] = {0xd3, 0x91, 0xd3, 0x91}; // 16-bit: SYNC1/SYNC0 once, 32-bit: twice
+static const uint8_t sync_1352[4] = {0x93, 0x0b, 0x51, 0xde}; // 16-bit: the 16 LSBs of the sync word
+uint8_t header_len = HEADER_LEN;
+
+uint8_t payload_size = PAYLOADSIZE;
+static bool whitening = false;
+// PN9 sequence of the CC2500 whitening (LFSR x^9 + x^5 + 1 initialized with all ones), one byte per transmitted byte
+static const uint8_t pn9[WHITENING_LEN] = {
+    0xFF, 0xE1, 0x1D, 0x9A, 0xED, 0x85, 0x33, 0x24, 0xEA, 0x7A, 0xD2, 0x39, 0x70, 0x97, 0x57, 0x0A,
+    0x54, 0x7D, 0x2D, 0xD8, 0x6D, 0x0D, 0xBA, 0x8F, 0x67, 0x59, 0xC7, 0xA2, 0xBF, 0x34, 0xCA, 0x18,
+    0x30, 0x53, 0x93, 0xDF, 0x92, 0xEC, 0xA7, 0x15, 0x8A, 0xDC, 0xF4, 0x86, 0x55, 0x4E, 0x18, 0x21,
+    0x40, 0xC4, 0xC4, 0xD5, 0xC6, 0x91, 0x8A, 0xCD, 0xE7, 0xD1, 0x4E, 0x09, 0x32, 0x17, 0xDF, 0x83,
+};
+// CRC-16 (polynomial 0x8005) of the 16 values of the upper nibble, the CRC is updated per nibble
+static const uint16_t crc16_nibble[16] = {
+    0x0000, 0x8005, 0x800F, 0x000A, 0x801B, 0x001E, 0x0014, 0x8011, 0x8033, 0x0036, 0x003C, 0x8039, 0x0028, 0x802D, 0x8027, 0x0022,
+};
+static Frame frame_arena[FRAME_ARENA_SIZE];
+static uint8_t frame_arena_position = 0;
+
+static struct data_source *data_source = NULL;
+static struct data_source synthetic;
+static uint16_t synthetic_ring[SOURCE_RING_SAMPLES];
+static uint32_t synthetic_written = 0;
 
 /*
  * obtain the packet header template for the corresponding radio
- * buffer: array of size HEADER_LEN 
+ * buffer: array of size get_header_len()
  * receiver: radio number (2500 or 1352)
  */
 uint8_t *packet_hdr_template(uint16_t receiver){
@@ -34,8 +62,8 @@ uint8_t *packet_hdr_template(uint16_t receiver){
  * generate of a uniform random number.
  */
 uint32_t rnd() {
-    const uint32_t A1 = 1664525;
-    const uint32_t C1 = 1013904223;
+    const uint32_t A1 = RND_A;
+    const uint32_t C1 = RND_C;
     const uint32_t RAND_MAX1 = 0xFFFFFFFF;
     seed = ((seed * A1 + C1) & RAND_MAX1);
     return seed;
@@ -59,6 +87,46 @@ uint16_t generate_sample(){
     return max(0.0,min(((double) 0x3FFFFF),tmp * cos(two_pi * u2) + ((double) 0x1FFF)));
 }
 
+/*
+ * seed after n calls of rnd(), by squaring the recurrence (O(log n))
+ */
+static uint32_t rnd_skip(uint32_t s, uint32_t n){
+    uint32_t a = RND_A, c = RND_C;
+    uint32_t acc_a = 1, acc_c = 0;
+    while(n > 0){
+        if(n & 1){
+            acc_a = acc_a * a;
+            acc_c = acc_c * a + c;
+        }
+        c = (a + 1) * c;
+        a = a * a;
+        n >>= 1;
+    }
+    return acc_a * s + acc_c;
+}
+
+/*
+ * continue the data at the given file_position (even), e.g. to regenerate a lost chunk
+ * every sample consumes two calls of rnd()
+ */
+void seek_data(uint16_t position){
+    file_position = position & 0xFFFE;
+    seed = rnd_skip(DEFAULT_SEED, file_position);
+}
+
+/*
+ * data of the file at position (even) without changing the sequence of generate_data() (file_position and seed)
+ * e.g. the reference of a received payload
+ */
+void reference_data(uint8_t *buffer, uint16_t position, uint8_t length){
+    uint16_t saved_position = file_position;
+    uint32_t saved_seed = seed;
+    seek_data(position);
+    generate_data(buffer, length, false);
+    file_position = saved_position;
+    seed = saved_seed;
+}
+
 /*
  * fill packet with 16-bit samples
  * include_index: shall the file index be included at the first two byte?
@@ -82,8 +150,182 @@ void generate_data(uint8_t *buffer, uint8_t length, bool include_index) {
     }
 }
 
+static bool synthetic_start(struct data_source *source){
+    synthetic_written = 0;
+    seek_data(0);
+    return true;
+}
+
+// writes the samples due since the last call, the generator skips those which would be overwritten anyway
+static uint32_t synthetic_produced(struct data_source *source){
+    uint32_t due = (uint32_t) ((time_us_64() - source->start_us) * source->sample_rate / 1000000);
+    if(due - synthetic_written > SOURCE_RING_SAMPLES){
+        synthetic_written = due - SOURCE_RING_SAMPLES;
+        seek_data(2 * synthetic_written);
+    }
+    while(synthetic_written != due){
+        source->ring[synthetic_written & (SOURCE_RING_SAMPLES - 1)] = generate_sample();
+        synthetic_written++;
+    }
+    return synthetic_written;
+}
+
+static void synthetic_stop(struct data_source *source){
+}
+
+/*
+ * stand-in for a sensor: replays generate_sample() at sample_rate
+ */
+struct data_source *synthetic_source(uint32_t sample_rate){
+    memset(&synthetic, 0, sizeof(synthetic));
+    synthetic.name = "synthetic";
+    synthetic.sample_rate = sample_rate;
+    synthetic.start = synthetic_start;
+    synthetic.produced = synthetic_produced;
+    synthetic.stop = synthetic_stop;
+    synthetic.ring = synthetic_ring;
+    return &synthetic;
+}
+
+/*
+ * build the following frames from source (NULL: generate_data())
+ * returns false (and falls back to generate_data()) if the source cannot be started
+ */
+bool set_data_source(struct data_source *source){
+    if(data_source != NULL){
+        data_source->stop(data_source);
+        data_source = NULL;
+    }
+    if(source == NULL){
+        return true;
+    }
+    source->consumed = 0;
+    source->frames = 0;
+    source->max_level = 0;
+    source->backpressure = 0;
+    source->underruns = 0;
+    source->overruns = 0;
+    source->lost_samples = 0;
+    source->start_us = time_us_64();
+    if(!source->start(source)){
+        printf("ERROR: the data source %s could not be started, using generate_data().\n", source->name);
+        return false;
+    }
+    data_source = source;
+    return true;
+}
+
+struct data_source *get_data_source(){
+    return data_source;
+}
+
+/*
+ * samples waiting in the ring, drops the oldest ones if the producer is about to overwrite them
+ */
+uint32_t source_level(){
+    if(data_source == NULL){
+        return 0;
+    }
+    uint32_t produced = data_source->produced(data_source);
+    uint32_t level = produced - data_source->consumed;
+    if(level > SOURCE_RING_SAMPLES - SOURCE_GUARD){
+        uint32_t dropped = level - (SOURCE_RING_SAMPLES - SOURCE_GUARD);
+        data_source->consumed += dropped;
+        data_source->overruns++;
+        data_source->lost_samples += dropped;
+        level -= dropped;
+    }
+    data_source->max_level = max(data_source->max_level, level);
+    return level;
+}
+
+bool source_ready(){
+    return data_source == NULL || source_level() >= (payload_size - 2) / 2;
+}
+
+bool source_backpressure(){
+    return data_source != NULL && source_level() > 3 * SOURCE_RING_SAMPLES / 4;
+}
+
+/*
+ * file index and samples of the data source, serialized from the ring slice (MSB first)
+ * waits for the samples if necessary
+ */
+static void source_data(uint8_t *buffer, uint8_t length){
+    uint8_t samples = (length - 2) / 2;
+    uint32_t level = source_level();
+    if(level < samples){
+        data_source->underruns++;
+        while(level < samples){
+            sleep_us(10);
+            level = source_level();
+        }
+    }
+    data_source->backpressure += level > 3 * SOURCE_RING_SAMPLES / 4;
+    data_source->frames++;
+    uint32_t position = data_source->consumed;
+    uint16_t index = (uint16_t) (2 * position);
+    buffer[0] = (uint8_t) (index >> 8);
+    buffer[1] = (uint8_t) (index & 0x00FF);
+    const uint16_t *ring = data_source->ring;
+    for(uint8_t i = 2; i < length; i = i + 2){
+        uint16_t sample = ring[position & (SOURCE_RING_SAMPLES - 1)];
+        buffer[i]   = (uint8_t) (sample >> 8);
+        buffer[i+1] = (uint8_t) (sample & 0x00FF);
+        position++;
+    }
+    data_source->consumed = position;
+}
+
+/*
+ * '#SOURCE t=<ms since boot> name= rate= produced= consumed= level= max_level= frames= backpressure= underruns= overruns= lost='
+ */
+void print_data_source(uint64_t time_us){
+    if(data_source == NULL){
+        printf("#SOURCE t=%" PRIu64 " name=generate_data\n", time_us/1000);
+        return;
+    }
+    uint32_t level = source_level();
+    printf("#SOURCE t=%" PRIu64 " name=%s rate=%" PRIu32 " produced=%" PRIu32 " consumed=%" PRIu32 " level=%" PRIu32 " max_level=%" PRIu32 " frames=%" PRIu32 " backpressure=%" PRIu32 " underruns=%" PRIu32 " overruns=%" PRIu32 " lost=%" PRIu32 "\n",
+        time_us/1000, data_source->name, data_source->sample_rate, data_source->consumed + level, data_source->consumed, level,
+        data_source->max_level, data_source->frames, data_source->backpressure, data_source->underruns, data_source->overruns,
+        data_source->lost_samples);
+}
+
+/*
+ * configure the framing profile used by packet_hdr_template(), add_header() and build_frame()
+ * preamble_len: number of preamble bytes (1 to MAX_PREAMBLE_LEN)
+ * sync_len: number of sync word bytes, 2 (16-bit) or 4 (32-bit)
+ * returns false (and keeps the previous profile) for invalid settings
+ */
+bool set_framing(uint8_t preamble_len, uint8_t sync_len){
+    if(preamble_len < 1 || preamble_len > MAX_PREAMBLE_LEN || (sync_len != 2 && sync_len != 4)){
+        printf("ERROR: invalid framing profile (preamble: 1 to %d byte, sync word: 2 or 4 byte).\n", MAX_PREAMBLE_LEN);
+        return false;
+    }
+    for(uint8_t i = 0; i < preamble_len; i++){
+        packet_hdr_2500[i] = 0xaa;
+        packet_hdr_1352[i] = 0xaa;
+    }
+    for(uint8_t i = 0; i < sync_len; i++){
+        packet_hdr_2500[preamble_len + i] = sync_2500[i];
+        packet_hdr_1352[preamble_len + i] = sync_1352[4 - sync_len + i];
+    }
+    header_len = preamble_len + sync_len + 2;
+    return true;
+}
+
+/* length of the header (preamble + sync word + length + seq) of the current framing profile */
+uint8_t get_header_len(){
+    return header_len;
+}
+
+uint8_t get_frame_len(){
+    return header_len + payload_size + CRC_LEN;
+}
+
 /* including a header to the packet:
- * - 8B header sequence
+ * - preamble and sync word (8B by default, see set_framing())
  * - 1B payload length
  * - 1B sequence number
  *
@@ -93,12 +335,117 @@ void generate_data(uint8_t *buffer, uint8_t length, bool include_index) {
  */
 void add_header(uint8_t *packet, uint8_t seq, uint8_t *header_template) {
     /* fill in the header sequence*/
-    for(int loop = 0; loop < HEADER_LEN-2; loop++) {
+    for(int loop = 0; loop < header_len-2; loop++) {
         packet[loop] = header_template[loop];
         }
     /* add the payload length*/
-    packet[HEADER_LEN-2] = 1 + PAYLOADSIZE; // The packet length is defined as the payload data, excluding the length byte and the optional CRC. (cc2500 data sheet, p. 30)
+    packet[header_len-2] = 1 + payload_size; // The packet length is defined as the payload data, excluding the length byte and the optional CRC. (cc2500 data sheet, p. 30)
     /* add the packet as sequence number. */
-    packet[HEADER_LEN-1] = seq;
+    packet[header_len-1] = seq;
+}
+
+/*
+ * CRC-16 of the CC2500, see packet_generation.h
+ */
+uint16_t crc16(const uint8_t *data, uint8_t len){
+    uint16_t crc = 0xFFFF;
+    for(uint8_t i = 0; i < len; i++){
+        crc = (crc << 4) ^ crc16_nibble[(crc >> 12) ^ (data[i] >> 4)];
+        crc = (crc << 4) ^ crc16_nibble[(crc >> 12) ^ (data[i] & 0x0F)];
+    }
+    return crc;
+}
+
+/*
+ * data whitening of build_frame(), see packet_generation.h
+ */
+void set_whitening(bool enabled){
+    whitening = enabled;
+}
+
+bool get_whitening(){
+    return whitening;
+}
+
+void whiten(uint8_t *data, uint8_t len){
+    len = min(len, WHITENING_LEN);
+    for(uint8_t i = 0; i < len; i++){
+        data[i] ^= pn9[i];
+    }
+}
+
+/*
+ * set the payload size [byte] used by add_header() and build_frame()
+ * size: even number between MIN_PAYLOADSIZE and MAX_PAYLOADSIZE
+ * returns false (and keeps the previous size) for invalid sizes
+ */
+bool set_payload_size(uint8_t size){
+    if(size < MIN_PAYLOADSIZE || size > MAX_PAYLOADSIZE || size % 2 != 0){
+        printf("ERROR: the payload size has to be an even number between %d and %d byte. Keeping %d byte.\n", MIN_PAYLOADSIZE, MAX_PAYLOADSIZE, payload_size);
+        return false;
+    }
+    payload_size = size;
+    return true;
+}
+
+uint8_t get_payload_size(){
+    return payload_size;
+}
+
+/*
+ * obtain the next frame of the preallocated arena (round-robin)
+ * a frame is overwritten after FRAME_ARENA_SIZE further calls
+ */
+Frame *frame_arena_next(){
+    Frame *frame = &frame_arena[frame_arena_position];
+    frame_arena_position = (frame_arena_position + 1) % FRAME_ARENA_SIZE;
+    return frame;
+}
+
+/*
+ * generate a new payload and assemble the complete frame incl. the CRC
+ * frame: obtained using frame_arena_next()
+ * seq: sequence number of the packet
+ * header_template: obtained using packet_hdr_template()
+ */
+void build_frame(Frame *frame, uint8_t seq, uint8_t *header_template){
+    /* add header and payload to the frame */
+    PROFILE_START(prof_add_header);
+    add_header(frame->bytes, seq, header_template);
+    PROFILE_STOP(prof_add_header);
+    PROFILE_START(prof_generate_data);
+    if(data_source != NULL){
+        source_data(&frame->bytes[header_len], payload_size);
+    }else{
+        generate_data(&frame->bytes[header_len], payload_size, true);
+    }
+    PROFILE_STOP(prof_generate_data);
+    /* the CRC of the receiver covers the length byte, seq and payload (before the whitening) */
+    uint16_t crc = crc16(&frame->bytes[header_len-2], 2 + payload_size);
+    frame->bytes[header_len + payload_size]     = (uint8_t) (crc >> 8);
+    frame->bytes[header_len + payload_size + 1] = (uint8_t) (crc & 0x00FF);
+    if(whitening){
+        whiten(&frame->bytes[header_len-2], 2 + payload_size + CRC_LEN);
+    }
+    frame->seq = seq;
+    frame->len_words = buffer_size(payload_size + CRC_LEN, header_len);
+
+    PROFILE_START(prof_pack_words);
+    pack_frame(frame);
+    PROFILE_STOP(prof_pack_words);
 }
 
+/*
+ * zero pad the last word and pack frame->bytes into frame->words (MSB first)
+ * frame->len_words has to be set
+ */
+void pack_frame(Frame *frame){
+    /* zero padding of the last word */
+    for (uint8_t i = header_len + payload_size + CRC_LEN; i < 4*frame->len_words; i++){
+        frame->bytes[i] = 0;
+    }
+    /* casting for 32-bit fifo */
+    for (uint8_t i=0; i < frame->len_words; i++) {
+        frame->words[i] = ((uint32_t) frame->bytes[4*i+3]) | (((uint32_t) frame->bytes[4*i+2]) << 8) | (((uint32_t) frame->bytes[4*i+1]) << 16) | (((uint32_t) frame->bytes[4*i]) << 24);
+    }
+}
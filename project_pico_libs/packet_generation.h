@@ -14,9 +14,22 @@
 #include "pico/stdlib.h"
 #include "packet_generation.h"
 
-#define PAYLOADSIZE 4
-#define HEADER_LEN  10 // 8 header + length + seq
+#define PAYLOADSIZE      4 // default payload size, can be changed at run-time with set_payload_size()
+#define MIN_PAYLOADSIZE  2 // the first two payload bytes carry the file index
+#define MAX_PAYLOADSIZE 60 // RX FIFO (64 byte) - length byte - seq - 2 status bytes
+#define HEADER_LEN      10 // default: 8 header (4 preamble + 4 sync) + length + seq
+#define PREAMBLE_LEN     4 // default number of preamble bytes
+#define SYNC_LEN         4 // default number of sync word bytes (2: 16-bit, 4: 32-bit)
+#define MAX_PREAMBLE_LEN 8
+#define MAX_HEADER_LEN  (MAX_PREAMBLE_LEN + 4 + 2)
+#define CRC_LEN          2 // CRC-16 after the payload (removed by the receiver, not in its RX FIFO)
 #define buffer_size(x, y) (((x + y) % 4 == 0) ? ((x + y) / 4) : ((x + y) / 4 + 1)) // define the buffer size with ceil((PAYLOADSIZE+HEADER_LEN)/4)
+#define MAX_FRAME_WORDS  buffer_size(MAX_PAYLOADSIZE + CRC_LEN, MAX_HEADER_LEN)
+#define FRAME_ARENA_SIZE 16 // number of preallocated frames
+#define SOURCE_RING_BITS   11 // ring buffer of a data source: 2^11 16-bit samples (4 KiB)
+#define SOURCE_RING_SAMPLES (1 << SOURCE_RING_BITS)
+#define SOURCE_GUARD       32 // samples kept free in front of the producer (it may be writing them while a frame is built)
+#define WHITENING_LEN (MAX_PAYLOADSIZE + 4) // bytes after the sync word: length, seq, payload and CRC
 
 #ifndef MINMAX
 #define MINMAX
@@ -24,6 +37,18 @@
 #define min(x, y) (((x) < (y)) ? (x) : (y))
 #endif
 
+/*
+ * a complete frame (header + payload + CRC), packed into 32-bit words for the PIO FIFO
+ * frames are taken from a preallocated arena (see frame_arena_next()), no allocation per packet
+ */
+struct frame {
+  uint8_t  bytes[MAX_FRAME_WORDS*4];  // header + payload + CRC
+  uint32_t words[MAX_FRAME_WORDS];    // bytes packed MSB first
+  uint8_t  len_words;                 // number of valid words
+  uint8_t  seq;
+};
+typedef struct frame Frame;
+
 /*
  * obtain the packet header template for the corresponding radio
  */
@@ -41,6 +66,18 @@ uint32_t rnd();
 extern uint16_t file_position;
 uint16_t generate_sample();
 
+/*
+ * continue the data at the given file_position (even), e.g. to regenerate a lost chunk
+ * the following samples are identical to those generated sequentially from file_position 0
+ */
+void seek_data(uint16_t position);
+
+/*
+ * data of the file at position (even) without changing the sequence of generate_data() (file_position and seed)
+ * e.g. the reference of a received payload
+ */
+void reference_data(uint8_t *buffer, uint16_t position, uint8_t length);
+
 /*
  * fill packet with 16-bit samples
  * include_index: shall the file index be included at the first two byte?
@@ -49,8 +86,78 @@ uint16_t generate_sample();
 void generate_data(uint8_t *buffer, uint8_t length, bool include_index);
 
 
+/*
+ * data source of build_frame(): a producer (e.g. the ADC via DMA) writes 16-bit samples at sample_rate into a ring
+ * of SOURCE_RING_SAMPLES, build_frame() serializes them from the ring slice directly into the frame (no intermediate
+ * buffer). The file index of a frame is twice the number of its first sample (as with generate_data()).
+ * If the airtime cannot keep up with the sample rate, the ring fills up (backpressure: more than 3/4 waiting when a
+ * frame is built) and finally overruns: the oldest samples are dropped (overruns, lost_samples).
+ * A frame which has to wait for samples counts as underrun (see source_ready()).
+ */
+struct data_source {
+  const char *name;
+  uint32_t sample_rate;       // [samples/s]
+  bool     (*start)(struct data_source *source);    // start writing into ring from position 0
+  uint32_t (*produced)(struct data_source *source); // samples written since the start (wraps)
+  void     (*stop)(struct data_source *source);
+  uint16_t *ring;             // SOURCE_RING_SAMPLES
+  uint32_t consumed;          // samples sent since the start (wraps)
+  uint64_t start_us;
+  uint32_t frames;
+  uint32_t max_level;         // most samples waiting in the ring
+  uint32_t backpressure;      // frames built with more than 3/4 of the ring waiting
+  uint32_t underruns;         // frames which had to wait for samples
+  uint32_t overruns;          // the producer caught up with the reader
+  uint32_t lost_samples;      // dropped by overruns
+};
+
+/*
+ * stand-in for a sensor: replays generate_sample() at sample_rate (virtual time on the host), i.e. the same data as
+ * without a data source as long as the airtime keeps up
+ */
+struct data_source *synthetic_source(uint32_t sample_rate);
+
+/*
+ * build the following frames from source (NULL: generate_data(), the default)
+ * the previous source is stopped, the new one started from sample 0
+ * returns false (and falls back to generate_data()) if the source cannot be started
+ */
+bool set_data_source(struct data_source *source);
+
+struct data_source *get_data_source();
+
+/* samples waiting in the ring of the data source */
+uint32_t source_level();
+
+/* enough samples for the next frame (build_frame() does not have to wait), always true without a data source */
+bool source_ready();
+
+/* more than 3/4 of the ring are waiting: send faster */
+bool source_backpressure();
+
+/*
+ * '#SOURCE t=<ms since boot> name= rate= produced= consumed= level= max_level= frames= backpressure= underruns=
+ * overruns= lost='
+ */
+void print_data_source(uint64_t time_us);
+
+/*
+ * configure the framing profile used by packet_hdr_template(), add_header() and build_frame()
+ * preamble_len: number of preamble bytes (1 to MAX_PREAMBLE_LEN)
+ * sync_len: number of sync word bytes, 2 (16-bit) or 4 (32-bit)
+ * returns false (and keeps the previous profile) for invalid settings
+ * The receiver has to be configured accordingly (e.g. set_sync_mode_rx(), set_preamble_quality_rx()).
+ */
+bool set_framing(uint8_t preamble_len, uint8_t sync_len);
+
+/* length of the header (preamble + sync word + length + seq) of the current framing profile */
+uint8_t get_header_len();
+
+/* length of a frame of build_frame() (header + payload + CRC) [byte] */
+uint8_t get_frame_len();
+
 /* including a header to the packet:
- * - 8B header sequence
+ * - preamble and sync word (8B by default, see set_framing())
  * - 1B payload length
  * - 1B sequence number
  *
@@ -59,4 +166,52 @@ void generate_data(uint8_t *buffer, uint8_t length, bool include_index);
  */
 void add_header(uint8_t *packet, uint8_t seq, uint8_t *header_template);
 
+/*
+ * CRC-16 of the CC2500 (polynomial x^16 + x^15 + x^2 + 1, initialized with all ones, MSB first) over len bytes,
+ * build_frame() appends it over the length byte, seq and payload such that the receiver reports CRC_OK
+ */
+uint16_t crc16(const uint8_t *data, uint8_t len);
+
+/*
+ * data whitening of build_frame(): the bytes after the sync word (length, seq, payload and CRC) are XORed with the PN9
+ * sequence (x^9 + x^5 + 1, all ones at the first byte) of the CC2500/CC1352 hardware whitening, such that long runs
+ * of identical bits (e.g. the zeros of the file index) do not occur on the air. The receiver removes it when its
+ * whitening is enabled (set_whitening_rx(), CC1352: CC1101/CC2500 compatible whitening). Disabled by default.
+ */
+void set_whitening(bool enabled);
+
+bool get_whitening();
+
+/* XOR data with the first len (up to WHITENING_LEN) bytes of the PN9 sequence: whitens and de-whitens */
+void whiten(uint8_t *data, uint8_t len);
+
+/*
+ * set the payload size [byte] used by add_header() and build_frame()
+ * size: even number between MIN_PAYLOADSIZE and MAX_PAYLOADSIZE
+ * returns false (and keeps the previous size) for invalid sizes
+ */
+bool set_payload_size(uint8_t size);
+
+uint8_t get_payload_size();
+
+/*
+ * obtain the next frame of the preallocated arena (round-robin)
+ * a frame is overwritten after FRAME_ARENA_SIZE further calls
+ */
+Frame *frame_arena_next();
+
+/*
+ * generate a new payload (or take it from the data source) and assemble the complete frame incl. the CRC
+ * frame: obtained using frame_arena_next()
+ * seq: sequence number of the packet
+ * header_template: obtained using packet_hdr_template()
+ */
+void build_frame(Frame *frame, uint8_t seq, uint8_t *header_template);
+
+/*
+ * zero pad the last word and pack frame->bytes into frame->words (MSB first)
+ * frame->len_words has to be set (done by build_frame())
+ */
+void pack_frame(Frame *frame);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,182 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * adaptive carrier power
+ * see power_control.h
+ *
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <math.h>
+#include "pico/stdlib.h"
+#include "power_control.h"
+#include "packet_generation.h"
+#include "link_counters.h"
+
+struct power_control power_control = {0};
+
+static void start_window(uint64_t time_us){
+    power_control.start_us = time_us;
+    power_control.sent_base = link_counters.packets_sent;
+    power_control.received = 0;
+    power_control.correct = 0;
+    power_control.rssi_sum = 0;
+    power_control.lqi_sum = 0;
+}
+
+static void step(int8_t direction, const char *reason, uint64_t time_us){
+    uint8_t from = power_control.level;
+    power_control.level += direction;
+    set_power_level_tx(power_control.level);
+    printf("#POWERSTEP t=%" PRIu64 " from=%u to=%u dbm=%d reason=%s\n", time_us/1000, from, power_control.level,
+        TX_power[power_control.level].TX_power_dbm, reason);
+}
+
+static bool valid_step(int8_t direction){
+    return (direction > 0 && power_control.level < power_control.max_level) || (direction < 0 && power_control.level > power_control.min_level);
+}
+
+// goodput of level a against level b: 1 higher, -1 lower, 0 similar or unknown
+static int8_t compare(uint8_t a, uint8_t b){
+    if(power_control.age[a] >= POWER_MEMORY_WINDOWS || power_control.age[b] >= POWER_MEMORY_WINDOWS){
+        return 0;
+    }
+    float ga = power_control.goodput[a], gb = power_control.goodput[b];
+    float difference = fabsf(ga - gb);
+    if(difference <= POWER_GOODPUT_MARGIN * max(ga, gb) || difference <= 2.0f * sqrtf(max(ga, gb))){
+        return 0;
+    }
+    return (ga > gb) ? 1 : -1;
+}
+
+bool setup_power_control(uint8_t level, uint8_t min_level, uint8_t max_level, uint16_t window, uint64_t time_us){
+    if(max_level > TX_POWER_MAX_LEVEL || min_level > max_level || level < min_level || level > max_level || window == 0){
+        printf("ERROR: invalid power control setting (levels 0 to %d, a window of at least one packet).\n", TX_POWER_MAX_LEVEL);
+        return false;
+    }
+    memset(&power_control, 0, sizeof(power_control));
+    power_control.enabled = true;
+    power_control.level = level;
+    power_control.min_level = min_level;
+    power_control.max_level = max_level;
+    power_control.window = window;
+    memset(power_control.age, POWER_MEMORY_WINDOWS, sizeof(power_control.age));
+    set_power_level_tx(level);
+    start_window(time_us);
+    return true;
+}
+
+// the data of generate_data() at the file index of the packet (the samples of a data source have no reference)
+static bool verified_data(const uint8_t *buffer, uint8_t payload_size){
+    if(get_data_source() != NULL){
+        return true;
+    }
+    uint8_t reference[MAX_PAYLOADSIZE];
+    uint16_t index = (((uint16_t) buffer[2]) << 8) | buffer[3];
+    reference_data(reference, index, payload_size - 2);
+    return memcmp(&buffer[4], reference, payload_size - 2) == 0;
+}
+
+void power_control_packet(const uint8_t *buffer, Packet_status status, uint8_t payload_size){
+    if(!power_control.enabled || status.overflowed){
+        return;
+    }
+    power_control.received++;
+    power_control.rssi_sum += status.RSSI;
+    power_control.lqi_sum += status.LinkQualityIndicator & 0x7F;
+    power_control.correct += status.CRCcheck && status.len == payload_size + 2 && verified_data(buffer, payload_size);
+}
+
+bool update_power_control(uint64_t time_us, uint8_t payload_size){
+    if(!power_control.enabled){
+        return false;
+    }
+    if(link_counters.packets_sent < power_control.sent_base){
+        power_control.sent_base = 0; // the link counters have been reset
+    }
+    uint32_t sent = link_counters.packets_sent - power_control.sent_base;
+    if(sent < power_control.window){
+        return false;
+    }
+
+    /* the window */
+    uint64_t duration_us = max(time_us - power_control.start_us, 1);
+    uint32_t correct = min(power_control.correct, sent);
+    float per = 1.0f - ((float) correct) / sent;
+    float rssi = power_control.received ? ((float) power_control.rssi_sum) / power_control.received : 0;
+    float lqi = power_control.received ? ((float) power_control.lqi_sum) / power_control.received : 127;
+    float goodput = 8.0f * correct * payload_size * 1000000.0f / duration_us;
+    bool received = power_control.received > 0;
+    power_control.last_sent = sent;
+    power_control.last_correct = correct;
+    power_control.last_per = per;
+    power_control.last_rssi = rssi;
+    power_control.last_lqi = lqi;
+    power_control.last_goodput_bps = goodput;
+    power_control.windows++;
+    start_window(time_us);
+
+    /* remember the goodput of the level */
+    for(uint8_t l = 0; l < TX_POWER_LEVELS; l++){
+        power_control.age[l] = min(power_control.age[l] + 1, POWER_MEMORY_WINDOWS);
+    }
+    uint8_t level = power_control.level;
+    float scaled = ((float) correct) * power_control.window / sent;
+    power_control.goodput[level] = (power_control.age[level] < POWER_MEMORY_WINDOWS) ? (power_control.goodput[level] + scaled) / 2 : scaled;
+    power_control.age[level] = 0;
+
+    /* vote */
+    int8_t direction = 0;
+    const char *reason = NULL;
+    bool margin = received && rssi > POWER_RSSI_MARGIN_DBM;
+    if(per > POWER_PER_HIGH){
+        direction = margin ? -1 : 1;
+        reason = margin ? "desense" : "up";
+    }else if(margin && per <= POWER_PER_LOW && lqi < POWER_LQI_GOOD && level > power_control.min_level
+        && rssi - (TX_power[level].TX_power_dbm - TX_power[level - 1].TX_power_dbm) > POWER_RSSI_MARGIN_DBM){
+        // the margin remains after the step
+        direction = -1;
+        reason = "down";
+    }
+    uint8_t best = level;
+    for(uint8_t l = power_control.min_level; l <= power_control.max_level; l++){
+        if(power_control.age[l] < POWER_MEMORY_WINDOWS && power_control.goodput[l] > power_control.goodput[best]){
+            best = l;
+        }
+    }
+    if(!valid_step(direction) || compare(level + direction, best) < 0){
+        // unknown levels are explored, known ones only if they are not worse than the best one
+        direction = 0;
+    }
+    if(direction == 0 && compare(best, level) > 0){
+        direction = (best > level) ? 1 : -1;
+        reason = "goodput";
+    }
+    if(direction == 0){
+        power_control.votes = 0;
+        return false;
+    }
+
+    /* a step needs POWER_HYSTERESIS votes in a row */
+    power_control.votes = (power_control.votes * direction > 0) ? power_control.votes + direction : direction;
+    if(power_control.votes * direction < POWER_HYSTERESIS && received){ // the link is lost: no hysteresis
+        return false;
+    }
+    power_control.votes = 0;
+    if(direction > 0){
+        power_control.steps_up++;
+    }else{
+        power_control.steps_down++;
+    }
+    step(direction, reason, time_us);
+    return true;
+}
+
+void print_power_control(uint64_t time_us){
+    printf("#POWER t=%" PRIu64 " level=%u dbm=%d sent=%" PRIu32 " correct=%" PRIu32 " per=%.4f rssi=%.1f lqi=%.1f goodput_bps=%.0f up=%" PRIu32 " down=%" PRIu32 "\n",
+        time_us/1000, power_control.level, TX_power[power_control.level].TX_power_dbm, power_control.last_sent,
+        power_control.last_correct, power_control.last_per, power_control.last_rssi, power_control.last_lqi,
+        power_control.last_goodput_bps, power_control.steps_up, power_control.steps_down);
+}
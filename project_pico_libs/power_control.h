@@ -0,0 +1,85 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * adaptive carrier power: the level of TX_power[] is chosen from the packets of the local receiver
+ *
+ * The packets sent (link_counters.packets_sent) and received are collected over windows of a number of sent
+ * packets. At the end of a window the packet error rate, the mean RSSI and the mean LQI vote:
+ *  - errors (PER above POWER_PER_HIGH) or no packet at all at a weak signal: one level up,
+ *  - errors although the signal has a margin to the sensitivity (RSSI above POWER_RSSI_MARGIN_DBM): one level down,
+ *    the carrier leaking into the receiver on the same board desensitizes it,
+ *  - no errors (PER up to POWER_PER_LOW) with a margin to the sensitivity which remains after the step (and LQI below
+ *    POWER_LQI_GOOD): one level down, less leakage at the same goodput.
+ * The goodput (correct packets per window) of every level is remembered (moving average) for POWER_MEMORY_WINDOWS
+ * windows. A vote for a level with a lower goodput than the best remembered one is dropped (unknown levels are
+ * explored); without a vote, the controller votes for a step towards the best level if it has a higher goodput than
+ * the current one. The level climbs to the maximum of the goodput rather than of the power. Higher and lower
+ * means a difference of more than POWER_GOODPUT_MARGIN and twice the standard deviation of the counts. A step needs
+ * POWER_HYSTERESIS windows in a row voting for it, unless no packet has been received in the window.
+ *
+ */
+
+#ifndef POWER_CONTROL_LIB
+#define POWER_CONTROL_LIB
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "receiver_CC2500.h"
+#include "carrier_CC2500.h"
+
+#define POWER_PER_HIGH            0.05
+#define POWER_PER_LOW             0.01
+#define POWER_RSSI_MARGIN_DBM      -75 // sensitivity (~-88 dBm) plus margin
+#define POWER_LQI_GOOD              20 // CC2500: the lower the better
+#define POWER_HYSTERESIS             2
+#define POWER_GOODPUT_MARGIN       0.1
+#define POWER_MEMORY_WINDOWS        32
+
+struct power_control {
+  bool     enabled;
+  uint8_t  level;             // TX_power[level]
+  uint8_t  min_level, max_level;
+  uint16_t window;            // sent packets per decision
+  // current window
+  uint64_t start_us;
+  uint32_t sent_base;         // link_counters.packets_sent at the start of the window
+  uint32_t received;
+  uint32_t correct;           // correct CRC, length and data
+  int32_t  rssi_sum;
+  uint32_t lqi_sum;
+  // last window
+  uint32_t last_sent, last_correct;
+  float    last_per, last_rssi, last_lqi, last_goodput_bps;
+  // decisions
+  float    goodput[TX_POWER_LEVELS]; // correct packets per window (moving average)
+  uint8_t  age[TX_POWER_LEVELS];     // windows since the level has been used, POWER_MEMORY_WINDOWS: unknown
+  int8_t   votes;             // consecutive windows voting up (> 0) or down (< 0)
+  uint32_t windows, steps_up, steps_down;
+};
+
+extern struct power_control power_control;
+
+/* start at level (min_level to max_level), decide every window sent packets */
+bool setup_power_control(uint8_t level, uint8_t min_level, uint8_t max_level, uint16_t window, uint64_t time_us);
+
+/*
+ * add a packet of readPacket() (buffer: length, seq, file index, data), payload_size: payload of the transmitter
+ * (get_payload_size()); a packet is correct if it is complete, passes the CRC and, without a data source, its data
+ * matches reference_data() at its file index
+ */
+void power_control_packet(const uint8_t *buffer, Packet_status status, uint8_t payload_size);
+
+/*
+ * decide once window packets have been sent since the last decision (call while the carrier is off)
+ * returns true if the level has been changed, a change is printed as
+ * #POWERSTEP t=<ms since boot> from= to= dbm= reason=up|down|desense|goodput
+ */
+bool update_power_control(uint64_t time_us, uint8_t payload_size);
+
+/*
+ * print the level with the last window:
+ * #POWER t=<ms since boot> level= dbm= sent= correct= per= rssi= lqi= goodput_bps= up= down=
+ */
+void print_power_control(uint64_t time_us);
+
+#endif
@@ -0,0 +1,92 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * lightweight timers for the packet hot-path
+ * see profiling.h
+ * 
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "profiling.h"
+
+#if PROFILING
+
+static struct profile_histogram histograms[PROFILE_STAGES];
+
+static const char *stage_names[PROFILE_STAGES] = {
+    "generate_data",
+    "add_header",
+    "pack_words",
+    "backscatter_send",
+    "read_packet",
+    "print_packet",
+    "rx_rearm",
+    "carrier_switch",
+    "sleep",
+    "analyze_packet",
+};
+
+void profile_init(){
+#if PROFILE_USE_SYSTICK
+    systick_hw->rvr = PROFILE_MASK; // free running over the full 24-bit range
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5;          // enable, processor clock
+#endif
+    profile_reset();
+}
+
+void profile_reset(){
+    memset(histograms, 0, sizeof(histograms));
+    for(uint8_t i = 0; i < PROFILE_STAGES; i++){
+        histograms[i].min = 0xFFFFFFFF;
+    }
+}
+
+void profile_record(profile_stage_t stage, uint32_t duration){
+    struct profile_histogram *h = &histograms[stage];
+    uint8_t bucket = (duration == 0) ? 0 : (32 - __builtin_clz(duration));
+    h->buckets[min(bucket, PROFILE_BUCKETS-1)]++;
+    h->count++;
+    h->sum += duration;
+    h->min = min(h->min, duration);
+    h->max = max(h->max, duration);
+}
+
+void profile_scope_end(struct profile_scope *scope){
+    profile_record(scope->stage, (profile_now() - scope->start) & PROFILE_MASK);
+}
+
+/* one line per stage: #PROF <stage> unit=<us|cycles> n=<count> mean min max hist=<bucket 0>,<bucket 1>,... */
+void profile_dump(){
+    for(uint8_t i = 0; i < PROFILE_STAGES; i++){
+        struct profile_histogram *h = &histograms[i];
+        if(h->count == 0){
+            continue;
+        }
+        bool cycles = PROFILE_USE_SYSTICK && i != prof_sleep; // sleeps in us (PROFILED_SLEEP_MS)
+        printf("#PROF %s unit=%s n=%" PRIu32 " mean=%" PRIu32 " min=%" PRIu32 " max=%" PRIu32 " hist=", stage_names[i], cycles ? "cycles" : "us", h->count, (uint32_t) (h->sum / h->count), h->min, h->max);
+        // omit trailing empty buckets
+        int8_t last = PROFILE_BUCKETS-1;
+        while(last > 0 && h->buckets[last] == 0){
+            last--;
+        }
+        for(int8_t b = 0; b <= last; b++){
+            printf((b < last) ? "%" PRIu32 "," : "%" PRIu32 "\n", h->buckets[b]);
+        }
+    }
+}
+
+// 'p': print histograms, 'r': reset histograms
+void profile_poll_usb(){
+    int c = getchar_timeout_us(0);
+    if(c == 'p'){
+        profile_dump();
+    }else if(c == 'r'){
+        profile_reset();
+    }
+}
+
+#endif
@@ -0,0 +1,96 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * lightweight timers for the packet hot-path
+ * 
+ * Every stage feeds a histogram with fixed power-of-two buckets in RAM. The histograms are printed
+ * over USB when receiving the character 'p' ('r' resets them), see profile_poll_usb().
+ * The instrumentation is only compiled with PROFILING=1 (cmake -DPROFILING=ON ..), otherwise
+ * all PROFILE_* macros compile to nothing.
+ * With PROFILE_USE_SYSTICK=1 the SysTick counter is used and times are given in clock cycles
+ * (wraps after 2^24 cycles, i.e. ~134 ms @ 125 MHz), otherwise the microsecond timer is used.
+ * Sleeps (prof_sleep) are always timed with the 64-bit microsecond timer, since they can exceed the SysTick range.
+ * 
+ */
+
+#ifndef PROFILING_LIB
+#define PROFILING_LIB
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+
+#ifndef PROFILING
+#define PROFILING 0
+#endif
+#ifndef PROFILE_USE_SYSTICK
+#define PROFILE_USE_SYSTICK 0
+#endif
+
+#ifndef MINMAX
+#define MINMAX
+#define max(x, y) (((x) > (y)) ? (x) : (y))
+#define min(x, y) (((x) < (y)) ? (x) : (y))
+#endif
+
+#define PROFILE_BUCKETS 24 // bucket 0: 0, bucket i: [2^(i-1), 2^i), last bucket: everything above
+
+typedef enum _profile_stage_t{
+    prof_generate_data    = 0,
+    prof_add_header       = 1,
+    prof_pack_words       = 2,
+    prof_backscatter_send = 3,
+    prof_read_packet      = 4,
+    prof_print_packet     = 5,
+    prof_rx_rearm         = 6,
+    prof_carrier_switch   = 7,
+    prof_sleep            = 8,
+    prof_analyze_packet   = 9,
+    PROFILE_STAGES        = 10
+} profile_stage_t;
+
+struct profile_histogram {
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t sum;
+  uint32_t buckets[PROFILE_BUCKETS];
+};
+
+struct profile_scope {
+  profile_stage_t stage;
+  uint32_t start;
+};
+
+#if PROFILING
+#if PROFILE_USE_SYSTICK
+#include "hardware/structs/systick.h"
+#define PROFILE_MASK 0x00FFFFFF
+static inline uint32_t profile_now() { return PROFILE_MASK - systick_hw->cvr; } // SysTick counts down
+#else
+#define PROFILE_MASK 0xFFFFFFFF
+static inline uint32_t profile_now() { return time_us_32(); }
+#endif
+
+void profile_init();
+void profile_record(profile_stage_t stage, uint32_t duration);
+void profile_scope_end(struct profile_scope *scope);
+void profile_reset();
+void profile_dump();
+void profile_poll_usb();
+
+#define PROFILE_INIT()        profile_init()
+#define PROFILE_START(stage)  uint32_t _profile_start_##stage = profile_now()
+#define PROFILE_STOP(stage)   profile_record(stage, (profile_now() - _profile_start_##stage) & PROFILE_MASK)
+#define PROFILE_SCOPE(s)      struct profile_scope _profile_scope __attribute__((cleanup(profile_scope_end))) = {.stage = s, .start = profile_now()} // stops at the end of the enclosing block
+#define PROFILE_POLL_USB()    profile_poll_usb()
+#define PROFILED_SLEEP_MS(ms) do { uint64_t _profile_sleep = time_us_64(); sleep_ms(ms); profile_record(prof_sleep, (uint32_t) (time_us_64() - _profile_sleep)); } while(0)
+#else
+#define PROFILE_INIT()
+#define PROFILE_START(stage)
+#define PROFILE_STOP(stage)
+#define PROFILE_SCOPE(s)
+#define PROFILE_POLL_USB()
+#define PROFILED_SLEEP_MS(ms) sleep_ms(ms)
+#endif
+
+#endif
@@ -15,6 +15,7 @@
  */
 
 #include <stdio.h>
+#include <inttypes.h>
 #include <string.h>
 #include <math.h>
 #include "pico/stdlib.h"
@@ -23,8 +24,20 @@
 #include "hardware/spi.h"
 #include "receiver_CC2500.h"
 #include "carrier_CC2500.h"
+#include "profiling.h"
+#include "link_counters.h"
 
-queue_t event_queue;
+/* the default receiver (RX_CSN, RX_GDO0_PIN) and the selected one, which all functions of this file operate on */
+struct cc2500_rx default_rx = {.cs_pin = RX_CSN, .gdo0_pin = RX_GDO0_PIN, .mcsm0 = 0x18};
+static struct cc2500_rx *rx = &default_rx;
+static struct cc2500_rx *rx_by_gdo0[RX_MAX_GPIO]; // receiver_isr(): GDO0 pin -> receiver
+
+/* the registers restored by end_scan_rx() */
+static const uint8_t scan_registers[RX_SCAN_SAVED] = {
+  0x0a, 0x0d, 0x0e, 0x0f, // CHANNR, FREQ2..0
+  0x13, 0x14, 0x18,       // MDMCFG1, MDMCFG0, MCSM0
+  0x23, 0x24, 0x25,       // FSCAL3..1
+};
 
 // Address Config = No address check
 // Base Frequency = 2456.596924
@@ -77,13 +90,13 @@ RF_setting cc2500_receiver[20] = {
 
 void cs_select_rx() {
     asm volatile("nop \n nop \n nop");
-    gpio_put(RX_CSN, 0);  // Active low
+    gpio_put(rx->cs_pin, 0);  // Active low
     asm volatile("nop \n nop \n nop");
 }
 
 void cs_deselect_rx() {
     asm volatile("nop \n nop \n nop");
-    gpio_put(RX_CSN, 1);
+    gpio_put(rx->cs_pin, 1);
     asm volatile("nop \n nop \n nop");
 }
 
@@ -94,7 +107,16 @@ void write_strobe_rx(uint8_t cmd) {
     sleep_ms(1);
 }
 
+// configuration registers as written, FSCAL3..1 change with every calibration
+static void shadow_rx(RF_setting set){
+    if(set.address < RX_CONFIG_REGS && (set.address < 0x23 || set.address > 0x25)){
+        rx->shadow[set.address] = set.value;
+        rx->shadow_valid |= ((uint64_t) 1) << set.address;
+    }
+}
+
 void write_register_rx(RF_setting set) {
+    shadow_rx(set);
     uint8_t buf[2];
     buf[0] = set.address;
     buf[1] = set.value;
@@ -108,6 +130,7 @@ void write_registers_rx(RF_setting* sets, uint8_t len) {
     uint8_t buf[2];
     cs_select_rx();
     for (int i = 0; i < len; i++) {
+        shadow_rx(sets[i]);
         buf[0] = sets[i].address;
         buf[1] = sets[i].value;
         spi_write_blocking(RADIO_SPI, buf, 2);
@@ -116,14 +139,34 @@ void write_registers_rx(RF_setting* sets, uint8_t len) {
 }
 
 RF_setting read_register_rx(uint8_t address) {
+    if(address < RX_CONFIG_REGS && (rx->shadow_valid >> address) & 0x01){
+        return (RF_setting){.address = address, .value = rx->shadow[address]}; // no SPI access
+    }
     uint8_t buf[2] = {0, 0};
     cs_select_rx();
     spi_read_blocking(RADIO_SPI, address+0x80, buf, 2);
     cs_deselect_rx();
     sleep_ms(1);
+    shadow_rx((RF_setting){.address = address, .value = buf[1]});
     return (RF_setting){.address = address, .value = buf[1]};
 }
 
+// command strobe without the fixed delay of write_strobe_rx()
+static void strobe_rx(uint8_t cmd){
+    cs_select_rx();
+    spi_write_blocking(RADIO_SPI, &cmd, 1);
+    cs_deselect_rx();
+}
+
+// status registers are read with the burst bit
+static uint8_t read_status_rx(uint8_t address){
+    uint8_t buf[2];
+    cs_select_rx();
+    spi_read_blocking(RADIO_SPI, address + 0xC0, buf, 2);
+    cs_deselect_rx();
+    return buf[1];
+}
+
 void print_registers_rx() {
     uint8_t buf[2] = {0, 0};
     uint8_t r = 0;
@@ -137,46 +180,105 @@ void print_registers_rx() {
     }
 }
 
-/* ISR */
+/* ISR: the event is added to the queue of the receiver with this GDO0 pin (independent of select_rx()) */
 void receiver_isr(uint gpio, uint32_t events)
 {
     event_t evt;
-    switch(gpio){
-        case RX_GDO0_PIN:
-            switch(events){
-                case GPIO_IRQ_EDGE_RISE:
-                    evt = rx_assert_evt;
-                    queue_try_add(&event_queue, &evt);
-                    break;
-                case GPIO_IRQ_EDGE_FALL:
-                    evt = rx_deassert_evt;
-                    queue_try_add(&event_queue, &evt);
-                    break;
+    struct cc2500_rx *r = (gpio < RX_MAX_GPIO) ? rx_by_gdo0[gpio] : NULL;
+    if(r == NULL){
+        return;
+    }
+    switch(events){
+        case GPIO_IRQ_EDGE_RISE:
+            evt = rx_assert_evt;
+            if(!queue_try_add(&r->event_queue, &evt)){
+                link_counters.event_drops++;
+                r->counters.event_drops++;
+            }
+            break;
+        case GPIO_IRQ_EDGE_FALL:
+            evt = rx_deassert_evt;
+            if(!queue_try_add(&r->event_queue, &evt)){
+                link_counters.event_drops++;
+                r->counters.event_drops++;
             }
-        break;
+            break;
     }
 }
 
+bool init_rx(struct cc2500_rx *r, uint cs_pin, uint gdo0_pin)
+{
+    if(gdo0_pin >= RX_MAX_GPIO || (rx_by_gdo0[gdo0_pin] != NULL && rx_by_gdo0[gdo0_pin] != r)){
+        printf("ERROR: GDO0 pin %u is invalid or used by another receiver.\n", gdo0_pin);
+        return false;
+    }
+    memset(r, 0, sizeof(struct cc2500_rx));
+    r->cs_pin = cs_pin;
+    r->gdo0_pin = gdo0_pin;
+    r->mcsm0 = 0x18;
+    // chip select is active-low: driven high
+    gpio_init(cs_pin);
+    gpio_set_dir(cs_pin, GPIO_OUT);
+    gpio_put(cs_pin, 1);
+    return true;
+}
+
+void select_rx(struct cc2500_rx *r)
+{
+    rx = r;
+}
+
+struct cc2500_rx *selected_rx()
+{
+    return rx;
+}
+
 void setupReceiver(){
     write_strobe_rx(SRES);  // in case of reset without power loss - reset manually
+    rx->fsctrl0 = 0;
+    rx->shadow_valid = 0;   // reset values, read once on demand
+    rx->channel_count = 0;
+    rx->scan_active = false;
     sleep_us(100);
     write_strobe_rx(SIDLE); // ensure IDLE mode with command strobe: SIDLE
     write_registers_rx(cc2500_receiver,20);
 
     /* Event queue setup */
-    queue_init(&event_queue, sizeof(event_t), EVENT_QUEUE_LENGTH);
+    queue_init(&rx->event_queue, sizeof(event_t), EVENT_QUEUE_LENGTH);
 
     /* Reset the queue */
-    while(queue_try_remove(&event_queue, NULL));
+    while(queue_try_remove(&rx->event_queue, NULL));
+
+    /* GDO0 setup as interrupt (one callback for all receivers) */
+    rx_by_gdo0[rx->gdo0_pin] = rx;
+    gpio_set_irq_enabled_with_callback(rx->gdo0_pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true, &receiver_isr);
+
+}
 
-    /* GDO0 setup as interrupt */
-    gpio_set_irq_enabled_with_callback(RX_GDO0_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true, &receiver_isr);
+// a sync word has been received, but the packet is aborted by re-arming the receiver
+static void rx_abort_packet(){
+    if(rx->synchronized){
+        link_counters.sync_without_eop++;
+        rx->counters.sync_without_eop++;
+        rx->synchronized = false;
+    }
+}
 
+// write the offset compensation of the tracking (in IDLE)
+static void apply_offset_rx(){
+    if(rx->offset_tracking.freqoff != rx->fsctrl0){
+        rx->fsctrl0 = rx->offset_tracking.freqoff;
+        RF_setting set = {.address = 0x0c, .value = (uint8_t) rx->fsctrl0}; // FSCTRL0.FREQOFF
+        write_registers_rx(&set, 1);
+    }
 }
 
 // continously listen for packets
 void RX_start_listen(){
+    PROFILE_SCOPE(prof_rx_rearm);
+    rx_abort_packet();
     write_strobe_rx(SIDLE);
+    apply_offset_rx();
     RF_setting set = {.address = 0x17, .value = 0x00};    // after receiving a packet, return to idle
     //RF_setting set = {.address = 0x17, .value = 0x0C}; // after receiving a packet, listen for next one
     write_register_rx(set);
@@ -184,13 +286,51 @@ void RX_start_listen(){
     write_strobe_rx(SRX);  // start listening (enter RX mode with command strobe: SRX)
 }
 
+// continously listen for packets and stay in RX after a packet (e.g. to receive bursts of frames)
+void RX_start_burst_listen(){
+    PROFILE_SCOPE(prof_rx_rearm);
+    rx_abort_packet();
+    write_strobe_rx(SIDLE);
+    apply_offset_rx();
+    RF_setting set = {.address = 0x17, .value = 0x0C}; // after receiving a packet, listen for next one
+    write_register_rx(set);
+    write_strobe_rx(SFRX); // clear FIFO
+    write_strobe_rx(SRX);  // start listening (enter RX mode with command strobe: SRX)
+}
+
 // stop listening
 void RX_stop_listen(){
+    rx_abort_packet();
     write_strobe_rx(SIDLE); // stop listening (enter IDLE mode with command strobe: SIDLE)
 }
 
+// average the offset of a packet (FREQEST relative to the compensation in FSCTRL0)
+static void track_offset(int8_t freqest){
+    int32_t sample = ((int32_t) rx->fsctrl0 + freqest) * 256;
+    if(rx->offset_tracking.packets == 0){
+        rx->offset_tracking.offset = sample;
+    }else{
+        rx->offset_tracking.offset += (sample - rx->offset_tracking.offset) / (1 << OFFSET_FILTER_SHIFT);
+        int32_t deviation = (sample > rx->offset_tracking.offset) ? sample - rx->offset_tracking.offset : rx->offset_tracking.offset - sample;
+        rx->offset_tracking.spread += (deviation - rx->offset_tracking.spread) / (1 << OFFSET_FILTER_SHIFT);
+    }
+    rx->offset_tracking.last_freqest = freqest;
+    rx->offset_tracking.packets++;
+    if(rx->offset_tracking.packets % OFFSET_UPDATE_PACKETS == 0){
+        // hysteresis of 3/4 step: the noise of the estimate does not toggle FSCTRL0 between two steps
+        int32_t residual = rx->offset_tracking.offset - 256 * (int32_t) rx->offset_tracking.freqoff;
+        int32_t freqoff = (rx->offset_tracking.offset + ((rx->offset_tracking.offset >= 0) ? 128 : -128)) / 256;
+        freqoff = min(max(freqoff, -128), 127);
+        if(freqoff != rx->offset_tracking.freqoff && (residual > 192 || residual < -192)){
+            rx->offset_tracking.freqoff = freqoff;
+            rx->offset_tracking.updates++;
+        }
+    }
+}
+
 Packet_status readPacket(uint8_t *buffer){
-    Packet_status status;
+    PROFILE_SCOPE(prof_read_packet);
+    Packet_status status = {.overflowed = false, .len = 0, .RSSI = 0, .CRCcheck = false, .LinkQualityIndicator = 0};
     uint8_t tmp_buffer[2];
     // since the provided length of a packet might be corrupted, read length from fifo status
     cs_select_rx();
@@ -206,16 +346,26 @@ Packet_status readPacket(uint8_t *buffer){
         cs_deselect_rx();
         status.CRCcheck = (bool) (tmp_buffer[1] & 0x80);
         status.LinkQualityIndicator = (tmp_buffer[1] & 0x7F);
-        if(tmp_buffer[0] >= 128){
-            status.RSSI = (((int32_t) tmp_buffer[0]) - 256)/2 - 70;
-        }else{
-            status.RSSI = ((int32_t) tmp_buffer[0])/2 - 70;
+        status.RSSI = rssi_dbm_rx((int8_t) tmp_buffer[0]);
+        link_counters.packets_received++;
+        rx->counters.packets_received++;
+        if(!status.CRCcheck){
+            link_counters.crc_failures++;
+            rx->counters.crc_failures++;
         }
+        if(rx->offset_tracking.enabled && status.len >= 1 && status.len <= 62 && buffer[0] == status.len - 1){
+            // the length byte agrees with the FIFO: a complete frame, FREQEST does not depend on its bit errors
+            track_offset((int8_t) read_status_rx(0x32)); // FREQEST of the last packet
+        }
+    }else{
+        link_counters.rx_fifo_overflows++;
+        rx->counters.rx_fifo_overflows++;
     }
     return status;
 }
 
 void printPacket(uint8_t *packet, Packet_status status, uint64_t time_us){
+    PROFILE_SCOPE(prof_print_packet);
     // generate timestamp since boot-up
     uint64_t time_rem;
     uint32_t hours    = (int32_t) (time_us  / ((uint64_t) 36 * (uint64_t) 100000000));
@@ -225,7 +375,7 @@ void printPacket(uint8_t *packet, Packet_status status, uint64_t time_us){
     uint32_t  sec     = (int32_t) (time_rem / (1000000));
     time_rem          =           (time_rem % (1000000));
     uint32_t msec     = (int32_t) (time_rem / (1000));
-    printf("%02d:%02d:%02d.%03d | ", hours, minutes, sec, msec);
+    printf("%02" PRIu32 ":%02" PRIu32 ":%02" PRIu32 ".%03" PRIu32 " | ", hours, minutes, sec, msec);
     if(status.overflowed){
         printf("packet overflow (possible length field corrupted) | CRC error\n");
     }else{
@@ -233,7 +383,7 @@ void printPacket(uint8_t *packet, Packet_status status, uint64_t time_us){
             printf("%02x ", packet[i]);
         }
         printf("| ");
-        printf("%d ", status.RSSI);
+        printf("%" PRId32 " ", status.RSSI);
         if(status.CRCcheck){
             printf("CRC pass\n");
         }else{
@@ -245,24 +395,35 @@ void printPacket(uint8_t *packet, Packet_status status, uint64_t time_us){
 event_t get_event(void)
 {
     event_t evt = no_evt;
-    if (queue_try_remove(&event_queue, &evt))
+    if (queue_try_remove(&rx->event_queue, &evt))
     {
+        if(evt == rx_assert_evt){
+            rx_abort_packet(); // a second sync word without end of the previous packet
+            rx->synchronized = true;
+        }else if(evt == rx_deassert_evt){
+            rx->synchronized = false;
+        }
         return evt;
     }
     return no_evt;
 }
 
+uint32_t calc_datarate_rx(uint32_t r_data, uint8_t *drate_e, uint8_t *drate_m)
+{
+    // see datasheet, section 12
+    *drate_e = floor(log2(((double) r_data * (1 << 20)) / ((double) F_XOSC)));
+    *drate_m = floor(((double) r_data * (1 << 28)) / ((double) F_XOSC * (1 << *drate_e)) - 256.0);
+    return floor(((256.0+*drate_m)*(1 << *drate_e) * (double) F_XOSC) / ((double) (1 << 28)));
+}
+
 void set_datarate_rx(uint32_t r_data)
 {
     write_strobe_rx(SIDLE); // ensure IDLE mode with command strobe: SIDLE
-    
-    // see datasheet, section 12
-    uint8_t drate_e = floor(log2(((double) r_data * (1 << 20)) / ((double) F_XOSC)));
-    uint8_t drate_m = floor(((double) r_data * (1 << 28)) / ((double) F_XOSC * (1 << drate_e)) - 256.0);
+    uint8_t drate_e, drate_m;
+    uint32_t r_data_calculated = calc_datarate_rx(r_data, &drate_e, &drate_m);
     
     // print new value
-    uint32_t r_data_calculated = floor(((256.0+drate_m)*(1 << drate_e) * (double) F_XOSC) / ((double) (1 << 28)));
-    printf("set rx r_data: [%u %u] %u\n", drate_e, drate_m, r_data_calculated);
+    printf("set rx r_data: [%u %u] %" PRIu32 "\n", drate_e, drate_m, r_data_calculated);
     
     // MDMCFG4, MDMCFG3
     RF_setting mdmcfg3 = read_register_rx(0x10);
@@ -273,17 +434,22 @@ void set_datarate_rx(uint32_t r_data)
     write_registers_rx(set,2);
 }
 
+uint32_t calc_filter_bandwidth_rx(uint32_t bw, uint8_t *chanbw_e, uint8_t *chanbw_m)
+{
+    // see datasheet, section 13
+    *chanbw_e = floor(log2(((double) F_XOSC)/((double) (1 << 5) * bw)/log2(2.0)));
+    *chanbw_m = floor(((double) F_XOSC)/((double) 8.0 * bw * (1 << *chanbw_e)) - 4.0);
+    return floor(((double) F_XOSC) / ((double) 8.0*(4.0+*chanbw_m)*(1 << *chanbw_e)));
+}
+
 void set_filter_bandwidth_rx(uint32_t bw)
 {
     write_strobe_rx(SIDLE); // ensure IDLE mode with command strobe: SIDLE
-
-    // see datasheet, section 13
-    uint8_t chanbw_e = floor(log2(((double) F_XOSC)/((double) (1 << 5) * bw)/log2(2.0)));
-    uint8_t chanbw_m = floor(((double) F_XOSC)/((double) 8.0 * bw * (1 << chanbw_e)) - 4.0);
+    uint8_t chanbw_e, chanbw_m;
+    uint32_t bw_calculated = calc_filter_bandwidth_rx(bw, &chanbw_e, &chanbw_m);
     
     // print new value
-    uint32_t bw_calculated = floor(((double) F_XOSC) / ((double) 8.0*(4.0+chanbw_m)*(1 << chanbw_e)));
-    printf("set rx bw: [%u %u] %u\n", chanbw_e, chanbw_m, bw_calculated);
+    printf("set rx bw: [%u %u] %" PRIu32 "\n", chanbw_e, chanbw_m, bw_calculated);
     
     // MDMCFG3
     RF_setting mdmcfg3 = read_register_rx(0x10);
@@ -291,23 +457,39 @@ void set_filter_bandwidth_rx(uint32_t bw)
     write_register_rx(set);
 }
 
+uint32_t calc_frequency_deviation_rx(uint32_t f_dev, uint8_t *deviation_e, uint8_t *deviation_m)
+{
+    // see datasheet, section 16
+    *deviation_e = floor(log2(((double) f_dev) * (1 << 14) / ((double) F_XOSC)));
+    *deviation_m = floor((((double) f_dev) * (1 << 17)) / ((double) (1 << *deviation_e) * F_XOSC) - 8.0);
+    return floor(((double) F_XOSC) * (8.0 + (double) *deviation_m + 1.0)*(1 << *deviation_e) / ((double) (1 << 17)));
+}
+
 void set_frequency_deviation_rx(uint32_t f_dev)
 {
     write_strobe_rx(SIDLE); // ensure IDLE mode with command strobe: SIDLE
-
-    // see datasheet, section 16
-    uint8_t deviation_e = floor(log2(((double) f_dev) * (1 << 14) / ((double) F_XOSC)));
-    uint8_t deviation_m = floor((((double) f_dev) * (1 << 17)) / ((double) (1 << deviation_e) * F_XOSC) - 8.0);
+    uint8_t deviation_e, deviation_m;
+    uint32_t f_dev_calculated = calc_frequency_deviation_rx(f_dev, &deviation_e, &deviation_m);
 
     // new value
-    uint32_t f_dev_calculated = floor(((double) F_XOSC) * (8.0 + (double) deviation_m + 1.0)*(1 << deviation_e) / ((double) (1 << 17)));
-    printf("set rx f_dev: [%u %u] %u\n", deviation_e, deviation_m, f_dev_calculated);
+    printf("set rx f_dev: [%u %u] %" PRIu32 "\n", deviation_e, deviation_m, f_dev_calculated);
 
     // DEVIATN
     RF_setting set = {.address = 0x15, .value = ((deviation_e & 0x07) << 4) + (deviation_m & 0x07)};
     write_register_rx(set);
 }
 
+uint32_t calc_frecuency_rx(uint32_t f_carrier, uint32_t *freq, uint8_t *channel, uint8_t *channspc_e, uint8_t *channspc_m)
+{
+    // see datasheet, section 21
+    // approach: chose start frequency as close as possible to f_carrier, correct with channel
+    *freq = floor(f_carrier *((double) (1 << 16)) / ((double) F_XOSC));
+    *channel = 0;
+    *channspc_e = 0;
+    *channspc_m = floor(((((double) f_carrier) * (1 << 16)) / ((double) F_XOSC) - *freq - (1 << 6)) * (1 << 2));
+    return floor(((double) F_XOSC) * (*freq + (double) *channel*(256+*channspc_m)/((double) (1 << 2))) / ((double) (1 << 16)));
+}
+
 void set_frecuency_rx(uint32_t f_carrier)
 {
 // Test read_register_rx
@@ -317,16 +499,17 @@ void set_frecuency_rx(uint32_t f_carrier)
 //    printf("debug return %02x\n", b.value);
     
     write_strobe_rx(SIDLE); // ensure IDLE mode with command strobe: SIDLE
-    // see datasheet, section 21
-    // approach: chose start frequency as close as possible to f_carrier, correct with channel
-    uint32_t freq = floor(f_carrier *((double) (1 << 16)) / ((double) F_XOSC));
-    uint8_t channel = 0;
-    uint8_t channspc_e = 0;
-    uint8_t channspc_m = floor(((((double) f_carrier) * (1 << 16)) / ((double) F_XOSC) - freq - (1 << 6)) * (1 << 2));
+    if(rx->channel_count > 0){
+        // leave hopping: the new frequency is calibrated when entering RX again
+        write_register_rx((RF_setting){.address = 0x18, .value = rx->mcsm0});
+        rx->channel_count = 0;
+    }
+    uint32_t freq;
+    uint8_t channel, channspc_e, channspc_m;
+    uint32_t f_carrier_calculated = calc_frecuency_rx(f_carrier, &freq, &channel, &channspc_e, &channspc_m);
 
     // print new value
-    uint32_t f_carrier_calculated = floor(((double) F_XOSC) * (freq + (double) channel*(256+channspc_m)/((double) (1 << 2))) / ((double) (1 << 16)));
-    printf("set rx f_carrier [%u %u %u %u] %u\n", freq, channel, channspc_e, channspc_m, f_carrier_calculated);
+    printf("set rx f_carrier [%" PRIu32 " %u %u %u] %" PRIu32 "\n", freq, channel, channspc_e, channspc_m, f_carrier_calculated);
     
     // CHANNR, FREQ2, FREQ1, FREQ0, MDMCFG1, MDMCFG1
     RF_setting mdmcfg1 = read_register_rx(0x13);
@@ -341,3 +524,321 @@ void set_frecuency_rx(uint32_t f_carrier)
     //printf("debug %02x %02x %02x %02x %02x %02x\n", set[0].value, set[1].value, set[2].value, set[3].value, set[4].value, set[5].value);
     write_registers_rx(set,6);
 }
+
+// poll MARCSTATE until the radio is IDLE (e.g. after SIDLE or SCAL), at most RX_STATE_TIMEOUT_US
+static bool wait_idle_rx(){
+    uint64_t timeout_us = time_us_64() + RX_STATE_TIMEOUT_US;
+    uint8_t state;
+    while((state = read_status_rx(0x35) & 0x1F) != 0x01){
+        if(time_us_64() > timeout_us){
+            printf("ERROR: the receiver does not reach IDLE (MARCSTATE %02x)\n", state);
+            return false;
+        }
+        tight_loop_contents();
+    }
+    return true;
+}
+
+// enter IDLE without the fixed delay of write_strobe_rx()
+static bool enter_idle_rx(){
+    strobe_rx(SIDLE);
+    return wait_idle_rx();
+}
+
+bool setup_channels_rx(const uint32_t *f_carriers, const uint32_t *f_devs, uint8_t channels)
+{
+    if(channels == 0 || channels > RX_MAX_CHANNELS){
+        printf("ERROR: hopping requires 1 to %d channels\n", RX_MAX_CHANNELS);
+        return false;
+    }
+    write_strobe_rx(SIDLE); // ensure IDLE mode with command strobe: SIDLE
+    if(rx->channel_count == 0){
+        rx->mcsm0 = read_register_rx(0x18).value;
+    }
+    // the frequency is set with FREQ2..0 only (see calc_frecuency_rx)
+    write_register_rx((RF_setting){.address = 0x0a, .value = 0x00});
+    for(uint8_t i = 0; i < channels; i++){
+        uint32_t freq;
+        uint8_t channel, channspc_e, channspc_m, deviation_e, deviation_m;
+        uint32_t f_carrier = calc_frecuency_rx(f_carriers[i], &freq, &channel, &channspc_e, &channspc_m);
+        uint32_t f_dev = calc_frequency_deviation_rx(f_devs[i], &deviation_e, &deviation_m);
+        RF_setting *regs = rx->channels[i];
+        regs[0] = (RF_setting){.address = 0x0d, .value = ((freq & 0x007f0000) >> 16)};
+        regs[1] = (RF_setting){.address = 0x0e, .value = ((freq & 0x0000ff00) >> 8)};
+        regs[2] = (RF_setting){.address = 0x0f, .value = (freq & 0x000000ff)};
+        regs[3] = (RF_setting){.address = 0x15, .value = ((deviation_e & 0x07) << 4) + (deviation_m & 0x07)};
+        write_registers_rx(regs, 4);
+        strobe_rx(SCAL); // calibrate (~720us)
+        if(!wait_idle_rx()){
+            return false;
+        }
+        regs[4] = read_register_rx(0x23);
+        regs[5] = read_register_rx(0x24);
+        regs[6] = read_register_rx(0x25);
+        printf("rx channel %u: f_carrier %" PRIu32 " f_dev %" PRIu32 " FSCAL [%02x %02x %02x]\n", i, f_carrier, f_dev, regs[4].value, regs[5].value, regs[6].value);
+    }
+    // MCSM0.FS_AUTOCAL = 0: entering RX only waits for the synthesizer to settle
+    write_register_rx((RF_setting){.address = 0x18, .value = rx->mcsm0 & 0xcf});
+    rx->channel_count = channels;
+    return hop_rx(0);
+}
+
+bool hop_rx(uint8_t channel)
+{
+    if(channel >= rx->channel_count){
+        return false;
+    }
+    rx_abort_packet();
+    if(!enter_idle_rx()){
+        return false;
+    }
+    write_registers_rx(rx->channels[channel], RX_CHANNEL_REGS);
+    return true;
+}
+
+void RX_start_listen_nowait(){
+    PROFILE_SCOPE(prof_rx_rearm);
+    rx_abort_packet();
+    enter_idle_rx();
+    apply_offset_rx();
+    RF_setting set = {.address = 0x17, .value = 0x00}; // after receiving a packet, return to idle
+    write_registers_rx(&set, 1);
+    strobe_rx(SFRX); // clear FIFO
+    strobe_rx(SRX);  // start listening
+}
+
+void set_sync_mode_rx(uint8_t sync_bits)
+{
+    write_strobe_rx(SIDLE); // ensure IDLE mode with command strobe: SIDLE
+
+    // see datasheet, MDMCFG2.SYNC_MODE: 2 = 16/16 sync word bits, 3 = 30/32 sync word bits
+    uint8_t sync_mode = (sync_bits == 16) ? 0x02 : 0x03;
+    printf("set rx sync mode: [%u] %u bits\n", sync_mode, (sync_bits == 16) ? 16 : 32);
+
+    // MDMCFG2
+    RF_setting mdmcfg2 = read_register_rx(0x12);
+    RF_setting set = {.address = 0x12, .value = (mdmcfg2.value & 0xf8) + sync_mode};
+    write_register_rx(set);
+}
+
+void set_preamble_quality_rx(uint8_t pqt)
+{
+    write_strobe_rx(SIDLE); // ensure IDLE mode with command strobe: SIDLE
+
+    // see datasheet, PKTCTRL1.PQT: the preamble quality estimator increases for each bit that differs from its predecessor
+    pqt = min(pqt, 7);
+    printf("set rx pqt: [%u] %u\n", pqt, 4*pqt);
+
+    // PKTCTRL1
+    RF_setting pktctrl1 = read_register_rx(0x07);
+    RF_setting set = {.address = 0x07, .value = ((pqt & 0x07) << 5) + (pktctrl1.value & 0x1f)};
+    write_register_rx(set);
+}
+
+void set_whitening_rx(bool enabled)
+{
+    write_strobe_rx(SIDLE); // ensure IDLE mode with command strobe: SIDLE
+
+    // see datasheet, PKTCTRL0.WHITE_DATA: whitening of the bytes after the sync word (incl. length byte and CRC)
+    printf("set rx whitening: %s\n", enabled ? "on" : "off");
+
+    // PKTCTRL0
+    RF_setting pktctrl0 = read_register_rx(0x08);
+    RF_setting set = {.address = 0x08, .value = (pktctrl0.value & 0xbf) | (enabled ? 0x40 : 0x00)};
+    write_register_rx(set);
+}
+
+int32_t rssi_dbm_rx(int8_t rssi)
+{
+    // see datasheet, section 17.3: RSSI_dBm = RSSI_dec/2 - RSSI_offset
+    return ((int32_t) rssi)/2 - 70;
+}
+
+uint32_t calc_channel_spacing_rx(uint32_t f_step, uint8_t *chanspc_e, uint8_t *chanspc_m)
+{
+    // see datasheet, section 21: f_step = F_XOSC/2^18 * (256 + CHANSPC_M) * 2^CHANSPC_E
+    double steps = ((double) f_step) * (1 << 18) / ((double) F_XOSC);
+    *chanspc_e = min(max(floor(log2(steps / 256.0)), 0), 3);
+    *chanspc_m = min(max(round(steps / (1 << *chanspc_e) - 256.0), 0), 255);
+    return round(((double) F_XOSC) * (256 + *chanspc_m) * (1 << *chanspc_e) / ((double) (1 << 18)));
+}
+
+bool setup_scan_rx(uint32_t f_start, uint32_t f_step, uint16_t points, uint32_t dwell_us)
+{
+    uint8_t chanspc_e, chanspc_m;
+    uint32_t f_step_calculated = calc_channel_spacing_rx(f_step, &chanspc_e, &chanspc_m);
+    uint32_t f_step_error = (f_step_calculated > f_step) ? f_step_calculated - f_step : f_step - f_step_calculated;
+    if(points == 0 || points > SCAN_MAX_POINTS || f_step_error > f_step / 16){
+        printf("ERROR: a scan supports 1 to %d points with a step of %" PRIu32 " to %" PRIu32 " Hz\n", SCAN_MAX_POINTS,
+            calc_channel_spacing_rx(0, &chanspc_e, &chanspc_m), calc_channel_spacing_rx(UINT32_MAX / 2, &chanspc_e, &chanspc_m));
+        return false;
+    }
+    rx_abort_packet();
+    write_strobe_rx(SIDLE); // ensure IDLE mode with command strobe: SIDLE
+    if(!rx->scan_active){
+        for(uint8_t i = 0; i < RX_SCAN_SAVED; i++){
+            rx->scan_saved[i] = read_register_rx(scan_registers[i]);
+        }
+    }
+    uint32_t freq;
+    uint8_t channel, channspc_e, channspc_m;
+    rx->scan_f_start = calc_frecuency_rx(f_start, &freq, &channel, &channspc_e, &channspc_m);
+    rx->scan_f_step = f_step_calculated;
+    rx->scan_dwell_us = dwell_us;
+    printf("set rx scan [%" PRIu32 " %u %u] %" PRIu32 " + %u * %" PRIu32 " Hz\n", freq, chanspc_e, chanspc_m, rx->scan_f_start, points - 1, rx->scan_f_step);
+
+    // FREQ2..0, MDMCFG1, MDMCFG0, MCSM0.FS_AUTOCAL = 0: every point is calibrated once
+    RF_setting set[6] = {
+        {.address = 0x0d, .value = ((freq & 0x007f0000) >> 16)},
+        {.address = 0x0e, .value = ((freq & 0x0000ff00) >> 8)},
+        {.address = 0x0f, .value = (freq & 0x000000ff)},
+        {.address = 0x13, .value = (rx->scan_saved[4].value & 0xfc) + (chanspc_e & 0x03)},
+        {.address = 0x14, .value = chanspc_m},
+        {.address = 0x18, .value = rx->scan_saved[6].value & 0xcf}
+    };
+    write_registers_rx(set, 6);
+    for(uint16_t i = 0; i < points; i++){
+        write_register_rx((RF_setting){.address = 0x0a, .value = i});
+        strobe_rx(SCAL); // calibrate (~720us)
+        if(!wait_idle_rx()){
+            rx->scan_active = true; // restore the saved registers
+            end_scan_rx();
+            return false;
+        }
+        uint8_t buf[4];
+        cs_select_rx();
+        spi_read_blocking(RADIO_SPI, 0xE3, buf, 4);                  // burst read: FSCAL3, FSCAL2, FSCAL1
+        cs_deselect_rx();
+        memcpy(rx->scan_fscal[i], &buf[1], 3);
+    }
+    rx->scan_points = points;
+    rx->scan_active = true;
+    return true;
+}
+
+void scan_rx(int8_t *rssi)
+{
+    if(!rx->scan_active){
+        return;
+    }
+    for(uint16_t i = 0; i < rx->scan_points; i++){
+        RF_setting set[4] = {
+            {.address = 0x0a, .value = i},
+            {.address = 0x23, .value = rx->scan_fscal[i][0]},
+            {.address = 0x24, .value = rx->scan_fscal[i][1]},
+            {.address = 0x25, .value = rx->scan_fscal[i][2]}
+        };
+        write_registers_rx(set, 4);
+        strobe_rx(SRX);
+        sleep_us(rx->scan_dwell_us); // settling and RSSI response
+        rssi[i] = (int8_t) read_status_rx(0x34);
+        enter_idle_rx();
+    }
+}
+
+void end_scan_rx()
+{
+    if(!rx->scan_active){
+        return;
+    }
+    enter_idle_rx();
+    write_registers_rx(rx->scan_saved, RX_SCAN_SAVED);
+    rx->scan_active = false;
+}
+
+int32_t band_rssi_rx(const int8_t *rssi, uint32_t f_low, uint32_t f_high)
+{
+    // every point covers f +- f_step/2
+    int32_t band = INT32_MAX;
+    for(uint16_t i = 0; i < rx->scan_points; i++){
+        uint32_t f = rx->scan_f_start + i * rx->scan_f_step;
+        if(f + rx->scan_f_step/2 >= f_low && f <= f_high + rx->scan_f_step/2){
+            band = (band == INT32_MAX) ? rssi_dbm_rx(rssi[i]) : max(band, rssi_dbm_rx(rssi[i]));
+        }
+    }
+    return band;
+}
+
+uint16_t select_channel_rx(const int8_t *rssi, const uint32_t *f_carriers, uint8_t carriers, const int32_t *offsets, const uint32_t *bws, uint8_t channels, int32_t *interference)
+{
+    uint16_t best = 0;
+    int32_t best_rssi = INT32_MAX;
+    for(uint8_t c = 0; c < carriers; c++){
+        for(uint8_t o = 0; o < channels; o++){
+            uint32_t f = f_carriers[c] + offsets[o];
+            int32_t band = band_rssi_rx(rssi, f - bws[o]/2, f + bws[o]/2);
+            if(band < best_rssi){
+                best = c * channels + o;
+                best_rssi = band;
+            }
+        }
+    }
+    if(interference != NULL){
+        *interference = best_rssi;
+    }
+    return best;
+}
+
+uint8_t select_carrier_rx(const int8_t *rssi, const uint32_t *f_carriers, uint8_t carriers, const int32_t *offsets, const uint32_t *bws, uint8_t channels, int32_t *interference)
+{
+    uint8_t best = 0;
+    int32_t best_rssi = INT32_MAX;
+    for(uint8_t c = 0; c < carriers; c++){
+        int32_t worst = INT32_MIN;
+        for(uint8_t o = 0; o < channels; o++){
+            uint32_t f = f_carriers[c] + offsets[o];
+            worst = max(worst, band_rssi_rx(rssi, f - bws[o]/2, f + bws[o]/2));
+        }
+        if(worst < best_rssi){
+            best = c;
+            best_rssi = worst;
+        }
+    }
+    if(interference != NULL){
+        *interference = best_rssi;
+    }
+    return best;
+}
+
+void print_spectrum_rx(const int8_t *rssi, uint64_t time_us)
+{
+    static const char hex[] = "0123456789abcdef";
+    static char record[2*SCAN_MAX_POINTS + 1];
+    for(uint16_t i = 0; i < rx->scan_points; i++){
+        record[2*i]     = hex[((uint8_t) rssi[i]) >> 4];
+        record[2*i + 1] = hex[((uint8_t) rssi[i]) & 0x0f];
+    }
+    record[2*rx->scan_points] = '\0';
+    printf("#SPECTRUM t_us=%" PRIu64 " f_start=%" PRIu32 " f_step=%" PRIu32 " points=%u rssi=%s\n", time_us, rx->scan_f_start, rx->scan_f_step, rx->scan_points, record);
+}
+
+void set_offset_tracking_rx(bool enabled)
+{
+    memset(&rx->offset_tracking, 0, sizeof(rx->offset_tracking));
+    rx->offset_tracking.enabled = enabled;
+}
+
+int32_t offset_hz_rx()
+{
+    return round(rx->offset_tracking.offset * FREQEST_STEP_HZ / 256.0);
+}
+
+uint32_t offset_spread_hz_rx()
+{
+    return round(rx->offset_tracking.spread * FREQEST_STEP_HZ / 256.0);
+}
+
+uint32_t tracked_bandwidth_rx(uint32_t signal_bw)
+{
+    // residual offset after the compensation: rounding to FSCTRL0 steps, spread and drift since the last update
+    int32_t residual = rx->offset_tracking.offset - 256 * (int32_t) rx->offset_tracking.freqoff;
+    residual = (residual >= 0) ? residual : -residual;
+    uint32_t margin = round((residual + 128 + 2 * rx->offset_tracking.spread) * FREQEST_STEP_HZ / 256.0);
+    return signal_bw + 2 * margin;
+}
+
+void print_offset_tracking_rx(uint64_t time_us)
+{
+    printf("#OFFSET t=%" PRIu64 " packets=%" PRIu32 " freqest=%d offset_hz=%" PRId32 " spread_hz=%" PRIu32 " freqoff=%d updates=%" PRIu32 "\n", time_us/1000,
+        rx->offset_tracking.packets, rx->offset_tracking.last_freqest, offset_hz_rx(), offset_spread_hz_rx(), rx->offset_tracking.freqoff, rx->offset_tracking.updates);
+}
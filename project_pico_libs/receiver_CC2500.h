@@ -23,6 +23,7 @@
 #include "pico/util/queue.h"
 #include "pico/binary_info.h"
 #include "hardware/spi.h"
+#include "link_counters.h"
 
 #define RADIO_SPI             spi0
 #define RADIO_MISO              16
@@ -39,6 +40,19 @@
 #define   SRX                 0x34
 #define  SFRX                 0x3A
 #define  SRES                 0x30
+#define  SCAL                 0x33
+
+#define RX_MAX_CHANNELS          8 // calibrated channels of the hopping cache
+#define RX_STATE_TIMEOUT_US   2000 // MARCSTATE polling: SIDLE and SCAL (~720us) until IDLE
+#define RX_CHANNEL_REGS          7 // per channel: FREQ2, FREQ1, FREQ0, DEVIATN, FSCAL3, FSCAL2, FSCAL1
+#define SCAN_MAX_POINTS        256 // points of a spectrum scan (selected with CHANNR)
+#define RX_SCAN_SAVED           10 // registers restored by end_scan_rx()
+#define RX_CONFIG_REGS        0x2F // configuration registers 0x00 to 0x2E (register shadow)
+#define RX_MAX_GPIO             30
+
+#define FREQEST_STEP_HZ     ((double) F_XOSC / (1 << 14)) // resolution of FREQEST and FSCTRL0 (~1587 Hz)
+#define OFFSET_FILTER_SHIFT      3 // drift estimate: exponential average, weight 1/2^3 per packet
+#define OFFSET_UPDATE_PACKETS   16 // packets between two FSCTRL0 updates
 
 #define F_XOSC            26000000
 
@@ -64,6 +78,51 @@ struct packet_status {
   bool CRCcheck;
   uint8_t LinkQualityIndicator;
 };
+/*
+ * closed-loop frequency offset tracking: FREQEST of every complete packet (length byte agrees with the RX FIFO,
+ * with or without CRC) is added to the compensation in FSCTRL0 and averaged, every OFFSET_UPDATE_PACKETS packets the average is written to
+ * FSCTRL0 (when the receiver is re-armed). Offsets are in FREQEST steps * 256 (see offset_hz_rx()).
+ */
+struct offset_tracking {
+  bool     enabled;
+  int32_t  offset;            // filtered frequency offset of the received packets
+  int32_t  spread;            // filtered absolute deviation of a packet from the offset
+  int8_t   freqoff;           // FSCTRL0 of the next re-arm
+  int8_t   last_freqest;
+  uint32_t packets;           // tracked packets
+  uint32_t updates;           // FSCTRL0 changes
+};
+
+/*
+ * one CC2500 receiver on RADIO_SPI: chip select and GDO0 pin, event queue of its GDO0 interrupt and the state of
+ * the functions below. The functions operate on the receiver selected with select_rx() (default_rx: RX_CSN,
+ * RX_GDO0_PIN), such that several receivers share the bus, e.g.:
+ *   init_rx(&second, 20, 22); select_rx(&second); setupReceiver(); set_frecuency_rx(...); RX_start_listen();
+ *   select_rx(&default_rx);
+ * The interrupt adds the events to the queue of the receiver with the respective GDO0 pin, independent of the
+ * selection. Writes are kept in a register shadow, reading a configuration register (read-modify-write of the
+ * set_*_rx() functions) only accesses the SPI once after setupReceiver() (except FSCAL3/2/1).
+ */
+struct cc2500_rx {
+  uint     cs_pin;
+  uint     gdo0_pin;
+  queue_t  event_queue;
+  bool     synchronized;      // sync word received, end of packet pending
+  uint8_t  shadow[RX_CONFIG_REGS];
+  uint64_t shadow_valid;      // bit per register
+  struct rf_setting channels[RX_MAX_CHANNELS][RX_CHANNEL_REGS]; // setup_channels_rx()
+  uint8_t  channel_count;
+  uint8_t  mcsm0;             // MCSM0 before hopping, restored by set_frecuency_rx()
+  uint8_t  scan_fscal[SCAN_MAX_POINTS][3];  // setup_scan_rx(): FSCAL3/2/1 per point
+  uint16_t scan_points;       // points of the last scan (band_rssi_rx, print_spectrum_rx)
+  bool     scan_active;       // between setup_scan_rx() and end_scan_rx()
+  uint32_t scan_f_start, scan_f_step, scan_dwell_us;
+  struct rf_setting scan_saved[RX_SCAN_SAVED];
+  struct offset_tracking offset_tracking;
+  int8_t   fsctrl0;           // FSCTRL0 written to the radio
+  struct link_counters counters; // receive counters of this receiver (link_counters: all receivers)
+};
+
 typedef struct rf_setting RF_setting;
 typedef struct rf_power RF_power;
 typedef struct packet_status Packet_status;
@@ -99,6 +158,16 @@ typedef enum _event_t{
 
 extern RF_setting cc2500_receiver[20];
 
+extern struct cc2500_rx default_rx;
+
+/* a further receiver: its chip select (driven high) and GDO0 pin, configure it after select_rx() with setupReceiver() */
+bool init_rx(struct cc2500_rx *r, uint cs_pin, uint gdo0_pin);
+
+/* receiver of the following calls */
+void select_rx(struct cc2500_rx *r);
+
+struct cc2500_rx *selected_rx();
+
 void cs_select_rx();
 
 void cs_deselect_rx();
@@ -117,6 +186,12 @@ void setupReceiver();
 // continously listen for packets
 void RX_start_listen();
 
+// continously listen for packets and stay in RX after a packet (e.g. to receive bursts of frames)
+void RX_start_burst_listen();
+
+// RX_start_listen() without the fixed delays of write_strobe_rx(), MARCSTATE is polled instead (e.g. after hop_rx())
+void RX_start_listen_nowait();
+
 // stop listening
 void RX_stop_listen();
 
@@ -140,4 +215,86 @@ void set_frequency_deviation_rx(uint32_t f_dev);
 //set carrier frequency [Hz]
 void set_frecuency_rx(uint32_t f_carrier);
 
+// register values (datasheet formulas) used by the set_*_rx() functions, return the resulting setting
+//data rate [baud]: MDMCFG4.DRATE_E, MDMCFG3.DRATE_M
+uint32_t calc_datarate_rx(uint32_t r_data, uint8_t *drate_e, uint8_t *drate_m);
+
+//filter bandwidth [Hz]: MDMCFG4.CHANBW_E, MDMCFG4.CHANBW_M
+uint32_t calc_filter_bandwidth_rx(uint32_t bw, uint8_t *chanbw_e, uint8_t *chanbw_m);
+
+//FSK frequency deviation [Hz]: DEVIATN.DEVIATION_E, DEVIATN.DEVIATION_M
+uint32_t calc_frequency_deviation_rx(uint32_t f_dev, uint8_t *deviation_e, uint8_t *deviation_m);
+
+//carrier frequency [Hz]: FREQ2/1/0, CHANNR, MDMCFG1.CHANSPC_E, MDMCFG0.CHANSPC_M
+uint32_t calc_frecuency_rx(uint32_t f_carrier, uint32_t *freq, uint8_t *channel, uint8_t *channspc_e, uint8_t *channspc_m);
+
+/*
+ * frequency hopping: calibrate the synthesizer once per channel (carrier frequency [Hz], FSK deviation [Hz]) and
+ * cache FREQ2/1/0, DEVIATN and the resulting FSCAL3/2/1. The calibration when entering RX is disabled
+ * (MCSM0.FS_AUTOCAL = 0) until the next set_frecuency_rx(). Returns false for more than RX_MAX_CHANNELS channels.
+ */
+bool setup_channels_rx(const uint32_t *f_carriers, const uint32_t *f_devs, uint8_t channels);
+
+// retune to a channel of setup_channels_rx() without calibration, the receiver is IDLE afterwards (see RX_start_listen())
+bool hop_rx(uint8_t channel);
+
+/*
+ * spectrum scan: the points f_start + i*f_step (i < points) are selected with CHANNR (f_step of 25 kHz to 405 kHz) and
+ * calibrated once, hence the sweeps skip the calibration. Each point is measured dwell_us after entering RX (settling
+ * and RSSI response). The frequency registers and MCSM0 are changed until end_scan_rx(). Returns false for invalid settings.
+ */
+bool setup_scan_rx(uint32_t f_start, uint32_t f_step, uint16_t points, uint32_t dwell_us);
+
+// one sweep: RSSI register value of every point (see rssi_dbm_rx()), the receiver is IDLE afterwards
+void scan_rx(int8_t *rssi);
+
+// restore the registers changed by setup_scan_rx()
+void end_scan_rx();
+
+// largest RSSI of the points of the last scan within [f_low, f_high] [dBm] (a point covers f +- f_step/2), INT32_MAX if the band was not scanned
+int32_t band_rssi_rx(const int8_t *rssi, uint32_t f_low, uint32_t f_high);
+
+/*
+ * channel with the least interference: the largest RSSI within f_carriers[c] + offsets[o] +- bws[o]/2 is the smallest
+ * returns c*channels + o, interference: its RSSI [dBm] (may be NULL)
+ */
+uint16_t select_channel_rx(const int8_t *rssi, const uint32_t *f_carriers, uint8_t carriers, const int32_t *offsets, const uint32_t *bws, uint8_t channels, int32_t *interference);
+
+/*
+ * carrier for frequency hopping over all channels: a carrier is scored by its worst band f_carriers[c] + offsets[o] +- bws[o]/2
+ * returns the carrier c whose worst band has the smallest RSSI, interference: that RSSI [dBm] (may be NULL)
+ */
+uint8_t select_carrier_rx(const int8_t *rssi, const uint32_t *f_carriers, uint8_t carriers, const int32_t *offsets, const uint32_t *bws, uint8_t channels, int32_t *interference);
+
+// stream a sweep: '#SPECTRUM t_us=... f_start=... f_step=... points=... rssi=<RSSI register value of every point, 2 hex digits>'
+void print_spectrum_rx(const int8_t *rssi, uint64_t time_us);
+
+// enable/disable the offset tracking, both reset the estimate and the compensation (FSCTRL0 = 0 with the next re-arm)
+void set_offset_tracking_rx(bool enabled);
+
+// tracked frequency offset and its spread [Hz]
+int32_t offset_hz_rx();
+uint32_t offset_spread_hz_rx();
+
+// filter bandwidth for a signal of signal_bw [Hz] once the offset is tracked: the residual offset instead of the crystal tolerances
+uint32_t tracked_bandwidth_rx(uint32_t signal_bw);
+
+// '#OFFSET t=<ms since boot> packets= freqest= offset_hz= spread_hz= freqoff= updates='
+void print_offset_tracking_rx(uint64_t time_us);
+
+//RSSI register value -> [dBm]
+int32_t rssi_dbm_rx(int8_t rssi);
+
+//channel spacing [Hz]: MDMCFG1.CHANSPC_E, MDMCFG0.CHANSPC_M
+uint32_t calc_channel_spacing_rx(uint32_t f_step, uint8_t *chanspc_e, uint8_t *chanspc_m);
+
+//set sync word length [bits]: 16 (16/16 sync word bits detected) or 32 (30/32 sync word bits detected)
+void set_sync_mode_rx(uint8_t sync_bits);
+
+//set preamble quality threshold: 0 (disabled) to 7, sync words are only accepted after 4*pqt preamble bits of quality
+void set_preamble_quality_rx(uint8_t pqt);
+
+//data whitening (PKTCTRL0.WHITE_DATA): the received bytes are de-whitened with PN9, see set_whitening() of the tag
+void set_whitening_rx(bool enabled);
+
 #endif
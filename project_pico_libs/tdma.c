@@ -0,0 +1,226 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * TDMA slot scheduler driven by a hardware alarm
+ * see tdma.h
+ *
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/timer.h"
+#include "tdma.h"
+#include "link_counters.h"
+
+struct tdma tdma = {.alarm = -1};
+
+static uint64_t slot_start_us(uint32_t superframe, uint8_t slot){
+    return tdma.epoch_us + ((uint64_t) superframe * tdma.slots + slot) * tdma.slot_us;
+}
+
+static uint64_t frame_airtime_us(Frame *frame, uint32_t baud){
+    return ((uint64_t) frame->len_words) * 32 * 1000000 / baud;
+}
+
+// arm the alarm at the next owned slot whose boundary has not passed yet
+static void schedule_next(){
+    while(true){
+        tdma.current++;
+        if(tdma.current == tdma.slots){
+            tdma.current = 0;
+            tdma.superframe++;
+        }
+        if(tdma.superframes > 0 && tdma.superframe >= tdma.superframes){
+            tdma.running = false;
+            return;
+        }
+        if(tdma.slot[tdma.current].tag < 0){
+            continue;
+        }
+        if(!hardware_alarm_set_target(tdma.alarm, from_us_since_boot(slot_start_us(tdma.superframe, tdma.current)))){
+            return;
+        }
+        tdma.slot[tdma.current].skipped++;
+    }
+}
+
+// interrupt at a slot boundary: start the DMA of the queued frame, arm the next slot
+static void tdma_alarm(uint alarm_num){
+    uint64_t now_us = time_us_64();
+    if(!tdma.running){
+        return;
+    }
+    struct tdma_slot *slot = &tdma.slot[tdma.current];
+    struct tdma_tag *tag = &tdma.tag[slot->tag];
+    Frame *frame = tag->queued;
+    if(frame == NULL){
+        tag->empty++;
+    }else if(dma_channel_is_busy(tag->dma_channel) || !pio_sm_is_tx_fifo_empty(tag->pio, tag->sm)){
+        tag->overlong++; // the previous frame is still being sent, keep the frame for the next slot
+    }else{
+        dma_channel_transfer_from_buffer_now(tag->dma_channel, frame->words, frame->len_words);
+        tag->queued = NULL;
+        uint32_t late_us = now_us - slot_start_us(tdma.superframe, tdma.current);
+        slot->fired++;
+        slot->late_sum_us += late_us;
+        slot->late_max_us = max(slot->late_max_us, late_us);
+        tag->sent++;
+        tag->airtime_us += frame_airtime_us(frame, tag->baud);
+        link_counters.packets_sent++;
+    }
+    schedule_next();
+}
+
+bool tdma_init(uint8_t slots, uint32_t slot_us){
+    if(slots == 0 || slots > TDMA_MAX_SLOTS || slot_us < TDMA_MIN_SLOT_US){
+        printf("ERROR: invalid TDMA setting (1 to %d slots of at least %d us).\n", TDMA_MAX_SLOTS, TDMA_MIN_SLOT_US);
+        return false;
+    }
+    if(tdma.alarm < 0){
+        tdma.alarm = hardware_alarm_claim_unused(false);
+        if(tdma.alarm < 0){
+            printf("ERROR: no hardware alarm left for the TDMA scheduler.\n");
+            return false;
+        }
+        hardware_alarm_set_callback(tdma.alarm, tdma_alarm);
+    }
+    for(uint8_t t = 0; t < tdma.tags; t++){
+        dma_channel_unclaim(tdma.tag[t].dma_channel);
+    }
+    int alarm = tdma.alarm;
+    memset(&tdma, 0, sizeof(tdma));
+    tdma.alarm = alarm;
+    tdma.slots = slots;
+    tdma.slot_us = slot_us;
+    for(uint8_t s = 0; s < TDMA_MAX_SLOTS; s++){
+        tdma.slot[s].tag = -1;
+    }
+    return true;
+}
+
+int8_t tdma_add_tag(PIO pio, uint sm, uint32_t slots, uint32_t baud){
+    uint32_t valid = (tdma.slots == 32) ? 0xFFFFFFFF : (1u << tdma.slots) - 1;
+    uint32_t used = 0;
+    for(uint8_t t = 0; t < tdma.tags; t++){
+        used |= tdma.tag[t].slots;
+    }
+    if(tdma.tags == TDMA_MAX_TAGS || slots == 0 || (slots & ~valid) || (slots & used) || baud == 0){
+        printf("ERROR: invalid TDMA tag (at most %d tags, every slot owned by one tag).\n", TDMA_MAX_TAGS);
+        return -1;
+    }
+    int channel = dma_claim_unused_channel(false);
+    if(channel < 0){
+        printf("ERROR: no DMA channel left for the TDMA tag.\n");
+        return -1;
+    }
+    // 32-bit words from the frame into the TX FIFO, paced by the state-machine
+    dma_channel_config c = dma_channel_get_default_config(channel);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sm, true));
+    dma_channel_configure(channel, &c, &pio->txf[sm], NULL, 0, false);
+
+    int8_t index = tdma.tags++;
+    struct tdma_tag *tag = &tdma.tag[index];
+    tag->pio = pio;
+    tag->sm = sm;
+    tag->slots = slots;
+    tag->baud = baud;
+    tag->dma_channel = channel;
+    for(uint8_t s = 0; s < tdma.slots; s++){
+        if(slots & (1u << s)){
+            tdma.slot[s].tag = index;
+        }
+    }
+    return index;
+}
+
+bool tdma_start(uint64_t carrier_on_us, uint32_t superframes){
+    if(tdma.alarm < 0 || tdma.tags == 0){
+        printf("ERROR: the TDMA scheduler has no tags.\n");
+        return false;
+    }
+    tdma_stop();
+    for(uint8_t t = 0; t < tdma.tags; t++){
+        struct tdma_tag *tag = &tdma.tag[t];
+        tag->queued = NULL;
+        tag->sent = tag->empty = tag->overlong = 0;
+        tag->airtime_us = 0;
+    }
+    for(uint8_t s = 0; s < tdma.slots; s++){
+        tdma.slot[s].fired = tdma.slot[s].skipped = 0;
+        tdma.slot[s].late_sum_us = 0;
+        tdma.slot[s].late_max_us = 0;
+    }
+    tdma.epoch_us = carrier_on_us + TDMA_CARRIER_SETTLE_US;
+    tdma.superframes = superframes;
+    tdma.current = tdma.slots - 1; // schedule_next() continues with slot 0 of superframe 0
+    tdma.superframe = (uint32_t) -1;
+    tdma.running = true;
+    schedule_next();
+    return true;
+}
+
+void tdma_stop(){
+    if(tdma.alarm >= 0){
+        hardware_alarm_cancel(tdma.alarm);
+    }
+    tdma.running = false;
+}
+
+bool tdma_running(){
+    return tdma.running;
+}
+
+bool tdma_ready(uint8_t tag){
+    return tdma.tag[tag].queued == NULL;
+}
+
+bool tdma_queue(uint8_t tag, Frame *frame){
+    struct tdma_tag *t = &tdma.tag[tag];
+    if(frame_airtime_us(frame, t->baud) >= tdma.slot_us){
+        printf("ERROR: the frame (%" PRIu64 " us) does not fit into a TDMA slot (%" PRIu32 " us).\n", frame_airtime_us(frame, t->baud), tdma.slot_us);
+        return false;
+    }
+    if(t->queued != NULL){
+        return false;
+    }
+    t->queued = frame;
+    return true;
+}
+
+void tdma_print(uint64_t time_us){
+    uint32_t sent = 0, empty = 0, overlong = 0, skipped = 0, fired = 0, late_max_us = 0;
+    uint64_t late_sum_us = 0, airtime_us = 0;
+    for(uint8_t t = 0; t < tdma.tags; t++){
+        sent += tdma.tag[t].sent;
+        empty += tdma.tag[t].empty;
+        overlong += tdma.tag[t].overlong;
+        airtime_us += tdma.tag[t].airtime_us;
+    }
+    for(uint8_t s = 0; s < tdma.slots; s++){
+        skipped += tdma.slot[s].skipped;
+        fired += tdma.slot[s].fired;
+        late_sum_us += tdma.slot[s].late_sum_us;
+        late_max_us = max(late_max_us, tdma.slot[s].late_max_us);
+    }
+    uint64_t duration_us = (time_us > tdma.epoch_us) ? time_us - tdma.epoch_us : 1;
+    if(!tdma.running && tdma.superframes > 0){
+        duration_us = (uint64_t) tdma.superframes * tdma.slots * tdma.slot_us;
+    }
+    printf("#TDMA t=%" PRIu64 " slots=%u slot_us=%" PRIu32 " superframes=%" PRIu32 " sent=%" PRIu32 " empty=%" PRIu32 " overlong=%" PRIu32 " skipped=%" PRIu32 " late_mean_us=%.2f late_max_us=%" PRIu32 " utilization=%.3f\n",
+        time_us/1000, tdma.slots, tdma.slot_us, tdma.superframe, sent, empty, overlong, skipped,
+        fired ? ((double) late_sum_us) / fired : 0.0, late_max_us, ((double) airtime_us) / duration_us);
+    for(uint8_t s = 0; s < tdma.slots; s++){
+        struct tdma_slot *slot = &tdma.slot[s];
+        if(slot->tag >= 0){
+            printf("#TDMASLOT slot=%u tag=%d fired=%" PRIu32 " skipped=%" PRIu32 " late_mean_us=%.2f late_max_us=%" PRIu32 "\n", s, slot->tag, slot->fired, slot->skipped,
+                slot->fired ? ((double) slot->late_sum_us) / slot->fired : 0.0, slot->late_max_us);
+        }
+    }
+}
@@ -0,0 +1,96 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * TDMA slot scheduler: frame starts at exact slot boundaries, driven by a hardware alarm
+ *
+ * A superframe consists of `slots` slots of `slot_us`, the first one starts TDMA_CARRIER_SETTLE_US after the
+ * carrier has been turned on. Every tag (a backscatter state-machine, see backscatter.h) owns a set of slots.
+ * The main loop queues the next frame of a tag with tdma_queue(); at the start of an owned slot, the alarm
+ * interrupt starts a DMA channel which feeds the frame into the TX FIFO of the state-machine (paced by its DREQ).
+ * The frame start therefore only depends on the interrupt latency, not on the main loop (USB prints, SPI sleeps),
+ * and the slot boundaries are computed from the slot index, i.e. errors do not accumulate.
+ *
+ * Statistics: per slot the fired frames and the lateness of the interrupt against the slot boundary (mean, max),
+ * slots skipped because the boundary had already passed; per tag the sent frames, owned slots without a queued
+ * frame (empty) and frames still being sent at the next owned slot (overlong, the frame did not fit its slot).
+ *
+ */
+
+#ifndef TDMA_LIB
+#define TDMA_LIB
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "packet_generation.h"
+
+#define TDMA_MAX_TAGS              4
+#define TDMA_MAX_SLOTS            32
+#define TDMA_MIN_SLOT_US         100
+#define TDMA_CARRIER_SETTLE_US  1000 // the first slot starts after the carrier has settled (as send_frame())
+
+struct tdma_tag {
+  PIO      pio;
+  uint     sm;
+  uint32_t slots;             // bit per owned slot
+  uint32_t baud;
+  int      dma_channel;
+  Frame    *volatile queued;  // next frame, taken by the interrupt
+  uint32_t sent;
+  uint32_t empty;             // owned slots without a queued frame
+  uint32_t overlong;          // DMA still busy at the next owned slot
+  uint64_t airtime_us;
+};
+
+struct tdma_slot {
+  int8_t   tag;               // owner, -1: free
+  uint32_t fired;
+  uint32_t skipped;           // the slot boundary had already passed
+  uint64_t late_sum_us;
+  uint32_t late_max_us;
+};
+
+struct tdma {
+  int      alarm;             // hardware alarm (-1: not initialized)
+  uint8_t  slots;
+  uint32_t slot_us;
+  uint8_t  tags;
+  struct tdma_tag tag[TDMA_MAX_TAGS];
+  struct tdma_slot slot[TDMA_MAX_SLOTS];
+  uint64_t epoch_us;          // start of superframe 0
+  uint32_t superframes;       // superframes of this run (0: endless)
+  volatile uint32_t superframe;
+  volatile uint8_t  current;  // slot of the pending alarm
+  volatile bool running;
+};
+
+extern struct tdma tdma;
+
+/* superframe of slots * slot_us, claims a hardware alarm */
+bool tdma_init(uint8_t slots, uint32_t slot_us);
+
+/* a tag (running backscatter state-machine at baud) owning the slots of the bit mask, returns its index or -1 */
+int8_t tdma_add_tag(PIO pio, uint sm, uint32_t slots, uint32_t baud);
+
+/* start the slots relative to the carrier start (carrier_on_us), superframes: 0 runs until tdma_stop() */
+bool tdma_start(uint64_t carrier_on_us, uint32_t superframes);
+
+void tdma_stop();
+
+bool tdma_running();
+
+/* the tag can take the next frame */
+bool tdma_ready(uint8_t tag);
+
+/* send the frame in the next owned slot of the tag; false if a frame is still queued or the frame is longer than a slot */
+bool tdma_queue(uint8_t tag, Frame *frame);
+
+/*
+ * print the statistics of the run:
+ * #TDMA t=<ms since boot> slots= slot_us= superframes= sent= empty= overlong= skipped= late_mean_us= late_max_us= utilization=
+ * #TDMASLOT slot= tag= fired= skipped= late_mean_us= late_max_us=   (every owned slot)
+ * (utilization: airtime of the sent frames / duration of the run)
+ */
+void tdma_print(uint64_t time_us);
+
+#endif
@@ -0,0 +1,182 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * USB-to-backscatter bridge: a byte stream of the USB host as data source of build_frame()
+ * see usb_bridge.h
+ *
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "usb_bridge.h"
+
+struct usb_bridge usb_bridge;
+static uint16_t bridge_ring[SOURCE_RING_SAMPLES];
+
+static uint32_t chunk_size(){
+    return get_payload_size() - 2;
+}
+
+// stream bytes taken from the ring (the padding is not part of the stream)
+static uint32_t bridge_sent(){
+    return min(2 * usb_bridge.source.consumed, usb_bridge.size);
+}
+
+// credits up to the free space of the ring, in steps of BRIDGE_CREDIT_STEP
+static void grant_credits(){
+    uint32_t limit = min(2 * usb_bridge.source.consumed + BRIDGE_CAPACITY, usb_bridge.size);
+    if(limit >= usb_bridge.granted + BRIDGE_CREDIT_STEP || (limit == usb_bridge.size && limit > usb_bridge.granted)){
+        usb_bridge.granted = limit;
+        printf("#CREDIT granted=%" PRIu32 "\n", usb_bridge.granted);
+    }
+}
+
+static void put_byte(uint8_t byte){
+    if(usb_bridge.odd_byte < 0){
+        usb_bridge.odd_byte = byte;
+        return;
+    }
+    uint32_t samples = (usb_bridge.received + usb_bridge.padding) / 2;
+    bridge_ring[samples & (SOURCE_RING_SAMPLES - 1)] = (((uint16_t) usb_bridge.odd_byte) << 8) | byte;
+    usb_bridge.odd_byte = -1;
+}
+
+static bool bridge_start(struct data_source *source){
+    return true;
+}
+
+// reads the bytes of the host within the credits, pads the last frame once the stream is complete
+static uint32_t bridge_produced(struct data_source *source){
+    int c;
+    while(usb_bridge.received < usb_bridge.size && (c = getchar_timeout_us(0)) != PICO_ERROR_TIMEOUT){
+        if(usb_bridge.received >= usb_bridge.granted){
+            usb_bridge.dropped++;
+            continue;
+        }
+        put_byte((uint8_t) c);
+        usb_bridge.received++;
+    }
+    if(usb_bridge.received == usb_bridge.size){
+        uint32_t total = usb_bridge.size + usb_bridge.padding;
+        uint32_t frames = (usb_bridge.size + chunk_size() - 1) / chunk_size();
+        while(total < frames * chunk_size()){
+            put_byte(0);
+            usb_bridge.padding++;
+            total++;
+        }
+    }
+    grant_credits();
+    return (usb_bridge.received + usb_bridge.padding) / 2;
+}
+
+static void bridge_stop(struct data_source *source){
+}
+
+// '#SEND size=<byte>', read character by character
+static bool read_send_line(uint32_t timeout_ms, uint32_t *size){
+    char line[BRIDGE_LINE_LEN];
+    uint8_t len = 0;
+    absolute_time_t timeout = make_timeout_time_ms(timeout_ms);
+    while(!time_reached(timeout)){
+        int c = getchar_timeout_us(1000);
+        if(c == PICO_ERROR_TIMEOUT || c == '\r'){
+            continue;
+        }
+        if(c != '\n'){
+            if(len < BRIDGE_LINE_LEN - 1){
+                line[len++] = (char) c;
+            }
+            continue;
+        }
+        line[len] = 0;
+        if(strncmp(line, "#SEND size=", 11) == 0){
+            *size = strtoul(&line[11], NULL, 10);
+            return true;
+        }
+        len = 0; // anything else, e.g. 'p' of the profiler
+    }
+    return false;
+}
+
+/*
+ * announce the bridge and wait for '#SEND size=<byte>', then start the stream as data source
+ */
+bool usb_bridge_accept(uint32_t timeout_ms){
+    if(get_payload_size() < MIN_PAYLOADSIZE + 2){
+        printf("ERROR: the bridge requires a payload of at least %d byte.\n", MIN_PAYLOADSIZE + 2);
+        return false;
+    }
+    printf("#BRIDGE ready payload=%u ring=%u\n", get_payload_size(), BRIDGE_CAPACITY);
+    uint32_t size;
+    if(!read_send_line(timeout_ms, &size)){
+        return false;
+    }
+    if(size == 0){
+        printf("ERROR: empty stream.\n");
+        return false;
+    }
+    memset(&usb_bridge, 0, sizeof(usb_bridge));
+    usb_bridge.size = size;
+    usb_bridge.odd_byte = -1;
+    usb_bridge.source.name = "usb";
+    usb_bridge.source.start = bridge_start;
+    usb_bridge.source.produced = bridge_produced;
+    usb_bridge.source.stop = bridge_stop;
+    usb_bridge.source.ring = bridge_ring;
+    usb_bridge.start_us = to_us_since_boot(get_absolute_time());
+    if(!set_data_source(&usb_bridge.source)){
+        return false;
+    }
+    grant_credits();
+    return true;
+}
+
+bool usb_bridge_done(){
+    if(usb_bridge.done_us == 0 && usb_bridge.received == usb_bridge.size && source_level() == 0){
+        usb_bridge.done_us = to_us_since_boot(get_absolute_time());
+        set_data_source(NULL);
+    }
+    return usb_bridge.done_us != 0;
+}
+
+void usb_bridge_wait(uint32_t us){
+    sleep_us(us);
+    usb_bridge.starved_us += us;
+}
+
+void usb_bridge_packet(const uint8_t *buffer, Packet_status status, Frame **sent, uint8_t count){
+    uint8_t len = 2 + get_payload_size();
+    if(status.overflowed || !status.CRCcheck || status.len != len){
+        return;
+    }
+    for(uint8_t i = 0; i < count; i++){
+        if(sent[i]->seq != buffer[1]){
+            continue;
+        }
+        // the frame after the sync word, de-whitened as by the receiver
+        uint8_t air[2 + MAX_PAYLOADSIZE];
+        memcpy(air, &sent[i]->bytes[get_header_len() - 2], len);
+        if(get_whitening()){
+            whiten(air, len);
+        }
+        usb_bridge.delivered += memcmp(buffer, air, len) == 0;
+        return;
+    }
+}
+
+void usb_bridge_print(uint64_t time_us){
+    uint32_t sent = bridge_sent();
+    printf("#BRIDGE t=%" PRIu64 " size=%" PRIu32 " received=%" PRIu32 " granted=%" PRIu32 " sent=%" PRIu32 " frames=%" PRIu32 " delivered=%" PRIu32 " starved_ms=%" PRIu64 " dropped=%" PRIu32 "\n", time_us/1000,
+        usb_bridge.size, usb_bridge.received, usb_bridge.granted, sent, usb_bridge.source.frames, usb_bridge.delivered,
+        usb_bridge.starved_us/1000, usb_bridge.dropped);
+    if(usb_bridge.done_us != 0){
+        uint64_t duration_us = max(usb_bridge.done_us - usb_bridge.start_us, 1);
+        uint32_t goodput = min(usb_bridge.delivered * chunk_size(), usb_bridge.size);
+        printf("#BRIDGEDONE bytes=%" PRIu32 " frames=%" PRIu32 " delivered=%" PRIu32 " delivery=%.4f completion_ms=%.1f throughput_bps=%.0f goodput_bps=%.0f\n",
+            usb_bridge.size, usb_bridge.source.frames, usb_bridge.delivered, ((double) usb_bridge.delivered) / max(usb_bridge.source.frames, 1),
+            duration_us / 1000.0, 8.0 * sent * 1000000.0 / duration_us, 8.0 * goodput * 1000000.0 / duration_us);
+    }
+}
@@ -0,0 +1,72 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * USB-to-backscatter bridge: a byte stream of the USB host as data source of build_frame()
+ *
+ * Protocol (USB serial):
+ *  1. the Pico announces '#BRIDGE ready payload=<byte> ring=<byte>'
+ *  2. the host sends the line '#SEND size=<byte>' followed by the raw bytes of the stream
+ *  3. the Pico grants credits with '#CREDIT granted=<byte>': the host must not have sent more than 'granted' bytes
+ *     of the stream in total (cumulative, a lost line is covered by the next one). The first grant covers the ring,
+ *     afterwards a grant follows once at least BRIDGE_CREDIT_STEP bytes have been sent over the air.
+ *  4. '#BRIDGEDONE' once the last frame has been sent
+ * The stream is chunked into frames of get_payload_size() - 2 bytes with the usual header and file index (the byte
+ * offset within the stream modulo 65536), the last frame is zero padded. Since the credits follow the frames sent,
+ * the ring never overflows and, as long as the host keeps up with the credits, the frames never wait for data.
+ *
+ */
+
+#ifndef USB_BRIDGE_LIB
+#define USB_BRIDGE_LIB
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "packet_generation.h"
+#include "receiver_CC2500.h"
+
+#define BRIDGE_CAPACITY    (2 * (SOURCE_RING_SAMPLES - SOURCE_GUARD)) // [byte] buffered on the Pico
+#define BRIDGE_CREDIT_STEP  512 // [byte]
+#define BRIDGE_LINE_LEN      48
+
+struct usb_bridge {
+  struct data_source source;  // two stream bytes per sample
+  uint32_t size;              // announced by the host [byte]
+  uint32_t received;          // read from USB
+  uint32_t granted;           // credits sent to the host
+  uint32_t dropped;           // bytes beyond the credits (ignored flow control)
+  uint32_t padding;           // zero bytes completing the last frame
+  uint64_t starved_us;        // waited for the host without a complete frame
+  uint32_t delivered;         // frames received as sent by the local receiver
+  int16_t  odd_byte;          // first byte of an incomplete sample (-1: none)
+  uint64_t start_us;          // '#SEND' received
+  uint64_t done_us;           // last frame sent
+};
+
+extern struct usb_bridge usb_bridge;
+
+/*
+ * announce the bridge and wait up to timeout_ms for '#SEND size=<byte>', then start the stream as data source and
+ * grant the first credits; returns false on timeout or an invalid line
+ */
+bool usb_bridge_accept(uint32_t timeout_ms);
+
+/* all bytes (and the padding) have been sent, the data source is released */
+bool usb_bridge_done();
+
+/* wait us for the stream (the host is behind its credits), counts as starved */
+void usb_bridge_wait(uint32_t us);
+
+/*
+ * count a packet of the local receiver (readPacket() buffer) as delivered if it is one of the count frames just sent
+ * and arrived as sent: complete, correct CRC, same sequence number and payload
+ */
+void usb_bridge_packet(const uint8_t *buffer, Packet_status status, Frame **sent, uint8_t count);
+
+/*
+ * '#BRIDGE t=<ms since boot> size= received= granted= sent= frames= delivered= starved_ms= dropped=' and, once done,
+ * '#BRIDGEDONE bytes= frames= delivered= delivery= completion_ms= throughput_bps= goodput_bps='
+ * (throughput: stream bytes sent over the air, goodput: bytes of the delivered frames)
+ */
+void usb_bridge_print(uint64_t time_us);
+
+#endif
@@ -0,0 +1,276 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * binary control protocol over USB serial
+ * see usb_control.h
+ *
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/stdio_usb.h"
+#include "usb_control.h"
+#include "packet_generation.h"
+#include "carrier_CC2500.h"
+#include "link_counters.h"
+#include "link_quality.h"
+
+struct usb_control usb_control;
+
+/* valid range of every parameter, CONTROL_SET checks it before the apply function */
+static const uint32_t param_range[CONTROL_PARAMS][2] = {
+    [PARAM_CARRIER_FREQ]   = {2400000000, 2483500000},
+    [PARAM_CLOCK_DIV0]     = {2, 0xFFFF},
+    [PARAM_CLOCK_DIV1]     = {2, 0xFFFF},
+    [PARAM_BAUD]           = {1000, 1000000},
+    [PARAM_PAYLOAD_SIZE]   = {MIN_PAYLOADSIZE, MAX_PAYLOADSIZE},
+    [PARAM_TX_INTERVAL_MS] = {0, 60000},
+    [PARAM_RECEIVER]       = {1352, 2500},
+    [PARAM_POWER_LEVEL]    = {0, TX_POWER_MAX_LEVEL},
+    [PARAM_PREAMBLE_LEN]   = {1, MAX_PREAMBLE_LEN},
+    [PARAM_SYNC_LEN]       = {2, 4},
+    [PARAM_WHITENING]      = {0, 1},
+};
+
+static uint8_t response[CONTROL_MAX_PAYLOAD + 5];
+static uint8_t response_len; // payload bytes
+
+static uint8_t crc8(const uint8_t *data, uint8_t len){
+    uint8_t crc = 0;
+    for(uint8_t i = 0; i < len; i++){
+        crc ^= data[i];
+        for(uint8_t b = 0; b < 8; b++){
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static void put_u8(uint8_t value){
+    response[4 + response_len++] = value;
+}
+
+static void put_u16(uint16_t value){
+    put_u8(value & 0xFF);
+    put_u8(value >> 8);
+}
+
+static void put_u32(uint32_t value){
+    put_u16(value & 0xFFFF);
+    put_u16(value >> 16);
+}
+
+static uint32_t get_u32(const uint8_t *data){
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24);
+}
+
+// the status is the first payload byte, the payload follows with put_*()
+static void begin_response(uint8_t command, uint8_t tag){
+    response[0] = CONTROL_SYNC;
+    response[1] = command | CONTROL_RESPONSE;
+    response[2] = tag;
+    response_len = 0;
+    put_u8(CONTROL_OK);
+}
+
+static void send_response(uint8_t status){
+    response[4] = status;
+    response[3] = response_len;
+    response[4 + response_len] = crc8(&response[1], 3 + response_len);
+    usb_control.errors += status != CONTROL_OK;
+    stdio_flush(); // the text printed before
+    stdio_usb.out_chars((const char *) response, 5 + response_len); // without the CR/LF translation
+}
+
+static bool valid_value(uint8_t param, uint32_t value){
+    if(value < param_range[param][0] || value > param_range[param][1]){
+        return false;
+    }
+    switch(param){
+        case PARAM_RECEIVER: return value == 1352 || value == 2500;
+        case PARAM_SYNC_LEN: return value == 2 || value == 4;
+        case PARAM_PAYLOAD_SIZE: return value % 2 == 0;
+        default: return true;
+    }
+}
+
+static uint8_t set_param(uint8_t param, uint32_t value){
+    if(!valid_value(param, value) || (usb_control.apply != NULL && !usb_control.apply(param, &value))){
+        return CONTROL_ERR_VALUE;
+    }
+    usb_control.params[param] = value;
+    return CONTROL_OK;
+}
+
+static void print_run(const char *state, uint64_t time_us){
+    printf("#RUN t=%" PRIu64 " state=%s sent=%" PRIu32 " packets=%" PRIu32 " run_ms=%" PRIu64 "\n", time_us/1000, state, usb_control.sent,
+        usb_control.packets, (time_us - usb_control.start_us)/1000);
+}
+
+static void execute(uint8_t command, uint8_t tag, const uint8_t *payload, uint8_t len){
+    uint64_t now_us = time_us_64();
+    uint8_t status = CONTROL_OK;
+    usb_control.commands++;
+    begin_response(command, tag);
+    switch(command){
+        case CONTROL_PING:
+            for(uint8_t i = 0; i < len; i++){
+                put_u8(payload[i]);
+            }
+        break;
+        case CONTROL_GET:
+        case CONTROL_SET:
+            if(len != ((command == CONTROL_GET) ? 1 : 5)){
+                status = CONTROL_ERR_LENGTH;
+            }else if(payload[0] >= CONTROL_PARAMS){
+                status = CONTROL_ERR_PARAM;
+            }else{
+                if(command == CONTROL_SET){
+                    status = set_param(payload[0], get_u32(&payload[1]));
+                }
+                put_u8(payload[0]);
+                put_u32(usb_control.params[payload[0]]);
+            }
+        break;
+        case CONTROL_GET_ALL:
+            put_u8(CONTROL_PARAMS);
+            for(uint8_t p = 0; p < CONTROL_PARAMS; p++){
+                put_u32(usb_control.params[p]);
+            }
+        break;
+        case CONTROL_START:
+            if(len != 4){
+                status = CONTROL_ERR_LENGTH;
+                break;
+            }
+            reset_link_counters();
+            reset_link_quality(now_us);
+            usb_control.running = true;
+            usb_control.packets = get_u32(payload);
+            usb_control.sent = 0;
+            usb_control.start_us = now_us;
+            usb_control.wake = true;
+            print_run("start", now_us);
+        break;
+        case CONTROL_STOP:
+            if(usb_control.running){
+                usb_control.running = false;
+                usb_control.wake = true;
+                print_run("stop", now_us);
+            }
+        break;
+        case CONTROL_STATUS:
+            put_u8(usb_control.running);
+            put_u32(usb_control.sent);
+            put_u32(usb_control.packets);
+            put_u32((now_us - usb_control.start_us) / 1000);
+            put_u32(usb_control.commands);
+            put_u32(usb_control.errors);
+        break;
+        case CONTROL_COUNTERS:
+            put_u32(link_counters.packets_sent);
+            put_u32(link_counters.pio_stalls);
+            put_u32(link_counters.carrier_starts);
+            put_u32(link_counters.carrier_stops);
+            put_u32(link_counters.packets_received);
+            put_u32(link_counters.crc_failures);
+            put_u32(link_counters.rx_fifo_overflows);
+            put_u32(link_counters.event_drops);
+            put_u32(link_counters.sync_without_eop);
+            put_u32(link_quality.received);
+            put_u32(link_quality.expected);
+            put_u32(link_quality.correct);
+            put_u32(link_quality.crc_failures);
+            put_u32(link_quality.overflows);
+            put_u32(link_quality.length_errors);
+            put_u32(link_quality.bits);
+            put_u32(link_quality.bit_errors);
+            put_u32(link_quality.rssi_sum);
+            put_u16(link_quality.rssi_min);
+            put_u16(link_quality.rssi_max);
+        break;
+        default:
+            status = CONTROL_ERR_COMMAND;
+        break;
+    }
+    send_response(status);
+}
+
+// collect the bytes of a frame, returns true once a frame has been answered
+static bool receive_byte(uint8_t byte){
+    uint64_t now_us = time_us_64();
+    uint8_t *frame = usb_control.frame;
+    if(usb_control.received > 0 && now_us - usb_control.last_byte_us > CONTROL_BYTE_TIMEOUT_US){
+        usb_control.received = 0; // incomplete frame
+    }
+    usb_control.last_byte_us = now_us;
+    if(usb_control.received == 0 && byte != CONTROL_SYNC){
+        return false; // e.g. a character typed into a terminal
+    }
+    frame[usb_control.received++] = byte;
+    if(usb_control.received == 4 && frame[3] > CONTROL_MAX_PAYLOAD){
+        usb_control.received = 0;
+        usb_control.commands++;
+        begin_response(frame[1], frame[2]);
+        send_response(CONTROL_ERR_LENGTH);
+        return true;
+    }
+    if(usb_control.received < 5 || usb_control.received < 5 + frame[3]){
+        return false;
+    }
+    usb_control.received = 0;
+    if(crc8(&frame[1], 3 + frame[3]) != frame[4 + frame[3]]){
+        usb_control.commands++;
+        begin_response(frame[1], frame[2]);
+        send_response(CONTROL_ERR_CRC);
+        return true;
+    }
+    execute(frame[1], frame[2], &frame[4], frame[3]);
+    return true;
+}
+
+void usb_control_init(const uint32_t *params, bool (*apply)(uint8_t param, uint32_t *value), bool running){
+    memset(&usb_control, 0, sizeof(usb_control));
+    memcpy(usb_control.params, params, sizeof(usb_control.params));
+    usb_control.apply = apply;
+    usb_control.running = running;
+    usb_control.start_us = time_us_64();
+}
+
+uint32_t usb_control_poll(){
+    uint32_t executed = 0;
+    int c;
+    while((c = getchar_timeout_us(0)) != PICO_ERROR_TIMEOUT){
+        executed += receive_byte((uint8_t) c);
+    }
+    return executed;
+}
+
+void usb_control_sleep_ms(uint32_t ms){
+    uint64_t end_us = time_us_64() + 1000 * (uint64_t) ms;
+    usb_control.wake = false;
+    uint64_t now_us;
+    while(!usb_control.wake && (now_us = time_us_64()) < end_us){
+        int c = getchar_timeout_us(min(end_us - now_us, CONTROL_POLL_US));
+        if(c != PICO_ERROR_TIMEOUT){
+            receive_byte((uint8_t) c);
+        }
+    }
+}
+
+bool usb_control_may_send(){
+    return usb_control.running;
+}
+
+void usb_control_sent(uint64_t time_us){
+    if(!usb_control.running){
+        return;
+    }
+    usb_control.sent++;
+    if(usb_control.packets > 0 && usb_control.sent >= usb_control.packets){
+        usb_control.running = false;
+        print_run("done", time_us);
+    }
+}
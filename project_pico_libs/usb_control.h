@@ -0,0 +1,122 @@
+/**
+ * Tobias Mages & Wenqing Yan
+ *
+ * binary control protocol over USB serial: get/set the link parameters, start and stop runs and fetch the counters
+ * at runtime instead of changing the #defines and flashing again
+ *
+ * Frame (both directions, values little endian):
+ *   CONTROL_SYNC | command | tag | len | payload (len bytes, up to CONTROL_MAX_PAYLOAD) | CRC-8 (polynomial 0x07 over
+ *   command, tag, len and payload)
+ * The response carries command | CONTROL_RESPONSE, the tag of the request and a payload starting with the status
+ * (enum control_status). The text output (packets, '#' summaries) is ASCII and never contains CONTROL_SYNC, such
+ * that the host separates the responses from the lines; the responses bypass the CR/LF translation of printf.
+ * A frame with a CRC error is answered with CONTROL_ERR_CRC, an incomplete one is dropped after
+ * CONTROL_BYTE_TIMEOUT_US without a byte.
+ *
+ * Commands (request payload -> response payload after the status):
+ *   CONTROL_PING      any bytes               -> the same bytes
+ *   CONTROL_GET       param (1)               -> param (1), value (4)
+ *   CONTROL_SET       param (1), value (4)    -> param (1), value (4) as applied (e.g. the achievable baud rate)
+ *   CONTROL_GET_ALL   -                       -> count (1), value (4) of every parameter
+ *   CONTROL_START     packets (4), 0: no end  -> -   the counters are reset, the run sends until STOP or 'packets'
+ *   CONTROL_STOP      -                       -> -
+ *   CONTROL_STATUS    -                       -> running (1), sent (4), packets (4), run_ms (4), commands (4), errors (4)
+ *   CONTROL_COUNTERS  -                       -> struct link_counters (9 x 4, since START), struct link_quality of
+ *                                                the current window (ANALYSIS, restarted by START and every '#LQ'):
+ *                                                received, expected, correct, crc_failures, overflows,
+ *                                                length_errors, bits, bit_errors (8 x 4), rssi_sum (4),
+ *                                                rssi_min (2), rssi_max (2)
+ * START, STOP and the end of a run are also printed: '#RUN t=<ms since boot> state=start|stop|done sent= packets= run_ms='
+ *
+ * The commands are executed while the caller polls (usb_control_poll(), usb_control_sleep_ms()), i.e. between two
+ * carrier on-periods. CONTROL_SET validates the range, calls the apply function of the application (reprogram the
+ * state-machine, retune carrier and receiver) and answers once the setting is in effect.
+ *
+ */
+
+#ifndef USB_CONTROL_LIB
+#define USB_CONTROL_LIB
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+
+#define CONTROL_SYNC             0xA5
+#define CONTROL_RESPONSE         0x80
+#define CONTROL_MAX_PAYLOAD        96
+#define CONTROL_BYTE_TIMEOUT_US 20000 // an incomplete frame is dropped
+#define CONTROL_POLL_US           500 // usb_control_sleep_ms(): longest wait for a byte
+
+enum control_command {
+  CONTROL_PING = 0x01,
+  CONTROL_GET = 0x02,
+  CONTROL_SET = 0x03,
+  CONTROL_GET_ALL = 0x04,
+  CONTROL_START = 0x05,
+  CONTROL_STOP = 0x06,
+  CONTROL_STATUS = 0x07,
+  CONTROL_COUNTERS = 0x08
+};
+
+enum control_status {
+  CONTROL_OK = 0,
+  CONTROL_ERR_CRC = 1,
+  CONTROL_ERR_COMMAND = 2,    // unknown command
+  CONTROL_ERR_LENGTH = 3,     // payload length does not fit the command
+  CONTROL_ERR_PARAM = 4,      // unknown parameter
+  CONTROL_ERR_VALUE = 5       // out of range or rejected by the apply function (the previous value remains)
+};
+
+enum control_param {
+  PARAM_CARRIER_FREQ = 0,     // [Hz]
+  PARAM_CLOCK_DIV0,
+  PARAM_CLOCK_DIV1,
+  PARAM_BAUD,
+  PARAM_PAYLOAD_SIZE,         // [byte]
+  PARAM_TX_INTERVAL_MS,       // pause after every carrier on-period (TX_DURATION)
+  PARAM_RECEIVER,             // 2500 or 1352 (header template)
+  PARAM_POWER_LEVEL,          // TX_power[] of the carrier
+  PARAM_PREAMBLE_LEN,         // [byte]
+  PARAM_SYNC_LEN,             // [byte]
+  PARAM_WHITENING,            // 0 or 1
+  CONTROL_PARAMS
+};
+
+struct usb_control {
+  uint32_t params[CONTROL_PARAMS];
+  bool (*apply)(uint8_t param, uint32_t *value); // may adjust the value, false: rejected
+  // run
+  bool     running;
+  uint32_t packets;           // of the run (0: until CONTROL_STOP)
+  uint32_t sent;              // packets sent in the run
+  uint64_t start_us;
+  bool     wake;              // a run has been started or stopped: usb_control_sleep_ms() returns
+  // frame receiver
+  uint8_t  frame[CONTROL_MAX_PAYLOAD + 5];
+  uint8_t  received;          // bytes of the frame
+  uint64_t last_byte_us;
+  // statistics
+  uint32_t commands;
+  uint32_t errors;            // responses with a status other than CONTROL_OK
+};
+
+extern struct usb_control usb_control;
+
+/*
+ * start the protocol with the parameters of the #defines (params: CONTROL_PARAMS values), apply is called for every
+ * CONTROL_SET after the range check; running: a run without end is started (the behaviour without the protocol)
+ */
+void usb_control_init(const uint32_t *params, bool (*apply)(uint8_t param, uint32_t *value), bool running);
+
+/* execute the commands which have arrived, returns the number of commands */
+uint32_t usb_control_poll();
+
+/* sleep ms while executing commands, returns early once a run has been started or stopped */
+void usb_control_sleep_ms(uint32_t ms);
+
+/* may the application send the next packet of the run? */
+bool usb_control_may_send();
+
+/* a packet of the run has been sent, the run ends after the requested number of packets */
+void usb_control_sent(uint64_t time_us);
+
+#endif
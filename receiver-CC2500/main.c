@@ -7,6 +7,7 @@
  * GPIO 18 (pin 24) SCK/spi0_sclk
  * GPIO 19 (pin 25) MOSI/spi0_tx
  * GPIO 21 GDO0: interrupt for received sync word
+ * further receivers (RECEIVERS > 1): chip select GPIO 20, 14, 15 and GDO0 GPIO 22, 12, 13
  *
  * The example uses SPI port 0.
  * The stdout has been directed to USB.
@@ -27,6 +28,11 @@
 #include "pico/binary_info.h"
 #include "hardware/spi.h"
 #include "receiver_CC2500.h"
+#include "profiling.h"
+#include "link_counters.h"
+#include "link_quality.h"
+#include "packet_generation.h"
+#include "multi_receiver.h"
 
 #define CARRIER_FEQ     2450000000
 
@@ -39,6 +45,65 @@
 #define PIO_DEVIATION 347222
 #define PIO_MIN_RX_BW 794444
 
+#define COUNTER_INTERVAL_MS 10000 // print the link counters every 10s (0: disabled)
+#define ANALYSIS            false // compare every payload with the regenerated file and print '#LQ' summaries instead of every packet
+#define ANALYSIS_PAYLOAD        4 // payload size of the tag [byte] (PAYLOAD_SIZE)
+#define ANALYSIS_INTERVAL_MS 1000 // window of the '#LQ' summaries
+#define WHITENING           false // de-whiten the packets (WHITENING of the tag)
+
+#define RECEIVERS               1 // CC2500 receivers on SPI0 (up to MAX_RECEIVERS, see multi_receiver.h)
+#define MULTI_MODE MULTI_DIVERSITY // RECEIVERS > 1: same channel (best copy of every packet) or MULTI_FDMA
+#define FDMA_SPACING      2000000 // MULTI_FDMA: receiver i listens at CARRIER_FEQ + PIO_CENTER_OFFSET + i * FDMA_SPACING [Hz]
+
+static const uint rx_csn_pins[MAX_RECEIVERS]  = {RX_CSN, 20, 14, 15};
+static const uint rx_gdo0_pins[MAX_RECEIVERS] = {RX_GDO0_PIN, 22, 12, 13};
+
+/*
+ * RECEIVERS > 1: every packet is printed once, in FDMA mode with the index of its receiver
+ * (ANALYSIS: in FDMA mode one '#LQ' window per receiver, prefixed with its index)
+ */
+static void multi_receiver_loop(){
+    static struct link_quality fdma_quality[MAX_RECEIVERS];
+    uint8_t windows = (MULTI_MODE == MULTI_FDMA) ? RECEIVERS : 1;
+    struct multi_packet packet;
+    absolute_time_t next_report = make_timeout_time_ms(COUNTER_INTERVAL_MS);
+    absolute_time_t next_analysis = make_timeout_time_ms(ANALYSIS_INTERVAL_MS);
+    for(uint8_t i = 0; i < windows; i++){
+        select_link_quality((MULTI_MODE == MULTI_FDMA) ? &fdma_quality[i] : &link_quality);
+        reset_link_quality(to_us_since_boot(get_absolute_time()));
+    }
+    while (true) {
+        if(poll_multi_rx(&packet)){
+            if(ANALYSIS){
+                select_link_quality((MULTI_MODE == MULTI_FDMA) ? &fdma_quality[packet.receiver] : &link_quality);
+                analyze_packet(packet.buffer, packet.status, ANALYSIS_PAYLOAD);
+            }else{
+                if(MULTI_MODE == MULTI_FDMA){
+                    printf("%u | ", packet.receiver);
+                }
+                printPacket(packet.buffer, packet.status, packet.time_us);
+            }
+        }
+        if(COUNTER_INTERVAL_MS > 0 && time_reached(next_report)){
+            print_link_counters(to_us_since_boot(get_absolute_time()));
+            print_multi_rx(to_us_since_boot(get_absolute_time()));
+            next_report = make_timeout_time_ms(COUNTER_INTERVAL_MS);
+        }
+        if(ANALYSIS && time_reached(next_analysis)){
+            for(uint8_t i = 0; i < windows; i++){
+                if(MULTI_MODE == MULTI_FDMA){
+                    select_link_quality(&fdma_quality[i]);
+                    printf("%u | ", i);
+                }
+                print_link_quality(to_us_since_boot(get_absolute_time()));
+            }
+            next_analysis = make_timeout_time_ms(ANALYSIS_INTERVAL_MS);
+        }
+        PROFILE_POLL_USB(); // 'p': print timing histograms
+        sleep_us(10);
+    }
+}
+
 void main() {
     stdio_init_all();
     spi_init(RADIO_SPI, 5 * 1000000); // SPI0 at 5MHz.
@@ -57,6 +122,28 @@ void main() {
     // Make the CS pin available to picotool
     bi_decl(bi_1pin_with_name(RX_CSN, "SPI CS"));
 
+    PROFILE_INIT();
+
+    if(RECEIVERS > 1){
+        if(!setup_multi_rx(rx_csn_pins, rx_gdo0_pins, RECEIVERS, MULTI_MODE)){
+            while(true){
+                sleep_ms(1000);
+            }
+        }
+        for(uint8_t i = 0; i < RECEIVERS; i++){
+            select_rx(multi_rx.rx[i]);
+            set_frecuency_rx(CARRIER_FEQ + PIO_CENTER_OFFSET + ((MULTI_MODE == MULTI_FDMA) ? i * FDMA_SPACING : 0));
+            set_frequency_deviation_rx(PIO_DEVIATION);
+            set_datarate_rx(PIO_BAUDRATE);
+            set_filter_bandwidth_rx(PIO_MIN_RX_BW);
+            set_whitening_rx(WHITENING);
+        }
+        select_rx(&default_rx);
+        sleep_ms(1);
+        multi_start_listen();
+        multi_receiver_loop(); // never returns
+    }
+
     // Start receiver
     event_t evt = no_evt;
     Packet_status status;
@@ -66,8 +153,12 @@ void main() {
     set_frequency_deviation_rx(PIO_DEVIATION);
     set_datarate_rx(PIO_BAUDRATE);
     set_filter_bandwidth_rx(PIO_MIN_RX_BW);
+    set_whitening_rx(WHITENING);
     sleep_ms(1);
     RX_start_listen();
+    absolute_time_t next_report = make_timeout_time_ms(COUNTER_INTERVAL_MS);
+    absolute_time_t next_analysis = make_timeout_time_ms(ANALYSIS_INTERVAL_MS);
+    reset_link_quality(to_us_since_boot(get_absolute_time()));
     
     while (true) {
         evt = get_event();
@@ -79,12 +170,25 @@ void main() {
                 // finished receiving
                 uint64_t time_us = to_us_since_boot(get_absolute_time());
                 status = readPacket(buffer);
-                printPacket(buffer,status,time_us);
+                if(ANALYSIS){
+                    analyze_packet(buffer, status, ANALYSIS_PAYLOAD);
+                }else{
+                    printPacket(buffer,status,time_us);
+                }
                 RX_start_listen();
             break;
             case no_evt:
             break;
         }
+        if(COUNTER_INTERVAL_MS > 0 && time_reached(next_report)){
+            print_link_counters(to_us_since_boot(get_absolute_time()));
+            next_report = make_timeout_time_ms(COUNTER_INTERVAL_MS);
+        }
+        if(ANALYSIS && time_reached(next_analysis)){
+            print_link_quality(to_us_since_boot(get_absolute_time()));
+            next_analysis = make_timeout_time_ms(ANALYSIS_INTERVAL_MS);
+        }
+        PROFILE_POLL_USB(); // 'p': print timing histograms
         sleep_us(10);
     }
     RX_stop_listen(); // never reached
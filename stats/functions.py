@@ -40,6 +40,7 @@ def readfile(filename):
     # parse the payload to seq and payload
     df.frame = df.frame.str.rstrip().str.lstrip()
     df = df[df.frame.str.contains("packet overflow") == False]
+    df['length'] = df.frame.apply(lambda x: int(x[0:2], base=16))
     df['seq'] = df.frame.apply(lambda x: int(x[3:5], base=16))
     df['payload'] = df.frame.apply(lambda x: x[6:])
     # parse the rssi data
@@ -114,16 +115,18 @@ def generate_data(NUM_16RND, TOTAL_NUM_16RND):
         df.loc[i, "data"] = payload_data
     return df
 
-file_content = None
+# the payload size can be changed at run-time, the reference file is generated once per packet length
+file_content = {}
 def payload_for_peudo_seq(pseudo_seq,PACKET_LEN):
-    global file_content
-    if type(file_content) == type(None): # generate data
-        file_content = generate_data(int(PACKET_LEN/2), TOTAL_NUM_16RND)
-    if pseudo_seq in file_content.index:
-        return file_content.loc[pseudo_seq, 'data']
+    if PACKET_LEN not in file_content: # generate data
+        file_content[PACKET_LEN] = generate_data(int(PACKET_LEN/2), TOTAL_NUM_16RND)
+    content = file_content[PACKET_LEN]
+    if pseudo_seq in content.index:
+        return content.loc[pseudo_seq, 'data']
     else:
-        return file_content.loc[0, 'data'] # TODO: pseudo sequence not within the first expected range
+        return content.loc[0, 'data'] # TODO: pseudo sequence not within the first expected range
 
+# PACKET_LEN: number of data bytes following the 2-byte pseudo sequence
 def compute_ber_packet(df_row, PACKET_LEN=32):
     payload = parse_payload(df_row.payload)
     pseudoseq = int(((payload[0]<<8) - 0) + payload[1])
@@ -132,11 +135,17 @@ def compute_ber_packet(df_row, PACKET_LEN=32):
     return (compute_bit_errors(payload[2:], expected_data, PACKET_LEN=PACKET_LEN), 8*(2+len(payload[2:]))) # 2+ for pseudo sequence
 
 # main function to compute the BER for each frame, return both the error statistics dataframe and in total BER for the received data
+# PACKET_LEN=None follows the payload size given by the length field (1B seq + 2B pseudo sequence + data),
+# a rolling median over neighbouring packets prevents that corrupted length fields select a wrong reference
 def compute_ber(df, PACKET_LEN=32):
     # seq number initialization
     print(f"The total number of packets transmitted by the tag is {df.seq[len(df)-1]+1}.")
     if len(df) > 0:
-        errors,total = zip(*[compute_ber_packet(row,PACKET_LEN) for (_,row) in df.iterrows()])
+        if PACKET_LEN is None:
+            packet_len = (df.length.rolling(15, center=True, min_periods=1).median().round().astype(int) - 3).tolist()
+        else:
+            packet_len = [PACKET_LEN]*len(df)
+        errors,total = zip(*[compute_ber_packet(row,packet_len[i]) for (i,(_,row)) in enumerate(df.iterrows())])
         return sum(errors)/sum(total)
     else:
         print("Warning, the log-file seems empty.")